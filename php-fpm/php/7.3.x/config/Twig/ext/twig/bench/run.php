@@ -0,0 +1,119 @@
+<?php
+
+/*
+ * Renders the templates of bench/scenarios.php with and without the C
+ * extension, each in its own process started with "php -n", and reports
+ * the throughput, the median and 99th percentile render times and the memory
+ * of both:
+ *
+ *   php bench/run.php [--extension=modules/twig.so] [--php=php] [--renders=50]
+ *                     [--scenario=attributes,loops,...] [--format=text|json] [--output=results.json]
+ *
+ * The extension defaults to the one built in modules/ by "make". The exit
+ * status is 1 when a scenario renders differently with the extension.
+ */
+
+$options = array(
+    'extension' => __DIR__.'/../modules/twig.'.PHP_SHLIB_SUFFIX,
+    'php' => defined('PHP_BINARY') && PHP_BINARY ? PHP_BINARY : 'php',
+    'renders' => 50,
+    'scenario' => null,
+    'format' => 'text',
+    'output' => null,
+);
+foreach (array_slice($argv, 1) as $arg) {
+    if (!preg_match('/^--([a-z]+)=(.*)$/', $arg, $match) || !array_key_exists($match[1], $options)) {
+        fwrite(STDERR, sprintf("Unknown option \"%s\".\n", $arg));
+        exit(2);
+    }
+    $options[$match[1]] = $match[2];
+}
+
+if (!is_file($options['extension'])) {
+    fwrite(STDERR, sprintf("The Twig C extension \"%s\" does not exist, build it or pass --extension.\n", $options['extension']));
+    exit(2);
+}
+
+$scenarios = array_keys(require __DIR__.'/scenarios.php');
+if (null !== $options['scenario']) {
+    $scenarios = array_intersect($scenarios, explode(',', $options['scenario']));
+}
+
+function bench_run(array $options, $scenario, $native)
+{
+    $command = sprintf('%s -n -d memory_limit=-1 %s %s %s %d',
+        escapeshellarg($options['php']),
+        $native ? '-d extension='.escapeshellarg(realpath($options['extension'])) : '',
+        escapeshellarg(__DIR__.'/render.php'),
+        escapeshellarg($scenario),
+        $options['renders']
+    );
+
+    exec($command, $output, $status);
+    $result = @unserialize(implode("\n", $output));
+
+    if (0 !== $status || !is_array($result)) {
+        fwrite(STDERR, sprintf("\"%s\" failed:\n%s\n", $command, implode("\n", $output)));
+        exit(2);
+    }
+
+    if ($result['extension'] !== $native) {
+        fwrite(STDERR, sprintf("The C extension was %s for \"%s\".\n", $native ? 'not loaded' : 'loaded', $command));
+        exit(2);
+    }
+
+    return $result;
+}
+
+$results = array();
+$comparisons = array();
+$status = 0;
+foreach ($scenarios as $scenario) {
+    $userland = bench_run($options, $scenario, false);
+    $native = bench_run($options, $scenario, true);
+
+    $results[] = $userland;
+    $results[] = $native;
+    $comparisons[$scenario] = array(
+        'speedup' => $native['throughput'] / $userland['throughput'],
+        'same_output' => $userland['output_md5'] === $native['output_md5'],
+    );
+
+    if (!$comparisons[$scenario]['same_output']) {
+        $status = 1;
+    }
+}
+
+$report = array(
+    'php' => $results ? $results[0]['php'] : null,
+    'renders' => (int) $options['renders'],
+    'results' => $results,
+    'comparisons' => $comparisons,
+);
+
+if (null !== $options['output']) {
+    file_put_contents($options['output'], json_encode($report)."\n");
+}
+
+if ('json' === $options['format']) {
+    echo json_encode($report), "\n";
+} else {
+    printf("%-12s %-9s %12s %10s %10s %12s\n", 'scenario', 'mode', 'renders/s', 'p50 ms', 'p99 ms', 'peak memory');
+    foreach ($results as $result) {
+        printf("%-12s %-9s %12.1f %10.3f %10.3f %12s\n",
+            $result['scenario'],
+            $result['extension'] ? 'native' : 'userland',
+            $result['throughput'],
+            $result['p50_ms'],
+            $result['p99_ms'],
+            null === $result['peak_memory'] ? 'n/a' : $result['peak_memory']
+        );
+    }
+
+    echo "\n";
+    foreach ($comparisons as $scenario => $comparison) {
+        printf("%-12s %.2fx%s\n", $scenario, $comparison['speedup'], $comparison['same_output'] ? '' : ' (the output differs!)');
+    }
+}
+
+exit($status);
@@ -0,0 +1,107 @@
+<?php
+
+/*
+ * The templates rendered by bench/run.php. Each scenario has its templates,
+ * the one to render and a function building the context. The data is the
+ * same on every run.
+ */
+
+class BenchNode
+{
+    public $name;
+    private $child;
+    private $visible;
+
+    public function __construct($name, $child = null, $visible = true)
+    {
+        $this->name = $name;
+        $this->child = $child;
+        $this->visible = $visible;
+    }
+
+    public function getChild()
+    {
+        return $this->child;
+    }
+
+    public function isVisible()
+    {
+        return $this->visible;
+    }
+
+    public function label($prefix)
+    {
+        return $prefix.$this->name;
+    }
+}
+
+function bench_chain($i)
+{
+    $leaf = new BenchNode('leaf '.$i, array('city' => array('name' => 'city '.$i, 'zip' => 10000 + $i)), 0 !== $i % 5);
+
+    return new BenchNode('root '.$i, new BenchNode('middle '.$i, $leaf));
+}
+
+return array(
+    'attributes' => array(
+        'templates' => array(
+            'index' => '{% for node in nodes %}{{ node.name }} {{ node.child.name }} {{ node.child.child.name }} {{ node.child.child.child.city.name }} {{ node.child.child.child.city.zip }} {{ node.child.child.visible ? "yes" : "no" }} {{ node.label("#") }} {{ meta.labels.node }}
+{% endfor %}',
+        ),
+        'context' => function () {
+            $nodes = array();
+            for ($i = 0; $i < 500; ++$i) {
+                $nodes[] = bench_chain($i);
+            }
+
+            return array('nodes' => $nodes, 'meta' => array('labels' => array('node' => 'node')));
+        },
+    ),
+
+    'loops' => array(
+        'templates' => array(
+            'index' => '{% for row in rows %}{% if loop.first %}[{% endif %}{{ loop.index }}/{{ loop.length }} {{ row.id }} {{ row.tags|length }} {{ row.tags|first }} {{ row.tags|last }} {{ row.tags|slice(1, 2)|join(",") }} {{ "b" in row.tags ? "b" }}{% for tag in row.tags %}{{ loop.index0 }}{{ tag }}{% endfor %}{% if loop.last %}]{% endif %}
+{% else %}empty{% endfor %}',
+        ),
+        'context' => function () {
+            $rows = array();
+            for ($i = 0; $i < 5000; ++$i) {
+                $rows[] = array('id' => $i, 'tags' => array_slice(array('a', 'b', 'c', 'd', 'e'), $i % 3));
+            }
+
+            return array('rows' => $rows);
+        },
+    ),
+
+    'escaping' => array(
+        'templates' => array(
+            'index' => '{% for text in texts %}<p title="{{ text|e("html_attr") }}">{{ text }}</p><a href="?q={{ text|e("url") }}">{{ plain }}</a><script>var t = "{{ text|e("js") }}";</script>
+{% endfor %}',
+        ),
+        'context' => function () {
+            $texts = array();
+            for ($i = 0; $i < 1000; ++$i) {
+                $texts[] = sprintf('<b>"Tom" & \'Jerry\'</b> #%d — café, naïve, 日本語 %s', $i, str_repeat('plain text ', $i % 10));
+            }
+
+            return array('texts' => $texts, 'plain' => str_repeat('nothing to escape here ', 20));
+        },
+    ),
+
+    'includes' => array(
+        'templates' => array(
+            'index' => '{% for item in items %}{% include "item" with {"item": item, "position": loop.index} %}{% endfor %}',
+            'item' => '<li>{{ position }} {% include "label" with {"label": item.name} only %}{% for child in item.children %}{% include "label" with {"label": child} only %}{% endfor %}</li>
+',
+            'label' => '<span>{{ label }}</span>',
+        ),
+        'context' => function () {
+            $items = array();
+            for ($i = 0; $i < 300; ++$i) {
+                $items[] = array('name' => 'item '.$i, 'children' => array('a '.$i, 'b '.$i));
+            }
+
+            return array('items' => $items);
+        },
+    ),
+);
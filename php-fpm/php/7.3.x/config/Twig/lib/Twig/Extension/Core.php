@@ -689,103 +689,109 @@ function twig_array_merge($arr1, $arr2)
     return array_merge($arr1, $arr2);
 }
 
-/**
- * Slices a variable.
- *
- * @param Twig_Environment $env          A Twig_Environment instance
- * @param mixed            $item         A variable
- * @param int              $start        Start of the slice
- * @param int              $length       Size of the slice
- * @param bool             $preserveKeys Whether to preserve key or not (when the input is an array)
- *
- * @return mixed The sliced variable
- */
-function twig_slice(Twig_Environment $env, $item, $start, $length = null, $preserveKeys = false)
-{
-    if ($item instanceof Traversable) {
-        if ($item instanceof IteratorAggregate) {
-            $item = $item->getIterator();
-        }
+// the C extension provides its own implementation
+if (!function_exists('twig_slice')) {
+    /**
+     * Slices a variable.
+     *
+     * @param Twig_Environment $env          A Twig_Environment instance
+     * @param mixed            $item         A variable
+     * @param int              $start        Start of the slice
+     * @param int              $length       Size of the slice
+     * @param bool             $preserveKeys Whether to preserve key or not (when the input is an array)
+     *
+     * @return mixed The sliced variable
+     */
+    function twig_slice(Twig_Environment $env, $item, $start, $length = null, $preserveKeys = false)
+    {
+        if ($item instanceof Traversable) {
+            if ($item instanceof IteratorAggregate) {
+                $item = $item->getIterator();
+            }
 
-        if ($start >= 0 && $length >= 0 && $item instanceof Iterator) {
-            try {
-                return iterator_to_array(new LimitIterator($item, $start, $length === null ? -1 : $length), $preserveKeys);
-            } catch (OutOfBoundsException $exception) {
-                return array();
+            if ($start >= 0 && $length >= 0 && $item instanceof Iterator) {
+                try {
+                    return iterator_to_array(new LimitIterator($item, $start, $length === null ? -1 : $length), $preserveKeys);
+                } catch (OutOfBoundsException $exception) {
+                    return array();
+                }
             }
+
+            $item = iterator_to_array($item, $preserveKeys);
         }
 
-        $item = iterator_to_array($item, $preserveKeys);
-    }
+        if (is_array($item)) {
+            return array_slice($item, $start, $length, $preserveKeys);
+        }
 
-    if (is_array($item)) {
-        return array_slice($item, $start, $length, $preserveKeys);
-    }
+        $item = (string) $item;
 
-    $item = (string) $item;
+        if (function_exists('mb_get_info') && null !== $charset = $env->getCharset()) {
+            return (string) mb_substr($item, $start, null === $length ? mb_strlen($item, $charset) - $start : $length, $charset);
+        }
 
-    if (function_exists('mb_get_info') && null !== $charset = $env->getCharset()) {
-        return (string) mb_substr($item, $start, null === $length ? mb_strlen($item, $charset) - $start : $length, $charset);
+        return (string) (null === $length ? substr($item, $start) : substr($item, $start, $length));
     }
 
-    return (string) (null === $length ? substr($item, $start) : substr($item, $start, $length));
-}
-
-/**
- * Returns the first element of the item.
- *
- * @param Twig_Environment $env  A Twig_Environment instance
- * @param mixed            $item A variable
- *
- * @return mixed The first element of the item
- */
-function twig_first(Twig_Environment $env, $item)
-{
-    $elements = twig_slice($env, $item, 0, 1, false);
+    /**
+     * Returns the first element of the item.
+     *
+     * @param Twig_Environment $env  A Twig_Environment instance
+     * @param mixed            $item A variable
+     *
+     * @return mixed The first element of the item
+     */
+    function twig_first(Twig_Environment $env, $item)
+    {
+        $elements = twig_slice($env, $item, 0, 1, false);
 
-    return is_string($elements) ? $elements : current($elements);
-}
+        return is_string($elements) ? $elements : current($elements);
+    }
 
-/**
- * Returns the last element of the item.
- *
- * @param Twig_Environment $env  A Twig_Environment instance
- * @param mixed            $item A variable
- *
- * @return mixed The last element of the item
- */
-function twig_last(Twig_Environment $env, $item)
-{
-    $elements = twig_slice($env, $item, -1, 1, false);
+    /**
+     * Returns the last element of the item.
+     *
+     * @param Twig_Environment $env  A Twig_Environment instance
+     * @param mixed            $item A variable
+     *
+     * @return mixed The last element of the item
+     */
+    function twig_last(Twig_Environment $env, $item)
+    {
+        $elements = twig_slice($env, $item, -1, 1, false);
 
-    return is_string($elements) ? $elements : current($elements);
+        return is_string($elements) ? $elements : current($elements);
+    }
 }
 
-/**
- * Joins the values to a string.
- *
- * The separator between elements is an empty string per default, you can define it with the optional parameter.
- *
- * <pre>
- *  {{ [1, 2, 3]|join('|') }}
- *  {# returns 1|2|3 #}
- *
- *  {{ [1, 2, 3]|join }}
- *  {# returns 123 #}
- * </pre>
- *
- * @param array  $value An array
- * @param string $glue  The separator
- *
- * @return string The concatenated string
- */
-function twig_join_filter($value, $glue = '')
-{
-    if ($value instanceof Traversable) {
-        $value = iterator_to_array($value, false);
-    }
+// the C extension provides its own implementation
+if (!function_exists('twig_join_filter')) {
+    /**
+     * Joins the values to a string.
+     *
+     * The separator between elements is an empty string per default, you can define it with the optional parameter.
+     *
+     * <pre>
+     *  {{ [1, 2, 3]|join('|') }}
+     *  {# returns 1|2|3 #}
+     *
+     *  {{ [1, 2, 3]|join }}
+     *  {# returns 123 #}
+     * </pre>
+     *
+     * @param array  $value An array
+     * @param string $glue  The separator
+     *
+     * @return string The concatenated string
+     */
+    function twig_join_filter($value, $glue = '')
+    {
+        if ($value instanceof Traversable) {
+            $value = iterator_to_array($value, false);
+        }
 
-    return implode($glue, (array) $value);
+        return implode($glue, (array) $value);
+    }
 }
 
 /**
@@ -932,171 +938,177 @@ function twig_sort_filter($array)
     return $array;
 }
 
-/* used internally */
-function twig_in_filter($value, $compare)
-{
-    if (is_array($compare)) {
-        return in_array($value, $compare, is_object($value) || is_resource($value));
-    } elseif (is_string($compare) && (is_string($value) || is_int($value) || is_float($value))) {
-        return '' === $value || false !== strpos($compare, (string) $value);
-    } elseif ($compare instanceof Traversable) {
-        return in_array($value, iterator_to_array($compare, false), is_object($value) || is_resource($value));
-    }
-
-    return false;
-}
+// the C extension provides its own implementation
+if (!function_exists('twig_in_filter')) {
+    /* used internally */
+    function twig_in_filter($value, $compare)
+    {
+        if (is_array($compare)) {
+            return in_array($value, $compare, is_object($value) || is_resource($value));
+        } elseif (is_string($compare) && (is_string($value) || is_int($value) || is_float($value))) {
+            return '' === $value || false !== strpos($compare, (string) $value);
+        } elseif ($compare instanceof Traversable) {
+            return in_array($value, iterator_to_array($compare, false), is_object($value) || is_resource($value));
+        }
 
-/**
- * Escapes a string.
- *
- * @param Twig_Environment $env        A Twig_Environment instance
- * @param string           $string     The value to be escaped
- * @param string           $strategy   The escaping strategy
- * @param string           $charset    The charset
- * @param bool             $autoescape Whether the function is called by the auto-escaping feature (true) or by the developer (false)
- *
- * @return string
- */
-function twig_escape_filter(Twig_Environment $env, $string, $strategy = 'html', $charset = null, $autoescape = false)
-{
-    if ($autoescape && $string instanceof Twig_Markup) {
-        return $string;
+        return false;
     }
+}
 
-    if (!is_string($string)) {
-        if (is_object($string) && method_exists($string, '__toString')) {
-            $string = (string) $string;
-        } else {
+// the C extension provides its own implementation
+if (!function_exists('twig_escape_filter')) {
+    /**
+     * Escapes a string.
+     *
+     * @param Twig_Environment $env        A Twig_Environment instance
+     * @param string           $string     The value to be escaped
+     * @param string           $strategy   The escaping strategy
+     * @param string           $charset    The charset
+     * @param bool             $autoescape Whether the function is called by the auto-escaping feature (true) or by the developer (false)
+     *
+     * @return string
+     */
+    function twig_escape_filter(Twig_Environment $env, $string, $strategy = 'html', $charset = null, $autoescape = false)
+    {
+        if ($autoescape && $string instanceof Twig_Markup) {
             return $string;
         }
-    }
 
-    if (null === $charset) {
-        $charset = $env->getCharset();
-    }
-
-    switch ($strategy) {
-        case 'html':
-            // see http://php.net/htmlspecialchars
-
-            // Using a static variable to avoid initializing the array
-            // each time the function is called. Moving the declaration on the
-            // top of the function slow downs other escaping strategies.
-            static $htmlspecialcharsCharsets;
-
-            if (null === $htmlspecialcharsCharsets) {
-                if (defined('HHVM_VERSION')) {
-                    $htmlspecialcharsCharsets = array('utf-8' => true, 'UTF-8' => true);
-                } else {
-                    $htmlspecialcharsCharsets = array(
-                        'ISO-8859-1' => true, 'ISO8859-1' => true,
-                        'ISO-8859-15' => true, 'ISO8859-15' => true,
-                        'utf-8' => true, 'UTF-8' => true,
-                        'CP866' => true, 'IBM866' => true, '866' => true,
-                        'CP1251' => true, 'WINDOWS-1251' => true, 'WIN-1251' => true,
-                        '1251' => true,
-                        'CP1252' => true, 'WINDOWS-1252' => true, '1252' => true,
-                        'KOI8-R' => true, 'KOI8-RU' => true, 'KOI8R' => true,
-                        'BIG5' => true, '950' => true,
-                        'GB2312' => true, '936' => true,
-                        'BIG5-HKSCS' => true,
-                        'SHIFT_JIS' => true, 'SJIS' => true, '932' => true,
-                        'EUC-JP' => true, 'EUCJP' => true,
-                        'ISO8859-5' => true, 'ISO-8859-5' => true, 'MACROMAN' => true,
-                    );
-                }
+        if (!is_string($string)) {
+            if (is_object($string) && method_exists($string, '__toString')) {
+                $string = (string) $string;
+            } else {
+                return $string;
             }
+        }
 
-            if (isset($htmlspecialcharsCharsets[$charset])) {
-                return htmlspecialchars($string, ENT_QUOTES | ENT_SUBSTITUTE, $charset);
-            }
+        if (null === $charset) {
+            $charset = $env->getCharset();
+        }
 
-            if (isset($htmlspecialcharsCharsets[strtoupper($charset)])) {
-                // cache the lowercase variant for future iterations
-                $htmlspecialcharsCharsets[$charset] = true;
+        switch ($strategy) {
+            case 'html':
+                // see http://php.net/htmlspecialchars
+
+                // Using a static variable to avoid initializing the array
+                // each time the function is called. Moving the declaration on the
+                // top of the function slow downs other escaping strategies.
+                static $htmlspecialcharsCharsets;
+
+                if (null === $htmlspecialcharsCharsets) {
+                    if (defined('HHVM_VERSION')) {
+                        $htmlspecialcharsCharsets = array('utf-8' => true, 'UTF-8' => true);
+                    } else {
+                        $htmlspecialcharsCharsets = array(
+                            'ISO-8859-1' => true, 'ISO8859-1' => true,
+                            'ISO-8859-15' => true, 'ISO8859-15' => true,
+                            'utf-8' => true, 'UTF-8' => true,
+                            'CP866' => true, 'IBM866' => true, '866' => true,
+                            'CP1251' => true, 'WINDOWS-1251' => true, 'WIN-1251' => true,
+                            '1251' => true,
+                            'CP1252' => true, 'WINDOWS-1252' => true, '1252' => true,
+                            'KOI8-R' => true, 'KOI8-RU' => true, 'KOI8R' => true,
+                            'BIG5' => true, '950' => true,
+                            'GB2312' => true, '936' => true,
+                            'BIG5-HKSCS' => true,
+                            'SHIFT_JIS' => true, 'SJIS' => true, '932' => true,
+                            'EUC-JP' => true, 'EUCJP' => true,
+                            'ISO8859-5' => true, 'ISO-8859-5' => true, 'MACROMAN' => true,
+                        );
+                    }
+                }
 
-                return htmlspecialchars($string, ENT_QUOTES | ENT_SUBSTITUTE, $charset);
-            }
+                if (isset($htmlspecialcharsCharsets[$charset])) {
+                    return htmlspecialchars($string, ENT_QUOTES | ENT_SUBSTITUTE, $charset);
+                }
 
-            $string = twig_convert_encoding($string, 'UTF-8', $charset);
-            $string = htmlspecialchars($string, ENT_QUOTES | ENT_SUBSTITUTE, 'UTF-8');
+                if (isset($htmlspecialcharsCharsets[strtoupper($charset)])) {
+                    // cache the lowercase variant for future iterations
+                    $htmlspecialcharsCharsets[$charset] = true;
 
-            return twig_convert_encoding($string, $charset, 'UTF-8');
+                    return htmlspecialchars($string, ENT_QUOTES | ENT_SUBSTITUTE, $charset);
+                }
 
-        case 'js':
-            // escape all non-alphanumeric characters
-            // into their \xHH or \uHHHH representations
-            if ('UTF-8' != $charset) {
                 $string = twig_convert_encoding($string, 'UTF-8', $charset);
-            }
+                $string = htmlspecialchars($string, ENT_QUOTES | ENT_SUBSTITUTE, 'UTF-8');
 
-            if (0 == strlen($string) ? false : (1 == preg_match('/^./su', $string) ? false : true)) {
-                throw new Twig_Error_Runtime('The string to escape is not a valid UTF-8 string.');
-            }
+                return twig_convert_encoding($string, $charset, 'UTF-8');
 
-            $string = preg_replace_callback('#[^a-zA-Z0-9,\._]#Su', '_twig_escape_js_callback', $string);
+            case 'js':
+                // escape all non-alphanumeric characters
+                // into their \xHH or \uHHHH representations
+                if ('UTF-8' != $charset) {
+                    $string = twig_convert_encoding($string, 'UTF-8', $charset);
+                }
 
-            if ('UTF-8' != $charset) {
-                $string = twig_convert_encoding($string, $charset, 'UTF-8');
-            }
+                if (0 == strlen($string) ? false : (1 == preg_match('/^./su', $string) ? false : true)) {
+                    throw new Twig_Error_Runtime('The string to escape is not a valid UTF-8 string.');
+                }
 
-            return $string;
+                $string = preg_replace_callback('#[^a-zA-Z0-9,\._]#Su', '_twig_escape_js_callback', $string);
 
-        case 'css':
-            if ('UTF-8' != $charset) {
-                $string = twig_convert_encoding($string, 'UTF-8', $charset);
-            }
+                if ('UTF-8' != $charset) {
+                    $string = twig_convert_encoding($string, $charset, 'UTF-8');
+                }
 
-            if (0 == strlen($string) ? false : (1 == preg_match('/^./su', $string) ? false : true)) {
-                throw new Twig_Error_Runtime('The string to escape is not a valid UTF-8 string.');
-            }
+                return $string;
 
-            $string = preg_replace_callback('#[^a-zA-Z0-9]#Su', '_twig_escape_css_callback', $string);
+            case 'css':
+                if ('UTF-8' != $charset) {
+                    $string = twig_convert_encoding($string, 'UTF-8', $charset);
+                }
 
-            if ('UTF-8' != $charset) {
-                $string = twig_convert_encoding($string, $charset, 'UTF-8');
-            }
+                if (0 == strlen($string) ? false : (1 == preg_match('/^./su', $string) ? false : true)) {
+                    throw new Twig_Error_Runtime('The string to escape is not a valid UTF-8 string.');
+                }
 
-            return $string;
+                $string = preg_replace_callback('#[^a-zA-Z0-9]#Su', '_twig_escape_css_callback', $string);
 
-        case 'html_attr':
-            if ('UTF-8' != $charset) {
-                $string = twig_convert_encoding($string, 'UTF-8', $charset);
-            }
+                if ('UTF-8' != $charset) {
+                    $string = twig_convert_encoding($string, $charset, 'UTF-8');
+                }
 
-            if (0 == strlen($string) ? false : (1 == preg_match('/^./su', $string) ? false : true)) {
-                throw new Twig_Error_Runtime('The string to escape is not a valid UTF-8 string.');
-            }
+                return $string;
 
-            $string = preg_replace_callback('#[^a-zA-Z0-9,\.\-_]#Su', '_twig_escape_html_attr_callback', $string);
+            case 'html_attr':
+                if ('UTF-8' != $charset) {
+                    $string = twig_convert_encoding($string, 'UTF-8', $charset);
+                }
 
-            if ('UTF-8' != $charset) {
-                $string = twig_convert_encoding($string, $charset, 'UTF-8');
-            }
+                if (0 == strlen($string) ? false : (1 == preg_match('/^./su', $string) ? false : true)) {
+                    throw new Twig_Error_Runtime('The string to escape is not a valid UTF-8 string.');
+                }
 
-            return $string;
+                $string = preg_replace_callback('#[^a-zA-Z0-9,\.\-_]#Su', '_twig_escape_html_attr_callback', $string);
 
-        case 'url':
-            if (PHP_VERSION_ID < 50300) {
-                return str_replace('%7E', '~', rawurlencode($string));
-            }
+                if ('UTF-8' != $charset) {
+                    $string = twig_convert_encoding($string, $charset, 'UTF-8');
+                }
 
-            return rawurlencode($string);
+                return $string;
 
-        default:
-            static $escapers;
+            case 'url':
+                if (PHP_VERSION_ID < 50300) {
+                    return str_replace('%7E', '~', rawurlencode($string));
+                }
 
-            if (null === $escapers) {
-                $escapers = $env->getExtension('core')->getEscapers();
-            }
+                return rawurlencode($string);
 
-            if (isset($escapers[$strategy])) {
-                return call_user_func($escapers[$strategy], $env, $string, $charset);
-            }
+            default:
+                static $escapers;
 
-            $validStrategies = implode(', ', array_merge(array('html', 'js', 'url', 'css', 'html_attr'), array_keys($escapers)));
+                if (null === $escapers) {
+                    $escapers = $env->getExtension('core')->getEscapers();
+                }
 
-            throw new Twig_Error_Runtime(sprintf('Invalid escaping strategy "%s" (valid ones: %s).', $strategy, $validStrategies));
+                if (isset($escapers[$strategy])) {
+                    return call_user_func($escapers[$strategy], $env, $string, $charset);
+                }
+
+                $validStrategies = implode(', ', array_merge(array('html', 'js', 'url', 'css', 'html_attr'), array_keys($escapers)));
+
+                throw new Twig_Error_Runtime(sprintf('Invalid escaping strategy "%s" (valid ones: %s).', $strategy, $validStrategies));
+        }
     }
 }
 
@@ -1223,17 +1235,20 @@ function _twig_escape_html_attr_callback($matches)
 
 // add multibyte extensions if possible
 if (function_exists('mb_get_info')) {
-    /**
-     * Returns the length of a variable.
-     *
-     * @param Twig_Environment $env   A Twig_Environment instance
-     * @param mixed            $thing A variable
-     *
-     * @return int The length of the value
-     */
-    function twig_length_filter(Twig_Environment $env, $thing)
-    {
-        return is_scalar($thing) ? mb_strlen($thing, $env->getCharset()) : count($thing);
+    // the C extension provides its own implementation
+    if (!function_exists('twig_length_filter')) {
+        /**
+         * Returns the length of a variable.
+         *
+         * @param Twig_Environment $env   A Twig_Environment instance
+         * @param mixed            $thing A variable
+         *
+         * @return int The length of the value
+         */
+        function twig_length_filter(Twig_Environment $env, $thing)
+        {
+            return is_scalar($thing) ? mb_strlen($thing, $env->getCharset()) : count($thing);
+        }
     }
 
     /**
@@ -1307,17 +1322,20 @@ if (function_exists('mb_get_info')) {
 }
 // and byte fallback
 else {
-    /**
-     * Returns the length of a variable.
-     *
-     * @param Twig_Environment $env   A Twig_Environment instance
-     * @param mixed            $thing A variable
-     *
-     * @return int The length of the value
-     */
-    function twig_length_filter(Twig_Environment $env, $thing)
-    {
-        return is_scalar($thing) ? strlen($thing) : count($thing);
+    // the C extension provides its own implementation
+    if (!function_exists('twig_length_filter')) {
+        /**
+         * Returns the length of a variable.
+         *
+         * @param Twig_Environment $env   A Twig_Environment instance
+         * @param mixed            $thing A variable
+         *
+         * @return int The length of the value
+         */
+        function twig_length_filter(Twig_Environment $env, $thing)
+        {
+            return is_scalar($thing) ? strlen($thing) : count($thing);
+        }
     }
 
     /**
@@ -1347,14 +1365,17 @@ else {
     }
 }
 
-/* used internally */
-function twig_ensure_traversable($seq)
-{
-    if ($seq instanceof Traversable || is_array($seq)) {
-        return $seq;
-    }
+// the C extension provides its own implementation
+if (!function_exists('twig_ensure_traversable')) {
+    /* used internally */
+    function twig_ensure_traversable($seq)
+    {
+        if ($seq instanceof Traversable || is_array($seq)) {
+            return $seq;
+        }
 
-    return array();
+        return array();
+    }
 }
 
 /**
@@ -25,6 +25,7 @@ class Twig_Profiler_Profile implements IteratorAggregate, Serializable
     private $starts = array();
     private $ends = array();
     private $profiles = array();
+    private $pending;
 
     public function __construct($template = 'main', $type = self::ROOT, $name = 'main')
     {
@@ -71,6 +72,8 @@ class Twig_Profiler_Profile implements IteratorAggregate, Serializable
 
     public function getProfiles()
     {
+        $this->loadPendingProfiles();
+
         return $this->profiles;
     }
 
@@ -86,6 +89,8 @@ class Twig_Profiler_Profile implements IteratorAggregate, Serializable
      */
     public function getDuration()
     {
+        $this->loadPendingProfiles();
+
         return isset($this->ends['wt']) && isset($this->starts['wt']) ? $this->ends['wt'] - $this->starts['wt'] : 0;
     }
 
@@ -96,6 +101,8 @@ class Twig_Profiler_Profile implements IteratorAggregate, Serializable
      */
     public function getMemoryUsage()
     {
+        $this->loadPendingProfiles();
+
         return isset($this->ends['mu']) && isset($this->starts['mu']) ? $this->ends['mu'] - $this->starts['mu'] : 0;
     }
 
@@ -106,40 +113,56 @@ class Twig_Profiler_Profile implements IteratorAggregate, Serializable
      */
     public function getPeakMemoryUsage()
     {
+        $this->loadPendingProfiles();
+
         return isset($this->ends['pmu']) && isset($this->starts['pmu']) ? $this->ends['pmu'] - $this->starts['pmu'] : 0;
     }
 
     /**
      * Starts the profiling.
+     *
+     * @param array $values The wall time, memory and peak memory usage recorded when the profiling started, or null to take them now
      */
-    public function enter()
+    public function enter(array $values = null)
     {
-        $this->starts = array(
-            'wt' => microtime(true),
-            'mu' => memory_get_usage(),
-            'pmu' => memory_get_peak_usage(),
-        );
+        $this->starts = $this->getValues($values);
     }
 
     /**
      * Stops the profiling.
+     *
+     * @param array $values The wall time, memory and peak memory usage recorded when the profiling stopped, or null to take them now
      */
-    public function leave()
+    public function leave(array $values = null)
     {
-        $this->ends = array(
-            'wt' => microtime(true),
-            'mu' => memory_get_usage(),
-            'pmu' => memory_get_peak_usage(),
-        );
+        $this->ends = $this->getValues($values);
+    }
+
+    /**
+     * Sets the profiler extension that still holds profiles recorded by the C extension.
+     *
+     * They are added to this profile when it is first read.
+     *
+     * @param Twig_Extension_Profiler $extension
+     *
+     * @internal
+     */
+    public function setPendingProfiles(Twig_Extension_Profiler $extension)
+    {
+        $this->pending = $extension;
     }
 
     public function getIterator()
     {
+        $this->loadPendingProfiles();
+
         return new ArrayIterator($this->profiles);
     }
 
     public function serialize()
     {
+        $this->loadPendingProfiles();
+
         return serialize(array($this->template, $this->name, $this->type, $this->starts, $this->ends, $this->profiles));
     }
 
@@ -147,4 +170,24 @@ class Twig_Profiler_Profile implements IteratorAggregate, Serializable
     {
         list($this->template, $this->name, $this->type, $this->starts, $this->ends, $this->profiles) = unserialize($data);
     }
+
+    private function getValues(array $values = null)
+    {
+        if (null === $values) {
+            return array(
+                'wt' => microtime(true),
+                'mu' => memory_get_usage(),
+                'pmu' => memory_get_peak_usage(),
+            );
+        }
+
+        return array('wt' => $values['wt'], 'mu' => $values['mu'], 'pmu' => $values['pmu']);
+    }
+
+    private function loadPendingProfiles()
+    {
+        if (null !== $this->pending) {
+            $this->pending->flush();
+        }
+    }
 }
@@ -148,6 +148,51 @@ class Twig_Tests_Extension_CoreTest extends PHPUnit_Framework_TestCase
         $this->assertSame('', twig_last($twig, null));
         $this->assertSame('', twig_last($twig, ''));
     }
+
+    public function testTwigSlice()
+    {
+        $twig = new Twig_Environment();
+        $this->assertSame(array(2, 3), twig_slice($twig, array(1, 2, 3, 4), 1, 2));
+        $this->assertSame(array(1 => 2, 2 => 3), twig_slice($twig, array(1, 2, 3, 4), 1, 2, true));
+        $this->assertSame(array('b' => 2, 0 => 3), twig_slice($twig, array('a' => 1, 'b' => 2, 5 => 3), 1));
+        $this->assertSame(array(3, 4), twig_slice($twig, new ArrayIterator(array(1, 2, 3, 4)), -2));
+        $this->assertSame(array(2), twig_slice($twig, new ArrayObject(array(1, 2, 3)), 1, 1));
+        $this->assertSame(array(), twig_slice($twig, new ArrayIterator(array(1, 2)), 5, 1));
+        $this->assertSame('', twig_slice($twig, 'abc', 10));
+
+        if (function_exists('mb_get_info')) {
+            $this->assertSame('éè', twig_slice($twig, 'àéèù', 1, 2));
+            $this->assertSame('èù', twig_slice($twig, 'àéèù', 2));
+        }
+    }
+
+    public function testTwigLengthFilter()
+    {
+        $twig = new Twig_Environment();
+        $this->assertSame(function_exists('mb_get_info') ? 4 : 8, twig_length_filter($twig, 'àéèù'));
+        $this->assertSame(3, twig_length_filter($twig, 123));
+        $this->assertSame(2, twig_length_filter($twig, array(1, 2)));
+        $this->assertSame(3, twig_length_filter($twig, new ArrayObject(array(1, 2, 3))));
+    }
+
+    public function testTwigInFilter()
+    {
+        $this->assertTrue(twig_in_filter(1, array('1', 2)));
+        $this->assertTrue(twig_in_filter('b', 'abc'));
+        $this->assertTrue(twig_in_filter('', 'abc'));
+        $this->assertTrue(twig_in_filter(2, new ArrayIterator(array(1, 2))));
+        $this->assertFalse(twig_in_filter(new stdClass(), array(new stdClass())));
+        $this->assertFalse(twig_in_filter('d', 'abc'));
+        $this->assertFalse(twig_in_filter(1, null));
+    }
+
+    public function testTwigJoinFilter()
+    {
+        $this->assertSame('1|2|3', twig_join_filter(array(1, 2, 3), '|'));
+        $this->assertSame('ab', twig_join_filter(new ArrayIterator(array('x' => 'a', 'y' => 'b'))));
+        $this->assertSame('foo', twig_join_filter('foo', ','));
+        $this->assertSame('', twig_join_filter(null));
+    }
 }
 
 function foo_escaper_for_test(Twig_Environment $env, $string, $charset)
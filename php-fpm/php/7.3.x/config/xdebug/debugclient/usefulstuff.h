@@ -19,17 +19,25 @@
 #ifndef __HAVE_USEFULSTUFF_H__
 #define __HAVE_USEFULSTUFF_H__
 
+#include <stddef.h>
+
 #define FD_RL_FILE    0
 #define FD_RL_SOCKET  1
 
 typedef struct _fd_buf fd_buf;
 
 struct _fd_buf {
-	char *buffer;
-	int   buffer_size;
+	char   *buffer;
+	size_t  size;
+	size_t  start;   /* first byte that has not been handed out yet */
+	size_t  end;     /* end of the data that has been read */
+	size_t  scanned; /* bytes after 'start' known not to contain the delimiter */
 };
 
+#define FD_BUF_INITIALIZER { NULL, 0, 0, 0, 0 }
+
 #define fd_read_line(s,c,t) fd_read_line_delim(s, c, t, '\n', NULL)
 char* fd_read_line_delim(int socket, fd_buf *context, int type, unsigned char delim, int *length);
+void fd_buf_dtor(fd_buf *context);
 
 #endif
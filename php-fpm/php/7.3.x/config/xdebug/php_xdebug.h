@@ -146,6 +146,9 @@ ZEND_BEGIN_MODULE_GLOBALS(xdebug)
 	zend_bool     default_enable;
 	zend_bool     collect_includes;
 	zend_long     collect_params;
+	zend_long     collect_params_max_size;
+	zend_long     collect_params_max_total_size;
+	size_t        collect_params_total_size;
 	zend_bool     collect_return;
 	zend_bool     collect_vars;
 	zend_bool     collect_assignments;
@@ -182,9 +185,13 @@ ZEND_BEGIN_MODULE_GLOBALS(xdebug)
 	char         *trace_output_name;
 	zend_long     trace_options;
 	zend_long     trace_format;
+	zend_long     trace_min_duration_us;
+	xdebug_str   *trace_record_capture;
+	FILE         *trace_deferred_file;
 	char         *last_exception_trace;
 	char         *last_eval_statement;
 	zend_bool     in_debug_info;
+	struct _xdebug_object_page_cache *object_page_cache; /* properties of the last object exported for the debugger */
 
 	/* variable dumping limitation settings */
 	zend_long     display_max_children;
@@ -205,6 +212,13 @@ ZEND_BEGIN_MODULE_GLOBALS(xdebug)
 	int           dead_code_analysis_tracker_offset;
 	long          dead_code_last_start_id;
 	long          code_coverage_filter_offset;
+	long          tracing_filter_offset;
+	long          brk_index_offset;
+	zend_ulong    brk_index_generation;
+	long          executable_lines_offset;
+	xdebug_set  **executable_lines_cache;
+	unsigned int  executable_lines_cache_count;
+	zend_ulong    executable_lines_cache_tag;
 	char                 *previous_filename;
 	xdebug_coverage_file *previous_file;
 	char                 *previous_mark_filename;
@@ -257,6 +271,7 @@ ZEND_BEGIN_MODULE_GLOBALS(xdebug)
 	zend_long     remote_cookie_expire_time; /* Expire time for the remote-session cookie */
 	char         *remote_addr_header; /* User configured header to check for forwarded IP address */
 	zend_long     remote_connect_timeout; /* Timeout in MS for remote connections */
+	zend_long     remote_connect_backoff; /* Time in MS to not retry a failed remote connection */
 
 	char         *ide_key; /* As Xdebug uses it, from environment, USER, USERNAME or empty */
 	char         *ide_key_setting; /* Set through php.ini and friends */
@@ -312,6 +327,9 @@ ZEND_BEGIN_MODULE_GLOBALS(xdebug)
 	FILE      *gc_stats_file;
 	char      *gc_stats_filename;
 
+	/* output file compression */
+	char      *output_compression;
+
 	/* in-execution checking */
 	zend_bool  in_execution;
 	zend_bool  in_var_serialisation;
@@ -320,8 +338,10 @@ ZEND_BEGIN_MODULE_GLOBALS(xdebug)
 	zend_long     filter_type_tracing;
 	zend_long     filter_type_profiler;
 	zend_long     filter_type_code_coverage;
-	xdebug_llist *filters_tracing;
-	xdebug_llist *filters_code_coverage;
+	struct _xdebug_trie *filters_tracing;
+	struct _xdebug_trie *filters_code_coverage;
+	zend_ulong    filter_tracing_generation;
+	zend_ulong    filter_tracing_tag;
 ZEND_END_MODULE_GLOBALS(xdebug)
 
 #ifdef ZTS
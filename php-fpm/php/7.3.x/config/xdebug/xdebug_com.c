@@ -36,6 +36,7 @@
 #  include <netinet/in.h>
 # endif
 # include <netdb.h>
+# include <sys/mman.h>
 #else
 # include <process.h>
 # include <direct.h>
@@ -305,6 +306,108 @@ void xdebug_close_socket(int socketfd)
 	SCLOSE(socketfd);
 }
 
+/* Connection attempts that failed are remembered per host and port in a small
+ * table, so that further attempts within xdebug.remote_connect_backoff
+ * milliseconds are not made at all. The table is mapped as shared memory
+ * before PHP-FPM and Apache fork their workers, so that all of them see each
+ * other's failures. Entries are written without locking; a torn entry can
+ * only cause one extra, or one skipped, connection attempt. */
+#define XDEBUG_CONNECT_BACKOFF_SLOTS 64
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+# define MAP_ANONYMOUS MAP_ANON
+#endif
+
+typedef struct _xdebug_connect_backoff_entry {
+	zend_ulong hash;
+	zend_long  port;
+	double     failed_at;
+} xdebug_connect_backoff_entry;
+
+static xdebug_connect_backoff_entry *xdebug_connect_backoff = NULL;
+static int                           xdebug_connect_backoff_shared = 0;
+
+void xdebug_connect_backoff_init(void)
+{
+	size_t size = XDEBUG_CONNECT_BACKOFF_SLOTS * sizeof(xdebug_connect_backoff_entry);
+
+#if !WIN32 && !WINNT && defined(MAP_ANONYMOUS)
+	xdebug_connect_backoff = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (xdebug_connect_backoff != MAP_FAILED) {
+		xdebug_connect_backoff_shared = 1;
+		return;
+	}
+#endif
+
+	/* Without shared memory, each process only remembers its own failures */
+	xdebug_connect_backoff = pecalloc(1, size, 1);
+	xdebug_connect_backoff_shared = 0;
+}
+
+void xdebug_connect_backoff_shutdown(void)
+{
+	if (!xdebug_connect_backoff) {
+		return;
+	}
+
+#if !WIN32 && !WINNT && defined(MAP_ANONYMOUS)
+	if (xdebug_connect_backoff_shared) {
+		munmap(xdebug_connect_backoff, XDEBUG_CONNECT_BACKOFF_SLOTS * sizeof(xdebug_connect_backoff_entry));
+		xdebug_connect_backoff = NULL;
+		return;
+	}
+#endif
+
+	pefree(xdebug_connect_backoff, 1);
+	xdebug_connect_backoff = NULL;
+}
+
+static xdebug_connect_backoff_entry *xdebug_connect_backoff_entry_for(const char *hostname, int dport, zend_ulong *hash)
+{
+	*hash = zend_inline_hash_func(hostname, strlen(hostname)) ^ (zend_ulong) dport;
+	if (!*hash) {
+		*hash = 1;
+	}
+
+	return &xdebug_connect_backoff[*hash % XDEBUG_CONNECT_BACKOFF_SLOTS];
+}
+
+int xdebug_connect_with_backoff(const char *hostname, int dport, int timeout TSRMLS_DC)
+{
+	xdebug_connect_backoff_entry *entry;
+	zend_ulong                    hash;
+	double                        now;
+	int                           socketfd;
+
+	if (!xdebug_connect_backoff || XG(remote_connect_backoff) <= 0) {
+		return xdebug_create_socket(hostname, dport, timeout TSRMLS_CC);
+	}
+
+	entry = xdebug_connect_backoff_entry_for(hostname, dport, &hash);
+	now = xdebug_get_utime();
+
+	if (
+		entry->hash == hash && entry->port == dport &&
+		now - entry->failed_at >= 0 && (now - entry->failed_at) * 1000 < XG(remote_connect_backoff)
+	) {
+		return SOCK_BACKOFF_ERR;
+	}
+
+	socketfd = xdebug_create_socket(hostname, dport, timeout TSRMLS_CC);
+
+	if (socketfd >= 0) {
+		if (entry->hash == hash && entry->port == dport) {
+			entry->hash = 0;
+		}
+	} else {
+		entry->hash = hash;
+		entry->port = dport;
+		entry->failed_at = xdebug_get_utime();
+	}
+
+	return socketfd;
+}
+
 /* Remote debugger helper functions */
 int xdebug_handle_hit_value(xdebug_brk_info *brk_info)
 {
@@ -425,7 +528,7 @@ static void xdebug_init_debugger()
 			}
 
 			XG(context).handler->log(XDEBUG_LOG_INFO, "Remote address found, connecting to %s:%ld.\n", Z_STRVAL_P(remote_addr), (long int) XG(remote_port));
-			XG(context).socket = xdebug_create_socket(Z_STRVAL_P(remote_addr), XG(remote_port), XG(remote_connect_timeout));
+			XG(context).socket = xdebug_connect_with_backoff(Z_STRVAL_P(remote_addr), XG(remote_port), XG(remote_connect_timeout));
 
 			/* Replace the ',', in case we had changed the original header due
 			 * to multiple values */
@@ -434,11 +537,11 @@ static void xdebug_init_debugger()
 			}
 		} else {
 			XG(context).handler->log(XDEBUG_LOG_WARN, "Remote address not found, connecting to configured address/port: %s:%ld. :-|\n", XG(remote_host), (long int) XG(remote_port));
-			XG(context).socket = xdebug_create_socket(XG(remote_host), XG(remote_port), XG(remote_connect_timeout));
+			XG(context).socket = xdebug_connect_with_backoff(XG(remote_host), XG(remote_port), XG(remote_connect_timeout));
 		}
 	} else {
 		XG(context).handler->log(XDEBUG_LOG_INFO, "Connecting to configured address/port: %s:%ld.\n", XG(remote_host), (long int) XG(remote_port));
-		XG(context).socket = xdebug_create_socket(XG(remote_host), XG(remote_port), XG(remote_connect_timeout));
+		XG(context).socket = xdebug_connect_with_backoff(XG(remote_host), XG(remote_port), XG(remote_connect_timeout));
 	}
 	if (XG(context).socket >= 0) {
 		XG(context).handler->log(XDEBUG_LOG_INFO, "Connected to client. :-)\n");
@@ -463,6 +566,8 @@ static void xdebug_init_debugger()
 		XG(context).handler->log(XDEBUG_LOG_ERR, "Time-out connecting to client (Waited: " ZEND_LONG_FMT " ms). :-(\n", XG(remote_connect_timeout));
 	} else if (XG(context).socket == -3) {
 		XG(context).handler->log(XDEBUG_LOG_ERR, "No permission connecting to client. This could be SELinux related. :-(\n");
+	} else if (XG(context).socket == SOCK_BACKOFF_ERR) {
+		XG(context).handler->log(XDEBUG_LOG_WARN, "Not connecting to client, as a connection attempt failed less than " ZEND_LONG_FMT " ms ago. :-|\n", XG(remote_connect_backoff));
 	}
 	if (!XG(remote_connection_enabled)) {
 		xdebug_close_log();
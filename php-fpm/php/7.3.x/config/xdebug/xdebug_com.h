@@ -33,6 +33,7 @@
 #endif
 #define SOCK_TIMEOUT_ERR -2
 #define SOCK_ACCESS_ERR -3
+#define SOCK_BACKOFF_ERR -4
 
 #if WIN32|WINNT
 #define SCLOSE(a) closesocket(a)
@@ -58,6 +59,10 @@
 int xdebug_create_socket(const char *hostname, int dport, int timeout TSRMLS_DC);
 void xdebug_close_socket(int socket);
 
+void xdebug_connect_backoff_init(void);
+void xdebug_connect_backoff_shutdown(void);
+int xdebug_connect_with_backoff(const char *hostname, int dport, int timeout TSRMLS_DC);
+
 /* Remote debugging helper functions */
 int xdebug_handle_hit_value(xdebug_brk_info *brk_info);
 
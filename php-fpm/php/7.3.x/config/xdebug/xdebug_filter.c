@@ -18,6 +18,7 @@
 #include "php_xdebug.h"
 #include "xdebug_private.h"
 #include "xdebug_filter.h"
+#include "xdebug_trie.h"
 
 ZEND_EXTERN_MODULE_GLOBALS(xdebug)
 
@@ -58,112 +59,132 @@ void xdebug_filter_register_constants(INIT_FUNC_ARGS)
 	REGISTER_LONG_CONSTANT("XDEBUG_NAMESPACE_BLACKLIST", XDEBUG_NAMESPACE_BLACKLIST, CONST_CS | CONST_PERSISTENT);
 }
 
-int xdebug_filter_match_path_whitelist(function_stack_entry *fse, long *filtered_flag, char *filter)
+static int xdebug_filter_match_path(function_stack_entry *fse, xdebug_trie *filters)
 {
-	if (strncasecmp(filter, fse->filename, strlen(filter)) == 0) {
-		*filtered_flag = 0;
-		return 1;
-	}
-	return 0;
-}
-
-int xdebug_filter_match_path_blacklist(function_stack_entry *fse, long *filtered_flag, char *filter)
-{
-	if (strncasecmp(filter, fse->filename, strlen(filter)) == 0) {
-		*filtered_flag = 1;
-		return 1;
-	}
-	return 0;
+	return xdebug_trie_has_prefix_of(filters, fse->filename);
 }
 
-int xdebug_filter_match_namespace_whitelist(function_stack_entry *fse, long *filtered_flag, char *filter)
+static int xdebug_filter_match_namespace(function_stack_entry *fse, xdebug_trie *filters)
 {
-	if (!fse->function.class && strlen(filter) == 0) {
-		*filtered_flag = 0;
-		return 1;
-	}
-	if (fse->function.class && strlen(filter) > 0 && strncasecmp(filter, fse->function.class, strlen(filter)) == 0) {
-		*filtered_flag = 0;
-		return 1;
-	}
-	return 0;
-}
-
-int xdebug_filter_match_namespace_blacklist(function_stack_entry *fse, long *filtered_flag, char *filter)
-{
-	if (!fse->function.class && strlen(filter) == 0) {
-		*filtered_flag = 1;
-		return 1;
-	}
-	if (fse->function.class && strlen(filter) > 0 && strncasecmp(filter, fse->function.class, strlen(filter)) == 0) {
-		*filtered_flag = 1;
-		return 1;
+	/* An empty filter only matches functions that are not in a class, and
+	 * non-empty filters only match functions that are */
+	if (!fse->function.class) {
+		return filters->root->terminal;
 	}
-	return 0;
+	return xdebug_trie_longest_prefix(filters, fse->function.class) > 0;
 }
 
-
-static void xdebug_filter_run_internal(function_stack_entry *fse, int group, long *filtered_flag, int type, xdebug_llist *filters)
+static void xdebug_filter_run_internal(function_stack_entry *fse, int group, long *filtered_flag, int type, xdebug_trie *filters)
 {
-	xdebug_llist_element *le;
-	unsigned int          k;
 	function_stack_entry  tmp_fse;
-	int (*filter_to_run)(function_stack_entry *fse, long *filtered_flag, char *filter);
-
-	le = XDEBUG_LLIST_HEAD(filters);
 
 	switch (type) {
 		case XDEBUG_PATH_WHITELIST:
-			*filtered_flag = 1;
-			if (group == XDEBUG_FILTER_CODE_COVERAGE && fse->function.type & XFUNC_INCLUDES) {
-				tmp_fse.filename = fse->include_filename;
-				fse = &tmp_fse;
-			}
-
-			filter_to_run = xdebug_filter_match_path_whitelist;
-			break;
-
 		case XDEBUG_PATH_BLACKLIST:
-			*filtered_flag = 0;
 			if (group == XDEBUG_FILTER_CODE_COVERAGE && fse->function.type & XFUNC_INCLUDES) {
 				tmp_fse.filename = fse->include_filename;
 				fse = &tmp_fse;
 			}
 
-			filter_to_run = xdebug_filter_match_path_blacklist;
+			*filtered_flag = xdebug_filter_match_path(fse, filters) ? (type == XDEBUG_PATH_BLACKLIST) : (type == XDEBUG_PATH_WHITELIST);
 			break;
 
 		case XDEBUG_NAMESPACE_WHITELIST:
-			*filtered_flag = 1;
-			filter_to_run = xdebug_filter_match_namespace_whitelist;
-			break;
-
 		case XDEBUG_NAMESPACE_BLACKLIST:
-			*filtered_flag = 0;
-			filter_to_run = xdebug_filter_match_namespace_blacklist;
+			*filtered_flag = xdebug_filter_match_namespace(fse, filters) ? (type == XDEBUG_NAMESPACE_BLACKLIST) : (type == XDEBUG_NAMESPACE_WHITELIST);
 			break;
 
 		default:
 			/* Logically can't happen, but compilers can't detect that */
 			return;
 	}
+}
 
-	for (k = 0; k < filters->size; k++, le = XDEBUG_LLIST_NEXT(le)) {
-		char *filter = XDEBUG_LLIST_VALP(le);
+/* Tracing filter verdicts are cached in a reserved slot of the op_array (or
+ * internal function) that determines them, tagged with
+ * XG(filter_tracing_tag). Op_arrays can be shared with other processes through
+ * OPcache, so the tag combines the PID with a generation counter that is
+ * bumped for every request and every change of the tracing filter. */
+#define XDEBUG_FILTER_CACHE_ENCODE(tag, verdict) ((void*) (zend_uintptr_t) (((tag) << 1) | ((verdict) ? 1 : 0)))
+#define XDEBUG_FILTER_CACHE_TAG(v)               (((zend_uintptr_t) (v)) >> 1)
+#define XDEBUG_FILTER_CACHE_VERDICT(v)           ((long) (((zend_uintptr_t) (v)) & 1))
 
-		/* If the filter matched once, we're done */
-		if (filter_to_run(fse, filtered_flag, filter)) {
-			break;
-		}
+void xdebug_filter_tracing_invalidate_cache(void)
+{
+	XG(filter_tracing_generation)++;
+
+#if SIZEOF_ZEND_LONG == 8
+	XG(filter_tracing_tag) = (xdebug_get_pid() << 31) | (XG(filter_tracing_generation) & 0x7fffffff);
+#else
+	XG(filter_tracing_tag) = XG(filter_tracing_generation) & 0x7fffffff;
+#endif
+	if (XG(filter_tracing_tag) == 0) {
+		XG(filter_tracing_tag) = 1;
+	}
+}
+
+/* Returns the slot the verdict for this frame can be cached in, or NULL if
+ * the verdict depends on more than the function that is called */
+static void **xdebug_filter_tracing_cache_slot(function_stack_entry *fse, zend_op_array *location_op_array, zend_function *func)
+{
+	if (XG(tracing_filter_offset) == -1) {
+		return NULL;
+	}
+
+	switch (XG(filter_type_tracing)) {
+		case XDEBUG_PATH_WHITELIST:
+		case XDEBUG_PATH_BLACKLIST:
+			/* The frame's filename is the one of the nearest user code, so
+			 * the verdict is the same for every call made from that op_array */
+			if (location_op_array) {
+				return &location_op_array->reserved[XG(tracing_filter_offset)];
+			}
+			return NULL;
+
+		case XDEBUG_NAMESPACE_WHITELIST:
+		case XDEBUG_NAMESPACE_BLACKLIST:
+			if (!func || (func->common.fn_flags & ZEND_ACC_CALL_VIA_TRAMPOLINE) || fse->function.type == XFUNC_ZEND_PASS) {
+				return NULL;
+			}
+
+			/* Method calls take the class from $this, which can be any
+			 * descendant of the function's scope */
+			if (
+				fse->function.class &&
+				!(fse->function.type == XFUNC_STATIC_MEMBER && func->common.function_name)
+			) {
+				return NULL;
+			}
+
+			if (ZEND_USER_CODE(func->type)) {
+				return &func->op_array.reserved[XG(tracing_filter_offset)];
+			}
+			return &func->internal_function.reserved[XG(tracing_filter_offset)];
 	}
+
+	return NULL;
 }
 
-void xdebug_filter_run_tracing(function_stack_entry *fse)
+void xdebug_filter_run_tracing(function_stack_entry *fse, zend_op_array *location_op_array, zend_function *func)
 {
+	void **cache_slot;
+
 	fse->filtered_tracing = 0;
 
-	if (XG(filter_type_tracing) != XDEBUG_FILTER_NONE) {
-		xdebug_filter_run_internal(fse, XDEBUG_FILTER_TRACING, &fse->filtered_tracing, XG(filter_type_tracing), XG(filters_tracing));
+	if (XG(filter_type_tracing) == XDEBUG_FILTER_NONE) {
+		return;
+	}
+
+	cache_slot = xdebug_filter_tracing_cache_slot(fse, location_op_array, func);
+	if (cache_slot && *cache_slot && XDEBUG_FILTER_CACHE_TAG(*cache_slot) == XG(filter_tracing_tag)) {
+		fse->filtered_tracing = XDEBUG_FILTER_CACHE_VERDICT(*cache_slot);
+		return;
+	}
+
+	xdebug_filter_run_internal(fse, XDEBUG_FILTER_TRACING, &fse->filtered_tracing, XG(filter_type_tracing), XG(filters_tracing));
+
+	if (cache_slot) {
+		*cache_slot = XDEBUG_FILTER_CACHE_ENCODE(XG(filter_tracing_tag), fse->filtered_tracing);
 	}
 }
 
@@ -187,7 +208,7 @@ PHP_FUNCTION(xdebug_set_filter)
 {
 	zend_long      filter_group;
 	zend_long      filter_type;
-	xdebug_llist **filter_list;
+	xdebug_trie  **filter_list;
 	zval          *filters, *item;
 
 	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "lla", &filter_group, &filter_type, &filters) == FAILURE) {
@@ -198,6 +219,7 @@ PHP_FUNCTION(xdebug_set_filter)
 		case XDEBUG_FILTER_TRACING:
 			filter_list = &XG(filters_tracing);
 			XG(filter_type_tracing) = XDEBUG_FILTER_NONE;
+			xdebug_filter_tracing_invalidate_cache();
 			break;
 
 		case XDEBUG_FILTER_CODE_COVERAGE:
@@ -235,7 +257,10 @@ PHP_FUNCTION(xdebug_set_filter)
 		return;
 	}
 
-	xdebug_llist_empty(*filter_list, NULL);
+	/* The filters are compiled into a prefix trie, so that matching a path or
+	 * class name costs a single walk over it however many filters there are */
+	xdebug_trie_destroy(*filter_list);
+	*filter_list = xdebug_trie_alloc();
 
 	if (filter_type == XDEBUG_FILTER_NONE) {
 		return;
@@ -247,7 +272,7 @@ PHP_FUNCTION(xdebug_set_filter)
 
 		/* If we are a namespace filter, and the filter name starts with \, we
 		 * need to strip the \ from the matcher */
-		xdebug_llist_insert_next(*filter_list, XDEBUG_LLIST_TAIL(*filter_list), xdstrdup(filter[0] == '\\' ? &filter[1] : filter));
+		xdebug_trie_add(*filter_list, filter[0] == '\\' ? &filter[1] : filter);
 
 		zend_string_release(str);
 	} ZEND_HASH_FOREACH_END();
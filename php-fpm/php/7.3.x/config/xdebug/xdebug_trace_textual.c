@@ -86,32 +86,6 @@ char *xdebug_trace_textual_get_filename(void *ctxt TSRMLS_DC)
 	return context->trace_filename;
 }
 
-static void add_single_value(xdebug_str *str, zval *zv, int collection_level TSRMLS_DC)
-{
-	xdebug_str *tmp_value = NULL;
-
-	switch (collection_level) {
-		case 1: /* synopsis */
-		case 2:
-			tmp_value = xdebug_get_zval_synopsis(zv, 0, NULL);
-			break;
-		case 3: /* full */
-		case 4: /* full (with var) */
-		default:
-			tmp_value = xdebug_get_zval_value(zv, 0, NULL);
-			break;
-		case 5: /* serialized */
-			tmp_value = xdebug_get_zval_value_serialized(zv, 0, NULL);
-			break;
-	}
-	if (tmp_value) {
-		xdebug_str_add_str(str, tmp_value);
-		xdebug_str_free(tmp_value);
-	} else {
-		xdebug_str_add(str, "???", 0);
-	}
-}
-
 void xdebug_trace_textual_function_entry(void *ctxt, function_stack_entry *fse, int function_nr TSRMLS_DC)
 {
 	xdebug_trace_textual_context *context = (xdebug_trace_textual_context*) ctxt;
@@ -170,7 +144,7 @@ void xdebug_trace_textual_function_entry(void *ctxt, function_stack_entry *fse,
 			}
 
 			if (!Z_ISUNDEF(fse->var[j].data)) {
-				add_single_value(&str, &fse->var[j].data, XG(collect_params) TSRMLS_CC);
+				xdebug_trace_add_value(&str, &fse->var[j].data, XG(collect_params) TSRMLS_CC);
 			} else {
 				xdebug_str_addl(&str, "???", 3, 0);
 			}
@@ -200,8 +174,7 @@ void xdebug_trace_textual_function_entry(void *ctxt, function_stack_entry *fse,
 
 	xdebug_str_add(&str, xdebug_sprintf(") %s:%d\n", fse->filename, fse->lineno), 1);
 
-	fprintf(context->trace_file, "%s", str.d);
-	fflush(context->trace_file);
+	xdebug_trace_write_record(context->trace_file, &str TSRMLS_CC);
 
 	xdfree(str.d);
 }
@@ -228,19 +201,14 @@ void xdebug_trace_textual_function_return_value(void *ctxt, function_stack_entry
 {
 	xdebug_trace_textual_context *context = (xdebug_trace_textual_context*) ctxt;
 	xdebug_str                    str = XDEBUG_STR_INITIALIZER;
-	xdebug_str                   *tmp_value;
 
 	xdebug_return_trace_stack_common(&str, fse TSRMLS_CC);
 
-	tmp_value = xdebug_get_zval_value(return_value, 0, NULL);
-	if (tmp_value) {
-		xdebug_str_add_str(&str, tmp_value);
-		xdebug_str_free(tmp_value);
-	}
+	/* Return values are always written in full, within the size limits */
+	xdebug_trace_add_value(&str, return_value, 3 TSRMLS_CC);
 	xdebug_str_addl(&str, "\n", 2, 0);
 
-	fprintf(context->trace_file, "%s", str.d);
-	fflush(context->trace_file);
+	xdebug_trace_write_record(context->trace_file, &str TSRMLS_CC);
 
 	xdebug_str_destroy(&str);
 }
@@ -249,7 +217,6 @@ void xdebug_trace_textual_generator_return_value(void *ctxt, function_stack_entr
 {
 	xdebug_trace_textual_context *context = (xdebug_trace_textual_context*) ctxt;
 	xdebug_str                    str = XDEBUG_STR_INITIALIZER;
-	xdebug_str                   *tmp_value = NULL;
 
 	if (! (generator->flags & ZEND_GENERATOR_CURRENTLY_RUNNING)) {
 		return;
@@ -262,28 +229,18 @@ void xdebug_trace_textual_generator_return_value(void *ctxt, function_stack_entr
 #endif
 
 	/* Generator key */
-	tmp_value = xdebug_get_zval_value(&generator->key, 0, NULL);
-	if (tmp_value) {
-		xdebug_return_trace_stack_common(&str, fse TSRMLS_CC);
-
-		xdebug_str_addl(&str, "(", 1, 0);
-		xdebug_str_add_str(&str, tmp_value);
-		xdebug_str_addl(&str, " => ", 4, 0);
-
-		tmp_value = xdebug_get_zval_value(&generator->value, 0, NULL);
-		if (tmp_value) {
-			xdebug_str_add_str(&str, tmp_value);
-			xdebug_str_free(tmp_value);
-		}
+	xdebug_return_trace_stack_common(&str, fse TSRMLS_CC);
 
-		xdebug_str_addl(&str, ")", 1, 0);
-		xdebug_str_addl(&str, "\n", 2, 0);
+	xdebug_str_addl(&str, "(", 1, 0);
+	xdebug_trace_add_value(&str, &generator->key, 3 TSRMLS_CC);
+	xdebug_str_addl(&str, " => ", 4, 0);
+	xdebug_trace_add_value(&str, &generator->value, 3 TSRMLS_CC);
+	xdebug_str_addl(&str, ")", 1, 0);
+	xdebug_str_addl(&str, "\n", 2, 0);
 
-		fprintf(context->trace_file, "%s", str.d);
-		fflush(context->trace_file);
+	xdebug_trace_write_record(context->trace_file, &str TSRMLS_CC);
 
-		xdebug_str_destroy(&str);
-	}
+	xdebug_str_destroy(&str);
 }
 
 void xdebug_trace_textual_assignment(void *ctxt, function_stack_entry *fse, char *full_varname, zval *retval, char *right_full_varname, const char *op, char *filename, int lineno TSRMLS_DC)
@@ -323,8 +280,7 @@ void xdebug_trace_textual_assignment(void *ctxt, function_stack_entry *fse, char
 	}
 	xdebug_str_add(&str, xdebug_sprintf(" %s:%d\n", filename, lineno), 1);
 
-	fprintf(context->trace_file, "%s", str.d);
-	fflush(context->trace_file);
+	xdebug_trace_write_record(context->trace_file, &str TSRMLS_CC);
 
 	xdfree(str.d);
 }
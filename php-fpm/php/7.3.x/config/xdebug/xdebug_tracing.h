@@ -26,7 +26,13 @@ char* xdebug_return_trace_stack_generator_retval(function_stack_entry* i, zend_g
 char* xdebug_return_trace_assignment(function_stack_entry *i, char *varname, zval *retval, char *op, char *file, int fileno TSRMLS_DC);
 FILE *xdebug_trace_open_file(char *fname, char *script_filename, long options, char **used_fname TSRMLS_DC);
 
+void xdebug_trace_write_record(FILE *file, xdebug_str *record TSRMLS_DC);
+void xdebug_trace_add_value(xdebug_str *str, zval *zv, int collection_level TSRMLS_DC);
+void xdebug_trace_release_arguments(function_stack_entry *fse TSRMLS_DC);
+void xdebug_trace_discard_pending_records(TSRMLS_D);
+
 void xdebug_trace_function_begin(function_stack_entry *fse, int function_nr TSRMLS_DC);
-void xdebug_trace_function_end(function_stack_entry *fse, int function_nr TSRMLS_DC);
+int xdebug_trace_function_end(function_stack_entry *fse, int function_nr TSRMLS_DC);
+void xdebug_trace_assignment(function_stack_entry *fse, char *full_varname, zval *value, char *right_full_varname, const char *op, char *file, int lineno TSRMLS_DC);
 
 #endif
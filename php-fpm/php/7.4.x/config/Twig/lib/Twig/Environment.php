@@ -331,8 +331,12 @@ class Twig_Environment
             if (false === $cache = $this->getCacheFilename($name)) {
                 eval('?>'.$this->compileSource($this->getLoader()->getSource($name), $name));
             } else {
-                if (!is_file($cache) || ($this->isAutoReload() && !$this->isTemplateFresh($name, filemtime($cache)))) {
-                    $this->writeCacheFile($cache, $this->compileSource($this->getLoader()->getSource($name), $name));
+                // templates compiled by Twig_CacheWarmer are known to be in the cache
+                $loader = $this->getLoader();
+                if ($this->isAutoReload() || !$loader instanceof Twig_Loader_Compiled || !$loader->isCompiled($name)) {
+                    if (!is_file($cache) || ($this->isAutoReload() && !$this->isTemplateFresh($name, filemtime($cache)))) {
+                        $this->writeCacheFile($cache, $this->compileSource($loader->getSource($name), $name));
+                    }
                 }
 
                 require_once $cache;
@@ -12,20 +12,43 @@
 class Twig_Extension_Profiler extends Twig_Extension
 {
     private $actives;
+    private $native = false;
 
     public function __construct(Twig_Profiler_Profile $profile)
     {
         $this->actives = array($profile);
+
+        // templates compiled while the C extension is loaded record their
+        // profiles in C; they are read when the root profile is
+        if (function_exists('twig_profiler_flush')) {
+            $this->native = true;
+            $profile->setPendingProfiles($this);
+        }
+    }
+
+    public function __destruct()
+    {
+        if ($this->native) {
+            twig_profiler_close($this);
+        }
     }
 
     public function enter(Twig_Profiler_Profile $profile)
     {
+        if ($this->native) {
+            $this->flush();
+        }
+
         $this->actives[0]->addProfile($profile);
         array_unshift($this->actives, $profile);
     }
 
     public function leave(Twig_Profiler_Profile $profile)
     {
+        if ($this->native) {
+            $this->flush();
+        }
+
         $profile->leave();
         array_shift($this->actives);
 
@@ -34,6 +57,34 @@ class Twig_Extension_Profiler extends Twig_Extension
         }
     }
 
+    /**
+     * Adds the profiles recorded by the C extension to the root profile.
+     *
+     * @internal
+     */
+    public function flush()
+    {
+        if (!$this->native) {
+            return;
+        }
+
+        foreach (twig_profiler_flush($this) as $event) {
+            if (isset($event['template'])) {
+                $profile = new Twig_Profiler_Profile($event['template'], $event['type'], $event['name']);
+                $profile->enter($event);
+                $this->actives[0]->addProfile($profile);
+                array_unshift($this->actives, $profile);
+            } else {
+                $this->actives[0]->leave($event);
+                array_shift($this->actives);
+
+                if (1 === count($this->actives)) {
+                    $this->actives[0]->leave($event);
+                }
+            }
+        }
+    }
+
     /**
      * {@inheritdoc}
      */
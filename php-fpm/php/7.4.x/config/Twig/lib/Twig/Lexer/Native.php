@@ -0,0 +1,66 @@
+<?php
+
+/*
+ * This file is part of Twig.
+ *
+ * (c) 2015 Fabien Potencier
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/**
+ * Lexes a template string with the C extension.
+ *
+ * The tokens are the same as the ones of Twig_Lexer, which is used instead
+ * when the extension is not loaded.
+ *
+ * @author Fabien Potencier <fabien@symfony.com>
+ */
+class Twig_Lexer_Native extends Twig_Lexer
+{
+    protected $operators;
+
+    public function __construct(Twig_Environment $env, array $options = array())
+    {
+        parent::__construct($env, $options);
+
+        $this->operators = $this->getOperators();
+    }
+
+    /**
+     * {@inheritdoc}
+     */
+    public function tokenize($code, $filename = null)
+    {
+        if (!function_exists('twig_lexer_tokenize')) {
+            return parent::tokenize($code, $filename);
+        }
+
+        $tokens = twig_lexer_tokenize($code, $filename, $this->options, $this->operators);
+        if (false === $tokens) {
+            return parent::tokenize($code, $filename);
+        }
+
+        return new Twig_TokenStream($tokens, $filename);
+    }
+
+    /**
+     * Returns the operators in the order getOperatorRegex() tries them.
+     *
+     * @return array
+     */
+    protected function getOperators()
+    {
+        $operators = array_merge(
+            array('='),
+            array_keys($this->env->getUnaryOperators()),
+            array_keys($this->env->getBinaryOperators())
+        );
+
+        $operators = array_combine($operators, array_map('strlen', $operators));
+        arsort($operators);
+
+        return array_map('strval', array_keys($operators));
+    }
+}
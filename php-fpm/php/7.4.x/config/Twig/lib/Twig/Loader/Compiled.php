@@ -0,0 +1,124 @@
+<?php
+
+/*
+ * This file is part of Twig.
+ *
+ * (c) 2015 Fabien Potencier
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/**
+ * Resolves templates compiled by Twig_CacheWarmer without touching the filesystem.
+ *
+ * The cache keys of the compiled templates are read from the manifest that
+ * the warmer wrote, and the environment loads their cache files without
+ * checking that they exist. Everything else goes to the wrapped loader.
+ *
+ * Only use it while the cache stays as the warmer left it, and without
+ * auto_reload.
+ *
+ * @author Fabien Potencier <fabien@symfony.com>
+ */
+class Twig_Loader_Compiled implements Twig_LoaderInterface, Twig_ExistsLoaderInterface
+{
+    protected $loader;
+    protected $manifest;
+    protected $cacheKeys;
+
+    /**
+     * Constructor.
+     *
+     * @param Twig_LoaderInterface $loader   The loader the templates were compiled from
+     * @param string               $manifest The manifest written by Twig_CacheWarmer::writeManifest()
+     */
+    public function __construct(Twig_LoaderInterface $loader, $manifest)
+    {
+        $this->loader = $loader;
+        $this->manifest = $manifest;
+    }
+
+    /**
+     * Returns the wrapped loader.
+     *
+     * @return Twig_LoaderInterface
+     */
+    public function getLoader()
+    {
+        return $this->loader;
+    }
+
+    /**
+     * Checks whether a template is in the manifest.
+     *
+     * @param string $name The template name
+     *
+     * @return bool
+     */
+    public function isCompiled($name)
+    {
+        if (null === $this->cacheKeys) {
+            $this->loadManifest();
+        }
+
+        return isset($this->cacheKeys[(string) $name]);
+    }
+
+    /**
+     * {@inheritdoc}
+     */
+    public function getSource($name)
+    {
+        return $this->loader->getSource($name);
+    }
+
+    /**
+     * {@inheritdoc}
+     */
+    public function getCacheKey($name)
+    {
+        if ($this->isCompiled($name)) {
+            return $this->cacheKeys[(string) $name];
+        }
+
+        return $this->loader->getCacheKey($name);
+    }
+
+    /**
+     * {@inheritdoc}
+     */
+    public function isFresh($name, $time)
+    {
+        return $this->loader->isFresh($name, $time);
+    }
+
+    /**
+     * {@inheritdoc}
+     */
+    public function exists($name)
+    {
+        if ($this->isCompiled($name)) {
+            return true;
+        }
+
+        if ($this->loader instanceof Twig_ExistsLoaderInterface) {
+            return $this->loader->exists($name);
+        }
+
+        try {
+            $this->loader->getSource($name);
+
+            return true;
+        } catch (Twig_Error_Loader $e) {
+            return false;
+        }
+    }
+
+    protected function loadManifest()
+    {
+        $cacheKeys = @include $this->manifest;
+
+        $this->cacheKeys = is_array($cacheKeys) ? $cacheKeys : array();
+    }
+}
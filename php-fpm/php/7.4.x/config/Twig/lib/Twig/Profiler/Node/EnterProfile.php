@@ -30,6 +30,21 @@ class Twig_Profiler_Node_EnterProfile extends Twig_Node
             ->write(sprintf('$%s = $this->env->getExtension(', $this->getAttribute('var_name')))
             ->repr($this->getAttribute('extension_name'))
             ->raw(");\n")
+        ;
+
+        if (function_exists('twig_profiler_enter')) {
+            $compiler
+                ->write(sprintf('twig_profiler_enter($%s, $this->getTemplateName(), ', $this->getAttribute('var_name')))
+                ->repr($this->getAttribute('type'))
+                ->raw(', ')
+                ->repr($this->getAttribute('name'))
+                ->raw(");\n\n")
+            ;
+
+            return;
+        }
+
+        $compiler
             ->write(sprintf('$%s->enter($%s = new Twig_Profiler_Profile($this->getTemplateName(), ', $this->getAttribute('var_name'), $this->getAttribute('var_name').'_prof'))
             ->repr($this->getAttribute('type'))
             ->raw(', ')
@@ -26,9 +26,12 @@ class Twig_Profiler_Node_LeaveProfile extends Twig_Node
      */
     public function compile(Twig_Compiler $compiler)
     {
-        $compiler
-            ->write("\n")
-            ->write(sprintf("\$%s->leave(\$%s);\n\n", $this->getAttribute('var_name'), $this->getAttribute('var_name').'_prof'))
-        ;
+        $compiler->write("\n");
+
+        if (function_exists('twig_profiler_leave')) {
+            $compiler->write(sprintf("twig_profiler_leave(\$%s);\n\n", $this->getAttribute('var_name')));
+        } else {
+            $compiler->write(sprintf("\$%s->leave(\$%s);\n\n", $this->getAttribute('var_name'), $this->getAttribute('var_name').'_prof'));
+        }
     }
 }
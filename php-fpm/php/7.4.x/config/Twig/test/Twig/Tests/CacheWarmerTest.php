@@ -0,0 +1,151 @@
+<?php
+
+/*
+ * This file is part of Twig.
+ *
+ * (c) Fabien Potencier
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+class Twig_Tests_CacheWarmerTest extends PHPUnit_Framework_TestCase
+{
+    protected $tmpDir;
+
+    public function setUp()
+    {
+        $this->tmpDir = sys_get_temp_dir().'/TwigCacheWarmerTests';
+        if (!file_exists($this->tmpDir)) {
+            @mkdir($this->tmpDir, 0777, true);
+        }
+
+        if (!is_writable($this->tmpDir)) {
+            $this->markTestSkipped(sprintf('Unable to run the tests as "%s" is not writable.', $this->tmpDir));
+        }
+    }
+
+    public function tearDown()
+    {
+        $this->removeDir($this->tmpDir);
+    }
+
+    public function testFindTemplates()
+    {
+        $loader = new Twig_Loader_Filesystem(dirname(__FILE__).'/Loader/Fixtures/themes');
+        $loader->addPath(dirname(__FILE__).'/Loader/Fixtures/named', 'named');
+        $warmer = new Twig_CacheWarmer(new Twig_Environment($loader));
+
+        $this->assertSame(array('@named/index.html', 'theme1/blocks.html.twig', 'theme2/blocks.html.twig'), $warmer->findTemplates());
+        $this->assertSame(array('@named/index.html'), $warmer->findTemplates('html'));
+    }
+
+    /**
+     * @expectedException LogicException
+     */
+    public function testFindTemplatesNeedsAFilesystemLoader()
+    {
+        $warmer = new Twig_CacheWarmer(new Twig_Environment(new Twig_Loader_Array(array())));
+        $warmer->findTemplates();
+    }
+
+    /**
+     * @expectedException LogicException
+     */
+    public function testWarmUpNeedsACache()
+    {
+        $warmer = new Twig_CacheWarmer(new Twig_Environment(new Twig_Loader_Array(array())));
+        $warmer->warmUp(array('index'));
+    }
+
+    /**
+     * @dataProvider getWorkers
+     */
+    public function testWarmUp($workers)
+    {
+        $env = new Twig_Environment($this->getLoader(), array('cache' => $this->tmpDir.'/cache'));
+        $warmer = new Twig_CacheWarmer($env);
+
+        $errors = $warmer->warmUp(array('index', 'layout', 'broken'), $workers);
+
+        $this->assertSame(array('broken'), array_keys($errors));
+        $this->assertFileExists($env->getCacheFilename('index'));
+        $this->assertFileExists($env->getCacheFilename('layout'));
+        $this->assertFileNotExists($env->getCacheFilename('broken'));
+    }
+
+    public function testWarmUpRecompilesExistingCacheFiles()
+    {
+        $env = new Twig_Environment(new Twig_Loader_Compiled($this->getLoader(), $this->tmpDir.'/missing.php'), array('cache' => $this->tmpDir.'/cache'));
+        $warmer = new Twig_CacheWarmer($env);
+
+        @mkdir(dirname($env->getCacheFilename('layout')), 0777, true);
+        file_put_contents($env->getCacheFilename('layout'), '<?php // stale');
+
+        $this->assertSame(array(), $warmer->warmUp(array('layout')));
+        $this->assertNotContains('stale', file_get_contents($env->getCacheFilename('layout')));
+    }
+
+    public function getWorkers()
+    {
+        return array(array(1), array(2));
+    }
+
+    public function testCompiledLoader()
+    {
+        $env = new Twig_Environment($this->getLoader(), array('cache' => $this->tmpDir.'/cache'));
+        $warmer = new Twig_CacheWarmer($env);
+        $warmer->warmUp(array('index', 'layout'));
+        $warmer->writeManifest($this->tmpDir.'/manifest.php', array('index', 'layout'));
+        $warmer->writePreloadScript($this->tmpDir.'/preload.php', array('index', 'layout'));
+
+        $preload = file_get_contents($this->tmpDir.'/preload.php');
+        $this->assertContains('Twig_Autoloader::register();', $preload);
+        $this->assertContains(var_export($env->getCacheFilename('index'), true), $preload);
+
+        $loader = new Twig_Loader_Compiled($this->getLoader(), $this->tmpDir.'/manifest.php');
+        $this->assertTrue($loader->isCompiled('index'));
+        $this->assertFalse($loader->isCompiled('broken'));
+        $this->assertTrue($loader->exists('broken'));
+        $this->assertFalse($loader->exists('missing'));
+        $this->assertSame($env->getLoader()->getCacheKey('index'), $loader->getCacheKey('index'));
+
+        $env = new Twig_Environment($loader, array('cache' => $this->tmpDir.'/cache'));
+        $this->assertSame('<p>index</p>', $env->render('index'));
+    }
+
+    public function testCompiledLoaderWithoutManifest()
+    {
+        $loader = new Twig_Loader_Compiled($this->getLoader(), $this->tmpDir.'/missing.php');
+
+        $this->assertFalse($loader->isCompiled('index'));
+        $this->assertSame('index', $loader->getCacheKey('index'));
+    }
+
+    protected function getLoader()
+    {
+        return new Twig_Loader_Array(array(
+            'index' => '{% extends "layout" %}{% block content %}index{% endblock %}',
+            'layout' => '<p>{% block content %}{% endblock %}</p>',
+            'broken' => '{% if %}',
+        ));
+    }
+
+    private function removeDir($target)
+    {
+        $fp = opendir($target);
+        while (false !== $file = readdir($fp)) {
+            if (in_array($file, array('.', '..'))) {
+                continue;
+            }
+
+            if (is_dir($target.'/'.$file)) {
+                self::removeDir($target.'/'.$file);
+            } else {
+                unlink($target.'/'.$file);
+            }
+        }
+        closedir($fp);
+        rmdir($target);
+    }
+}
@@ -75,6 +75,53 @@ class Twig_Tests_Profiler_ProfileTest extends PHPUnit_Framework_TestCase
         $this->assertTrue($profile->getDuration() > 0, sprintf('Expected duration > 0, got: %f', $profile->getDuration()));
     }
 
+    public function testEnterAndLeaveWithValues()
+    {
+        $profile = new Twig_Profiler_Profile();
+        $profile->enter(array('wt' => 1.5, 'mu' => 100, 'pmu' => 200));
+        $profile->leave(array('wt' => 2, 'mu' => 150, 'pmu' => 300));
+
+        $this->assertEquals(0.5, $profile->getDuration());
+        $this->assertSame(50, $profile->getMemoryUsage());
+        $this->assertSame(100, $profile->getPeakMemoryUsage());
+    }
+
+    public function testProfilerExtension()
+    {
+        $profile = new Twig_Profiler_Profile();
+        $twig = new Twig_Environment(new Twig_Loader_Array(array(
+            'index' => '{% extends "layout" %}{% block content %}{{ _self.hello() }}{% endblock %}{% macro hello() %}hello{% endmacro %}',
+            'layout' => '<p>{% block content %}{% endblock %}</p>',
+        )));
+        $twig->addExtension(new Twig_Extension_Profiler($profile));
+
+        $this->assertSame('<p>hello</p>', $twig->render('index'));
+        $this->assertSame('<p>hello</p>', $twig->render('index'));
+
+        $profiles = $profile->getProfiles();
+        $this->assertCount(2, $profiles);
+        $this->assertTrue($profile->getDuration() > 0);
+
+        $index = $profiles[0];
+        $this->assertTrue($index->isTemplate());
+        $this->assertSame('index', $index->getTemplate());
+        $this->assertCount(1, $index->getProfiles());
+
+        list($layout) = $index->getProfiles();
+        $this->assertSame('layout', $layout->getTemplate());
+        $this->assertCount(1, $layout->getProfiles());
+
+        list($block) = $layout->getProfiles();
+        $this->assertTrue($block->isBlock());
+        $this->assertSame('index', $block->getTemplate());
+        $this->assertSame('content', $block->getName());
+
+        list($macro) = $block->getProfiles();
+        $this->assertTrue($macro->isMacro());
+        $this->assertSame('hello', $macro->getName());
+        $this->assertTrue($macro->getDuration() >= 0);
+    }
+
     public function testSerialize()
     {
         $profile = new Twig_Profiler_Profile('template', 'type', 'name');
@@ -0,0 +1,33 @@
+/*
+   +----------------------------------------------------------------------+
+   | Xdebug                                                               |
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2002-2018 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 1.01 of the Xdebug license,   |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available at through the world-wide-web at                           |
+   | https://xdebug.org/license.php                                       |
+   | If you did not receive a copy of the Xdebug license and are unable   |
+   | to obtain it through the world-wide-web, please send a note to       |
+   | derick@xdebug.org so we can mail you a copy immediately.             |
+   +----------------------------------------------------------------------+
+   | Authors: Derick Rethans <derick@xdebug.org>                          |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef __HAVE_PROXY_H__
+#define __HAVE_PROXY_H__
+
+#define DEFAULT_IDE_PORT    9001
+
+#define IPV4                4
+#define IPV6                6
+
+/* Runs a DBGp proxy: engines connect on engine_port, IDEs register their
+ * IDE key on ide_port with proxyinit, and every engine session is passed on
+ * to the IDE that registered the session's IDE key. Does not return unless
+ * the proxy could not be started. */
+int proxy_run(int engine_port, int ide_port, int ipversion);
+
+#endif
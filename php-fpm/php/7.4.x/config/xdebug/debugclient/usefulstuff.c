@@ -16,6 +16,7 @@
    +----------------------------------------------------------------------+
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #ifndef WIN32
@@ -28,58 +29,93 @@
 #endif
 #include "usefulstuff.h"
 
-#define READ_BUFFER_SIZE 128
+/* Lines are read into one growable buffer that is reused for the whole
+ * connection. The lines handed out point into that buffer, with their
+ * delimiter replaced by a NUL, and stay valid until the next read from the
+ * same buffer. Consumed data is only moved out of the way when the free
+ * space at the end runs out. */
+#define READ_BUFFER_SIZE 8192
 
-char* fd_read_line_delim(int socket, fd_buf *context, int type, unsigned char delim, int *length)
+static char *fd_buf_find(fd_buf *context, unsigned char delim)
 {
-	int size = 0, newl = 0, nbufsize = 0;
-	char *tmp;
-	char *tmp_buf = NULL;
-	char *ptr;
-	char buffer[READ_BUFFER_SIZE + 1];
-
-	if (!context->buffer) {
-		context->buffer = calloc(1,1);
-		context->buffer_size = 0;
+	char   *ptr;
+	size_t  unscanned = context->end - context->start - context->scanned;
+
+	if (!unscanned) {
+		return NULL;
+	}
+
+	ptr = memchr(context->buffer + context->start + context->scanned, delim, unscanned);
+	context->scanned = ptr ? (size_t) (ptr - (context->buffer + context->start)) : context->end - context->start;
+
+	return ptr;
+}
+
+static int fd_buf_fill(int socketfd, fd_buf *context, int type, int flags)
+{
+	int newl;
+
+	if (context->size - context->end < READ_BUFFER_SIZE) {
+		if (context->start > 0) {
+			memmove(context->buffer, context->buffer + context->start, context->end - context->start);
+			context->end -= context->start;
+			context->start = 0;
+		}
+		if (context->size - context->end < READ_BUFFER_SIZE) {
+			do {
+				context->size = context->size ? context->size * 2 : READ_BUFFER_SIZE;
+			} while (context->size - context->end < READ_BUFFER_SIZE);
+			context->buffer = realloc(context->buffer, context->size);
+		}
 	}
 
-	while ((ptr = memchr(context->buffer, delim, context->buffer_size)) == NULL) {
-		ptr = context->buffer + context->buffer_size;
+	do {
 		if (type == FD_RL_FILE) {
-			newl = read(socket, buffer, READ_BUFFER_SIZE);
+			newl = read(socketfd, context->buffer + context->end, context->size - context->end);
 		} else {
-			newl = recv(socket, buffer, READ_BUFFER_SIZE, 0);
+			newl = recv(socketfd, context->buffer + context->end, context->size - context->end, flags);
 		}
-		if (newl > 0) {
-			context->buffer = realloc(context->buffer, context->buffer_size + newl + 1);
-			memcpy(context->buffer + context->buffer_size, buffer, newl);
-			context->buffer_size += newl;
-			context->buffer[context->buffer_size] = '\0';
-		} else {
+	} while (newl == -1 && errno == EINTR);
+
+	if (newl > 0) {
+		context->end += newl;
+	}
+	return newl;
+}
+
+void fd_buf_dtor(fd_buf *context)
+{
+	free(context->buffer);
+	context->buffer = NULL;
+	context->size = 0;
+	context->start = 0;
+	context->end = 0;
+	context->scanned = 0;
+}
+
+char* fd_read_line_delim(int socketfd, fd_buf *context, int type, unsigned char delim, int *length)
+{
+	char *line, *ptr;
+
+	while ((ptr = fd_buf_find(context, delim)) == NULL) {
+		if (fd_buf_fill(socketfd, context, type, 0) <= 0) {
+			fd_buf_dtor(context);
 			return NULL;
 		}
 	}
 
-	ptr = memchr(context->buffer, delim, context->buffer_size);
-	size = ptr - context->buffer;
-	/* Copy that line into tmp */
-	tmp = malloc(size + 1);
-	tmp[size] = '\0';
-	memcpy(tmp, context->buffer, size);
-	/* Rewrite existing buffer */
-	if ((nbufsize = context->buffer_size - size - 1)  > 0) {
-		tmp_buf = malloc(nbufsize + 1);
-		memcpy(tmp_buf, ptr + 1, nbufsize);
-		tmp_buf[nbufsize] = 0;
+	line = context->buffer + context->start;
+	*ptr = '\0';
+
+	context->start += (ptr - line) + 1;
+	context->scanned = 0;
+	if (context->start == context->end) {
+		context->start = 0;
+		context->end = 0;
 	}
-	free(context->buffer);
-	context->buffer = tmp_buf;
-	context->buffer_size = context->buffer_size - (size + 1);
 
-	/* Return normal line */
 	if (length) {
-		*length = size;
+		*length = ptr - line;
 	}
-	return tmp;
+	return line;
 }
-
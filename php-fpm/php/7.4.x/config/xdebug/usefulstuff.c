@@ -51,64 +51,127 @@
 
 ZEND_EXTERN_MODULE_GLOBALS(xdebug)
 
-#define READ_BUFFER_SIZE 128
+/* Lines are read into one growable buffer that is reused for the whole
+ * connection. The lines handed out point into that buffer, with their
+ * delimiter replaced by a NUL, and stay valid until the next line is read
+ * from the same buffer. Consumed data is only moved out of the way when the
+ * free space at the end runs out, and only by that next read: checking for
+ * a pending line never moves, grows or rewinds the buffer. */
+#define READ_BUFFER_SIZE 8192
+
+static char *fd_buf_find(fd_buf *context, unsigned char delim)
+{
+	char   *ptr;
+	size_t  unscanned = context->end - context->start - context->scanned;
 
-char* xdebug_fd_read_line_delim(int socketfd, fd_buf *context, int type, unsigned char delim, int *length)
+	if (!unscanned) {
+		return NULL;
+	}
+
+	ptr = memchr(context->buffer + context->start + context->scanned, delim, unscanned);
+	context->scanned = ptr ? (size_t) (ptr - (context->buffer + context->start)) : context->end - context->start;
+
+	return ptr;
+}
+
+static int fd_buf_fill(int socketfd, fd_buf *context, int type, int flags, int compact)
 {
-	int size = 0, newl = 0, nbufsize = 0;
-	char *tmp;
-	char *tmp_buf = NULL;
-	char *ptr;
-	char buffer[READ_BUFFER_SIZE + 1];
+	int newl;
 
-	if (!context->buffer) {
-		context->buffer = calloc(1,1);
-		context->buffer_size = 0;
+	if (!compact) {
+		if (context->size == context->end) {
+			return 0;
+		}
+	} else if (context->size - context->end < READ_BUFFER_SIZE) {
+		if (context->start > 0) {
+			memmove(context->buffer, context->buffer + context->start, context->end - context->start);
+			context->end -= context->start;
+			context->start = 0;
+		}
+		if (context->size - context->end < READ_BUFFER_SIZE) {
+			do {
+				context->size = context->size ? context->size * 2 : READ_BUFFER_SIZE;
+			} while (context->size - context->end < READ_BUFFER_SIZE);
+			context->buffer = realloc(context->buffer, context->size);
+		}
 	}
 
-	while (context->buffer_size < 1 || context->buffer[context->buffer_size - 1] != delim) {
-		ptr = context->buffer + context->buffer_size;
+	do {
 		if (type == FD_RL_FILE) {
-			newl = read(socketfd, buffer, READ_BUFFER_SIZE);
+			newl = read(socketfd, context->buffer + context->end, context->size - context->end);
 		} else {
-			newl = recv(socketfd, buffer, READ_BUFFER_SIZE, 0);
+			newl = recv(socketfd, context->buffer + context->end, context->size - context->end, flags);
 		}
-		if (newl > 0) {
-			context->buffer = realloc(context->buffer, context->buffer_size + newl + 1);
-			memcpy(context->buffer + context->buffer_size, buffer, newl);
-			context->buffer_size += newl;
-			context->buffer[context->buffer_size] = '\0';
-		} else if (newl == -1 && errno == EINTR) {
-			continue;
-		} else {
-			free(context->buffer);
-			context->buffer = NULL;
-			context->buffer_size = 0;
+	} while (newl == -1 && errno == EINTR);
+
+	if (newl > 0) {
+		context->end += newl;
+	}
+	return newl;
+}
+
+void xdebug_fd_buf_dtor(fd_buf *context)
+{
+	free(context->buffer);
+	context->buffer = NULL;
+	context->size = 0;
+	context->start = 0;
+	context->end = 0;
+	context->scanned = 0;
+}
+
+char* xdebug_fd_read_line_delim(int socketfd, fd_buf *context, int type, unsigned char delim, int *length)
+{
+	char *line, *ptr;
+
+	/* The line handed out last is no longer needed */
+	if (context->start == context->end) {
+		context->start = 0;
+		context->end = 0;
+		context->scanned = 0;
+	}
+
+	while ((ptr = fd_buf_find(context, delim)) == NULL) {
+		if (fd_buf_fill(socketfd, context, type, 0, 1) <= 0) {
+			xdebug_fd_buf_dtor(context);
 			return NULL;
 		}
 	}
 
-	ptr = memchr(context->buffer, delim, context->buffer_size);
-	size = ptr - context->buffer;
-	/* Copy that line into tmp */
-	tmp = malloc(size + 1);
-	tmp[size] = '\0';
-	memcpy(tmp, context->buffer, size);
-	/* Rewrite existing buffer */
-	if ((nbufsize = context->buffer_size - size - 1)  > 0) {
-		tmp_buf = malloc(nbufsize + 1);
-		memcpy(tmp_buf, ptr + 1, nbufsize);
-		tmp_buf[nbufsize] = 0;
-	}
-	free(context->buffer);
-	context->buffer = tmp_buf;
-	context->buffer_size = context->buffer_size - (size + 1);
+	line = context->buffer + context->start;
+	*ptr = '\0';
+
+	context->start += (ptr - line) + 1;
+	context->scanned = 0;
 
-	/* Return normal line */
 	if (length) {
-		*length = size;
+		*length = ptr - line;
 	}
-	return tmp;
+	return line;
+}
+
+/* Returns whether a complete line is already waiting in the buffer, after
+ * pulling in whatever the socket has available without blocking for more.
+ * Only the free space at the end of the buffer is filled, so that the line
+ * returned last stays intact; when there is none, no line is reported as
+ * pending, which at worst means a response is not held back. */
+int xdebug_fd_line_pending(int socketfd, fd_buf *context, int type, unsigned char delim)
+{
+	if (fd_buf_find(context, delim)) {
+		return 1;
+	}
+
+#ifdef MSG_DONTWAIT
+	if (type == FD_RL_SOCKET) {
+		while (fd_buf_fill(socketfd, context, type, MSG_DONTWAIT, 0) > 0) {
+			if (fd_buf_find(context, delim)) {
+				return 1;
+			}
+		}
+	}
+#endif
+
+	return 0;
 }
 
 xdebug_str* xdebug_join(const char *delim, xdebug_arg *args, int begin, int end)
@@ -25,10 +25,15 @@
 typedef struct _fd_buf fd_buf;
 
 struct _fd_buf {
-	char *buffer;
-	int   buffer_size;
+	char   *buffer;
+	size_t  size;
+	size_t  start;   /* first byte that has not been handed out yet */
+	size_t  end;     /* end of the data that has been read */
+	size_t  scanned; /* bytes after 'start' known not to contain the delimiter */
 };
 
+#define FD_BUF_INITIALIZER { NULL, 0, 0, 0, 0 }
+
 typedef struct xdebug_arg {
 	int    c;
 	char **args;
@@ -52,6 +57,8 @@ typedef struct xdebug_arg {
 
 #define xdebug_fd_read_line(s,c,t) xdebug_fd_read_line_delim(s, c, t, '\n', NULL)
 char* xdebug_fd_read_line_delim(int socket, fd_buf *context, int type, unsigned char delim, int *length);
+int xdebug_fd_line_pending(int socket, fd_buf *context, int type, unsigned char delim);
+void xdebug_fd_buf_dtor(fd_buf *context);
 xdebug_str* xdebug_join(const char *delim, xdebug_arg *args, int begin, int end);
 void xdebug_explode(const char *delim, char *str, xdebug_arg *args, int limit);
 char* xdebug_memnstr(char *haystack, const char *needle, int needle_len, char *end);
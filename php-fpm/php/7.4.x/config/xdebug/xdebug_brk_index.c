@@ -0,0 +1,327 @@
+/*
+   +----------------------------------------------------------------------+
+   | Xdebug                                                               |
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2002-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 1.01 of the Xdebug license,   |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available at through the world-wide-web at                           |
+   | https://xdebug.org/license.php                                       |
+   | If you did not receive a copy of the Xdebug license and are unable   |
+   | to obtain it through the world-wide-web, please send a note to       |
+   | derick@xdebug.org so we can mail you a copy immediately.             |
+   +----------------------------------------------------------------------+
+   | Authors: Derick Rethans <derick@xdebug.org>                          |
+   +----------------------------------------------------------------------+
+ */
+
+#include <ctype.h>
+
+#include "php_xdebug.h"
+#include "xdebug_brk_index.h"
+#include "xdebug_compat.h"
+#include "xdebug_mm.h"
+#include "usefulstuff.h"
+
+ZEND_EXTERN_MODULE_GLOBALS(xdebug)
+
+/* For every op_array, the position of its file in the index is cached in a
+ * reserved slot, tagged with the index that it was looked up in. The position
+ * of its set of executable lines is cached the same way, with a tag for each
+ * request. Op_arrays can be shared with other processes through OPcache, so
+ * a tag combines the PID with a generation counter. There is no room for
+ * such a tag on 32-bit platforms, and there nothing is cached in the slots. */
+#define XDEBUG_OP_ARRAY_CACHE_NR_BITS      16
+#define XDEBUG_OP_ARRAY_CACHE_ENCODE(t, n) ((void*) (zend_uintptr_t) (((t) << XDEBUG_OP_ARRAY_CACHE_NR_BITS) | (n)))
+#define XDEBUG_OP_ARRAY_CACHE_TAG(v)       (((zend_uintptr_t) (v)) >> XDEBUG_OP_ARRAY_CACHE_NR_BITS)
+#define XDEBUG_OP_ARRAY_CACHE_NR(v)        ((int) (((zend_uintptr_t) (v)) & ((1 << XDEBUG_OP_ARRAY_CACHE_NR_BITS) - 1)))
+
+static char *xdebug_brk_index_fold(const char *file, int file_len)
+{
+	char *folded = xdmalloc(file_len + 1);
+	int   i;
+
+	for (i = 0; i < file_len; i++) {
+		folded[i] = tolower((unsigned char) file[i]);
+	}
+	folded[file_len] = '\0';
+
+	return folded;
+}
+
+static void xdebug_brk_index_line_dtor(void *list)
+{
+	xdebug_llist_destroy((xdebug_llist*) list, NULL);
+}
+
+static void xdebug_brk_index_file_dtor(void *elem)
+{
+	xdebug_brk_index_file *file = (xdebug_brk_index_file*) elem;
+
+	if (file->lines) {
+		xdebug_set_free(file->lines);
+	}
+	xdebug_hash_destroy(file->breakpoints);
+	xdfree(file);
+}
+
+static xdebug_brk_index_file *xdebug_brk_index_file_fetch(xdebug_brk_index *index, xdebug_brk_info *brk, int create)
+{
+	xdebug_brk_index_file *file = NULL;
+	char                  *folded;
+
+	folded = xdebug_brk_index_fold(brk->file, brk->file_len);
+	if (!xdebug_hash_find(index->file_lookup, folded, brk->file_len, (void*) &file) && create) {
+		file = xdcalloc(1, sizeof(xdebug_brk_index_file));
+		file->nr = index->files_count;
+		file->breakpoints = xdebug_hash_alloc(32, xdebug_brk_index_line_dtor);
+
+		index->files = xdrealloc(index->files, (index->files_count + 1) * sizeof(xdebug_brk_index_file*));
+		index->files[index->files_count] = file;
+		index->files_count++;
+
+		xdebug_hash_add(index->file_lookup, folded, brk->file_len, file);
+	}
+	xdfree(folded);
+
+	return file;
+}
+
+static zend_ulong xdebug_next_op_array_cache_tag(void)
+{
+	/* Start at a different generation in every process, so that a process
+	 * that gets the PID of an earlier one doesn't trust its tags */
+	if (!XG(brk_index_generation)) {
+		XG(brk_index_generation) = (zend_ulong) (xdebug_get_utime() * 1000000);
+	}
+	XG(brk_index_generation)++;
+
+#if SIZEOF_ZEND_LONG == 8
+	return ((xdebug_get_pid() & 0xffffff) << 24) | (XG(brk_index_generation) & 0xffffff);
+#else
+	return 0;
+#endif
+}
+
+static xdebug_brk_index *xdebug_brk_index_build(xdebug_con *context)
+{
+	xdebug_brk_index      *index;
+	xdebug_llist_element  *le;
+	xdebug_brk_info       *brk;
+	xdebug_brk_index_file *file;
+	xdebug_llist          *list;
+	unsigned int          *max_lineno;
+	int                    i;
+
+	index = xdcalloc(1, sizeof(xdebug_brk_index));
+	index->tag = xdebug_next_op_array_cache_tag();
+	index->file_lookup = xdebug_hash_alloc(64, NULL);
+
+	for (le = XDEBUG_LLIST_HEAD(context->line_breakpoints); le != NULL; le = XDEBUG_LLIST_NEXT(le)) {
+		brk = XDEBUG_LLIST_VALP(le);
+
+		if (!brk->file || brk->resolved_lineno < 0) {
+			continue;
+		}
+
+		file = xdebug_brk_index_file_fetch(index, brk, 1);
+		if (!xdebug_hash_index_find(file->breakpoints, brk->resolved_lineno, (void*) &list)) {
+			list = xdebug_llist_alloc(NULL);
+			xdebug_hash_index_add(file->breakpoints, brk->resolved_lineno, list);
+		}
+		xdebug_llist_insert_next(list, XDEBUG_LLIST_TAIL(list), brk);
+	}
+
+	/* Now that the number of files is known, size the line sets */
+	max_lineno = xdcalloc(index->files_count + 1, sizeof(unsigned int));
+	for (le = XDEBUG_LLIST_HEAD(context->line_breakpoints); le != NULL; le = XDEBUG_LLIST_NEXT(le)) {
+		brk = XDEBUG_LLIST_VALP(le);
+
+		if ((file = xdebug_brk_index_file_fetch(index, brk, 0)) && brk->resolved_lineno >= 0) {
+			if ((unsigned int) brk->resolved_lineno > max_lineno[file->nr]) {
+				max_lineno[file->nr] = brk->resolved_lineno;
+			}
+		}
+	}
+	for (i = 0; i < index->files_count; i++) {
+		index->files[i]->lines = xdebug_set_create(max_lineno[i] + 1);
+	}
+	xdfree(max_lineno);
+
+	for (le = XDEBUG_LLIST_HEAD(context->line_breakpoints); le != NULL; le = XDEBUG_LLIST_NEXT(le)) {
+		brk = XDEBUG_LLIST_VALP(le);
+
+		if ((file = xdebug_brk_index_file_fetch(index, brk, 0)) && brk->resolved_lineno >= 0) {
+			xdebug_set_add(file->lines, brk->resolved_lineno);
+		}
+	}
+
+	return index;
+}
+
+void xdebug_brk_index_invalidate(xdebug_con *context)
+{
+	xdebug_brk_index *index = context->line_breakpoint_index;
+	int               i;
+
+	if (!index) {
+		return;
+	}
+
+	for (i = 0; i < index->files_count; i++) {
+		xdebug_brk_index_file_dtor(index->files[i]);
+	}
+	xdfree(index->files);
+	xdebug_hash_destroy(index->file_lookup);
+	xdfree(index);
+
+	context->line_breakpoint_index = NULL;
+}
+
+static xdebug_brk_index_file *xdebug_brk_index_file_lookup(xdebug_con *context, xdebug_brk_index *index, zend_op_array *op_array)
+{
+	xdebug_brk_index_file *file = NULL;
+	xdebug_eval_info      *ei;
+	void                 **cache_slot = NULL;
+	char                  *filename, *folded;
+	int                    filename_len;
+
+#if SIZEOF_ZEND_LONG == 8
+	if (XG(brk_index_offset) != -1) {
+		cache_slot = &op_array->reserved[XG(brk_index_offset)];
+
+		if (*cache_slot && XDEBUG_OP_ARRAY_CACHE_TAG(*cache_slot) == index->tag) {
+			int nr = XDEBUG_OP_ARRAY_CACHE_NR(*cache_slot);
+
+			return nr > 0 && nr <= index->files_count ? index->files[nr - 1] : NULL;
+		}
+	}
+#endif
+
+	filename = (char*) STR_NAME_VAL(op_array->filename);
+	filename_len = STR_NAME_LEN(op_array->filename);
+
+	/* Breakpoints in eval()'d code are set on its dbgp:// URL */
+	if (
+		filename_len >= (int) (sizeof("eval()'d code") - 1) &&
+		strcmp(filename + filename_len - (sizeof("eval()'d code") - 1), "eval()'d code") == 0 &&
+		context->eval_id_lookup &&
+		xdebug_hash_find(context->eval_id_lookup, filename, filename_len, (void*) &ei)
+	) {
+		filename = xdebug_sprintf("dbgp://%d", ei->id);
+		filename_len = strlen(filename);
+		folded = xdebug_brk_index_fold(filename, filename_len);
+		xdfree(filename);
+	} else {
+		folded = xdebug_brk_index_fold(filename, filename_len);
+	}
+
+	xdebug_hash_find(index->file_lookup, folded, filename_len, (void*) &file);
+	xdfree(folded);
+
+	if (cache_slot && index->files_count < (1 << XDEBUG_OP_ARRAY_CACHE_NR_BITS) - 1) {
+		*cache_slot = XDEBUG_OP_ARRAY_CACHE_ENCODE(index->tag, file ? file->nr + 1 : 0);
+	}
+
+	return file;
+}
+
+xdebug_llist *xdebug_brk_index_find(xdebug_con *context, zend_op_array *op_array, int lineno)
+{
+	xdebug_brk_index_file *file;
+	xdebug_llist          *list;
+
+	if (!context->line_breakpoints || !XDEBUG_LLIST_COUNT(context->line_breakpoints)) {
+		return NULL;
+	}
+
+	if (!context->line_breakpoint_index) {
+		context->line_breakpoint_index = xdebug_brk_index_build(context);
+	}
+
+	file = xdebug_brk_index_file_lookup(context, context->line_breakpoint_index, op_array);
+	if (!file || lineno < 0 || (unsigned int) lineno >= file->lines->size || !xdebug_set_in(file->lines, lineno)) {
+		return NULL;
+	}
+
+	if (!xdebug_hash_index_find(file->breakpoints, lineno, (void*) &list)) {
+		return NULL;
+	}
+
+	return list;
+}
+
+xdebug_set *xdebug_executable_lines_build(zend_op_array *opa)
+{
+	xdebug_set *tmp;
+	uint32_t    i;
+
+	tmp = xdebug_set_create(opa->line_end);
+
+	for (i = 0; i < opa->last; i++ ) {
+		if (opa->opcodes[i].opcode == ZEND_EXT_STMT ) {
+			xdebug_set_add(tmp, opa->opcodes[i].lineno);
+		}
+	}
+
+	return tmp;
+}
+
+void xdebug_executable_lines_cache_init(void)
+{
+	XG(executable_lines_cache) = NULL;
+	XG(executable_lines_cache_count) = 0;
+	XG(executable_lines_cache_tag) = xdebug_next_op_array_cache_tag();
+}
+
+void xdebug_executable_lines_cache_destroy(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < XG(executable_lines_cache_count); i++) {
+		xdebug_set_free(XG(executable_lines_cache)[i]);
+	}
+	if (XG(executable_lines_cache)) {
+		xdfree(XG(executable_lines_cache));
+	}
+	XG(executable_lines_cache) = NULL;
+	XG(executable_lines_cache_count) = 0;
+}
+
+xdebug_set *xdebug_executable_lines_cache_find(zend_op_array *opa)
+{
+#if SIZEOF_ZEND_LONG == 8
+	void       **cache_slot;
+	xdebug_set  *lines;
+
+	if (XG(executable_lines_offset) == -1) {
+		return NULL;
+	}
+
+	cache_slot = &opa->reserved[XG(executable_lines_offset)];
+	if (*cache_slot && XDEBUG_OP_ARRAY_CACHE_TAG(*cache_slot) == XG(executable_lines_cache_tag)) {
+		int nr = XDEBUG_OP_ARRAY_CACHE_NR(*cache_slot);
+
+		if (nr > 0 && (unsigned int) nr <= XG(executable_lines_cache_count)) {
+			return XG(executable_lines_cache)[nr - 1];
+		}
+	}
+
+	if (XG(executable_lines_cache_count) >= (1 << XDEBUG_OP_ARRAY_CACHE_NR_BITS) - 1) {
+		return NULL;
+	}
+
+	lines = xdebug_executable_lines_build(opa);
+
+	XG(executable_lines_cache) = xdrealloc(XG(executable_lines_cache), (XG(executable_lines_cache_count) + 1) * sizeof(xdebug_set*));
+	XG(executable_lines_cache)[XG(executable_lines_cache_count)] = lines;
+	XG(executable_lines_cache_count)++;
+
+	*cache_slot = XDEBUG_OP_ARRAY_CACHE_ENCODE(XG(executable_lines_cache_tag), XG(executable_lines_cache_count));
+
+	return lines;
+#else
+	return NULL;
+#endif
+}
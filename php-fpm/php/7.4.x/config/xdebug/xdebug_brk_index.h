@@ -0,0 +1,58 @@
+/*
+   +----------------------------------------------------------------------+
+   | Xdebug                                                               |
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2002-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 1.01 of the Xdebug license,   |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available at through the world-wide-web at                           |
+   | https://xdebug.org/license.php                                       |
+   | If you did not receive a copy of the Xdebug license and are unable   |
+   | to obtain it through the world-wide-web, please send a note to       |
+   | derick@xdebug.org so we can mail you a copy immediately.             |
+   +----------------------------------------------------------------------+
+   | Authors: Derick Rethans <derick@xdebug.org>                          |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef __XDEBUG_BRK_INDEX_H__
+#define __XDEBUG_BRK_INDEX_H__
+
+#include "xdebug_handlers.h"
+
+/* An index of the line breakpoints, so that the statement handler doesn't
+ * have to walk (and log about) every line breakpoint for every statement.
+ * Breakpoints are grouped per file (compared case-insensitively, just like
+ * break_on_line does), and per file by their resolved line number. */
+typedef struct _xdebug_brk_index_file {
+	int           nr;
+	xdebug_set   *lines;       /* resolved line numbers that have breakpoints */
+	xdebug_hash  *breakpoints; /* line number -> xdebug_llist of xdebug_brk_info* */
+} xdebug_brk_index_file;
+
+typedef struct _xdebug_brk_index {
+	zend_ulong              tag;
+	xdebug_hash            *file_lookup; /* folded file name -> xdebug_brk_index_file* */
+	xdebug_brk_index_file **files;
+	int                     files_count;
+} xdebug_brk_index;
+
+/* Returns the line breakpoints that are set on this line of the op_array, in
+ * the order in which they were set, or NULL if there are none */
+xdebug_llist *xdebug_brk_index_find(xdebug_con *context, zend_op_array *op_array, int lineno);
+
+/* Has to be called whenever a line breakpoint is added or removed, or when
+ * its resolved line number changes */
+void xdebug_brk_index_invalidate(xdebug_con *context);
+
+/* The set of lines that have statements in an op_array, as used for
+ * resolving line breakpoints. It is built once per op_array per request, and
+ * owned by the cache. Returns NULL if the op_array can't be cached, in which
+ * case the caller has to build (and free) the set itself. */
+xdebug_set *xdebug_executable_lines_build(zend_op_array *opa);
+xdebug_set *xdebug_executable_lines_cache_find(zend_op_array *opa);
+void xdebug_executable_lines_cache_init(void);
+void xdebug_executable_lines_cache_destroy(void);
+
+#endif
@@ -583,8 +583,8 @@ static int xdebug_common_assign_dim_handler(const char *op, int do_cc, zend_exec
 		}
 
 		fse = XDEBUG_LLIST_VALP(XDEBUG_LLIST_TAIL(XG(stack)));
-		if (XG(trace_context) && XG(collect_assignments) && XG(trace_handler)->assignment) {
-			XG(trace_handler)->assignment(XG(trace_context), fse, full_varname, val, right_full_varname, op, file, lineno TSRMLS_CC);
+		if (XG(trace_context) && XG(collect_assignments)) {
+			xdebug_trace_assignment(fse, full_varname, val, right_full_varname, op, file, lineno TSRMLS_CC);
 		}
 		xdfree(full_varname);
 	}
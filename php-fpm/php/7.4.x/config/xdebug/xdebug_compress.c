@@ -0,0 +1,370 @@
+/*
+   +----------------------------------------------------------------------+
+   | Xdebug                                                               |
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2002-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 1.01 of the Xdebug license,   |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available at through the world-wide-web at                           |
+   | https://xdebug.org/license.php                                       |
+   | If you did not receive a copy of the Xdebug license and are unable   |
+   | to obtain it through the world-wide-web, please send a note to       |
+   | derick@xdebug.org so we can mail you a copy immediately.             |
+   +----------------------------------------------------------------------+
+   | Authors: Derick Rethans <derick@xdebug.org>                          |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE /* fopencookie() */
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php_xdebug.h"
+#include "xdebug_compress.h"
+#include "xdebug_mm.h"
+#include "usefulstuff.h"
+
+#ifdef HAVE_XDEBUG_ZLIB
+# include <zlib.h>
+#endif
+#ifdef HAVE_XDEBUG_ZSTD
+# include <zstd.h>
+#endif
+
+ZEND_EXTERN_MODULE_GLOBALS(xdebug)
+
+/* Compression levels that keep up with a busy tracer: gzip's fastest level
+ * already halves the size of a trace file many times over, and zstd's
+ * default level is both faster and smaller than that. */
+#define XDEBUG_GZIP_LEVEL 1
+#define XDEBUG_ZSTD_LEVEL 3
+
+#define XDEBUG_COMPRESS_BUFFER_SIZE 65536
+
+#if (defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN)) && (defined(HAVE_XDEBUG_ZLIB) || defined(HAVE_XDEBUG_ZSTD))
+# define XDEBUG_HAVE_COMPRESSION 1
+#endif
+
+static const char *xdebug_compression_suffix(int type)
+{
+	switch (type) {
+		case XDEBUG_COMPRESSION_GZIP:
+			return "gz";
+		case XDEBUG_COMPRESSION_ZSTD:
+			return "zst";
+	}
+	return NULL;
+}
+
+static int xdebug_compression_from_name(const char *name)
+{
+	const char *dot;
+
+	if (!name || !(dot = strrchr(name, '.'))) {
+		return XDEBUG_COMPRESSION_NONE;
+	}
+	if (strcmp(dot + 1, "gz") == 0) {
+		return XDEBUG_COMPRESSION_GZIP;
+	}
+	if (strcmp(dot + 1, "zst") == 0) {
+		return XDEBUG_COMPRESSION_ZSTD;
+	}
+	return XDEBUG_COMPRESSION_NONE;
+}
+
+static int xdebug_compression_from_setting(const char *setting)
+{
+	if (!setting) {
+		return XDEBUG_COMPRESSION_NONE;
+	}
+	if (strcasecmp(setting, "gzip") == 0 || strcasecmp(setting, "gz") == 0 || strcasecmp(setting, "zlib") == 0) {
+		return XDEBUG_COMPRESSION_GZIP;
+	}
+	if (strcasecmp(setting, "zstd") == 0 || strcasecmp(setting, "zst") == 0) {
+		return XDEBUG_COMPRESSION_ZSTD;
+	}
+	return XDEBUG_COMPRESSION_NONE;
+}
+
+int xdebug_compression_supported(int type)
+{
+#ifdef XDEBUG_HAVE_COMPRESSION
+	switch (type) {
+# ifdef HAVE_XDEBUG_ZLIB
+		case XDEBUG_COMPRESSION_GZIP:
+			return 1;
+# endif
+# ifdef HAVE_XDEBUG_ZSTD
+		case XDEBUG_COMPRESSION_ZSTD:
+			return 1;
+# endif
+	}
+#endif
+	return 0;
+}
+
+#ifdef XDEBUG_HAVE_COMPRESSION
+typedef struct _xdebug_compressed_file {
+	int            type;
+	FILE          *raw;
+	char          *out;
+	size_t         out_size;
+# ifdef HAVE_XDEBUG_ZLIB
+	z_stream       zs;
+# endif
+# ifdef HAVE_XDEBUG_ZSTD
+	ZSTD_CStream  *zcs;
+# endif
+} xdebug_compressed_file;
+
+static int xdebug_compressed_file_put(xdebug_compressed_file *cf, size_t len)
+{
+	return len == 0 || fwrite(cf->out, 1, len, cf->raw) == len;
+}
+
+/* Feeds "size" bytes to the compressor, and writes out whatever compressed
+ * data it hands back. With "finish" set, the stream is completed as well. */
+static int xdebug_compressed_file_compress(xdebug_compressed_file *cf, const char *buf, size_t size, int finish)
+{
+	switch (cf->type) {
+# ifdef HAVE_XDEBUG_ZLIB
+		case XDEBUG_COMPRESSION_GZIP: {
+			int r;
+
+			cf->zs.next_in = (Bytef*) buf;
+			cf->zs.avail_in = size;
+			do {
+				cf->zs.next_out = (Bytef*) cf->out;
+				cf->zs.avail_out = cf->out_size;
+				r = deflate(&cf->zs, finish ? Z_FINISH : Z_NO_FLUSH);
+				if (r == Z_STREAM_ERROR) {
+					return 0;
+				}
+				if (!xdebug_compressed_file_put(cf, cf->out_size - cf->zs.avail_out)) {
+					return 0;
+				}
+			} while (finish ? r != Z_STREAM_END : cf->zs.avail_out == 0);
+			return 1;
+		}
+# endif
+
+# ifdef HAVE_XDEBUG_ZSTD
+		case XDEBUG_COMPRESSION_ZSTD: {
+			ZSTD_inBuffer  in;
+			ZSTD_outBuffer out;
+			size_t         r;
+
+			in.src = buf;
+			in.size = size;
+			in.pos = 0;
+			while (in.pos < in.size) {
+				out.dst = cf->out;
+				out.size = cf->out_size;
+				out.pos = 0;
+				r = ZSTD_compressStream(cf->zcs, &out, &in);
+				if (ZSTD_isError(r) || !xdebug_compressed_file_put(cf, out.pos)) {
+					return 0;
+				}
+			}
+			if (finish) {
+				do {
+					out.dst = cf->out;
+					out.size = cf->out_size;
+					out.pos = 0;
+					r = ZSTD_endStream(cf->zcs, &out);
+					if (ZSTD_isError(r) || !xdebug_compressed_file_put(cf, out.pos)) {
+						return 0;
+					}
+				} while (r != 0);
+			}
+			return 1;
+		}
+# endif
+	}
+	return 0;
+}
+
+static void xdebug_compressed_file_free(xdebug_compressed_file *cf)
+{
+	switch (cf->type) {
+# ifdef HAVE_XDEBUG_ZLIB
+		case XDEBUG_COMPRESSION_GZIP:
+			deflateEnd(&cf->zs);
+			break;
+# endif
+# ifdef HAVE_XDEBUG_ZSTD
+		case XDEBUG_COMPRESSION_ZSTD:
+			ZSTD_freeCStream(cf->zcs);
+			break;
+# endif
+	}
+	xdfree(cf->out);
+	xdfree(cf);
+}
+
+static xdebug_compressed_file *xdebug_compressed_file_alloc(FILE *raw, int type)
+{
+	xdebug_compressed_file *cf = xdcalloc(1, sizeof(xdebug_compressed_file));
+
+	cf->type = type;
+	cf->raw = raw;
+
+	switch (type) {
+# ifdef HAVE_XDEBUG_ZLIB
+		case XDEBUG_COMPRESSION_GZIP:
+			/* 15 + 16: the largest window, with a gzip header */
+			if (deflateInit2(&cf->zs, XDEBUG_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+				xdfree(cf);
+				return NULL;
+			}
+			cf->out_size = XDEBUG_COMPRESS_BUFFER_SIZE;
+			break;
+# endif
+# ifdef HAVE_XDEBUG_ZSTD
+		case XDEBUG_COMPRESSION_ZSTD:
+			cf->zcs = ZSTD_createCStream();
+			if (!cf->zcs || ZSTD_isError(ZSTD_initCStream(cf->zcs, XDEBUG_ZSTD_LEVEL))) {
+				if (cf->zcs) {
+					ZSTD_freeCStream(cf->zcs);
+				}
+				xdfree(cf);
+				return NULL;
+			}
+			cf->out_size = ZSTD_CStreamOutSize();
+			break;
+# endif
+		default:
+			xdfree(cf);
+			return NULL;
+	}
+
+	cf->out = xdmalloc(cf->out_size);
+	return cf;
+}
+
+/* stdio hooks. The FILE's own buffer batches up the many small writes of the
+ * trace writers, and an fflush() hands them to the compressor without forcing
+ * a (ratio destroying) flush of the compressed stream itself. */
+# ifdef HAVE_FOPENCOOKIE
+static ssize_t xdebug_compressed_file_write(void *cookie, const char *buf, size_t size)
+# else
+static int xdebug_compressed_file_write(void *cookie, const char *buf, int size)
+# endif
+{
+	if (!xdebug_compressed_file_compress((xdebug_compressed_file*) cookie, buf, size, 0)) {
+		return -1;
+	}
+	return size;
+}
+
+static int xdebug_compressed_file_close(void *cookie)
+{
+	xdebug_compressed_file *cf = (xdebug_compressed_file*) cookie;
+	int                     ok;
+
+	ok = xdebug_compressed_file_compress(cf, NULL, 0, 1);
+	ok = (fclose(cf->raw) == 0) && ok;
+	xdebug_compressed_file_free(cf);
+
+	return ok ? 0 : EOF;
+}
+
+static FILE *xdebug_compressed_file_open(FILE *raw, int type)
+{
+	xdebug_compressed_file *cf;
+	FILE                   *fh;
+# ifdef HAVE_FOPENCOOKIE
+	cookie_io_functions_t   funcs = { NULL, xdebug_compressed_file_write, NULL, xdebug_compressed_file_close };
+# endif
+
+	cf = xdebug_compressed_file_alloc(raw, type);
+	if (!cf) {
+		return NULL;
+	}
+
+# ifdef HAVE_FOPENCOOKIE
+	fh = fopencookie(cf, "w", funcs);
+# else
+	fh = funopen(cf, NULL, xdebug_compressed_file_write, NULL, xdebug_compressed_file_close);
+# endif
+	if (!fh) {
+		xdebug_compressed_file_free(cf);
+		return NULL;
+	}
+
+	return fh;
+}
+#endif
+
+FILE *xdebug_fopen_output(char *fname, const char *mode, const char *extension, char **new_fname)
+{
+	FILE *fh;
+	int   type;
+	char *tmp_extension = NULL;
+	TSRMLS_FETCH();
+
+	/* A compression suffix that is already part of the name wins, otherwise
+	 * the setting picks one, and adds its suffix to the file name. Nothing
+	 * goes after a compression suffix in the file name, so the "xt" that
+	 * traces ask for is dropped from "trace.gz" rather than giving
+	 * "trace.gz.xt". */
+	type = xdebug_compression_from_name(extension);
+	if (type == XDEBUG_COMPRESSION_NONE) {
+		type = xdebug_compression_from_name(fname);
+		if (type != XDEBUG_COMPRESSION_NONE) {
+			extension = NULL;
+		}
+	}
+	/* Writing plain text under a compressed name only yields a file that
+	 * no tool can read */
+	if (type != XDEBUG_COMPRESSION_NONE && !xdebug_compression_supported(type)) {
+		php_error(E_WARNING, "Xdebug can not write '%s': it was built without support for '.%s' files", fname, xdebug_compression_suffix(type));
+		return NULL;
+	}
+	if (type == XDEBUG_COMPRESSION_NONE) {
+		type = xdebug_compression_from_setting(XG(output_compression));
+
+		if (type != XDEBUG_COMPRESSION_NONE && xdebug_compression_supported(type)) {
+			if (extension) {
+				tmp_extension = xdebug_sprintf("%s.%s", extension, xdebug_compression_suffix(type));
+			} else {
+				tmp_extension = xdstrdup(xdebug_compression_suffix(type));
+			}
+			extension = tmp_extension;
+		}
+	}
+
+	fh = xdebug_fopen(fname, mode, extension, new_fname);
+	if (tmp_extension) {
+		xdfree(tmp_extension);
+	}
+
+	if (!fh || !xdebug_compression_supported(type)) {
+		return fh;
+	}
+
+#ifdef XDEBUG_HAVE_COMPRESSION
+	{
+		/* Appending works as well, as both formats allow for a file to
+		 * consist of several concatenated streams */
+		FILE *cfh = xdebug_compressed_file_open(fh, type);
+
+		if (cfh) {
+			return cfh;
+		}
+
+		fclose(fh);
+		if (new_fname && *new_fname) {
+			xdfree(*new_fname);
+			*new_fname = NULL;
+		}
+	}
+#endif
+
+	return NULL;
+}
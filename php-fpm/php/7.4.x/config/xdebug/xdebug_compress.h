@@ -0,0 +1,37 @@
+/*
+   +----------------------------------------------------------------------+
+   | Xdebug                                                               |
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2002-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 1.01 of the Xdebug license,   |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available at through the world-wide-web at                           |
+   | https://xdebug.org/license.php                                       |
+   | If you did not receive a copy of the Xdebug license and are unable   |
+   | to obtain it through the world-wide-web, please send a note to       |
+   | derick@xdebug.org so we can mail you a copy immediately.             |
+   +----------------------------------------------------------------------+
+   | Authors: Derick Rethans <derick@xdebug.org>                          |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef __XDEBUG_COMPRESS_H__
+#define __XDEBUG_COMPRESS_H__
+
+#include <stdio.h>
+
+#define XDEBUG_COMPRESSION_NONE 0
+#define XDEBUG_COMPRESSION_GZIP 1
+#define XDEBUG_COMPRESSION_ZSTD 2
+
+/* Opens an output file (trace, profile, or GC stats file) just like
+ * xdebug_fopen() does. If the file name ends in ".gz" or ".zst", or when
+ * xdebug.output_compression asks for it, the returned handle compresses
+ * everything that is written to it, and the compressed stream is only
+ * completed when the handle is closed with fclose(). */
+FILE *xdebug_fopen_output(char *fname, const char *mode, const char *extension, char **new_fname);
+
+int xdebug_compression_supported(int type);
+
+#endif
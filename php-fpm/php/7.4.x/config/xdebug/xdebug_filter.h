@@ -25,7 +25,8 @@ int xdebug_filter_is_valid(void);
 int xdebug_is_stack_frame_filtered(int filter_type, function_stack_entry *fse);
 int xdebug_is_top_stack_frame_filtered(int filter_type);
 void xdebug_filter_register_constants(INIT_FUNC_ARGS);
-void xdebug_filter_run_tracing(function_stack_entry *fse);
+void xdebug_filter_run_tracing(function_stack_entry *fse, zend_op_array *location_op_array, zend_function *func);
+void xdebug_filter_tracing_invalidate_cache(void);
 void xdebug_filter_run_code_coverage(zend_op_array *op_array);
 
 #define XDEBUG_FILTER_NONE           0x000
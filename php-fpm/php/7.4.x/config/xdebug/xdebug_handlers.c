@@ -45,6 +45,17 @@ xdebug_remote_handler_info* xdebug_handlers_get(void)
 	return handlers;
 }
 
+void xdebug_brk_info_condition_dtor(xdebug_brk_info *brk_info)
+{
+	/* After a bailout, the memory manager cleans up after us */
+	if (brk_info->condition_op_array && !CG(unclean_shutdown)) {
+		destroy_op_array(brk_info->condition_op_array);
+		efree(brk_info->condition_op_array);
+	}
+	brk_info->condition_op_array = NULL;
+	brk_info->condition_compiled = 0;
+}
+
 void xdebug_brk_info_dtor(xdebug_brk_info *brk_info)
 {
 	if (brk_info->classname) {
@@ -59,6 +70,9 @@ void xdebug_brk_info_dtor(xdebug_brk_info *brk_info)
 	if (brk_info->condition) {
 		xdfree(brk_info->condition);
 	}
+	/* The compiled condition is request memory, which is gone by the time
+	 * the remote context is torn down: it is freed in RSHUTDOWN, or by
+	 * breakpoint_remove, through xdebug_brk_info_condition_dtor() */
 	xdfree(brk_info);
 }
 
@@ -21,6 +21,7 @@
 #include "php_globals.h"
 #include "php_xdebug.h"
 #include "Zend/zend_alloc.h"
+#include "xdebug_compress.h"
 #include "xdebug_mm.h"
 #include "xdebug_profiler.h"
 #include "xdebug_str.h"
@@ -91,9 +92,9 @@ void xdebug_profiler_init(char *script_name)
 	xdfree(fname);
 
 	if (XG(profiler_append)) {
-		XG(profile_file) = xdebug_fopen(filename, "a", NULL, &XG(profile_filename));
+		XG(profile_file) = xdebug_fopen_output(filename, "a", NULL, &XG(profile_filename));
 	} else {
-		XG(profile_file) = xdebug_fopen(filename, "w", NULL, &XG(profile_filename));
+		XG(profile_file) = xdebug_fopen_output(filename, "w", NULL, &XG(profile_filename));
 	}
 	xdfree(filename);
 
@@ -434,7 +435,7 @@ int xdebug_profiler_output_aggr_data(const char *prefix TSRMLS_DC)
 	}
 
 	fprintf(stderr, "opening %s\n", filename);
-	aggr_file = xdebug_fopen(filename, "w", NULL, NULL);
+	aggr_file = xdebug_fopen_output(filename, "w", NULL, NULL);
 	if (!aggr_file) {
 		return FAILURE;
 	}
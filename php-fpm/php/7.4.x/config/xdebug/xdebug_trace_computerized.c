@@ -89,33 +89,6 @@ char *xdebug_trace_computerized_get_filename(void *ctxt TSRMLS_DC)
 	return context->trace_filename;
 }
 
-static void add_single_value(xdebug_str *str, zval *zv, int collection_level TSRMLS_DC)
-{
-	xdebug_str *tmp_value = NULL;
-
-	switch (collection_level) {
-		case 1: /* synopsis */
-		case 2:
-			tmp_value = xdebug_get_zval_synopsis(zv, 0, NULL);
-			break;
-		case 3: /* full */
-		case 4: /* full (with var) */
-		default:
-			tmp_value = xdebug_get_zval_value(zv, 0, NULL);
-			break;
-		case 5: /* serialized */
-			tmp_value = xdebug_get_zval_value_serialized(zv, 0, NULL);
-			break;
-	}
-	if (tmp_value) {
-		xdebug_str_add_str(str, tmp_value);
-		xdebug_str_free(tmp_value);
-	} else {
-		xdebug_str_add(str, "???", 0);
-	}
-}
-
-
 void xdebug_trace_computerized_function_entry(void *ctxt, function_stack_entry *fse, int function_nr TSRMLS_DC)
 {
 	xdebug_trace_computerized_context *context = (xdebug_trace_computerized_context*) ctxt;
@@ -174,7 +147,7 @@ void xdebug_trace_computerized_function_entry(void *ctxt, function_stack_entry *
 			}
 
 			if (!Z_ISUNDEF(fse->var[j].data)) {
-				add_single_value(&str, &(fse->var[j].data), XG(collect_params));
+				xdebug_trace_add_value(&str, &(fse->var[j].data), XG(collect_params) TSRMLS_CC);
 			} else {
 				xdebug_str_add(&str, "???", 0);
 			}
@@ -184,8 +157,7 @@ void xdebug_trace_computerized_function_entry(void *ctxt, function_stack_entry *
 	/* Trailing \n */
 	xdebug_str_add(&str, "\n", 0);
 
-	fprintf(context->trace_file, "%s", str.d);
-	fflush(context->trace_file);
+	xdebug_trace_write_record(context->trace_file, &str TSRMLS_CC);
 	xdfree(str.d);
 }
 
@@ -201,8 +173,7 @@ void xdebug_trace_computerized_function_exit(void *ctxt, function_stack_entry *f
 	xdebug_str_add(&str, xdebug_sprintf("%F\t", xdebug_get_utime() - XG(start_time)), 1);
 	xdebug_str_add(&str, xdebug_sprintf("%lu\n", zend_memory_usage(0 TSRMLS_CC)), 1);
 
-	fprintf(context->trace_file, "%s", str.d);
-	fflush(context->trace_file);
+	xdebug_trace_write_record(context->trace_file, &str TSRMLS_CC);
 	xdfree(str.d);
 }
 
@@ -215,12 +186,11 @@ void xdebug_trace_computerized_function_return_value(void *ctxt, function_stack_
 	xdebug_str_add(&str, xdebug_sprintf("%d\t", function_nr), 1);
 	xdebug_str_add(&str, "R\t\t\t", 0);
 
-	add_single_value(&str, return_value, XG(collect_params));
+	xdebug_trace_add_value(&str, return_value, XG(collect_params) TSRMLS_CC);
 
 	xdebug_str_addl(&str, "\n", 2, 0);
 
-	fprintf(context->trace_file, "%s", str.d);
-	fflush(context->trace_file);
+	xdebug_trace_write_record(context->trace_file, &str TSRMLS_CC);
 	xdfree(str.d);
 }
 
@@ -0,0 +1,52 @@
+/*
+   +----------------------------------------------------------------------+
+   | Xdebug                                                               |
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2002-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 1.01 of the Xdebug license,   |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available at through the world-wide-web at                           |
+   | https://xdebug.org/license.php                                       |
+   | If you did not receive a copy of the Xdebug license and are unable   |
+   | to obtain it through the world-wide-web, please send a note to       |
+   | derick@xdebug.org so we can mail you a copy immediately.             |
+   +----------------------------------------------------------------------+
+   | Authors: Derick Rethans <derick@xdebug.org>                          |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef __XDEBUG_TRIE_H__
+#define __XDEBUG_TRIE_H__
+
+#include <stddef.h>
+
+/* A case-insensitive (ASCII) prefix trie. Keys are folded to lower case when
+ * they are added, and lookups fold the subject as they walk it, so that
+ * finding which keys are a prefix of a string is a single pass over that
+ * string, no matter how many keys there are. */
+
+typedef struct _xdebug_trie_node xdebug_trie_node;
+
+struct _xdebug_trie_node {
+	int                terminal;    /* a key ends at this node */
+	unsigned int       child_count;
+	unsigned char     *child_chars; /* sorted, folded */
+	xdebug_trie_node **children;
+};
+
+typedef struct _xdebug_trie {
+	xdebug_trie_node *root;
+	size_t            size;
+} xdebug_trie;
+
+#define XDEBUG_TRIE_NO_MATCH -1
+
+xdebug_trie *xdebug_trie_alloc(void);
+void xdebug_trie_add(xdebug_trie *trie, const char *key);
+long xdebug_trie_longest_prefix(xdebug_trie *trie, const char *subject);
+void xdebug_trie_destroy(xdebug_trie *trie);
+
+#define xdebug_trie_has_prefix_of(t, s) (xdebug_trie_longest_prefix((t), (s)) != XDEBUG_TRIE_NO_MATCH)
+
+#endif
@@ -2094,13 +2094,133 @@ void xdebug_attach_static_vars(xdebug_xml_node *node, xdebug_var_export_options
 	xdebug_xml_add_child(node, static_container);
 }
 
+/* The merged property table of the object that was last exported at the top
+ * level is kept, so that fetching more pages of the same object does not
+ * collect all of its properties again. The table points into the object's
+ * own property table, so it is only used while that has not been changed.
+ * The debugger drops it for every command that can run PHP code. */
+typedef struct _xdebug_object_page_cache {
+	zend_object *object;
+	uint32_t     handle;
+	HashTable   *properties;
+	Bucket      *properties_data;
+	uint32_t     properties_used;
+	uint32_t     properties_count;
+	HashTable   *merged;
+} xdebug_object_page_cache;
+
+void xdebug_var_object_page_cache_clear(TSRMLS_D)
+{
+	xdebug_object_page_cache *cache = XG(object_page_cache);
+
+	if (!cache) {
+		return;
+	}
+
+	zend_hash_destroy(cache->merged);
+	FREE_HASHTABLE(cache->merged);
+	xdfree(cache);
+	XG(object_page_cache) = NULL;
+}
+
+static HashTable *xdebug_var_object_page_cache_find(zend_object *object, HashTable **properties TSRMLS_DC)
+{
+	xdebug_object_page_cache *cache = XG(object_page_cache);
+
+	if (!cache || cache->object != object || cache->handle != object->handle) {
+		return NULL;
+	}
+
+	if (cache->properties && (
+		cache->properties_data != cache->properties->arData ||
+		cache->properties_used != cache->properties->nNumUsed ||
+		cache->properties_count != cache->properties->nNumOfElements
+	)) {
+		xdebug_var_object_page_cache_clear(TSRMLS_C);
+		return NULL;
+	}
+
+	*properties = cache->properties;
+	return cache->merged;
+}
+
+static void xdebug_var_object_page_cache_store(zend_object *object, HashTable *properties, HashTable *merged TSRMLS_DC)
+{
+	xdebug_object_page_cache *cache;
+
+	xdebug_var_object_page_cache_clear(TSRMLS_C);
+
+	cache = xdmalloc(sizeof(xdebug_object_page_cache));
+	cache->object = object;
+	cache->handle = object->handle;
+	cache->properties = properties;
+	cache->properties_data = properties ? properties->arData : NULL;
+	cache->properties_used = properties ? properties->nNumUsed : 0;
+	cache->properties_count = properties ? properties->nNumOfElements : 0;
+	cache->merged = merged;
+
+	XG(object_page_cache) = cache;
+}
+
+/* Without holes in the bucket array, the Nth element lives in the Nth bucket,
+ * and the requested page can be found without walking all elements before
+ * it. The symbol table is excluded, as its IS_INDIRECT slots can be empty. */
+static int xdebug_var_can_seek(HashTable *ht TSRMLS_DC)
+{
+	return ht->nNumUsed == ht->nNumOfElements && ht != &EG(symbol_table);
+}
+
+static void xdebug_array_export_xml_page(HashTable *myht, int level, xdebug_xml_node *node, xdebug_str *name, xdebug_var_export_options *options TSRMLS_DC)
+{
+	zend_ulong   num;
+	zend_string *key;
+	zval        *z_val;
+	uint32_t     idx;
+
+	if (options->runtime[level].start_element_nr >= 0 && xdebug_var_can_seek(myht TSRMLS_CC)) {
+		for (idx = options->runtime[level].start_element_nr; idx < myht->nNumUsed && (int) idx < options->runtime[level].end_element_nr; idx++) {
+			Bucket *p = myht->arData + idx;
+
+			options->runtime[level].current_element_nr = idx;
+			xdebug_array_element_export_xml_node(&p->val, p->h, p->key, level, node, name, options);
+		}
+		return;
+	}
+
+	ZEND_HASH_FOREACH_KEY_VAL_IND(myht, num, key, z_val) {
+		if (options->runtime[level].current_element_nr >= options->runtime[level].end_element_nr) {
+			break;
+		}
+		xdebug_array_element_export_xml_node(z_val, num, key, level, node, name, options);
+	} ZEND_HASH_FOREACH_END();
+}
+
+static void xdebug_object_export_xml_page(HashTable *merged_hash, int level, xdebug_xml_node *node, xdebug_str *name, xdebug_var_export_options *options, char *class_name TSRMLS_DC)
+{
+	xdebug_object_item *xoi_val;
+	uint32_t            idx;
+
+	if (options->runtime[level].start_element_nr >= 0 && xdebug_var_can_seek(merged_hash TSRMLS_CC)) {
+		for (idx = options->runtime[level].start_element_nr; idx < merged_hash->nNumUsed && (int) idx < options->runtime[level].end_element_nr; idx++) {
+			options->runtime[level].current_element_nr = idx;
+			xdebug_object_element_export_xml_node(Z_PTR(merged_hash->arData[idx].val), level, node, name, options, class_name);
+		}
+		return;
+	}
+
+	ZEND_HASH_FOREACH_PTR(merged_hash, xoi_val) {
+		if (options->runtime[level].current_element_nr >= options->runtime[level].end_element_nr) {
+			break;
+		}
+		xdebug_object_element_export_xml_node(xoi_val, level, node, name, options, class_name);
+	} ZEND_HASH_FOREACH_END();
+}
+
 void xdebug_var_export_xml_node(zval **struc, xdebug_str *name, xdebug_xml_node *node, xdebug_var_export_options *options, int level)
 {
 	HashTable *myht;
 	zend_ulong num;
 	zend_string *key;
-	zval *z_val;
-	xdebug_object_item *xoi_val;
 	zval *tmpz;
 
 	if (Z_TYPE_P(*struc) == IS_INDIRECT) {
@@ -2163,11 +2283,7 @@ void xdebug_var_export_xml_node(zval **struc, xdebug_str *name, xdebug_xml_node
 					}
 
 					xdebug_zend_hash_apply_protection_begin(myht);
-
-					ZEND_HASH_FOREACH_KEY_VAL_IND(myht, num, key, z_val) {
-						xdebug_array_element_export_xml_node(z_val, num, key, level, node, name, options);
-					} ZEND_HASH_FOREACH_END();
-
+					xdebug_array_export_xml_page(myht, level, node, name, options TSRMLS_CC);
 					xdebug_zend_hash_apply_protection_end(myht);
 				}
 			} else {
@@ -2180,41 +2296,48 @@ void xdebug_var_export_xml_node(zval **struc, xdebug_str *name, xdebug_xml_node
 			xdebug_str         *class_name;
 			zend_class_entry   *ce;
 			int                 is_temp;
+			int                 from_cache = 0;
 			zend_property_info *zpi_val;
 
-			ALLOC_HASHTABLE(merged_hash);
-			zend_hash_init(merged_hash, 128, NULL, NULL, 0);
-
 			class_name = xdebug_str_create(STR_NAME_VAL(Z_OBJCE_P(*struc)->name), STR_NAME_LEN(Z_OBJCE_P(*struc)->name));
 			ce = xdebug_fetch_class(class_name->d, class_name->l, ZEND_FETCH_CLASS_DEFAULT TSRMLS_CC);
 
-			/* Adding static properties */
-			xdebug_zend_hash_apply_protection_begin(&ce->properties_info);
+			merged_hash = level == 0 ? xdebug_var_object_page_cache_find(Z_OBJ_P(*struc), &myht TSRMLS_CC) : NULL;
+			if (merged_hash) {
+				is_temp = 0;
+				from_cache = 1;
+			} else {
+				ALLOC_HASHTABLE(merged_hash);
+				zend_hash_init(merged_hash, 128, NULL, NULL, 0);
+
+				/* Adding static properties */
+				xdebug_zend_hash_apply_protection_begin(&ce->properties_info);
 
 #if PHP_VERSION_ID >= 70400
-			if (ce->type == ZEND_INTERNAL_CLASS || (ce->ce_flags & ZEND_ACC_IMMUTABLE)) {
-				zend_class_init_statics(ce);
-			}
+				if (ce->type == ZEND_INTERNAL_CLASS || (ce->ce_flags & ZEND_ACC_IMMUTABLE)) {
+					zend_class_init_statics(ce);
+				}
 #endif
 
-			ZEND_HASH_FOREACH_PTR(&ce->properties_info, zpi_val) {
-				object_item_add_zend_prop_to_merged_hash(zpi_val, merged_hash, (int) XDEBUG_OBJECT_ITEM_TYPE_STATIC_PROPERTY, ce);
-			} ZEND_HASH_FOREACH_END();
+				ZEND_HASH_FOREACH_PTR(&ce->properties_info, zpi_val) {
+					object_item_add_zend_prop_to_merged_hash(zpi_val, merged_hash, (int) XDEBUG_OBJECT_ITEM_TYPE_STATIC_PROPERTY, ce);
+				} ZEND_HASH_FOREACH_END();
 
-			xdebug_zend_hash_apply_protection_end(&ce->properties_info);
+				xdebug_zend_hash_apply_protection_end(&ce->properties_info);
 
-			/* Adding normal properties */
-			myht = xdebug_objdebug_pp(struc, &is_temp TSRMLS_CC);
-			if (myht) {
-				zval *tmp_val;
+				/* Adding normal properties */
+				myht = xdebug_objdebug_pp(struc, &is_temp TSRMLS_CC);
+				if (myht) {
+					zval *tmp_val;
 
-				xdebug_zend_hash_apply_protection_begin(myht);
+					xdebug_zend_hash_apply_protection_begin(myht);
 
-				ZEND_HASH_FOREACH_KEY_VAL_IND(myht, num, key, tmp_val) {
-					object_item_add_to_merged_hash(tmp_val, num, key, merged_hash, (int) XDEBUG_OBJECT_ITEM_TYPE_PROPERTY);
-				} ZEND_HASH_FOREACH_END();
+					ZEND_HASH_FOREACH_KEY_VAL_IND(myht, num, key, tmp_val) {
+						object_item_add_to_merged_hash(tmp_val, num, key, merged_hash, (int) XDEBUG_OBJECT_ITEM_TYPE_PROPERTY);
+					} ZEND_HASH_FOREACH_END();
 
-				xdebug_zend_hash_apply_protection_end(myht);
+					xdebug_zend_hash_apply_protection_end(myht);
+				}
 			}
 
 			xdebug_xml_add_attribute(node, "type", "object");
@@ -2237,17 +2360,21 @@ void xdebug_var_export_xml_node(zval **struc, xdebug_str *name, xdebug_xml_node
 					}
 
 					xdebug_zend_hash_apply_protection_begin(merged_hash);
-
-					ZEND_HASH_FOREACH_KEY_PTR(merged_hash, num, key, xoi_val) {
-						xdebug_object_element_export_xml_node(xoi_val, level, node, name, options, class_name->d);
-					} ZEND_HASH_FOREACH_END();
-
+					xdebug_object_export_xml_page(merged_hash, level, node, name, options, class_name->d TSRMLS_CC);
 					xdebug_zend_hash_apply_protection_end(merged_hash);
 				}
 			}
 
-			zend_hash_destroy(merged_hash);
-			FREE_HASHTABLE(merged_hash);
+			/* Temporary property tables are gone after this, so only the
+			 * merged tables of objects' own properties can be kept */
+			if (level == 0 && !is_temp) {
+				if (!from_cache) {
+					xdebug_var_object_page_cache_store(Z_OBJ_P(*struc), myht, merged_hash TSRMLS_CC);
+				}
+			} else {
+				zend_hash_destroy(merged_hash);
+				FREE_HASHTABLE(merged_hash);
+			}
 			xdebug_str_free(class_name);
 
 			maybe_destroy_ht(myht, is_temp);
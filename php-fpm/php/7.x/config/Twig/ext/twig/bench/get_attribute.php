@@ -0,0 +1,78 @@
+<?php
+
+/*
+ * Renders a loop-heavy template with the call site cache of the C extension
+ * turned on and off, and reports how long each took:
+ *
+ *   php -d extension=twig.so bench/get_attribute.php [products] [renders]
+ */
+
+require_once __DIR__.'/../../../lib/Twig/Autoloader.php';
+Twig_Autoloader::register();
+
+if (!function_exists('twig_template_get_attributes')) {
+    fwrite(STDERR, "The Twig C extension is not loaded.\n");
+    exit(1);
+}
+
+class BenchProduct
+{
+    public $name;
+    private $price;
+    private $available;
+
+    public function __construct($name, $price, $available)
+    {
+        $this->name = $name;
+        $this->price = $price;
+        $this->available = $available;
+    }
+
+    public function getPrice()
+    {
+        return $this->price;
+    }
+
+    public function isAvailable()
+    {
+        return $this->available;
+    }
+}
+
+class BenchDiscountedProduct extends BenchProduct
+{
+    public function getPrice()
+    {
+        return parent::getPrice() * 0.9;
+    }
+}
+
+$count = isset($argv[1]) ? (int) $argv[1] : 1000;
+$renders = isset($argv[2]) ? (int) $argv[2] : 200;
+
+$products = array();
+for ($i = 0; $i < $count; ++$i) {
+    $products[] = $i % 2
+        ? new BenchProduct('product '.$i, $i, true)
+        : new BenchDiscountedProduct('product '.$i, $i, $i % 3 == 0);
+}
+
+$twig = new Twig_Environment(new Twig_Loader_Array(array(
+    'list' => '{% for product in products %}{{ product.name }} {{ product.price }} {{ product.available ? "yes" : "no" }} {{ meta.currency }}
+{% endfor %}',
+)), array('autoescape' => false, 'cache' => false));
+$template = $twig->loadTemplate('list');
+$context = array('products' => $products, 'meta' => array('currency' => 'EUR'));
+
+foreach (array('0' => 'without call site cache', '1' => 'with call site cache') as $setting => $label) {
+    ini_set('twig.call_site_cache', $setting);
+
+    $template->render($context);
+    $start = microtime(true);
+    for ($i = 0; $i < $renders; ++$i) {
+        $template->render($context);
+    }
+    $elapsed = microtime(true) - $start;
+
+    printf("%-24s %8.2f ms/render %10.0f attributes/s\n", $label, $elapsed * 1000 / $renders, $renders * $count * 4 / $elapsed);
+}
@@ -0,0 +1,77 @@
+<?php
+
+/*
+ * Renders one scenario of bench/scenarios.php and prints its timings,
+ * serialized as json may not be loaded under "php -n". It is run by
+ * bench/run.php, with and without the C extension:
+ *
+ *   php bench/render.php scenario [renders]
+ */
+
+require_once __DIR__.'/../../../lib/Twig/Autoloader.php';
+Twig_Autoloader::register();
+
+$scenarios = require __DIR__.'/scenarios.php';
+
+if (!isset($argv[1], $scenarios[$argv[1]])) {
+    fwrite(STDERR, sprintf("Usage: php render.php %s [renders]\n", implode('|', array_keys($scenarios))));
+    exit(1);
+}
+
+function bench_clock()
+{
+    return function_exists('hrtime') ? hrtime(true) : (int) (microtime(true) * 1e9);
+}
+
+function bench_percentile(array $sorted, $percentile)
+{
+    return $sorted[max(0, (int) ceil($percentile / 100 * count($sorted)) - 1)];
+}
+
+$scenario = $scenarios[$argv[1]];
+$renders = isset($argv[2]) ? max(1, (int) $argv[2]) : 50;
+
+$twig = new Twig_Environment(new Twig_Loader_Array($scenario['templates']), array('cache' => false));
+$template = $twig->loadTemplate('index');
+$context = call_user_func($scenario['context']);
+
+// compiles the included templates and warms up the caches of the extension
+$output = $template->render($context);
+
+if (function_exists('memory_reset_peak_usage')) {
+    memory_reset_peak_usage();
+}
+$memory = memory_get_usage();
+$peak = memory_get_peak_usage();
+
+$times = array();
+$start = bench_clock();
+for ($i = 0; $i < $renders; ++$i) {
+    $renderStart = bench_clock();
+    $template->render($context);
+    $times[] = bench_clock() - $renderStart;
+}
+$total = bench_clock() - $start;
+
+// without memory_reset_peak_usage(), the peak is only known when the renders went past the one of the compilation
+$peakMemory = memory_get_peak_usage() > $peak || function_exists('memory_reset_peak_usage') ? memory_get_peak_usage() - $memory : null;
+$retainedMemory = memory_get_usage() - $memory;
+
+sort($times);
+
+echo serialize(array(
+    'scenario' => $argv[1],
+    'extension' => function_exists('twig_template_get_attributes'),
+    'php' => PHP_VERSION,
+    'renders' => $renders,
+    'throughput' => $renders / ($total / 1e9),
+    'mean_ms' => array_sum($times) / $renders / 1e6,
+    'p50_ms' => bench_percentile($times, 50) / 1e6,
+    'p99_ms' => bench_percentile($times, 99) / 1e6,
+    'min_ms' => $times[0] / 1e6,
+    'max_ms' => $times[$renders - 1] / 1e6,
+    'peak_memory' => $peakMemory,
+    'retained_memory' => $retainedMemory,
+    'output_bytes' => strlen($output),
+    'output_md5' => md5($output),
+));
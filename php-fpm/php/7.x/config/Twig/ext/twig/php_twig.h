@@ -29,7 +29,53 @@ zend_module_entry *get_module(void);
 #include "TSRM.h"
 #endif
 
+/* A declared property of the class that was looked up last */
+typedef struct _twig_property_cache {
+	zend_class_entry   *ce;
+	zend_property_info *info;
+} twig_property_cache;
+
+ZEND_BEGIN_MODULE_GLOBALS(twig)
+	zend_bool            persistent_class_cache;
+	zend_bool            call_site_cache;
+	HashTable           *class_cache;
+	HashTable           *call_sites;
+	HashTable           *profiler_buffers;       /* twig_profiler_buffer by Twig_Extension_Profiler handle */
+	twig_property_cache  env_property;           /* Twig_Template::$env */
+	twig_property_cache  extensions_property;    /* Twig_Environment::$extensions */
+	zend_bool            stock_extension_lookup; /* whether that class keeps Twig_Environment::hasExtension() and getExtension() */
+	twig_property_cache  charset_property;       /* Twig_Environment::$charset */
+	zend_bool            stock_charset_lookup;   /* whether that class keeps Twig_Environment::getCharset() */
+	zend_class_entry    *sandbox_ce;
+	zend_function       *check_property_allowed; /* of sandbox_ce */
+	zend_function       *check_method_allowed;   /* of sandbox_ce */
+ZEND_END_MODULE_GLOBALS(twig)
+
+ZEND_EXTERN_MODULE_GLOBALS(twig)
+
+#define TWIG_G(v) ZEND_MODULE_GLOBALS_ACCESSOR(twig, v)
+
+#if defined(ZTS) && defined(COMPILE_DL_TWIG)
+ZEND_TSRMLS_CACHE_EXTERN()
+#endif
+
 PHP_FUNCTION(twig_template_get_attributes);
+PHP_FUNCTION(twig_escape_filter);
+PHP_FUNCTION(twig_lexer_tokenize);
+PHP_FUNCTION(twig_ensure_traversable);
+PHP_FUNCTION(twig_length_filter);
+PHP_FUNCTION(twig_in_filter);
+PHP_FUNCTION(twig_slice);
+PHP_FUNCTION(twig_first);
+PHP_FUNCTION(twig_last);
+PHP_FUNCTION(twig_join_filter);
+PHP_FUNCTION(twig_profiler_enter);
+PHP_FUNCTION(twig_profiler_leave);
+PHP_FUNCTION(twig_profiler_flush);
+PHP_FUNCTION(twig_profiler_close);
+PHP_MINIT_FUNCTION(twig);
+PHP_MSHUTDOWN_FUNCTION(twig);
 PHP_RSHUTDOWN_FUNCTION(twig);
+PHP_MINFO_FUNCTION(twig);
 
 #endif
@@ -17,32 +17,79 @@
 #endif
 
 #include "php.h"
+#include "php_ini.h"
 #include "php_twig.h"
+#include "ext/standard/info.h"
 #include "ext/standard/php_var.h"
 #include "ext/standard/php_string.h"
-#include "ext/standard/php_smart_str.h"
+#include "ext/standard/html.h"
+#include "ext/standard/url.h"
 #include "ext/spl/spl_exceptions.h"
+#include "ext/spl/spl_iterators.h"
 
 #include "Zend/zend_object_handlers.h"
 #include "Zend/zend_interfaces.h"
 #include "Zend/zend_exceptions.h"
+#include "Zend/zend_smart_str.h"
 
-#ifndef Z_ADDREF_P
-#define Z_ADDREF_P(pz)                (pz)->refcount++
+#ifdef PHP_WIN32
+# include "win32/time.h"
+#else
+# include <sys/time.h>
 #endif
+#include <time.h>
 
-#define FREE_DTOR(z) 	\
-	zval_dtor(z); 		\
-	efree(z);
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define TWIG_HAVE_SSE2 1
+#endif
 
-#if PHP_VERSION_ID >= 50300
-	#define APPLY_TSRMLS_DC TSRMLS_DC
-	#define APPLY_TSRMLS_CC TSRMLS_CC
-	#define APPLY_TSRMLS_FETCH()
-#else
-	#define APPLY_TSRMLS_DC
-	#define APPLY_TSRMLS_CC
-	#define APPLY_TSRMLS_FETCH() TSRMLS_FETCH()
+/* Method names are looked up lowercased, with room in front for a "get" or
+ * "is" prefix, in a buffer of this size on the stack. Longer names fall back
+ * to the heap. */
+#define TWIG_METHOD_NAME_BUFFER 128
+
+/* Hash key for a class entry or opline. Both are at least 8 byte aligned,
+ * so the bits shifted out are always zero and would only make the hash
+ * buckets collide. */
+#define TWIG_POINTER_KEY(p) ((zend_ulong) ((zend_uintptr_t) (p) >> 3))
+
+/* What an item resolved to for a class. Only what is the same for every
+ * object of the class is stored; dynamic properties and __isset() are
+ * still checked on each access. */
+typedef struct _twig_resolution {
+	zend_property_info *info; /* the declared property, if any */
+	zend_function      *fbc;  /* the public method, getter or isser, if any */
+} twig_resolution;
+
+/* Each place in a template that accesses an attribute remembers the
+ * resolutions for the first few classes it sees; when it sees more classes
+ * or other items, it falls back to the per class cache. */
+#define TWIG_CALL_SITE_ENTRIES     4
+#define TWIG_CALL_SITE_MEGAMORPHIC ((uint32_t) -1)
+
+/* The resolved items of one class. The name tells apart a class that took
+ * the place of a discarded one in a persistent cache. */
+typedef struct _twig_class_cache {
+	zend_string *name;
+	HashTable    items;
+} twig_class_cache;
+
+typedef struct _twig_call_site {
+	zend_string      *item;
+	uint32_t          count;
+	zend_class_entry *ce[TWIG_CALL_SITE_ENTRIES];
+	twig_resolution  *res[TWIG_CALL_SITE_ENTRIES];
+} twig_call_site;
+
+ZEND_DECLARE_MODULE_GLOBALS(twig)
+
+static void twig_init_escape_tables(void);
+
+#ifndef ZTS
+/* Resolutions of internal classes, and of classes that opcache made
+ * immutable, kept from one request to the next */
+static HashTable *twig_persistent_class_cache = NULL;
 #endif
 
 ZEND_BEGIN_ARG_INFO_EX(twig_template_get_attribute_args, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 6)
@@ -54,666 +101,1108 @@ ZEND_BEGIN_ARG_INFO_EX(twig_template_get_attribute_args, ZEND_SEND_BY_VAL, ZEND_
 	ZEND_ARG_INFO(0, isDefinedTest)
 ZEND_END_ARG_INFO()
 
-#ifndef PHP_FE_END
-#define PHP_FE_END { NULL, NULL, NULL}
-#endif
+ZEND_BEGIN_ARG_INFO_EX(twig_escape_filter_args, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 2)
+	ZEND_ARG_INFO(0, env)
+	ZEND_ARG_INFO(0, string)
+	ZEND_ARG_INFO(0, strategy)
+	ZEND_ARG_INFO(0, charset)
+	ZEND_ARG_INFO(0, autoescape)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(twig_lexer_tokenize_args, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 4)
+	ZEND_ARG_INFO(0, code)
+	ZEND_ARG_INFO(0, filename)
+	ZEND_ARG_INFO(0, options)
+	ZEND_ARG_INFO(0, operators)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(twig_ensure_traversable_args, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_INFO(0, seq)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(twig_length_filter_args, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 2)
+	ZEND_ARG_INFO(0, env)
+	ZEND_ARG_INFO(0, thing)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(twig_in_filter_args, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 2)
+	ZEND_ARG_INFO(0, value)
+	ZEND_ARG_INFO(0, compare)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(twig_slice_args, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 3)
+	ZEND_ARG_INFO(0, env)
+	ZEND_ARG_INFO(0, item)
+	ZEND_ARG_INFO(0, start)
+	ZEND_ARG_INFO(0, length)
+	ZEND_ARG_INFO(0, preserveKeys)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(twig_first_args, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 2)
+	ZEND_ARG_INFO(0, env)
+	ZEND_ARG_INFO(0, item)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(twig_join_filter_args, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_INFO(0, value)
+	ZEND_ARG_INFO(0, glue)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(twig_profiler_enter_args, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 4)
+	ZEND_ARG_INFO(0, extension)
+	ZEND_ARG_INFO(0, template)
+	ZEND_ARG_INFO(0, type)
+	ZEND_ARG_INFO(0, name)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(twig_profiler_extension_args, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_INFO(0, extension)
+ZEND_END_ARG_INFO()
 
 static const zend_function_entry twig_functions[] = {
 	PHP_FE(twig_template_get_attributes, twig_template_get_attribute_args)
+	PHP_FE(twig_escape_filter, twig_escape_filter_args)
+	PHP_FE(twig_lexer_tokenize, twig_lexer_tokenize_args)
+	PHP_FE(twig_ensure_traversable, twig_ensure_traversable_args)
+	PHP_FE(twig_length_filter, twig_length_filter_args)
+	PHP_FE(twig_in_filter, twig_in_filter_args)
+	PHP_FE(twig_slice, twig_slice_args)
+	PHP_FE(twig_first, twig_first_args)
+	PHP_FE(twig_last, twig_first_args)
+	PHP_FE(twig_join_filter, twig_join_filter_args)
+	PHP_FE(twig_profiler_enter, twig_profiler_enter_args)
+	PHP_FE(twig_profiler_leave, twig_profiler_extension_args)
+	PHP_FE(twig_profiler_flush, twig_profiler_extension_args)
+	PHP_FE(twig_profiler_close, twig_profiler_extension_args)
 	PHP_FE_END
 };
 
+PHP_INI_BEGIN()
+	STD_PHP_INI_BOOLEAN("twig.persistent_class_cache", "0", PHP_INI_SYSTEM, OnUpdateBool, persistent_class_cache, zend_twig_globals, twig_globals)
+	STD_PHP_INI_BOOLEAN("twig.call_site_cache", "1", PHP_INI_ALL, OnUpdateBool, call_site_cache, zend_twig_globals, twig_globals)
+PHP_INI_END()
+
+static PHP_GINIT_FUNCTION(twig)
+{
+#if defined(ZTS) && defined(COMPILE_DL_TWIG)
+	ZEND_TSRMLS_CACHE_UPDATE();
+#endif
+	memset(twig_globals, 0, sizeof(zend_twig_globals));
+	twig_globals->call_site_cache = 1;
+}
+
+PHP_MINIT_FUNCTION(twig)
+{
+	REGISTER_INI_ENTRIES();
+	twig_init_escape_tables();
+	return SUCCESS;
+}
+
+PHP_MSHUTDOWN_FUNCTION(twig)
+{
+#ifndef ZTS
+	if (twig_persistent_class_cache) {
+		zend_hash_destroy(twig_persistent_class_cache);
+		pefree(twig_persistent_class_cache, 1);
+		twig_persistent_class_cache = NULL;
+	}
+#endif
+	UNREGISTER_INI_ENTRIES();
+	return SUCCESS;
+}
+
 PHP_RSHUTDOWN_FUNCTION(twig)
 {
+	if (TWIG_G(call_sites)) {
+		zend_hash_destroy(TWIG_G(call_sites));
+		FREE_HASHTABLE(TWIG_G(call_sites));
+		TWIG_G(call_sites) = NULL;
+	}
+	if (TWIG_G(class_cache)) {
+		zend_hash_destroy(TWIG_G(class_cache));
+		FREE_HASHTABLE(TWIG_G(class_cache));
+		TWIG_G(class_cache) = NULL;
+	}
+	if (TWIG_G(profiler_buffers)) {
+		zend_hash_destroy(TWIG_G(profiler_buffers));
+		FREE_HASHTABLE(TWIG_G(profiler_buffers));
+		TWIG_G(profiler_buffers) = NULL;
+	}
+	/* The classes these point into may be gone by the next request */
+	TWIG_G(env_property).ce = NULL;
+	TWIG_G(extensions_property).ce = NULL;
+	TWIG_G(charset_property).ce = NULL;
+	TWIG_G(sandbox_ce) = NULL;
 #if ZEND_DEBUG
 	CG(unclean_shutdown) = 0; /* get rid of PHPUnit's exit() and report memleaks */
 #endif
 	return SUCCESS;
 }
 
+PHP_MINFO_FUNCTION(twig)
+{
+	php_info_print_table_start();
+	php_info_print_table_header(2, "Twig support", "enabled");
+	php_info_print_table_row(2, "Version", PHP_TWIG_VERSION);
+	php_info_print_table_end();
+
+	DISPLAY_INI_ENTRIES();
+}
+
 zend_module_entry twig_module_entry = {
 	STANDARD_MODULE_HEADER,
 	"twig",
 	twig_functions,
-	NULL,
-	NULL,
+	PHP_MINIT(twig),
+	PHP_MSHUTDOWN(twig),
 	NULL,
 	PHP_RSHUTDOWN(twig),
-	NULL,
+	PHP_MINFO(twig),
 	PHP_TWIG_VERSION,
-	STANDARD_MODULE_PROPERTIES
+	PHP_MODULE_GLOBALS(twig),
+	PHP_GINIT(twig),
+	NULL,
+	NULL,
+	STANDARD_MODULE_PROPERTIES_EX
 };
 
 
 #ifdef COMPILE_DL_TWIG
+#ifdef ZTS
+ZEND_TSRMLS_CACHE_DEFINE()
+#endif
 ZEND_GET_MODULE(twig)
 #endif
 
-static int TWIG_ARRAY_KEY_EXISTS(zval *array, zval *key)
+/* Copies the result of a read handler into 'dst'. Handlers either return a
+ * pointer to a zval they own, or 'rv' which then belongs to the caller. */
+static void TWIG_COPY_RESULT(zval *dst, zval *result, zval *rv)
 {
-	if (Z_TYPE_P(array) != IS_ARRAY) {
-		return 0;
+	zval *value = result;
+
+	ZVAL_DEREF(value);
+	ZVAL_COPY(dst, value);
+	if (result == rv) {
+		zval_ptr_dtor(rv);
+	}
+}
+
+/* The type names that gettype() uses, which the error messages of
+ * Twig_Template::getAttribute() show */
+static const char *TWIG_GETTYPE(zval *value)
+{
+	switch (Z_TYPE_P(value)) {
+		case IS_NULL:     return "NULL";
+		case IS_FALSE:
+		case IS_TRUE:     return "boolean";
+		case IS_LONG:     return "integer";
+		case IS_DOUBLE:   return "double";
+		case IS_STRING:   return "string";
+		case IS_ARRAY:    return "array";
+		case IS_OBJECT:   return "object";
+		case IS_RESOURCE: return "resource";
+	}
+	return "unknown type";
+}
+
+/* The key that "$object[$item]" uses: booleans and floats are cast to
+ * integers, and everything else is used as is. The result is not refcounted
+ * separately from 'item'. */
+static void TWIG_ARRAY_ITEM(zval *array_item, zval *item)
+{
+	switch (Z_TYPE_P(item)) {
+		case IS_FALSE:
+			ZVAL_LONG(array_item, 0);
+			break;
+
+		case IS_TRUE:
+			ZVAL_LONG(array_item, 1);
+			break;
+
+		case IS_DOUBLE:
+			ZVAL_LONG(array_item, zend_dval_to_lval(Z_DVAL_P(item)));
+			break;
+
+		default:
+			ZVAL_COPY_VALUE(array_item, item);
+			break;
 	}
+}
+
+/* array_key_exists() and the element fetch in one hash lookup */
+static zval *TWIG_FIND_ARRAY_ELEMENT(HashTable *ht, zval *key)
+{
+	zval *tmp = NULL;
 
 	switch (Z_TYPE_P(key)) {
 		case IS_NULL:
-			return zend_hash_exists(Z_ARRVAL_P(array), "", 1);
+			tmp = zend_hash_str_find(ht, "", 0);
+			break;
 
-		case IS_BOOL:
-		case IS_DOUBLE:
-			convert_to_long(key);
 		case IS_LONG:
-			return zend_hash_index_exists(Z_ARRVAL_P(array), Z_LVAL_P(key));
+			tmp = zend_hash_index_find(ht, Z_LVAL_P(key));
+			break;
+
+		case IS_STRING:
+			tmp = zend_symtable_find(ht, Z_STR_P(key));
+			break;
+
+		case IS_RESOURCE:
+			tmp = zend_hash_index_find(ht, Z_RES_HANDLE_P(key));
+			break;
 
 		default:
-			convert_to_string(key);
-			return zend_symtable_exists(Z_ARRVAL_P(array), Z_STRVAL_P(key), Z_STRLEN_P(key) + 1);
+			return NULL;
+	}
+
+	if (tmp && Z_TYPE_P(tmp) == IS_INDIRECT) {
+		tmp = Z_INDIRECT_P(tmp);
+		if (Z_TYPE_P(tmp) == IS_UNDEF) {
+			return NULL;
+		}
 	}
+	return tmp;
 }
 
-static int TWIG_INSTANCE_OF(zval *object, zend_class_entry *interface TSRMLS_DC)
+static int TWIG_INSTANCE_OF(zval *object, zend_class_entry *interface)
 {
 	if (Z_TYPE_P(object) != IS_OBJECT) {
 		return 0;
 	}
-	return instanceof_function(Z_OBJCE_P(object), interface TSRMLS_CC);
+	return instanceof_function(Z_OBJCE_P(object), interface);
 }
 
-static int TWIG_INSTANCE_OF_USERLAND(zval *object, char *interface TSRMLS_DC)
+/* Checks against a userland class or interface without autoloading it; an
+ * object can't be an instance of a class that hasn't been loaded. The name
+ * has to be given in lowercase. */
+static int TWIG_INSTANCE_OF_USERLAND(zval *object, const char *lc_name, size_t lc_name_len)
 {
-	zend_class_entry **pce;
+	zend_class_entry *ce;
+
 	if (Z_TYPE_P(object) != IS_OBJECT) {
 		return 0;
 	}
-	if (zend_lookup_class(interface, strlen(interface), &pce TSRMLS_CC) == FAILURE) {
+	ce = zend_hash_str_find_ptr(EG(class_table), lc_name, lc_name_len);
+	if (!ce) {
 		return 0;
 	}
-	return instanceof_function(Z_OBJCE_P(object), *pce TSRMLS_CC);
+	return instanceof_function(Z_OBJCE_P(object), ce);
 }
 
-static zval *TWIG_GET_ARRAYOBJECT_ELEMENT(zval *object, zval *offset TSRMLS_DC)
+static zend_class_entry *TWIG_LOOKUP_CLASS(const char *name, size_t name_len)
 {
-	zend_class_entry *ce = Z_OBJCE_P(object);
-	zval *retval;
-
-	if (Z_TYPE_P(object) == IS_OBJECT) {
-		SEPARATE_ARG_IF_REF(offset);
-		zend_call_method_with_1_params(&object, ce, NULL, "offsetget", &retval, offset);
+	zend_string      *class_name = zend_string_init(name, name_len, 0);
+	zend_class_entry *ce = zend_lookup_class(class_name);
 
-		zval_ptr_dtor(&offset);
+	zend_string_release(class_name);
+	return ce;
+}
 
-		if (!retval) {
-			if (!EG(exception)) {
-				zend_error(E_ERROR, "Undefined offset for object of type %s used as array", ce->name);
-			}
-			return NULL;
-		}
+/* Returns the declared instance property 'name' of 'ce', remembering it in
+ * 'cache' for as long as the same class keeps being asked about */
+static zend_property_info *TWIG_FIND_PROPERTY_INFO(twig_property_cache *cache, zend_class_entry *ce, const char *name, size_t name_len)
+{
+	zend_property_info *info;
 
-		return retval;
+	if (cache->ce != ce) {
+		info = zend_hash_str_find_ptr(&ce->properties_info, name, name_len);
+		cache->ce = ce;
+		cache->info = info && !(info->flags & ZEND_ACC_STATIC) ? info : NULL;
 	}
-	return NULL;
+	return cache->info;
 }
 
-static int TWIG_ISSET_ARRAYOBJECT_ELEMENT(zval *object, zval *offset TSRMLS_DC)
+/* Returns the template's Twig_Environment. The protected property is read
+ * straight from its slot, which avoids both the name allocation and the
+ * visibility check of zend_read_property(). */
+static zval *TWIG_GET_ENV(zval *template, zval *rv)
 {
-	zend_class_entry *ce = Z_OBJCE_P(object);
-	zval *retval;
+	zend_class_entry   *ce = Z_OBJCE_P(template);
+	zend_property_info *info = TWIG_FIND_PROPERTY_INFO(&TWIG_G(env_property), ce, "env", sizeof("env") - 1);
+	zval               *env;
 
-	if (Z_TYPE_P(object) == IS_OBJECT) {
-		SEPARATE_ARG_IF_REF(offset);
-		zend_call_method_with_1_params(&object, ce, NULL, "offsetexists", &retval, offset);
+	if (info) {
+		env = OBJ_PROP(Z_OBJ_P(template), info->offset);
+	} else {
+		env = zend_read_property(ce, template, "env", sizeof("env") - 1, 1, rv);
+	}
+	ZVAL_DEREF(env);
 
-		zval_ptr_dtor(&offset);
+	return Z_TYPE_P(env) == IS_OBJECT ? env : NULL;
+}
 
-		if (!retval) {
-			if (!EG(exception)) {
-				zend_error(E_ERROR, "Undefined offset for object of type %s used as array", ce->name);
-			}
-			return 0;
-		}
+static int TWIG_IS_STRICT_VARIABLES(zval *template)
+{
+	zval  rv, retval;
+	zval *env = TWIG_GET_ENV(template, &rv);
+	int   strict;
 
-		return (retval && Z_TYPE_P(retval) == IS_BOOL && Z_LVAL_P(retval));
+	if (!env) {
+		return 0;
 	}
-	return 0;
+	ZVAL_UNDEF(&retval);
+	zend_call_method_with_0_params(env, Z_OBJCE_P(env), NULL, "isstrictvariables", &retval);
+	strict = zend_is_true(&retval);
+	zval_ptr_dtor(&retval);
+
+	return strict;
 }
 
-static char *TWIG_STRTOLOWER(const char *str, int str_len)
+/* Whether 'ce' inherits the method 'lc_name' from Twig_Environment as is */
+static int TWIG_IS_STOCK_ENV_METHOD(zend_class_entry *ce, const char *lc_name, size_t lc_name_len)
 {
-	char *item_dup;
+	zend_function *fbc = zend_hash_str_find_ptr(&ce->function_table, lc_name, lc_name_len);
 
-	item_dup = estrndup(str, str_len);
-	php_strtolower(item_dup, str_len);
-	return item_dup;
+	return fbc && fbc->common.scope && zend_string_equals_literal_ci(fbc->common.scope->name, "Twig_Environment");
 }
 
-static zval *TWIG_CALL_USER_FUNC_ARRAY(zval *object, char *function, zval *arguments TSRMLS_DC)
+/* $this->env->hasExtension('sandbox') ? $this->env->getExtension('sandbox') : null
+ *
+ * Unless the environment class overrides either method, this is what
+ * isset($this->env->extensions['sandbox']) says, which is looked up in the
+ * array rather than asked from userland on every attribute access. Returns
+ * whether there is a sandbox, which 'sandbox' then holds a reference to. */
+static int TWIG_GET_SANDBOX(zval *template, zval *sandbox)
 {
-	zend_fcall_info fci;
-	zval ***args = NULL;
-	int arg_count = 0;
-	HashTable *table;
-	HashPosition pos;
-	int i = 0;
-	zval *retval_ptr;
-	zval *zfunction;
+	zval                rv, name, retval;
+	zval               *env = TWIG_GET_ENV(template, &rv), *extensions, *extension;
+	zend_class_entry   *ce;
+	zend_property_info *info;
+	int                 has_sandbox;
 
-	if (arguments) {
-		table = HASH_OF(arguments);
-		args = safe_emalloc(sizeof(zval **), table->nNumOfElements, 0);
+	if (!env) {
+		return 0;
+	}
 
-		zend_hash_internal_pointer_reset_ex(table, &pos);
+	ce = Z_OBJCE_P(env);
+	if (TWIG_G(extensions_property).ce != ce) {
+		TWIG_G(stock_extension_lookup) =
+			TWIG_IS_STOCK_ENV_METHOD(ce, "hasextension", sizeof("hasextension") - 1) &&
+			TWIG_IS_STOCK_ENV_METHOD(ce, "getextension", sizeof("getextension") - 1);
+	}
+	info = TWIG_FIND_PROPERTY_INFO(&TWIG_G(extensions_property), ce, "extensions", sizeof("extensions") - 1);
 
-		while (zend_hash_get_current_data_ex(table, (void **)&args[i], &pos) == SUCCESS) {
-			i++;
-			zend_hash_move_forward_ex(table, &pos);
+	if (info && TWIG_G(stock_extension_lookup)) {
+		extensions = OBJ_PROP(Z_OBJ_P(env), info->offset);
+		ZVAL_DEREF(extensions);
+		if (Z_TYPE_P(extensions) != IS_ARRAY) {
+			return 0;
+		}
+		extension = zend_hash_str_find(Z_ARRVAL_P(extensions), "sandbox", sizeof("sandbox") - 1);
+		if (!extension) {
+			return 0;
 		}
-		arg_count = table->nNumOfElements;
+		ZVAL_DEREF(extension);
+		if (Z_TYPE_P(extension) != IS_OBJECT) {
+			return 0;
+		}
+		ZVAL_COPY(sandbox, extension);
+		return 1;
 	}
 
-	MAKE_STD_ZVAL(zfunction);
-	ZVAL_STRING(zfunction, function, 1);
-	fci.size = sizeof(fci);
-	fci.function_table = EG(function_table);
-	fci.function_name = zfunction;
-	fci.symbol_table = NULL;
-#if PHP_VERSION_ID >= 50300
-	fci.object_ptr = object;
-#else
-	fci.object_pp = &object;
-#endif
-	fci.retval_ptr_ptr = &retval_ptr;
-	fci.param_count = arg_count;
-	fci.params = args;
-	fci.no_separation = 0;
+	ZVAL_STRINGL(&name, "sandbox", sizeof("sandbox") - 1);
+	ZVAL_UNDEF(&retval);
+	zend_call_method_with_1_params(env, ce, NULL, "hasextension", &retval, &name);
+	has_sandbox = zend_is_true(&retval);
+	zval_ptr_dtor(&retval);
 
-	if (zend_call_function(&fci, NULL TSRMLS_CC) == FAILURE) {
-		ALLOC_INIT_ZVAL(retval_ptr);
-		ZVAL_BOOL(retval_ptr, 0);
+	ZVAL_UNDEF(sandbox);
+	if (has_sandbox && !EG(exception)) {
+		zend_call_method_with_1_params(env, ce, NULL, "getextension", sandbox, &name);
 	}
+	zval_ptr_dtor(&name);
 
-	if (args) {
-		efree(fci.params);
+	if (Z_TYPE_P(sandbox) != IS_OBJECT) {
+		zval_ptr_dtor(sandbox);
+		return 0;
 	}
-	FREE_DTOR(zfunction);
-	return retval_ptr;
+	return 1;
 }
 
-static int TWIG_CALL_BOOLEAN(zval *object, char *functionName TSRMLS_DC)
+/* $this->env->hasExtension('sandbox') && $this->env->getExtension('sandbox')->{method}($object, $arg)
+ *
+ * 'fn_proxy' remembers the method for the sandbox class it was last
+ * looked up for. */
+static void TWIG_SANDBOX_CHECK(zval *template, const char *method, size_t method_len, zend_function **fn_proxy, zval *object, zval *arg)
 {
-	zval *ret;
-	int   res;
-
-	ret = TWIG_CALL_USER_FUNC_ARRAY(object, functionName, NULL TSRMLS_CC);
-	res = Z_LVAL_P(ret);
-	zval_ptr_dtor(&ret);
-	return res;
-}
+	zval sandbox, retval;
 
-static zval *TWIG_GET_STATIC_PROPERTY(zval *class, char *prop_name TSRMLS_DC)
-{
-	zval **tmp_zval;
-	zend_class_entry *ce;
+	if (!TWIG_GET_SANDBOX(template, &sandbox)) {
+		return;
+	}
 
-	if (class == NULL || Z_TYPE_P(class) != IS_OBJECT) {
-		return NULL;
+	if (TWIG_G(sandbox_ce) != Z_OBJCE(sandbox)) {
+		TWIG_G(sandbox_ce) = Z_OBJCE(sandbox);
+		TWIG_G(check_property_allowed) = NULL;
+		TWIG_G(check_method_allowed) = NULL;
 	}
 
-	ce = zend_get_class_entry(class TSRMLS_CC);
-#if PHP_VERSION_ID >= 50400
-	tmp_zval = zend_std_get_static_property(ce, prop_name, strlen(prop_name), 0, NULL TSRMLS_CC);
-#else
-	tmp_zval = zend_std_get_static_property(ce, prop_name, strlen(prop_name), 0 TSRMLS_CC);
-#endif
-	return *tmp_zval;
+	ZVAL_UNDEF(&retval);
+	zend_call_method(&sandbox, Z_OBJCE(sandbox), fn_proxy, method, method_len, &retval, 2, object, arg);
+	zval_ptr_dtor(&retval);
+	zval_ptr_dtor(&sandbox);
 }
 
-static zval *TWIG_GET_ARRAY_ELEMENT_ZVAL(zval *class, zval *prop_name TSRMLS_DC)
+static void TWIG_IMPLODE_ARRAY_KEYS(smart_str *collector, const char *joiner, HashTable *ht)
 {
-	zval **tmp_zval;
+	zend_string *str_key;
+	zend_ulong   num_key;
+	int          first = 1;
 
-	if (class == NULL || Z_TYPE_P(class) != IS_ARRAY) {
-		if (class != NULL && Z_TYPE_P(class) == IS_OBJECT && TWIG_INSTANCE_OF(class, zend_ce_arrayaccess TSRMLS_CC)) {
-			// array access object
-			return TWIG_GET_ARRAYOBJECT_ELEMENT(class, prop_name TSRMLS_CC);
+	ZEND_HASH_FOREACH_KEY(ht, num_key, str_key) {
+		if (!first) {
+			smart_str_appends(collector, joiner);
 		}
-		return NULL;
-	}
+		first = 0;
 
-	switch(Z_TYPE_P(prop_name)) {
-		case IS_NULL:
-			zend_hash_find(HASH_OF(class), "", 1, (void**) &tmp_zval);
-			return *tmp_zval;
+		if (str_key) {
+			smart_str_append(collector, str_key);
+		} else {
+			smart_str_append_long(collector, (zend_long) num_key);
+		}
+	} ZEND_HASH_FOREACH_END();
+	smart_str_0(collector);
+}
 
-		case IS_BOOL:
-		case IS_DOUBLE:
-			convert_to_long(prop_name);
-		case IS_LONG:
-			zend_hash_index_find(HASH_OF(class), Z_LVAL_P(prop_name), (void **) &tmp_zval);
-			return *tmp_zval;
+static void TWIG_RUNTIME_ERROR(zval *template, char *message, ...)
+{
+	char             *buffer;
+	va_list           args;
+	zend_class_entry *ce;
+	zval              ex;
+	zval              constructor;
+	zval              constructor_args[3];
+	zval              retval;
 
-		case IS_STRING:
-			zend_symtable_find(HASH_OF(class), Z_STRVAL_P(prop_name), Z_STRLEN_P(prop_name) + 1, (void**) &tmp_zval);
-			return *tmp_zval;
+	ce = TWIG_LOOKUP_CLASS("Twig_Error_Runtime", sizeof("Twig_Error_Runtime") - 1);
+	if (!ce) {
+		return;
 	}
 
-	return NULL;
-}
+	va_start(args, message);
+	vspprintf(&buffer, 0, message, args);
+	va_end(args);
 
-static zval *TWIG_GET_ARRAY_ELEMENT(zval *class, char *prop_name, int prop_name_length TSRMLS_DC)
-{
-	zval **tmp_zval;
+	object_init_ex(&ex, ce);
 
-	if (class == NULL/* || Z_TYPE_P(class) != IS_ARRAY*/) {
-		return NULL;
+	// Call Twig_Error constructor
+	ZVAL_STRING(&constructor_args[0], buffer);
+	ZVAL_LONG(&constructor_args[1], -1);
+
+	// Get template filename
+	ZVAL_UNDEF(&constructor_args[2]);
+	zend_call_method_with_0_params(template, Z_OBJCE_P(template), NULL, "gettemplatename", &constructor_args[2]);
+	if (Z_ISUNDEF(constructor_args[2])) {
+		ZVAL_NULL(&constructor_args[2]);
 	}
 
-	if (class != NULL && Z_TYPE_P(class) == IS_OBJECT && TWIG_INSTANCE_OF(class, zend_ce_arrayaccess TSRMLS_CC)) {
-		// array access object
-		zval *tmp_name_zval;
-		zval *tmp_ret_zval;
+	ZVAL_STRINGL(&constructor, "__construct", sizeof("__construct") - 1);
+	ZVAL_UNDEF(&retval);
+	call_user_function(EG(function_table), &ex, &constructor, &retval, 3, constructor_args);
+	zval_ptr_dtor(&retval);
+	zval_ptr_dtor(&constructor);
 
-		ALLOC_INIT_ZVAL(tmp_name_zval);
-		ZVAL_STRING(tmp_name_zval, prop_name, 1);
-		tmp_ret_zval = TWIG_GET_ARRAYOBJECT_ELEMENT(class, tmp_name_zval TSRMLS_CC);
-		FREE_DTOR(tmp_name_zval);
-		return tmp_ret_zval;
-	}
+	zval_ptr_dtor(&constructor_args[0]);
+	zval_ptr_dtor(&constructor_args[2]);
+	efree(buffer);
+
+	zend_throw_exception_object(&ex);
+}
 
-	if (zend_symtable_find(HASH_OF(class), prop_name, prop_name_length+1, (void**)&tmp_zval) == SUCCESS) {
-		return *tmp_zval;
+static const char *TWIG_GET_CLASS_NAME(zval *object)
+{
+	if (Z_TYPE_P(object) != IS_OBJECT) {
+		return "";
 	}
-	return NULL;
+	return ZSTR_VAL(Z_OBJCE_P(object)->name);
 }
 
-static zval *TWIG_PROPERTY(zval *object, zval *propname TSRMLS_DC)
+/* Reports that the item doesn't exist as an array key, like
+ * Twig_Template::getAttribute() does for strict templates */
+static void TWIG_ARRAY_KEY_ERROR(zval *template, zval *object, zval *item, zval *array_item, int array_call)
 {
-	zval *tmp = NULL;
+	zend_string *item_str = zval_get_string(item);
+	zend_string *array_item_str = zval_get_string(array_item);
+
+	if (TWIG_INSTANCE_OF(object, zend_ce_arrayaccess)) {
+		TWIG_RUNTIME_ERROR(template, "Key \"%s\" in object with ArrayAccess of class \"%s\" does not exist", ZSTR_VAL(array_item_str), TWIG_GET_CLASS_NAME(object));
+	} else if (Z_TYPE_P(object) == IS_OBJECT) {
+		TWIG_RUNTIME_ERROR(template, "Impossible to access a key \"%s\" on an object of class \"%s\" that does not implement ArrayAccess interface", ZSTR_VAL(item_str), TWIG_GET_CLASS_NAME(object));
+	} else if (Z_TYPE_P(object) == IS_ARRAY) {
+		if (0 == zend_hash_num_elements(Z_ARRVAL_P(object))) {
+			TWIG_RUNTIME_ERROR(template, "Key \"%s\" does not exist as the array is empty", ZSTR_VAL(array_item_str));
+		} else {
+			smart_str array_keys = {0};
 
-	if (Z_OBJ_HT_P(object)->read_property) {
-#if PHP_VERSION_ID >= 50400
-		tmp = Z_OBJ_HT_P(object)->read_property(object, propname, BP_VAR_IS, NULL TSRMLS_CC);
-#else
-		tmp = Z_OBJ_HT_P(object)->read_property(object, propname, BP_VAR_IS TSRMLS_CC);
-#endif
-		if (tmp == EG(uninitialized_zval_ptr)) {
-		        ZVAL_NULL(tmp);
+			TWIG_IMPLODE_ARRAY_KEYS(&array_keys, ", ", Z_ARRVAL_P(object));
+			TWIG_RUNTIME_ERROR(template, "Key \"%s\" for array with keys \"%s\" does not exist", ZSTR_VAL(array_item_str), ZSTR_VAL(array_keys.s));
+			smart_str_free(&array_keys);
 		}
+	} else if (Z_TYPE_P(object) == IS_NULL) {
+		TWIG_RUNTIME_ERROR(template,
+			array_call
+				? "Impossible to access a key (\"%s\") on a null variable"
+				: "Impossible to access an attribute (\"%s\") on a null variable",
+			ZSTR_VAL(item_str));
+	} else {
+		zend_string *object_str = zval_get_string(object);
+
+		TWIG_RUNTIME_ERROR(template,
+			array_call
+				? "Impossible to access a key (\"%s\") on a %s variable (\"%s\")"
+				: "Impossible to access an attribute (\"%s\") on a %s variable (\"%s\")",
+			ZSTR_VAL(item_str), TWIG_GETTYPE(object), ZSTR_VAL(object_str));
+		zend_string_release(object_str);
 	}
-	return tmp;
+
+	zend_string_release(array_item_str);
+	zend_string_release(item_str);
 }
 
-static int TWIG_HAS_PROPERTY(zval *object, zval *propname TSRMLS_DC)
+/* isset($object->$item) || array_key_exists((string) $item, $object) */
+static int TWIG_HAS_PROPERTY(zval *object, zval *member)
 {
-	if (Z_OBJ_HT_P(object)->has_property) {
-#if PHP_VERSION_ID >= 50400
-		return Z_OBJ_HT_P(object)->has_property(object, propname, 0, NULL TSRMLS_CC);
-#else
-		return Z_OBJ_HT_P(object)->has_property(object, propname, 0 TSRMLS_CC);
-#endif
+	zend_object        *zobj = Z_OBJ_P(object);
+	zend_property_info *info;
+	HashTable          *properties;
+
+	if (Z_OBJ_HT_P(object)->has_property && Z_OBJ_HT_P(object)->has_property(object, member, 0, NULL)) {
+		return 1;
 	}
-	return 0;
+	if (EG(exception)) {
+		return 0;
+	}
+
+	/* Declared public properties that are null */
+	info = zend_hash_find_ptr(&zobj->ce->properties_info, Z_STR_P(member));
+	if (info && (info->flags & ZEND_ACC_PUBLIC) && !(info->flags & ZEND_ACC_STATIC)) {
+		return 1;
+	}
+
+	/* Dynamic properties. Standard objects only have them once their
+	 * property table exists, so the table isn't built just to find out. */
+	if (Z_OBJ_HT_P(object)->get_properties == zend_std_get_properties) {
+		properties = zobj->properties;
+	} else {
+		properties = Z_OBJ_HT_P(object)->get_properties ? Z_OBJ_HT_P(object)->get_properties(object) : NULL;
+	}
+	return properties && zend_symtable_exists(properties, Z_STR_P(member));
 }
 
-static int TWIG_HAS_DYNAMIC_PROPERTY(zval *object, char *prop, int prop_len TSRMLS_DC)
+/* Finds the public method that "item" resolves to: the method itself, its
+ * getter or its isser, in that order. Returns NULL if there is none. */
+static zend_function *TWIG_FIND_METHOD(zend_class_entry *ce, zend_string *item)
 {
-	if (Z_OBJ_HT_P(object)->get_properties) {
-		return zend_hash_quick_exists(
-				Z_OBJ_HT_P(object)->get_properties(object TSRMLS_CC), // the properties hash
-				prop,                                                 // property name
-				prop_len + 1,                                         // property length
-				zend_get_hash_value(prop, prop_len + 1)               // hash value
-			);
+	char           stack_buffer[TWIG_METHOD_NAME_BUFFER];
+	char          *buffer = stack_buffer;
+	char          *lc_item;
+	size_t         len = ZSTR_LEN(item);
+	zend_function *fbc;
+
+	if (len + 4 > sizeof(stack_buffer)) {
+		buffer = emalloc(len + 4);
 	}
-	return 0;
+	lc_item = buffer + 3;
+	zend_str_tolower_copy(lc_item, ZSTR_VAL(item), len);
+
+	fbc = zend_hash_str_find_ptr(&ce->function_table, lc_item, len);
+	if (!fbc || !(fbc->common.fn_flags & ZEND_ACC_PUBLIC)) {
+		memcpy(buffer, "get", 3);
+		fbc = zend_hash_str_find_ptr(&ce->function_table, buffer, len + 3);
+	}
+	if (!fbc || !(fbc->common.fn_flags & ZEND_ACC_PUBLIC)) {
+		memcpy(buffer + 1, "is", 2);
+		fbc = zend_hash_str_find_ptr(&ce->function_table, buffer + 1, len + 2);
+	}
+	if (fbc && !(fbc->common.fn_flags & ZEND_ACC_PUBLIC)) {
+		fbc = NULL;
+	}
+
+	if (buffer != stack_buffer) {
+		efree(buffer);
+	}
+	return fbc;
 }
 
-static zval *TWIG_PROPERTY_CHAR(zval *object, char *propname TSRMLS_DC)
+static void twig_resolution_dtor(zval *zv)
 {
-	zval *tmp_name_zval, *tmp;
-
-	ALLOC_INIT_ZVAL(tmp_name_zval);
-	ZVAL_STRING(tmp_name_zval, propname, 1);
-	tmp = TWIG_PROPERTY(object, tmp_name_zval TSRMLS_CC);
-	FREE_DTOR(tmp_name_zval);
-	return tmp;
+	efree(Z_PTR_P(zv));
 }
 
-static zval *TWIG_CALL_S(zval *object, char *method, char *arg0 TSRMLS_DC)
+static void twig_class_cache_dtor(zval *zv)
 {
-	zend_fcall_info fci;
-	zval **args[1];
-	zval *argument;
-	zval *zfunction;
-	zval *retval_ptr;
+	twig_class_cache *class_cache = Z_PTR_P(zv);
 
-	MAKE_STD_ZVAL(argument);
-	ZVAL_STRING(argument, arg0, 1);
-	args[0] = &argument;
+	zend_hash_destroy(&class_cache->items);
+	efree(class_cache);
+}
 
-	MAKE_STD_ZVAL(zfunction);
-	ZVAL_STRING(zfunction, method, 1);
-	fci.size = sizeof(fci);
-	fci.function_table = EG(function_table);
-	fci.function_name = zfunction;
-	fci.symbol_table = NULL;
-#if PHP_VERSION_ID >= 50300
-	fci.object_ptr = object;
-#else
-	fci.object_pp = &object;
-#endif
-	fci.retval_ptr_ptr = &retval_ptr;
-	fci.param_count = 1;
-	fci.params = args;
-	fci.no_separation = 0;
-
-	if (zend_call_function(&fci, NULL TSRMLS_CC) == FAILURE) {
-		FREE_DTOR(zfunction);
-		zval_ptr_dtor(&argument);
-		return 0;
-	}
-	FREE_DTOR(zfunction);
-	zval_ptr_dtor(&argument);
-	return retval_ptr;
+#ifndef ZTS
+static void twig_persistent_resolution_dtor(zval *zv)
+{
+	pefree(Z_PTR_P(zv), 1);
 }
 
-static int TWIG_CALL_SB(zval *object, char *method, char *arg0 TSRMLS_DC)
+static void twig_persistent_class_cache_dtor(zval *zv)
 {
-	zval *retval_ptr;
-	int success;
+	twig_class_cache *class_cache = Z_PTR_P(zv);
 
-	retval_ptr = TWIG_CALL_S(object, method, arg0 TSRMLS_CC);
-	success = (retval_ptr && (Z_TYPE_P(retval_ptr) == IS_BOOL) && Z_LVAL_P(retval_ptr));
+	zend_hash_destroy(&class_cache->items);
+	pefree(class_cache, 1);
+}
+#endif
 
-	if (retval_ptr) {
-		zval_ptr_dtor(&retval_ptr);
+/* Returns the cache that 'ce' belongs in. Resolutions point into the class
+ * entry, so they can only outlive the request if the class entry does, which
+ * only internal classes are sure to. The classes opcache made immutable live
+ * in shared memory that a restart of opcache discards, without anything
+ * telling this cache about it. */
+static HashTable *TWIG_CLASS_CACHE(zend_class_entry *ce, int *persistent)
+{
+#ifndef ZTS
+	if (TWIG_G(persistent_class_cache) && ce->type == ZEND_INTERNAL_CLASS) {
+		if (!twig_persistent_class_cache) {
+			twig_persistent_class_cache = pemalloc(sizeof(HashTable), 1);
+			zend_hash_init(twig_persistent_class_cache, 32, NULL, twig_persistent_class_cache_dtor, 1);
+		}
+		*persistent = 1;
+		return twig_persistent_class_cache;
 	}
+#endif
 
-	return success;
+	if (!TWIG_G(class_cache)) {
+		ALLOC_HASHTABLE(TWIG_G(class_cache));
+		zend_hash_init(TWIG_G(class_cache), 32, NULL, twig_class_cache_dtor, 0);
+	}
+	*persistent = 0;
+	return TWIG_G(class_cache);
 }
 
-static int TWIG_CALL_ZZ(zval *object, char *method, zval *arg1, zval *arg2 TSRMLS_DC)
+/* Returns what 'item' resolves to for objects of class 'ce', which is only
+ * worked out the first time it is asked for */
+static twig_resolution *TWIG_RESOLVE(zend_class_entry *ce, zend_string *item)
 {
-	zend_fcall_info fci;
-	zval **args[2];
-	zval *zfunction;
-	zval *retval_ptr;
-	int   success;
-
-	args[0] = &arg1;
-	args[1] = &arg2;
-
-	MAKE_STD_ZVAL(zfunction);
-	ZVAL_STRING(zfunction, method, 1);
-	fci.size = sizeof(fci);
-	fci.function_table = EG(function_table);
-	fci.function_name = zfunction;
-	fci.symbol_table = NULL;
-#if PHP_VERSION_ID >= 50300
-	fci.object_ptr = object;
+	int               persistent;
+	HashTable        *classes = TWIG_CLASS_CACHE(ce, &persistent);
+	twig_class_cache *class_cache;
+	twig_resolution  *res, new_res;
+	zend_string      *key;
+
+	class_cache = zend_hash_index_find_ptr(classes, TWIG_POINTER_KEY(ce));
+	if (class_cache && class_cache->name != ce->name) {
+		zend_hash_index_del(classes, TWIG_POINTER_KEY(ce));
+		class_cache = NULL;
+	}
+	if (!class_cache) {
+		class_cache = pemalloc(sizeof(twig_class_cache), persistent);
+		class_cache->name = ce->name;
+#ifndef ZTS
+		zend_hash_init(&class_cache->items, 8, NULL, persistent ? twig_persistent_resolution_dtor : twig_resolution_dtor, persistent);
 #else
-	fci.object_pp = &object;
+		zend_hash_init(&class_cache->items, 8, NULL, twig_resolution_dtor, 0);
 #endif
-	fci.retval_ptr_ptr = &retval_ptr;
-	fci.param_count = 2;
-	fci.params = args;
-	fci.no_separation = 0;
-
-	if (zend_call_function(&fci, NULL TSRMLS_CC) == FAILURE) {
-		FREE_DTOR(zfunction);
-		return 0;
+		zend_hash_index_add_new_ptr(classes, TWIG_POINTER_KEY(ce), class_cache);
 	}
 
-	FREE_DTOR(zfunction);
+	res = zend_hash_find_ptr(&class_cache->items, item);
+	if (res) {
+		return res;
+	}
 
-	success = (retval_ptr && (Z_TYPE_P(retval_ptr) == IS_BOOL) && Z_LVAL_P(retval_ptr));
-	if (retval_ptr) {
-		zval_ptr_dtor(&retval_ptr);
+	new_res.info = zend_hash_find_ptr(&ce->properties_info, item);
+	if (new_res.info && (new_res.info->flags & ZEND_ACC_STATIC)) {
+		new_res.info = NULL;
 	}
+	new_res.fbc = TWIG_FIND_METHOD(ce, item);
 
-	return success;
-}
+	key = persistent ? zend_string_init(ZSTR_VAL(item), ZSTR_LEN(item), 1) : zend_string_copy(item);
+	res = zend_hash_add_new_mem(&class_cache->items, key, &new_res, sizeof(twig_resolution));
+	zend_string_release(key);
 
-#ifndef Z_SET_REFCOUNT_P
-# define Z_SET_REFCOUNT_P(pz, rc)  pz->refcount = rc
-# define Z_UNSET_ISREF_P(pz) pz->is_ref = 0
-#endif
+	return res;
+}
 
-static void TWIG_NEW(zval *object, char *class, zval *arg0, zval *arg1 TSRMLS_DC)
+static void twig_call_site_dtor(zval *zv)
 {
-	zend_class_entry **pce;
-
-	if (zend_lookup_class(class, strlen(class), &pce TSRMLS_CC) == FAILURE) {
-		return;
-	}
+	twig_call_site *site = Z_PTR_P(zv);
 
-	Z_TYPE_P(object) = IS_OBJECT;
-	object_init_ex(object, *pce);
-	Z_SET_REFCOUNT_P(object, 1);
-	Z_UNSET_ISREF_P(object);
-
-	TWIG_CALL_ZZ(object, "__construct", arg0, arg1 TSRMLS_CC);
+	zend_string_release(site->item);
+	efree(site);
 }
 
-static int twig_add_array_key_to_string(void *pDest APPLY_TSRMLS_DC, int num_args, va_list args, zend_hash_key *hash_key)
+/* TWIG_RESOLVE() for the opline that called twig_template_get_attributes(),
+ * which in the steady state of a template is a single probe by that opline.
+ * The entries are only ever matched on class and item, so an opline address
+ * that eval()'d code reuses can't pick up a wrong resolution. */
+static twig_resolution *TWIG_CALL_SITE_RESOLVE(zend_execute_data *execute_data, zend_class_entry *ce, zend_string *item)
 {
-	smart_str *buf;
-	char *joiner;
-	APPLY_TSRMLS_FETCH();
+	zend_execute_data *caller = EX(prev_execute_data);
+	twig_call_site    *site;
+	twig_resolution   *res;
+	uint32_t           i;
 
-	buf = va_arg(args, smart_str*);
-	joiner = va_arg(args, char*);
+	if (!TWIG_G(call_site_cache) || !caller || !caller->func || !ZEND_USER_CODE(caller->func->common.type) || !caller->opline) {
+		return TWIG_RESOLVE(ce, item);
+	}
 
-	if (buf->len != 0) {
-		smart_str_appends(buf, joiner);
+	if (!TWIG_G(call_sites)) {
+		ALLOC_HASHTABLE(TWIG_G(call_sites));
+		zend_hash_init(TWIG_G(call_sites), 64, NULL, twig_call_site_dtor, 0);
 	}
 
-	if (hash_key->nKeyLength == 0) {
-		smart_str_append_long(buf, (long) hash_key->h);
-	} else {
-		char *key, *tmp_str;
-		int key_len, tmp_len;
-		key = php_addcslashes(hash_key->arKey, hash_key->nKeyLength - 1, &key_len, 0, "'\\", 2 TSRMLS_CC);
-		tmp_str = php_str_to_str_ex(key, key_len, "\0", 1, "' . \"\\0\" . '", 12, &tmp_len, 0, NULL);
+	site = zend_hash_index_find_ptr(TWIG_G(call_sites), TWIG_POINTER_KEY(caller->opline));
+	if (!site) {
+		site = emalloc(sizeof(twig_call_site));
+		site->item = zend_string_copy(item);
+		site->count = 0;
+		zend_hash_index_add_new_ptr(TWIG_G(call_sites), TWIG_POINTER_KEY(caller->opline), site);
+	} else if (site->count == TWIG_CALL_SITE_MEGAMORPHIC) {
+		return TWIG_RESOLVE(ce, item);
+	} else if (site->item != item && !zend_string_equals(site->item, item)) {
+		/* attribute(object, name) with a name that varies */
+		site->count = TWIG_CALL_SITE_MEGAMORPHIC;
+		return TWIG_RESOLVE(ce, item);
+	}
 
-		smart_str_appendl(buf, tmp_str, tmp_len);
-		efree(key);
-		efree(tmp_str);
+	for (i = 0; i < site->count; i++) {
+		if (site->ce[i] == ce) {
+			return site->res[i];
+		}
 	}
 
-	return 0;
+	res = TWIG_RESOLVE(ce, item);
+	if (site->count < TWIG_CALL_SITE_ENTRIES) {
+		site->ce[site->count] = ce;
+		site->res[site->count] = res;
+		site->count++;
+	} else {
+		site->count = TWIG_CALL_SITE_MEGAMORPHIC;
+	}
+	return res;
 }
 
-static char *TWIG_IMPLODE_ARRAY_KEYS(char *joiner, zval *array TSRMLS_DC)
+/* The class of the compiled template code that called us */
+static zend_class_entry *TWIG_CALLING_SCOPE(void)
 {
-	smart_str collector = { 0, 0, 0 };
-
-	smart_str_appendl(&collector, "", 0);
-	zend_hash_apply_with_arguments(HASH_OF(array) APPLY_TSRMLS_CC, twig_add_array_key_to_string, 2, &collector, joiner);
-	smart_str_0(&collector);
+	zend_execute_data *caller = EG(current_execute_data) ? EG(current_execute_data)->prev_execute_data : NULL;
 
-	return collector.c;
+	return caller && caller->func ? caller->func->common.scope : NULL;
 }
 
-static void TWIG_RUNTIME_ERROR(zval *template TSRMLS_DC, char *message, ...)
+/* Whether code of 'scope' could see the non-public properties of objects of
+ * class 'ce' at all, which takes the two classes to share an ancestor */
+static int TWIG_SHARES_ANCESTOR(zend_class_entry *scope, zend_class_entry *ce)
 {
-	char *buffer;
-	va_list args;
-	zend_class_entry **pce;
-	zval *ex;
-	zval *constructor;
-	zval *zmessage;
-	zval *lineno;
-	zval *filename_func;
-	zval *filename;
-	zval *constructor_args[3];
-	zval *constructor_retval;
-
-	if (zend_lookup_class("Twig_Error_Runtime", strlen("Twig_Error_Runtime"), &pce TSRMLS_CC) == FAILURE) {
-		return;
+	if (!scope) {
+		return 0;
 	}
-
-	va_start(args, message);
-	vspprintf(&buffer, 0, message, args);
-	va_end(args);
-
-	MAKE_STD_ZVAL(ex);
-	object_init_ex(ex, *pce);
-
-	// Call Twig_Error constructor
-	MAKE_STD_ZVAL(constructor);
-	MAKE_STD_ZVAL(zmessage);
-	MAKE_STD_ZVAL(lineno);
-	MAKE_STD_ZVAL(filename);
-	MAKE_STD_ZVAL(filename_func);
-	MAKE_STD_ZVAL(constructor_retval);
-
-	ZVAL_STRINGL(constructor, "__construct", sizeof("__construct")-1, 1);
-	ZVAL_STRING(zmessage, buffer, 1);
-	ZVAL_LONG(lineno, -1);
-
-	// Get template filename
-	ZVAL_STRINGL(filename_func, "getTemplateName", sizeof("getTemplateName")-1, 1);
-	call_user_function(EG(function_table), &template, filename_func, filename, 0, 0 TSRMLS_CC);
-
-	constructor_args[0] = zmessage;
-	constructor_args[1] = lineno;
-	constructor_args[2] = filename;
-	call_user_function(EG(function_table), &ex, constructor, constructor_retval, 3, constructor_args TSRMLS_CC);
-
-	zval_ptr_dtor(&constructor_retval);
-	zval_ptr_dtor(&zmessage);
-	zval_ptr_dtor(&lineno);
-	zval_ptr_dtor(&filename);
-	FREE_DTOR(constructor);
-	FREE_DTOR(filename_func);
-	efree(buffer);
-
-	zend_throw_exception_object(ex TSRMLS_CC);
+	for (; ce; ce = ce->parent) {
+		if (instanceof_function(scope, ce)) {
+			return 1;
+		}
+	}
+	return 0;
 }
 
-static char *TWIG_GET_CLASS_NAME(zval *object TSRMLS_DC)
+/* Whether 'object' has the property 'item', as far as the resolution can
+ * tell without calling any handler: 1 for a declared public property that
+ * is set, with 'prop' pointing to its slot, 0 if there is no property, and
+ * -1 if only TWIG_HAS_PROPERTY() can tell. */
+static int TWIG_HAS_RESOLVED_PROPERTY(zval *object, twig_resolution *res, zend_string *item, zend_class_entry *scope, zval **prop)
 {
-	char *class_name;
-	zend_uint class_name_len;
+	zend_object *zobj = Z_OBJ_P(object);
 
-	if (Z_TYPE_P(object) != IS_OBJECT) {
-		return "";
+	if (Z_OBJ_HT_P(object)->has_property != zend_std_has_property
+		|| Z_OBJ_HT_P(object)->read_property != zend_std_read_property
+		|| Z_OBJ_HT_P(object)->get_properties != zend_std_get_properties
+	) {
+		return -1;
 	}
-#if PHP_API_VERSION >= 20100412
-	zend_get_object_classname(object, (const char **) &class_name, &class_name_len TSRMLS_CC);
-#else
-	zend_get_object_classname(object, &class_name, &class_name_len TSRMLS_CC);
-#endif
-	return class_name;
+
+	if (res->info && (res->info->flags & ZEND_ACC_PUBLIC)) {
+		*prop = OBJ_PROP(zobj, res->info->offset);
+		return Z_TYPE_P(*prop) != IS_UNDEF ? 1 : -1;
+	}
+	/* A private or protected property, like the one behind a getter, is
+	 * as good as missing for the template unless their classes are related */
+	if (res->info && TWIG_SHARES_ANCESTOR(scope, zobj->ce)) {
+		return -1;
+	}
+	if (zobj->ce->__isset) {
+		return -1;
+	}
+	if (zobj->properties && zend_symtable_exists(zobj->properties, item)) {
+		return -1;
+	}
+	return 0;
 }
 
-static int twig_add_method_to_class(void *pDest APPLY_TSRMLS_DC, int num_args, va_list args, zend_hash_key *hash_key)
+/* call_user_func_array(array($object, $method), $arguments). With 'fbc',
+ * the method that was resolved already, it is called straight away; only
+ * __call() still goes through a lookup by name. */
+static int TWIG_CALL_USER_FUNC_ARRAY(zval *object, zend_function *fbc, zval *method, zval *arguments, zval *retval)
 {
-	zval *retval;
-	char *item;
-	size_t item_len;
-	zend_function *mptr = (zend_function *) pDest;
-	APPLY_TSRMLS_FETCH();
-
-	if (!(mptr->common.fn_flags & ZEND_ACC_PUBLIC)) {
-		return 0;
+	zval                  stack_params[8];
+	zval                 *params = stack_params;
+	uint32_t              param_count = 0;
+	zval                 *arg;
+	int                   result;
+	zend_fcall_info       fci;
+	zend_fcall_info_cache fcc;
+
+	if (arguments && zend_hash_num_elements(Z_ARRVAL_P(arguments))) {
+		if (zend_hash_num_elements(Z_ARRVAL_P(arguments)) > sizeof(stack_params) / sizeof(zval)) {
+			params = safe_emalloc(sizeof(zval), zend_hash_num_elements(Z_ARRVAL_P(arguments)), 0);
+		}
+		ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(arguments), arg) {
+			ZVAL_COPY_VALUE(&params[param_count], arg);
+			param_count++;
+		} ZEND_HASH_FOREACH_END();
 	}
 
-	retval = va_arg(args, zval*);
-
-	item_len = strlen(mptr->common.function_name);
-	item = estrndup(mptr->common.function_name, item_len);
-	php_strtolower(item, item_len);
+	ZVAL_UNDEF(retval);
+	if (fbc) {
+		fci.size = sizeof(fci);
+#if PHP_VERSION_ID < 70100
+		fci.function_table = &Z_OBJCE_P(object)->function_table;
+		fci.symbol_table = NULL;
+#endif
+		ZVAL_COPY_VALUE(&fci.function_name, method);
+		fci.retval = retval;
+		fci.params = params;
+		fci.object = Z_OBJ_P(object);
+		fci.no_separation = 1;
+		fci.param_count = param_count;
+
+#if PHP_VERSION_ID < 70300
+		fcc.initialized = 1;
+#endif
+		fcc.function_handler = fbc;
+		fcc.calling_scope = Z_OBJCE_P(object);
+		fcc.called_scope = Z_OBJCE_P(object);
+		fcc.object = Z_OBJ_P(object);
 
-	add_assoc_stringl_ex(retval, item, item_len+1, item, item_len, 0);
+		result = zend_call_function(&fci, &fcc);
+	} else {
+		result = call_user_function(EG(function_table), object, method, retval, param_count, params);
+	}
 
-	return 0;
+	if (params != stack_params) {
+		efree(params);
+	}
+	return result;
 }
 
-static int twig_add_property_to_class(void *pDest APPLY_TSRMLS_DC, int num_args, va_list args, zend_hash_key *hash_key)
+/* Everything of Twig_Template::getAttribute() from the object property
+ * lookup on; 'object' is known to be an object here */
+static void twig_get_object_attribute(zval *template, zval *object, zend_string *item, twig_resolution *res, zval *arguments, int method_call, zend_bool isDefinedTest, zend_bool ignoreStrictCheck, zval *return_value)
 {
-	zend_class_entry *ce;
-	zval *retval;
-	char *class_name, *prop_name;
-	zend_property_info *pptr = (zend_property_info *) pDest;
-	APPLY_TSRMLS_FETCH();
+	zend_class_entry *ce = Z_OBJCE_P(object);
+	zend_function    *fbc;
+	zval              member, zmethod, ret, rv, *prop = NULL;
+	int               call = 0, result, found;
 
-	if (!(pptr->flags & ZEND_ACC_PUBLIC) || (pptr->flags & ZEND_ACC_STATIC)) {
-		return 0;
+	ZVAL_STR(&member, item);
+
+/*
+	// object property
+	if (Twig_Template::METHOD_CALL !== $type) {
+		if (isset($object->$item) || array_key_exists((string) $item, $object)) {
+			if ($isDefinedTest) {
+				return true;
+			}
+
+			if ($this->env->hasExtension('sandbox')) {
+				$this->env->getExtension('sandbox')->checkPropertyAllowed($object, $item);
+			}
+
+			return $object->$item;
+		}
 	}
+*/
+	if (!method_call) {
+		found = TWIG_HAS_RESOLVED_PROPERTY(object, res, item, TWIG_CALLING_SCOPE(), &prop);
+		if (found < 0) {
+			prop = NULL;
+			found = TWIG_HAS_PROPERTY(object, &member);
+		}
+		if (found) {
+			if (isDefinedTest) {
+				RETURN_TRUE;
+			}
+			TWIG_SANDBOX_CHECK(template, "checkpropertyallowed", sizeof("checkpropertyallowed") - 1, &TWIG_G(check_property_allowed), object, &member);
+			if (EG(exception)) {
+				return;
+			}
 
-	ce = *va_arg(args, zend_class_entry**);
-	retval = va_arg(args, zval*);
+			/* The slot stays put, but the sandbox may have unset it */
+			if (prop && Z_TYPE_P(prop) != IS_UNDEF) {
+				ZVAL_DEREF(prop);
+				RETURN_ZVAL(prop, 1, 0);
+			}
+			prop = Z_OBJ_HT_P(object)->read_property(object, &member, BP_VAR_R, NULL, &rv);
+			if (prop) {
+				TWIG_COPY_RESULT(return_value, prop, &rv);
+			}
+			return;
+		}
+		if (EG(exception)) {
+			return;
+		}
+	}
 
-#if PHP_API_VERSION >= 20100412
-	zend_unmangle_property_name(pptr->name, pptr->name_length, (const char **) &class_name, (const char **) &prop_name);
-#else
-	zend_unmangle_property_name(pptr->name, pptr->name_length, &class_name, &prop_name);
-#endif
+/*
+	// object method
+	$call = false;
+	$lcItem = strtolower($item);
+	if (isset(self::$cache[$class]['methods'][$lcItem])) {
+		$method = (string) $item;
+	} elseif (isset(self::$cache[$class]['methods']['get'.$lcItem])) {
+		$method = 'get'.$item;
+	} elseif (isset(self::$cache[$class]['methods']['is'.$lcItem])) {
+		$method = 'is'.$item;
+	} elseif (isset(self::$cache[$class]['methods']['__call'])) {
+		$method = (string) $item;
+		$call = true;
+	} else {
+		if ($isDefinedTest) {
+			return false;
+		}
 
-	add_assoc_string(retval, prop_name, prop_name, 1);
+		if ($ignoreStrictCheck || !$this->env->isStrictVariables()) {
+			return null;
+		}
 
-	return 0;
-}
+		throw new Twig_Error_Runtime(sprintf('Method "%s" for object "%s" does not exist', $item, get_class($object)), -1, $this->getTemplateName());
+	}
+*/
+	fbc = res->fbc;
+	if (fbc) {
+		ZVAL_STR(&zmethod, fbc->common.function_name);
+	} else if (ce->__call) {
+		ZVAL_STR(&zmethod, item);
+		call = 1;
+	} else {
+		if (isDefinedTest) {
+			RETURN_FALSE;
+		}
+		if (ignoreStrictCheck || !TWIG_IS_STRICT_VARIABLES(template)) {
+			return;
+		}
+		TWIG_RUNTIME_ERROR(template, "Method \"%s\" for object \"%s\" does not exist", ZSTR_VAL(item), TWIG_GET_CLASS_NAME(object));
+		return;
+	}
 
-static void twig_add_class_to_cache(zval *cache, zval *object, char *class_name TSRMLS_DC)
-{
-	zval *class_info, *class_methods, *class_properties;
-	zend_class_entry *class_ce;
+	if (isDefinedTest) {
+		RETURN_TRUE;
+	}
+
+/*
+	if ($this->env->hasExtension('sandbox')) {
+		$this->env->getExtension('sandbox')->checkMethodAllowed($object, $method);
+	}
+*/
+	TWIG_SANDBOX_CHECK(template, "checkmethodallowed", sizeof("checkmethodallowed") - 1, &TWIG_G(check_method_allowed), object, &zmethod);
+	if (EG(exception)) {
+		return;
+	}
+
+/*
+	// Some objects throw exceptions when they have __call, and the method we try
+	// to call is not supported. If ignoreStrictCheck is true, we should return null.
+	try {
+	    $ret = call_user_func_array(array($object, $method), $arguments);
+	} catch (BadMethodCallException $e) {
+	    if ($call && ($ignoreStrictCheck || !$this->env->isStrictVariables())) {
+	        return null;
+	    }
+	    throw $e;
+	}
+*/
+	if (call) {
+		/* Decided up front, as no methods can be called with the exception pending */
+		ignoreStrictCheck = ignoreStrictCheck || !TWIG_IS_STRICT_VARIABLES(template);
+		if (EG(exception)) {
+			return;
+		}
+	}
+	result = TWIG_CALL_USER_FUNC_ARRAY(object, fbc, &zmethod, arguments, &ret);
+	if (EG(exception)) {
+		zval_ptr_dtor(&ret);
+		if (call && ignoreStrictCheck && instanceof_function(EG(exception)->ce, spl_ce_BadMethodCallException)) {
+			zend_clear_exception();
+		}
+		return;
+	}
+	if (result == FAILURE || Z_ISUNDEF(ret)) {
+		return;
+	}
+
+/*
+	// useful when calling a template method from a template
+	// this is not supported but unfortunately heavily used in the Symfony profiler
+	if ($object instanceof Twig_TemplateInterface) {
+		return $ret === '' ? '' : new Twig_Markup($ret, $this->env->getCharset());
+	}
+
+	return $ret;
+*/
+	if (TWIG_INSTANCE_OF_USERLAND(object, "twig_templateinterface", sizeof("twig_templateinterface") - 1)) {
+		zval              charset, retval, *env;
+		zend_class_entry *markup_ce;
+
+		if (Z_TYPE(ret) == IS_STRING && Z_STRLEN(ret) == 0) {
+			RETURN_ZVAL(&ret, 0, 0);
+		}
+
+		env = TWIG_GET_ENV(template, &rv);
+		markup_ce = TWIG_LOOKUP_CLASS("Twig_Markup", sizeof("Twig_Markup") - 1);
+		if (!env || !markup_ce) {
+			zval_ptr_dtor(&ret);
+			return;
+		}
+
+		ZVAL_UNDEF(&charset);
+		zend_call_method_with_0_params(env, Z_OBJCE_P(env), NULL, "getcharset", &charset);
 
-	class_ce = zend_get_class_entry(object TSRMLS_CC);
+		object_init_ex(return_value, markup_ce);
+		if (markup_ce->constructor) {
+			ZVAL_UNDEF(&retval);
+			zend_call_method(return_value, markup_ce, &markup_ce->constructor, "__construct", sizeof("__construct") - 1, &retval, 2, &ret, &charset);
+			zval_ptr_dtor(&retval);
+		}
 
-	ALLOC_INIT_ZVAL(class_info);
-	ALLOC_INIT_ZVAL(class_methods);
-	ALLOC_INIT_ZVAL(class_properties);
-	array_init(class_info);
-	array_init(class_methods);
-	array_init(class_properties);
-	// add all methods to self::cache[$class]['methods']
-	zend_hash_apply_with_arguments(&class_ce->function_table APPLY_TSRMLS_CC, twig_add_method_to_class, 1, class_methods);
-	zend_hash_apply_with_arguments(&class_ce->properties_info APPLY_TSRMLS_CC, twig_add_property_to_class, 2, &class_ce, class_properties);
+		zval_ptr_dtor(&charset);
+		zval_ptr_dtor(&ret);
+		return;
+	}
 
-	add_assoc_zval(class_info, "methods", class_methods);
-	add_assoc_zval(class_info, "properties", class_properties);
-	add_assoc_zval(cache, class_name, class_info);
+	TWIG_COPY_RESULT(return_value, &ret, &ret);
 }
 
 /* {{{ proto mixed twig_template_get_attributes(TwigTemplate template, mixed object, mixed item, array arguments, string type, boolean isDefinedTest, boolean ignoreStrictCheck)
    A C implementation of TwigTemplate::getAttribute() */
 PHP_FUNCTION(twig_template_get_attributes)
 {
-	zval *template;
-	zval *object;
-	char *item;
-	int  item_len;
-	zval *zitem, ztmpitem;
-	zval *arguments = NULL;
-	zval *ret = NULL;
-	char *type = NULL;
-	int   type_len = 0;
-	zend_bool isDefinedTest = 0;
-	zend_bool ignoreStrictCheck = 0;
-	int free_ret = 0;
-	zval *tmp_self_cache;
-	char *class_name = NULL;
-	zval *tmp_class;
-	char *type_name;
-
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ozz|asbb", &template, &object, &zitem, &arguments, &type, &type_len, &isDefinedTest, &ignoreStrictCheck) == FAILURE) {
+	zval        *template;
+	zval        *object;
+	zval        *zitem;
+	zval         array_item;
+	zval        *arguments = NULL;
+	zval        *ret;
+	zend_string *type = NULL;
+	zend_string *item;
+	twig_resolution *res;
+	zend_bool    isDefinedTest = 0;
+	zend_bool    ignoreStrictCheck = 0;
+	int          method_call, array_call;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "ozz|aSbb", &template, &object, &zitem, &arguments, &type, &isDefinedTest, &ignoreStrictCheck) == FAILURE) {
 		return;
 	}
 
-	// convert the item to a string
-	ztmpitem = *zitem;
-	zval_copy_ctor(&ztmpitem);
-	convert_to_string(&ztmpitem);
-	item_len = Z_STRLEN(ztmpitem);
-	item = estrndup(Z_STRVAL(ztmpitem), item_len);
-	zval_dtor(&ztmpitem);
-
-	if (!type) {
-		type = "any";
-	}
+	method_call = type && zend_string_equals_literal(type, "method");
+	array_call = type && zend_string_equals_literal(type, "array");
 
 /*
 	// array
@@ -730,107 +1219,57 @@ PHP_FUNCTION(twig_template_get_attributes)
 			return $object[$arrayItem];
 		}
 */
-
-
-	if (strcmp("method", type) != 0) {
-		if ((TWIG_ARRAY_KEY_EXISTS(object, zitem))
-			|| (TWIG_INSTANCE_OF(object, zend_ce_arrayaccess TSRMLS_CC) && TWIG_ISSET_ARRAYOBJECT_ELEMENT(object, zitem TSRMLS_CC))
-		) {
-
-			if (isDefinedTest) {
-				efree(item);
-				RETURN_TRUE;
+	if (!method_call) {
+		TWIG_ARRAY_ITEM(&array_item, zitem);
+
+		if (Z_TYPE_P(object) == IS_ARRAY) {
+			ret = TWIG_FIND_ARRAY_ELEMENT(Z_ARRVAL_P(object), &array_item);
+			if (ret) {
+				if (isDefinedTest) {
+					RETURN_TRUE;
+				}
+				ZVAL_DEREF(ret);
+				RETURN_ZVAL(ret, 1, 0);
 			}
+		} else if (TWIG_INSTANCE_OF(object, zend_ce_arrayaccess)) {
+			if (Z_OBJ_HT_P(object)->has_dimension(object, &array_item, 0)) {
+				zval rv;
 
-			ret = TWIG_GET_ARRAY_ELEMENT_ZVAL(object, zitem TSRMLS_CC);
-
-			if (!ret) {
-				ret = &EG(uninitialized_zval);
+				if (isDefinedTest) {
+					RETURN_TRUE;
+				}
+				ret = Z_OBJ_HT_P(object)->read_dimension(object, &array_item, BP_VAR_R, &rv);
+				if (ret) {
+					TWIG_COPY_RESULT(return_value, ret, &rv);
+				}
+				return;
 			}
-			RETVAL_ZVAL(ret, 1, 0);
-			if (free_ret) {
-				zval_ptr_dtor(&ret);
+			if (EG(exception)) {
+				return;
 			}
-			efree(item);
-			return;
 		}
+
 /*
-		if (Twig_Template::ARRAY_CALL === $type) {
+		if (Twig_Template::ARRAY_CALL === $type || !is_object($object)) {
 			if ($isDefinedTest) {
 				return false;
 			}
 			if ($ignoreStrictCheck || !$this->env->isStrictVariables()) {
 				return null;
 			}
+			...
+			throw new Twig_Error_Runtime($message, -1, $this->getTemplateName());
+		}
+	}
 */
-		if (strcmp("array", type) == 0 || Z_TYPE_P(object) != IS_OBJECT) {
+		if (array_call || Z_TYPE_P(object) != IS_OBJECT) {
 			if (isDefinedTest) {
-				efree(item);
 				RETURN_FALSE;
 			}
-			if (ignoreStrictCheck || !TWIG_CALL_BOOLEAN(TWIG_PROPERTY_CHAR(template, "env" TSRMLS_CC), "isStrictVariables" TSRMLS_CC)) {
-				efree(item);
+			if (ignoreStrictCheck || !TWIG_IS_STRICT_VARIABLES(template)) {
 				return;
 			}
-/*
-			if ($object instanceof ArrayAccess) {
-				$message = sprintf('Key "%s" in object with ArrayAccess of class "%s" does not exist', $arrayItem, get_class($object));
-			} elseif (is_object($object)) {
-				$message = sprintf('Impossible to access a key "%s" on an object of class "%s" that does not implement ArrayAccess interface', $item, get_class($object));
-			} elseif (is_array($object)) {
-				if (empty($object)) {
-					$message = sprintf('Key "%s" does not exist as the array is empty', $arrayItem);
-				} else {
-					$message = sprintf('Key "%s" for array with keys "%s" does not exist', $arrayItem, implode(', ', array_keys($object)));
-				}
-			} elseif (Twig_Template::ARRAY_CALL === $type) {
-				if (null === $object) {
-					$message = sprintf('Impossible to access a key ("%s") on a null variable', $item);
-				} else {
-					$message = sprintf('Impossible to access a key ("%s") on a %s variable ("%s")', $item, gettype($object), $object);
-				}
-			} elseif (null === $object) {
-				$message = sprintf('Impossible to access an attribute ("%s") on a null variable', $item);
-			} else {
-				$message = sprintf('Impossible to access an attribute ("%s") on a %s variable ("%s")', $item, gettype($object), $object);
-			}
-			throw new Twig_Error_Runtime($message, -1, $this->getTemplateName());
-		}
-	}
-*/
-			if (TWIG_INSTANCE_OF(object, zend_ce_arrayaccess TSRMLS_CC)) {
-				TWIG_RUNTIME_ERROR(template TSRMLS_CC, "Key \"%s\" in object with ArrayAccess of class \"%s\" does not exist", item, TWIG_GET_CLASS_NAME(object TSRMLS_CC));
-			} else if (Z_TYPE_P(object) == IS_OBJECT) {
-				TWIG_RUNTIME_ERROR(template TSRMLS_CC, "Impossible to access a key \"%s\" on an object of class \"%s\" that does not implement ArrayAccess interface", item, TWIG_GET_CLASS_NAME(object TSRMLS_CC));
-			} else if (Z_TYPE_P(object) == IS_ARRAY) {
-				if (0 == zend_hash_num_elements(Z_ARRVAL_P(object))) {
-					TWIG_RUNTIME_ERROR(template TSRMLS_CC, "Key \"%s\" does not exist as the array is empty", item);
-				} else {
-					char *array_keys = TWIG_IMPLODE_ARRAY_KEYS(", ", object TSRMLS_CC);
-					TWIG_RUNTIME_ERROR(template TSRMLS_CC, "Key \"%s\" for array with keys \"%s\" does not exist", item, array_keys);
-					efree(array_keys);
-				}
-			} else {
-				char *type_name = zend_zval_type_name(object);
-				Z_ADDREF_P(object);
-				if (Z_TYPE_P(object) == IS_NULL) {
-					convert_to_string(object);
-					TWIG_RUNTIME_ERROR(template TSRMLS_CC,
-						(strcmp("array", type) == 0)
-							? "Impossible to access a key (\"%s\") on a %s variable"
-							: "Impossible to access an attribute (\"%s\") on a %s variable",
-						item, type_name);
-				} else {
-					convert_to_string(object);
-					TWIG_RUNTIME_ERROR(template TSRMLS_CC,
-						(strcmp("array", type) == 0)
-							? "Impossible to access a key (\"%s\") on a %s variable (\"%s\")"
-							: "Impossible to access an attribute (\"%s\") on a %s variable (\"%s\")",
-						item, type_name, Z_STRVAL_P(object));
-				}
-				zval_ptr_dtor(&object);
-			}
-			efree(item);
+			TWIG_ARRAY_KEY_ERROR(template, object, zitem, &array_item, array_call);
 			return;
 		}
 	}
@@ -840,14 +1279,6 @@ PHP_FUNCTION(twig_template_get_attributes)
 		if ($isDefinedTest) {
 			return false;
 		}
-*/
-
-	if (Z_TYPE_P(object) != IS_OBJECT) {
-		if (isDefinedTest) {
-			efree(item);
-			RETURN_FALSE;
-		}
-/*
 		if ($ignoreStrictCheck || !$this->env->isStrictVariables()) {
 			return null;
 		}
@@ -861,239 +1292,2431 @@ PHP_FUNCTION(twig_template_get_attributes)
 		throw new Twig_Error_Runtime($message, -1, $this->getTemplateName());
 	}
 */
-		if (ignoreStrictCheck || !TWIG_CALL_BOOLEAN(TWIG_PROPERTY_CHAR(template, "env" TSRMLS_CC), "isStrictVariables" TSRMLS_CC)) {
-			efree(item);
+	item = zval_get_string(zitem);
+
+	if (Z_TYPE_P(object) != IS_OBJECT) {
+		if (isDefinedTest) {
+			zend_string_release(item);
+			RETURN_FALSE;
+		}
+		if (ignoreStrictCheck || !TWIG_IS_STRICT_VARIABLES(template)) {
+			zend_string_release(item);
 			return;
 		}
 
-		type_name = zend_zval_type_name(object);
-		Z_ADDREF_P(object);
 		if (Z_TYPE_P(object) == IS_NULL) {
-			convert_to_string_ex(&object);
-
-			TWIG_RUNTIME_ERROR(template TSRMLS_CC, "Impossible to invoke a method (\"%s\") on a %s variable", item, type_name);
+			TWIG_RUNTIME_ERROR(template, "Impossible to invoke a method (\"%s\") on a null variable", ZSTR_VAL(item));
 		} else {
-			convert_to_string_ex(&object);
+			zend_string *object_str = zval_get_string(object);
 
-			TWIG_RUNTIME_ERROR(template TSRMLS_CC, "Impossible to invoke a method (\"%s\") on a %s variable (\"%s\")", item, type_name, Z_STRVAL_P(object));
+			TWIG_RUNTIME_ERROR(template, "Impossible to invoke a method (\"%s\") on a %s variable (\"%s\")", ZSTR_VAL(item), TWIG_GETTYPE(object), ZSTR_VAL(object_str));
+			zend_string_release(object_str);
 		}
-
-		zval_ptr_dtor(&object);
-		efree(item);
+		zend_string_release(item);
 		return;
 	}
-/*
-	$class = get_class($object);
-*/
 
-	class_name = TWIG_GET_CLASS_NAME(object TSRMLS_CC);
-	tmp_self_cache = TWIG_GET_STATIC_PROPERTY(template, "cache" TSRMLS_CC);
-	tmp_class = TWIG_GET_ARRAY_ELEMENT(tmp_self_cache, class_name, strlen(class_name) TSRMLS_CC);
+	res = TWIG_CALL_SITE_RESOLVE(execute_data, Z_OBJCE_P(object), item);
+	twig_get_object_attribute(template, object, item, res, arguments, method_call, isDefinedTest, ignoreStrictCheck, return_value);
+	zend_string_release(item);
+}
+
+/* Escaping
+ *
+ * The strategies of twig_escape_filter() that only need UTF-8 are done here;
+ * other charsets are converted with the userland twig_convert_encoding(),
+ * and escapers added with Twig_Extension_Core::setEscaper() are called as
+ * they are. Each strategy first looks for the first byte it has to escape,
+ * 16 at a time where SSE2 is available, so that a string with nothing to
+ * escape is returned as is without being copied. */
+
+/* What is left alone besides [a-zA-Z0-9], which the SSE2 scan compares
+ * against one by one */
+#define TWIG_JS_SAFE        ",._"
+#define TWIG_CSS_SAFE       ""
+#define TWIG_HTML_ATTR_SAFE ",.-_"
+#define TWIG_URL_SAFE       "-_.~"
+
+static unsigned char twig_js_safe[256];
+static unsigned char twig_css_safe[256];
+static unsigned char twig_html_attr_safe[256];
+static unsigned char twig_url_safe[256];
+static unsigned char twig_html_safe[256];
+
+static void twig_init_safe_table(unsigned char *table, const char *extra)
+{
+	int c;
 
-	if (!tmp_class) {
-		twig_add_class_to_cache(tmp_self_cache, object, class_name TSRMLS_CC);
-		tmp_class = TWIG_GET_ARRAY_ELEMENT(tmp_self_cache, class_name, strlen(class_name) TSRMLS_CC);
+	memset(table, 0, 256);
+	for (c = '0'; c <= '9'; c++) {
+		table[c] = 1;
+	}
+	for (c = 'a'; c <= 'z'; c++) {
+		table[c] = 1;
+		table[c - 'a' + 'A'] = 1;
+	}
+	for (; *extra; extra++) {
+		table[(unsigned char) *extra] = 1;
 	}
-	efree(class_name);
+}
 
-/*
-	// object property
-	if (Twig_Template::METHOD_CALL !== $type) {
-		if (isset($object->$item) || array_key_exists((string) $item, $object)) {
-			if ($isDefinedTest) {
-				return true;
-			}
+static void twig_init_escape_tables(void)
+{
+	int c;
 
-			if ($this->env->hasExtension('sandbox')) {
-				$this->env->getExtension('sandbox')->checkPropertyAllowed($object, $item);
-			}
+	twig_init_safe_table(twig_js_safe, TWIG_JS_SAFE);
+	twig_init_safe_table(twig_css_safe, TWIG_CSS_SAFE);
+	twig_init_safe_table(twig_html_attr_safe, TWIG_HTML_ATTR_SAFE);
+	twig_init_safe_table(twig_url_safe, TWIG_URL_SAFE);
 
-			return $object->$item;
-		}
+	/* Non-ASCII bytes are "unsafe" too, as they need the charset */
+	memset(twig_html_safe, 0, 256);
+	for (c = 0; c < 0x80; c++) {
+		twig_html_safe[c] = c != '&' && c != '<' && c != '>' && c != '"' && c != '\'';
 	}
-*/
-	if (strcmp("method", type) != 0) {
-		zval *tmp_properties, *tmp_item;
-
-		tmp_properties = TWIG_GET_ARRAY_ELEMENT(tmp_class, "properties", strlen("properties") TSRMLS_CC);
-		tmp_item = TWIG_GET_ARRAY_ELEMENT(tmp_properties, item, item_len TSRMLS_CC);
+}
 
-		if (tmp_item || TWIG_HAS_PROPERTY(object, zitem TSRMLS_CC) || TWIG_HAS_DYNAMIC_PROPERTY(object, item, item_len TSRMLS_CC)) {
-			if (isDefinedTest) {
-				efree(item);
-				RETURN_TRUE;
-			}
-			if (TWIG_CALL_SB(TWIG_PROPERTY_CHAR(template, "env" TSRMLS_CC), "hasExtension", "sandbox" TSRMLS_CC)) {
-				TWIG_CALL_ZZ(TWIG_CALL_S(TWIG_PROPERTY_CHAR(template, "env" TSRMLS_CC), "getExtension", "sandbox" TSRMLS_CC), "checkPropertyAllowed", object, zitem TSRMLS_CC);
-			}
-			if (EG(exception)) {
-				efree(item);
-				return;
+/* Returns how many bytes from the start of 's' are in 'safe', which holds
+ * [a-zA-Z0-9] and the bytes of 'extra' */
+static size_t TWIG_SAFE_SPAN(const unsigned char *s, size_t len, const unsigned char *safe, const char *extra)
+{
+	size_t i = 0;
+
+#ifdef TWIG_HAVE_SSE2
+	if (len >= 16) {
+		const __m128i case_bit = _mm_set1_epi8(0x20);
+		const __m128i lower_a = _mm_set1_epi8('a');
+		const __m128i letters = _mm_set1_epi8(25);
+		const __m128i zero = _mm_set1_epi8('0');
+		const __m128i digits = _mm_set1_epi8(9);
+		__m128i       v, t, ok;
+		const char   *e;
+
+		for (; i + 16 <= len; i += 16) {
+			v = _mm_loadu_si128((const __m128i *) (s + i));
+
+			/* letters: (v | 0x20) - 'a' <= 25, digits: v - '0' <= 9, unsigned */
+			t = _mm_sub_epi8(_mm_or_si128(v, case_bit), lower_a);
+			ok = _mm_cmpeq_epi8(_mm_min_epu8(t, letters), t);
+			t = _mm_sub_epi8(v, zero);
+			ok = _mm_or_si128(ok, _mm_cmpeq_epi8(_mm_min_epu8(t, digits), t));
+			for (e = extra; *e; e++) {
+				ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8(*e)));
 			}
 
-			ret = TWIG_PROPERTY(object, zitem TSRMLS_CC);
-			efree(item);
-			RETURN_ZVAL(ret, 1, 0);
+			if (_mm_movemask_epi8(ok) != 0xFFFF) {
+				break;
+			}
 		}
 	}
-/*
-	// object method
-	if (!isset(self::$cache[$class]['methods'])) {
-		self::$cache[$class]['methods'] = array_change_key_case(array_flip(get_class_methods($object)));
+#endif
+
+	while (i < len && safe[s[i]]) {
+		i++;
 	}
+	return i;
+}
 
-	$call = false;
-	$lcItem = strtolower($item);
-	if (isset(self::$cache[$class]['methods'][$lcItem])) {
-		$method = (string) $item;
-	} elseif (isset(self::$cache[$class]['methods']['get'.$lcItem])) {
-		$method = 'get'.$item;
-	} elseif (isset(self::$cache[$class]['methods']['is'.$lcItem])) {
-		$method = 'is'.$item;
-	} elseif (isset(self::$cache[$class]['methods']['__call'])) {
-		$method = (string) $item;
-		$call = true;
-*/
-	{
-		int call = 0;
-		char *lcItem = TWIG_STRTOLOWER(item, item_len);
-		int   lcItem_length;
-		char *method = NULL;
-		char *tmp_method_name_get;
-		char *tmp_method_name_is;
-		zval *zmethod;
-		zval *tmp_methods;
-
-		lcItem_length = strlen(lcItem);
-		tmp_method_name_get = emalloc(4 + lcItem_length);
-		tmp_method_name_is  = emalloc(3 + lcItem_length);
-
-		sprintf(tmp_method_name_get, "get%s", lcItem);
-		sprintf(tmp_method_name_is, "is%s", lcItem);
-
-		tmp_methods = TWIG_GET_ARRAY_ELEMENT(tmp_class, "methods", strlen("methods") TSRMLS_CC);
-
-		if (TWIG_GET_ARRAY_ELEMENT(tmp_methods, lcItem, lcItem_length TSRMLS_CC)) {
-			method = item;
-		} else if (TWIG_GET_ARRAY_ELEMENT(tmp_methods, tmp_method_name_get, lcItem_length + 3 TSRMLS_CC)) {
-			method = tmp_method_name_get;
-		} else if (TWIG_GET_ARRAY_ELEMENT(tmp_methods, tmp_method_name_is, lcItem_length + 2 TSRMLS_CC)) {
-			method = tmp_method_name_is;
-		} else if (TWIG_GET_ARRAY_ELEMENT(tmp_methods, "__call", 6 TSRMLS_CC)) {
-			method = item;
-			call = 1;
-/*
-	} else {
-		if ($isDefinedTest) {
-			return false;
-		}
+/* Returns how many bytes from the start of 's' are ASCII that
+ * htmlspecialchars() leaves alone */
+static size_t TWIG_HTML_SAFE_SPAN(const unsigned char *s, size_t len)
+{
+	size_t i = 0;
+
+#ifdef TWIG_HAVE_SSE2
+	if (len >= 16) {
+		const __m128i amp = _mm_set1_epi8('&');
+		const __m128i lt = _mm_set1_epi8('<');
+		const __m128i gt = _mm_set1_epi8('>');
+		const __m128i quot = _mm_set1_epi8('"');
+		const __m128i apos = _mm_set1_epi8('\'');
+		__m128i       v, special;
+
+		for (; i + 16 <= len; i += 16) {
+			v = _mm_loadu_si128((const __m128i *) (s + i));
+			special = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, lt)),
+				_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, gt), _mm_cmpeq_epi8(v, quot)), _mm_cmpeq_epi8(v, apos))
+			);
 
-		if ($ignoreStrictCheck || !$this->env->isStrictVariables()) {
-			return null;
+			/* The sign bits are the non-ASCII bytes */
+			if (_mm_movemask_epi8(_mm_or_si128(special, v))) {
+				break;
+			}
 		}
-
-		throw new Twig_Error_Runtime(sprintf('Method "%s" for object "%s" does not exist', $item, get_class($object)), -1, $this->getTemplateName());
 	}
+#endif
 
-	if ($isDefinedTest) {
-		return true;
+	while (i < len && twig_html_safe[s[i]]) {
+		i++;
 	}
-*/
-		} else {
-			efree(tmp_method_name_get);
-			efree(tmp_method_name_is);
-			efree(lcItem);
+	return i;
+}
 
-			if (isDefinedTest) {
-				efree(item);
-				RETURN_FALSE;
-			}
-			if (ignoreStrictCheck || !TWIG_CALL_BOOLEAN(TWIG_PROPERTY_CHAR(template, "env" TSRMLS_CC), "isStrictVariables" TSRMLS_CC)) {
-				efree(item);
-				return;
-			}
-			TWIG_RUNTIME_ERROR(template TSRMLS_CC, "Method \"%s\" for object \"%s\" does not exist", item, TWIG_GET_CLASS_NAME(object TSRMLS_CC));
-			efree(item);
-			return;
-		}
+/* Decodes the UTF-8 character at the start of 's' into 'cp' and returns
+ * its length, or 0 if it isn't valid UTF-8 as PCRE sees it: no overlong
+ * forms, no surrogates and nothing beyond U+10FFFF. */
+static size_t TWIG_UTF8_DECODE(const unsigned char *s, size_t len, uint32_t *cp)
+{
+	size_t   need, k;
+	uint32_t min;
 
-		if (isDefinedTest) {
-			efree(tmp_method_name_get);
-			efree(tmp_method_name_is);
-			efree(lcItem);efree(item);
-			RETURN_TRUE;
-		}
-/*
-	if ($this->env->hasExtension('sandbox')) {
-		$this->env->getExtension('sandbox')->checkMethodAllowed($object, $method);
+	if (s[0] < 0xC2 || s[0] > 0xF4) {
+		return 0;
 	}
-*/
-		MAKE_STD_ZVAL(zmethod);
-		ZVAL_STRING(zmethod, method, 1);
-		if (TWIG_CALL_SB(TWIG_PROPERTY_CHAR(template, "env" TSRMLS_CC), "hasExtension", "sandbox" TSRMLS_CC)) {
-			TWIG_CALL_ZZ(TWIG_CALL_S(TWIG_PROPERTY_CHAR(template, "env" TSRMLS_CC), "getExtension", "sandbox" TSRMLS_CC), "checkMethodAllowed", object, zmethod TSRMLS_CC);
+	if (s[0] < 0xE0) {
+		need = 1;
+		*cp = s[0] & 0x1F;
+		min = 0x80;
+	} else if (s[0] < 0xF0) {
+		need = 2;
+		*cp = s[0] & 0x0F;
+		min = 0x800;
+	} else {
+		need = 3;
+		*cp = s[0] & 0x07;
+		min = 0x10000;
+	}
+
+	if (len <= need) {
+		return 0;
+	}
+	for (k = 1; k <= need; k++) {
+		if ((s[k] & 0xC0) != 0x80) {
+			return 0;
 		}
-		zval_ptr_dtor(&zmethod);
+		*cp = (*cp << 6) | (s[k] & 0x3F);
+	}
+	if (*cp < min || *cp > 0x10FFFF || (*cp >= 0xD800 && *cp <= 0xDFFF)) {
+		return 0;
+	}
+	return need + 1;
+}
+
+/* Appends 'value' in uppercase hex, zero padded to 'digits', or with as
+ * few digits as it takes if 'digits' is 0 */
+static void TWIG_APPEND_HEX(smart_str *out, uint32_t value, int digits)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	char              buffer[8];
+	int               n = 0;
+
+	do {
+		buffer[sizeof(buffer) - ++n] = hex[value & 0xF];
+		value >>= 4;
+	} while (value || n < digits);
+
+	smart_str_appendl(out, buffer + sizeof(buffer) - n, n);
+}
+
+/* The last UTF-16 code unit of 'cp': what bin2hex() of the UTF-16BE form
+ * cut down to its last four digits gives */
+#define TWIG_UTF16_LAST_UNIT(cp) ((cp) < 0x10000 ? (cp) : 0xDC00 | (((cp) - 0x10000) & 0x3FF))
+
+#define TWIG_ESCAPE_JS        1
+#define TWIG_ESCAPE_CSS       2
+#define TWIG_ESCAPE_HTML_ATTR 3
+#define TWIG_ESCAPE_HTML      4
+#define TWIG_ESCAPE_URL       5
+
+/* Returns which of the strategies above 'strategy' names, or 0 for any
+ * other */
+static int TWIG_ESCAPE_STRATEGY(zend_string *strategy)
+{
+	if (!strategy || zend_string_equals_literal(strategy, "html")) {
+		return TWIG_ESCAPE_HTML;
+	}
+	if (zend_string_equals_literal(strategy, "js")) {
+		return TWIG_ESCAPE_JS;
+	}
+	if (zend_string_equals_literal(strategy, "css")) {
+		return TWIG_ESCAPE_CSS;
+	}
+	if (zend_string_equals_literal(strategy, "html_attr")) {
+		return TWIG_ESCAPE_HTML_ATTR;
+	}
+	if (zend_string_equals_literal(strategy, "url")) {
+		return TWIG_ESCAPE_URL;
+	}
+	return 0;
+}
+
+/* _twig_escape_js_callback(), _twig_escape_css_callback() and
+ * _twig_escape_html_attr_callback() for a single byte character */
+static void TWIG_ESCAPE_ASCII(smart_str *out, int strategy, unsigned char c)
+{
+	switch (strategy) {
+		case TWIG_ESCAPE_JS:
+			smart_str_appendl(out, "\\x", 2);
+			TWIG_APPEND_HEX(out, c, 2);
+			break;
+
+		case TWIG_ESCAPE_CSS:
+			smart_str_appendc(out, '\\');
+			TWIG_APPEND_HEX(out, c, 0);
+			smart_str_appendc(out, ' ');
+			break;
+
+		case TWIG_ESCAPE_HTML_ATTR:
+			if ((c <= 0x1f && c != '\t' && c != '\n' && c != '\r') || c == 0x7f) {
+				smart_str_appendl(out, "&#xFFFD;", sizeof("&#xFFFD;") - 1);
+			} else if (c == '"') {
+				smart_str_appendl(out, "&quot;", sizeof("&quot;") - 1);
+			} else if (c == '&') {
+				smart_str_appendl(out, "&amp;", sizeof("&amp;") - 1);
+			} else if (c == '<') {
+				smart_str_appendl(out, "&lt;", sizeof("&lt;") - 1);
+			} else if (c == '>') {
+				smart_str_appendl(out, "&gt;", sizeof("&gt;") - 1);
+			} else {
+				smart_str_appendl(out, "&#x", 3);
+				TWIG_APPEND_HEX(out, c, 2);
+				smart_str_appendc(out, ';');
+			}
+			break;
+	}
+}
+
+/* The same for a multibyte character. Only the entity map of
+ * _twig_escape_html_attr_callback() is left out, as it has nothing beyond
+ * ASCII. */
+static void TWIG_ESCAPE_CODE_POINT(smart_str *out, int strategy, uint32_t cp)
+{
+	switch (strategy) {
+		case TWIG_ESCAPE_JS:
+			smart_str_appendl(out, "\\u", 2);
+			TWIG_APPEND_HEX(out, TWIG_UTF16_LAST_UNIT(cp), 4);
+			break;
+
+		case TWIG_ESCAPE_CSS:
+			smart_str_appendc(out, '\\');
+			if (cp < 0x10000) {
+				TWIG_APPEND_HEX(out, cp, 0);
+			} else {
+				TWIG_APPEND_HEX(out, 0xD800 | ((cp - 0x10000) >> 10), 4);
+				TWIG_APPEND_HEX(out, 0xDC00 | ((cp - 0x10000) & 0x3FF), 4);
+			}
+			smart_str_appendc(out, ' ');
+			break;
+
+		case TWIG_ESCAPE_HTML_ATTR:
+			smart_str_appendl(out, "&#x", 3);
+			TWIG_APPEND_HEX(out, TWIG_UTF16_LAST_UNIT(cp), 4);
+			smart_str_appendc(out, ';');
+			break;
+	}
+}
+
+/* Throws a Twig_Error_Runtime that isn't tied to a template */
+static void TWIG_THROW_RUNTIME_ERROR(const char *message)
+{
+	zend_class_entry *ce = TWIG_LOOKUP_CLASS("Twig_Error_Runtime", sizeof("Twig_Error_Runtime") - 1);
+	zval              ex, constructor, arg, retval;
+
+	if (!ce) {
+		return;
+	}
+
+	object_init_ex(&ex, ce);
+	ZVAL_STRING(&arg, message);
+	ZVAL_STRINGL(&constructor, "__construct", sizeof("__construct") - 1);
+	ZVAL_UNDEF(&retval);
+	call_user_function(EG(function_table), &ex, &constructor, &retval, 1, &arg);
+	zval_ptr_dtor(&retval);
+	zval_ptr_dtor(&constructor);
+	zval_ptr_dtor(&arg);
+
+	zend_throw_exception_object(&ex);
+}
+
+/* preg_replace_callback() of the js, css or html_attr strategy over a
+ * UTF-8 string. Returns NULL with an exception thrown if the string isn't
+ * valid UTF-8. */
+static zend_string *TWIG_ESCAPE_UTF8(zend_string *str, int strategy)
+{
+	const unsigned char *s = (const unsigned char *) ZSTR_VAL(str);
+	size_t               len = ZSTR_LEN(str), start = 0, i, n;
+	const unsigned char *safe;
+	const char          *extra;
+	smart_str            out = {0};
+	uint32_t             cp;
+
+	switch (strategy) {
+		case TWIG_ESCAPE_JS:
+			safe = twig_js_safe;
+			extra = TWIG_JS_SAFE;
+			break;
+		case TWIG_ESCAPE_CSS:
+			safe = twig_css_safe;
+			extra = TWIG_CSS_SAFE;
+			break;
+		default:
+			safe = twig_html_attr_safe;
+			extra = TWIG_HTML_ATTR_SAFE;
+			break;
+	}
+
+	i = TWIG_SAFE_SPAN(s, len, safe, extra);
+	if (i == len) {
+		return zend_string_copy(str);
+	}
+
+	smart_str_alloc(&out, len + len / 2, 0);
+	for (;;) {
+		smart_str_appendl(&out, (const char *) s + start, i - start);
+		if (i == len) {
+			break;
+		}
+
+		if (s[i] < 0x80) {
+			TWIG_ESCAPE_ASCII(&out, strategy, s[i]);
+			i++;
+		} else {
+			n = TWIG_UTF8_DECODE(s + i, len - i, &cp);
+			if (!n) {
+				smart_str_free(&out);
+				TWIG_THROW_RUNTIME_ERROR("The string to escape is not a valid UTF-8 string.");
+				return NULL;
+			}
+			TWIG_ESCAPE_CODE_POINT(&out, strategy, cp);
+			i += n;
+		}
+
+		start = i;
+		i += TWIG_SAFE_SPAN(s + i, len - i, safe, extra);
+	}
+
+	smart_str_0(&out);
+	return out.s;
+}
+
+/* htmlspecialchars($string, ENT_QUOTES | ENT_SUBSTITUTE, $charset) for a
+ * charset it supports. ASCII is the same in all of them, so only strings
+ * with other bytes are left to htmlspecialchars() itself. */
+static zend_string *TWIG_HTMLSPECIALCHARS(zend_string *str, const char *charset)
+{
+	const unsigned char *s = (const unsigned char *) ZSTR_VAL(str);
+	size_t               len = ZSTR_LEN(str), start = 0;
+	size_t               i = TWIG_HTML_SAFE_SPAN(s, len);
+	smart_str            out = {0};
+
+	if (i == len) {
+		return zend_string_copy(str);
+	}
+
+	smart_str_alloc(&out, len + len / 4, 0);
+	for (;;) {
+		smart_str_appendl(&out, (const char *) s + start, i - start);
+		if (i == len) {
+			break;
+		}
+
+		switch (s[i]) {
+			case '&':
+				smart_str_appendl(&out, "&amp;", sizeof("&amp;") - 1);
+				break;
+			case '<':
+				smart_str_appendl(&out, "&lt;", sizeof("&lt;") - 1);
+				break;
+			case '>':
+				smart_str_appendl(&out, "&gt;", sizeof("&gt;") - 1);
+				break;
+			case '"':
+				smart_str_appendl(&out, "&quot;", sizeof("&quot;") - 1);
+				break;
+			case '\'':
+				smart_str_appendl(&out, "&#039;", sizeof("&#039;") - 1);
+				break;
+			default:
+				smart_str_free(&out);
+				return php_escape_html_entities((unsigned char *) ZSTR_VAL(str), ZSTR_LEN(str), 0, ENT_QUOTES | ENT_SUBSTITUTE, (char *) charset);
+		}
+
+		start = ++i;
+		i += TWIG_HTML_SAFE_SPAN(s + i, len - i);
+	}
+
+	smart_str_0(&out);
+	return out.s;
+}
+
+/* The charsets twig_escape_filter() hands to htmlspecialchars() straight
+ * away, in any case */
+static const char *twig_htmlspecialchars_charsets[] = {
+	"ISO-8859-1", "ISO8859-1", "ISO-8859-15", "ISO8859-15", "UTF-8",
+	"CP866", "IBM866", "866", "CP1251", "WINDOWS-1251", "WIN-1251", "1251",
+	"CP1252", "WINDOWS-1252", "1252", "KOI8-R", "KOI8-RU", "KOI8R",
+	"BIG5", "950", "GB2312", "936", "BIG5-HKSCS", "SHIFT_JIS", "SJIS", "932",
+	"EUC-JP", "EUCJP", "ISO8859-5", "ISO-8859-5", "MACROMAN",
+	NULL
+};
+
+static int TWIG_IS_HTMLSPECIALCHARS_CHARSET(zend_string *charset)
+{
+	const char **name;
+
+	for (name = twig_htmlspecialchars_charsets; *name; name++) {
+		if (strlen(*name) == ZSTR_LEN(charset) && !strcasecmp(*name, ZSTR_VAL(charset))) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* twig_convert_encoding($string, $to, $from), which is left in userland to
+ * pick between mbstring and iconv. Returns NULL if it threw. */
+static zend_string *TWIG_CONVERT_ENCODING(zend_string *str, const char *to, const char *from)
+{
+	zval function, args[3], retval;
+	zend_string *result = NULL;
+
+	ZVAL_STRINGL(&function, "twig_convert_encoding", sizeof("twig_convert_encoding") - 1);
+	ZVAL_STR_COPY(&args[0], str);
+	ZVAL_STRING(&args[1], to);
+	ZVAL_STRING(&args[2], from);
+	ZVAL_UNDEF(&retval);
+
+	if (call_user_function(EG(function_table), NULL, &function, &retval, 3, args) == SUCCESS && !EG(exception) && !Z_ISUNDEF(retval)) {
+		result = zval_get_string(&retval);
+	}
+
+	zval_ptr_dtor(&retval);
+	zval_ptr_dtor(&args[2]);
+	zval_ptr_dtor(&args[1]);
+	zval_ptr_dtor(&args[0]);
+	zval_ptr_dtor(&function);
+	return result;
+}
+
+/* $env->getCharset(), read from the property as long as the environment
+ * class doesn't override the method */
+static zend_string *TWIG_GET_CHARSET(zval *env)
+{
+	zend_class_entry   *ce = Z_OBJCE_P(env);
+	zend_property_info *info;
+	zval                retval, *charset;
+	zend_string        *result;
+
+	if (TWIG_G(charset_property).ce != ce) {
+		TWIG_G(stock_charset_lookup) = TWIG_IS_STOCK_ENV_METHOD(ce, "getcharset", sizeof("getcharset") - 1);
+	}
+	info = TWIG_FIND_PROPERTY_INFO(&TWIG_G(charset_property), ce, "charset", sizeof("charset") - 1);
+
+	if (info && TWIG_G(stock_charset_lookup)) {
+		charset = OBJ_PROP(Z_OBJ_P(env), info->offset);
+		ZVAL_DEREF(charset);
+		return zval_get_string(charset);
+	}
+
+	ZVAL_UNDEF(&retval);
+	zend_call_method_with_0_params(env, ce, NULL, "getcharset", &retval);
+	if (EG(exception)) {
+		zval_ptr_dtor(&retval);
+		return NULL;
+	}
+	result = zval_get_string(&retval);
+	zval_ptr_dtor(&retval);
+	return result;
+}
+
+/* The escapers added with Twig_Extension_Core::setEscaper(): calls the
+ * one for 'strategy', or complains that there is none */
+static void TWIG_CUSTOM_ESCAPE(zval *env, zend_string *str, zend_string *strategy, zend_string *charset, zval *return_value)
+{
+	zval      name, core, escapers, *escaper, args[3];
+	smart_str valid = {0};
+	char     *message;
+
+	ZVAL_STRINGL(&name, "core", sizeof("core") - 1);
+	ZVAL_UNDEF(&core);
+	zend_call_method_with_1_params(env, Z_OBJCE_P(env), NULL, "getextension", &core, &name);
+	zval_ptr_dtor(&name);
+	if (EG(exception) || Z_TYPE(core) != IS_OBJECT) {
+		zval_ptr_dtor(&core);
+		return;
+	}
+
+	ZVAL_UNDEF(&escapers);
+	zend_call_method_with_0_params(&core, Z_OBJCE(core), NULL, "getescapers", &escapers);
+	zval_ptr_dtor(&core);
+	if (EG(exception) || Z_TYPE(escapers) != IS_ARRAY) {
+		zval_ptr_dtor(&escapers);
+		return;
+	}
+
+	escaper = zend_symtable_find(Z_ARRVAL(escapers), strategy);
+	if (escaper && Z_TYPE_P(escaper) != IS_NULL) {
+		ZVAL_COPY_VALUE(&args[0], env);
+		ZVAL_STR(&args[1], str);
+		ZVAL_STR(&args[2], charset);
+		call_user_function(EG(function_table), NULL, escaper, return_value, 3, args);
+		zval_ptr_dtor(&escapers);
+		return;
+	}
+
+	smart_str_appends(&valid, "html, js, url, css, html_attr");
+	if (zend_hash_num_elements(Z_ARRVAL(escapers))) {
+		smart_str_appends(&valid, ", ");
+		TWIG_IMPLODE_ARRAY_KEYS(&valid, ", ", Z_ARRVAL(escapers));
+	}
+	smart_str_0(&valid);
+
+	spprintf(&message, 0, "Invalid escaping strategy \"%s\" (valid ones: %s).", ZSTR_VAL(strategy), ZSTR_VAL(valid.s));
+	TWIG_THROW_RUNTIME_ERROR(message);
+	efree(message);
+	smart_str_free(&valid);
+	zval_ptr_dtor(&escapers);
+}
+
+/* One of the built-in strategies for 'charset'. Returns NULL if an exception
+ * was thrown. */
+static zend_string *TWIG_ESCAPE(zend_string *str, int strategy, zend_string *charset)
+{
+	zend_string *utf8, *escaped, *result;
+
+	switch (strategy) {
+		case TWIG_ESCAPE_URL:
+			if (TWIG_SAFE_SPAN((const unsigned char *) ZSTR_VAL(str), ZSTR_LEN(str), twig_url_safe, TWIG_URL_SAFE) == ZSTR_LEN(str)) {
+				return zend_string_copy(str);
+			}
+			return php_raw_url_encode(ZSTR_VAL(str), ZSTR_LEN(str));
+
+		case TWIG_ESCAPE_HTML:
+			if (TWIG_IS_HTMLSPECIALCHARS_CHARSET(charset)) {
+				return TWIG_HTMLSPECIALCHARS(str, ZSTR_VAL(charset));
+			}
+			break;
+
+		default:
+			if (zend_string_equals_literal(charset, "UTF-8")) {
+				return TWIG_ESCAPE_UTF8(str, strategy);
+			}
+			break;
+	}
+	/* Another charset: escape its UTF-8 form */
+	utf8 = TWIG_CONVERT_ENCODING(str, "UTF-8", ZSTR_VAL(charset));
+	if (!utf8) {
+		return NULL;
+	}
+	if (strategy == TWIG_ESCAPE_HTML) {
+		escaped = TWIG_HTMLSPECIALCHARS(utf8, "UTF-8");
+	} else {
+		escaped = TWIG_ESCAPE_UTF8(utf8, strategy);
+	}
+	zend_string_release(utf8);
+	if (!escaped) {
+		return NULL;
+	}
+
+	result = TWIG_CONVERT_ENCODING(escaped, ZSTR_VAL(charset), "UTF-8");
+	zend_string_release(escaped);
+	return result;
+}
+
+/* {{{ proto string twig_escape_filter(Twig_Environment env, mixed string [, string strategy [, string charset [, bool autoescape]]])
+   A C implementation of twig_escape_filter() */
+PHP_FUNCTION(twig_escape_filter)
+{
+	zval        *env;
+	zval        *value;
+	zend_string *strategy = NULL;
+	zend_string *charset = NULL;
+	zend_string *str, *result;
+	zend_bool    autoescape = 0;
+	int          builtin;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "oz|SS!b", &env, &value, &strategy, &charset, &autoescape) == FAILURE) {
+		return;
+	}
+
+/*
+	if ($autoescape && $string instanceof Twig_Markup) {
+		return $string;
+	}
+
+	if (!is_string($string)) {
+		if (is_object($string) && method_exists($string, '__toString')) {
+			$string = (string) $string;
+		} else {
+			return $string;
+		}
+	}
+*/
+	if (autoescape && TWIG_INSTANCE_OF_USERLAND(value, "twig_markup", sizeof("twig_markup") - 1)) {
+		RETURN_ZVAL(value, 1, 0);
+	}
+
+	if (Z_TYPE_P(value) == IS_STRING) {
+		str = zend_string_copy(Z_STR_P(value));
+	} else if (Z_TYPE_P(value) == IS_OBJECT && zend_hash_str_exists(&Z_OBJCE_P(value)->function_table, "__tostring", sizeof("__tostring") - 1)) {
+		str = zval_get_string(value);
+		if (EG(exception)) {
+			zend_string_release(str);
+			return;
+		}
+	} else {
+		RETURN_ZVAL(value, 1, 0);
+	}
+
+/*
+	if (null === $charset) {
+		$charset = $env->getCharset();
+	}
+*/
+	if (charset) {
+		charset = zend_string_copy(charset);
+	} else {
+		charset = TWIG_GET_CHARSET(env);
+		if (!charset) {
+			zend_string_release(str);
+			return;
+		}
+	}
+
+	builtin = TWIG_ESCAPE_STRATEGY(strategy);
+	if (builtin) {
+		result = TWIG_ESCAPE(str, builtin, charset);
+		if (result) {
+			RETVAL_STR(result);
+		}
+	} else {
+		TWIG_CUSTOM_ESCAPE(env, str, strategy, charset, return_value);
+	}
+
+	zend_string_release(charset);
+	zend_string_release(str);
+}
+/* }}} */
+
+/* Lexing
+ *
+ * twig_lexer_tokenize() does what Twig_Lexer::tokenize() does with its
+ * regular expressions in one pass over the template, and gives the same
+ * tokens. Twig_Lexer_Native wraps it into a Twig_LexerInterface. */
+
+#define TWIG_LEX_STATE_DATA          0
+#define TWIG_LEX_STATE_BLOCK         1
+#define TWIG_LEX_STATE_VAR           2
+#define TWIG_LEX_STATE_STRING        3
+#define TWIG_LEX_STATE_INTERPOLATION 4
+
+/* The Twig_Token types */
+#define TWIG_TOKEN_EOF                 -1
+#define TWIG_TOKEN_TEXT                0
+#define TWIG_TOKEN_BLOCK_START         1
+#define TWIG_TOKEN_VAR_START           2
+#define TWIG_TOKEN_BLOCK_END           3
+#define TWIG_TOKEN_VAR_END             4
+#define TWIG_TOKEN_NAME                5
+#define TWIG_TOKEN_NUMBER              6
+#define TWIG_TOKEN_STRING              7
+#define TWIG_TOKEN_OPERATOR            8
+#define TWIG_TOKEN_PUNCTUATION         9
+#define TWIG_TOKEN_INTERPOLATION_START 10
+#define TWIG_TOKEN_INTERPOLATION_END   11
+
+/* The kinds of tag a template can open */
+#define TWIG_LEX_TAG_VARIABLE 0
+#define TWIG_LEX_TAG_BLOCK    1
+#define TWIG_LEX_TAG_COMMENT  2
+
+/* What \s matches in PCRE */
+#define TWIG_LEX_IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\v' || (c) == '\f' || (c) == '\r')
+
+/* What rtrim() strips by default */
+#define TWIG_LEX_IS_TRIM(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r' || (c) == '\0' || (c) == '\v')
+
+#define TWIG_LEX_IS_ALPHA(c) (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z'))
+#define TWIG_LEX_IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+/* [a-zA-Z_\x7f-\xff] and [a-zA-Z0-9_\x7f-\xff] of Twig_Lexer::REGEX_NAME */
+#define TWIG_LEX_IS_NAME_START(c) (TWIG_LEX_IS_ALPHA(c) || (c) == '_' || (c) >= 0x7f)
+#define TWIG_LEX_IS_NAME_CHAR(c)  (TWIG_LEX_IS_NAME_START(c) || TWIG_LEX_IS_DIGIT(c))
+
+/* Where a tag opens: what lex_tokens_start matched */
+typedef struct _twig_lex_position {
+	size_t offset;
+	size_t len;   /* of the tag and whitespace_trim */
+	int    kind;
+	int    trim;  /* whether whitespace_trim follows the tag */
+} twig_lex_position;
+
+typedef struct _twig_lex_bracket {
+	const char *open;
+	size_t      open_len;
+	zend_long   lineno;
+} twig_lex_bracket;
+
+typedef struct _twig_lexer {
+	const unsigned char *code;
+	size_t               end;
+	size_t               cursor;
+	zend_long            lineno;
+	zend_long            current_var_block_line;
+	zval                *filename;
+	zval                *tokens;
+
+	int                  state;
+	int                 *states;
+	size_t               states_count;
+	size_t               states_size;
+
+	twig_lex_bracket    *brackets;
+	size_t               brackets_count;
+	size_t               brackets_size;
+
+	twig_lex_position   *positions;
+	size_t               positions_count;
+	zend_long            position;
+
+	zend_string         *tag_comment[2];
+	zend_string         *tag_block[2];
+	zend_string         *tag_variable[2];
+	zend_string         *whitespace_trim;
+	zend_string         *interpolation[2];
+	zend_string        **operators;
+	size_t               operators_count;
+
+	zend_class_entry    *token_ce;
+	zend_property_info  *token_value;
+	zend_property_info  *token_type;
+	zend_property_info  *token_lineno;
+} twig_lexer;
+
+/* Whether 'str' is at 'pos' */
+static int TWIG_LEX_MATCH(twig_lexer *lx, size_t pos, zend_string *str)
+{
+	return ZSTR_LEN(str) <= lx->end - pos && !memcmp(lx->code + pos, ZSTR_VAL(str), ZSTR_LEN(str));
+}
+
+/* Whether 'a' followed by 'b' is at 'pos' */
+static int TWIG_LEX_MATCH2(twig_lexer *lx, size_t pos, zend_string *a, zend_string *b)
+{
+	return TWIG_LEX_MATCH(lx, pos, a) && TWIG_LEX_MATCH(lx, pos + ZSTR_LEN(a), b);
+}
+
+static size_t TWIG_LEX_SKIP_SPACE(twig_lexer *lx, size_t pos)
+{
+	while (pos < lx->end && TWIG_LEX_IS_SPACE(lx->code[pos])) {
+		pos++;
+	}
+	return pos;
+}
+
+/* moveCursor() of the text between the cursor and 'to' */
+static void TWIG_LEX_MOVE_CURSOR(twig_lexer *lx, size_t to)
+{
+	const unsigned char *p = lx->code + lx->cursor, *e = lx->code + to;
+
+	while ((p = memchr(p, '\n', e - p))) {
+		lx->lineno++;
+		p++;
+	}
+	lx->cursor = to;
+}
+
+/* Throws a Twig_Error_Syntax for the template being lexed */
+static void TWIG_LEX_ERROR(twig_lexer *lx, zend_long lineno, const char *message, size_t message_len)
+{
+	zend_class_entry *ce = TWIG_LOOKUP_CLASS("Twig_Error_Syntax", sizeof("Twig_Error_Syntax") - 1);
+	zval              ex, constructor, args[3], retval;
+
+	if (!ce) {
+		return;
+	}
+
+	object_init_ex(&ex, ce);
+	ZVAL_STRINGL(&args[0], message, message_len);
+	ZVAL_LONG(&args[1], lineno);
+	ZVAL_COPY(&args[2], lx->filename);
+	ZVAL_STRINGL(&constructor, "__construct", sizeof("__construct") - 1);
+	ZVAL_UNDEF(&retval);
+	call_user_function(EG(function_table), &ex, &constructor, &retval, 3, args);
+	zval_ptr_dtor(&retval);
+	zval_ptr_dtor(&constructor);
+	zval_ptr_dtor(&args[2]);
+	zval_ptr_dtor(&args[0]);
+
+	zend_throw_exception_object(&ex);
+}
+
+/* 'Unclosed "%s"' for a bracket */
+static void TWIG_LEX_UNCLOSED(twig_lexer *lx, twig_lex_bracket *bracket)
+{
+	smart_str message = {0};
+
+	smart_str_appendl(&message, "Unclosed \"", sizeof("Unclosed \"") - 1);
+	smart_str_appendl(&message, bracket->open, bracket->open_len);
+	smart_str_appendc(&message, '"');
+	smart_str_0(&message);
+
+	TWIG_LEX_ERROR(lx, bracket->lineno, ZSTR_VAL(message.s), ZSTR_LEN(message.s));
+	smart_str_free(&message);
+}
+
+/* 'Unexpected "%s"' and 'Unexpected character "%s"' */
+static void TWIG_LEX_UNEXPECTED(twig_lexer *lx, const char *what, size_t what_len, unsigned char c)
+{
+	smart_str message = {0};
+
+	smart_str_appendl(&message, what, what_len);
+	smart_str_appendc(&message, c);
+	smart_str_appendc(&message, '"');
+	smart_str_0(&message);
+
+	TWIG_LEX_ERROR(lx, lx->lineno, ZSTR_VAL(message.s), ZSTR_LEN(message.s));
+	smart_str_free(&message);
+}
+
+/* pushToken(). Takes over 'value'. */
+static void TWIG_LEX_PUSH_TOKEN(twig_lexer *lx, zend_long type, zval *value)
+{
+	zval token, *slot, constructor, args[3], retval;
+
+	/* do not push empty text tokens */
+	if (type == TWIG_TOKEN_TEXT && Z_TYPE_P(value) == IS_STRING && Z_STRLEN_P(value) == 0) {
+		zval_ptr_dtor(value);
+		return;
+	}
+
+	object_init_ex(&token, lx->token_ce);
+
+	/* Twig_Token::__construct() only sets the three properties, which is
+	 * done straight in their slots when they are where it expects them */
+	if (lx->token_value && lx->token_type && lx->token_lineno) {
+		slot = OBJ_PROP(Z_OBJ(token), lx->token_value->offset);
+		zval_ptr_dtor(slot);
+		ZVAL_COPY_VALUE(slot, value);
+		slot = OBJ_PROP(Z_OBJ(token), lx->token_type->offset);
+		zval_ptr_dtor(slot);
+		ZVAL_LONG(slot, type);
+		slot = OBJ_PROP(Z_OBJ(token), lx->token_lineno->offset);
+		zval_ptr_dtor(slot);
+		ZVAL_LONG(slot, lx->lineno);
+	} else {
+		ZVAL_LONG(&args[0], type);
+		ZVAL_COPY_VALUE(&args[1], value);
+		ZVAL_LONG(&args[2], lx->lineno);
+		ZVAL_STRINGL(&constructor, "__construct", sizeof("__construct") - 1);
+		ZVAL_UNDEF(&retval);
+		call_user_function(EG(function_table), &token, &constructor, &retval, 3, args);
+		zval_ptr_dtor(&retval);
+		zval_ptr_dtor(&constructor);
+		zval_ptr_dtor(&args[1]);
+	}
+
+	add_next_index_zval(lx->tokens, &token);
+}
+
+static void TWIG_LEX_PUSH_EMPTY_TOKEN(twig_lexer *lx, zend_long type)
+{
+	zval value;
+
+	ZVAL_EMPTY_STRING(&value);
+	TWIG_LEX_PUSH_TOKEN(lx, type, &value);
+}
+
+static void TWIG_LEX_PUSH_STRING_TOKEN(twig_lexer *lx, zend_long type, size_t start, size_t len)
+{
+	zval value;
+
+	ZVAL_STRINGL(&value, (const char *) lx->code + start, len);
+	TWIG_LEX_PUSH_TOKEN(lx, type, &value);
+}
+
+/* A string token, with stripcslashes() applied */
+static void TWIG_LEX_PUSH_UNESCAPED_TOKEN(twig_lexer *lx, size_t start, size_t len)
+{
+	zend_string *str = zend_string_init((const char *) lx->code + start, len, 0);
+	zval         value;
+
+	php_stripcslashes(str);
+	ZVAL_STR(&value, str);
+	TWIG_LEX_PUSH_TOKEN(lx, TWIG_TOKEN_STRING, &value);
+}
+
+static void TWIG_LEX_PUSH_STATE(twig_lexer *lx, int state)
+{
+	if (lx->states_count == lx->states_size) {
+		lx->states_size = lx->states_size ? lx->states_size * 2 : 8;
+		lx->states = erealloc(lx->states, lx->states_size * sizeof(int));
+	}
+	lx->states[lx->states_count++] = lx->state;
+	lx->state = state;
+}
+
+static void TWIG_LEX_POP_STATE(twig_lexer *lx)
+{
+	/* Every state but the first is pushed before it is popped */
+	lx->state = lx->states[--lx->states_count];
+}
+
+static void TWIG_LEX_PUSH_BRACKET(twig_lexer *lx, const char *open, size_t open_len)
+{
+	if (lx->brackets_count == lx->brackets_size) {
+		lx->brackets_size = lx->brackets_size ? lx->brackets_size * 2 : 8;
+		lx->brackets = erealloc(lx->brackets, lx->brackets_size * sizeof(twig_lex_bracket));
+	}
+	lx->brackets[lx->brackets_count].open = open;
+	lx->brackets[lx->brackets_count].open_len = open_len;
+	lx->brackets[lx->brackets_count].lineno = lx->lineno;
+	lx->brackets_count++;
+}
+
+/* preg_match_all() of lex_tokens_start: where each tag opens, in order,
+ * without overlaps */
+static void TWIG_LEX_FIND_POSITIONS(twig_lexer *lx)
+{
+	zend_string *starts[3];
+	size_t       pos = 0, size = 0, len;
+	int          kind;
+
+	starts[TWIG_LEX_TAG_VARIABLE] = lx->tag_variable[0];
+	starts[TWIG_LEX_TAG_BLOCK] = lx->tag_block[0];
+	starts[TWIG_LEX_TAG_COMMENT] = lx->tag_comment[0];
+
+	while (pos < lx->end) {
+		for (kind = 0; kind < 3; kind++) {
+			if (lx->code[pos] == (unsigned char) ZSTR_VAL(starts[kind])[0] && TWIG_LEX_MATCH(lx, pos, starts[kind])) {
+				break;
+			}
+		}
+		if (kind == 3) {
+			pos++;
+			continue;
+		}
+
+		if (lx->positions_count == size) {
+			size = size ? size * 2 : 32;
+			lx->positions = erealloc(lx->positions, size * sizeof(twig_lex_position));
+		}
+		len = ZSTR_LEN(starts[kind]);
+		lx->positions[lx->positions_count].offset = pos;
+		lx->positions[lx->positions_count].kind = kind;
+		lx->positions[lx->positions_count].trim = TWIG_LEX_MATCH(lx, pos + len, lx->whitespace_trim);
+		if (lx->positions[lx->positions_count].trim) {
+			len += ZSTR_LEN(lx->whitespace_trim);
+		}
+		lx->positions[lx->positions_count].len = len;
+		lx->positions_count++;
+		pos += len;
+	}
+}
+
+/* \s*(?:-%}\s*|\s*%}) at 'pos', which lex_block, lex_block_raw and
+ * lex_raw_data end with. Returns where it ends, or 0. */
+static size_t TWIG_LEX_MATCH_BLOCK_END(twig_lexer *lx, size_t pos)
+{
+	pos = TWIG_LEX_SKIP_SPACE(lx, pos);
+	if (TWIG_LEX_MATCH2(lx, pos, lx->whitespace_trim, lx->tag_block[1])) {
+		return TWIG_LEX_SKIP_SPACE(lx, pos + ZSTR_LEN(lx->whitespace_trim) + ZSTR_LEN(lx->tag_block[1]));
+	}
+	if (TWIG_LEX_MATCH(lx, pos, lx->tag_block[1])) {
+		return pos + ZSTR_LEN(lx->tag_block[1]);
+	}
+	return 0;
+}
+
+/* lex_raw_data: finds the end tag of a raw or verbatim block, which was
+ * opened with the tag at the cursor, and pushes what is in between */
+static int TWIG_LEX_RAW_DATA(twig_lexer *lx, const char *tag, size_t tag_len)
+{
+	zend_string *open[2];
+	size_t       pos, at, match_start = 0, match_end = 0, text_len;
+	int          alt, trim = 0;
+	char        *message;
+
+	open[0] = zend_string_alloc(ZSTR_LEN(lx->tag_block[0]) + ZSTR_LEN(lx->whitespace_trim), 0);
+	memcpy(ZSTR_VAL(open[0]), ZSTR_VAL(lx->tag_block[0]), ZSTR_LEN(lx->tag_block[0]));
+	memcpy(ZSTR_VAL(open[0]) + ZSTR_LEN(lx->tag_block[0]), ZSTR_VAL(lx->whitespace_trim), ZSTR_LEN(lx->whitespace_trim) + 1);
+	open[1] = lx->tag_block[0];
+
+	for (at = lx->cursor; at < lx->end && !match_end; at++) {
+		if (lx->code[at] != (unsigned char) ZSTR_VAL(lx->tag_block[0])[0]) {
+			continue;
+		}
+		for (alt = 0; alt < 2; alt++) {
+			if (!TWIG_LEX_MATCH(lx, at, open[alt])) {
+				continue;
+			}
+			pos = TWIG_LEX_SKIP_SPACE(lx, at + ZSTR_LEN(open[alt]));
+			if (lx->end - pos < 3 + tag_len || memcmp(lx->code + pos, "end", 3) || memcmp(lx->code + pos + 3, tag, tag_len)) {
+				continue;
+			}
+			match_end = TWIG_LEX_MATCH_BLOCK_END(lx, pos + 3 + tag_len);
+			if (match_end) {
+				match_start = at;
+				trim = php_memnstr(ZSTR_VAL(open[alt]), ZSTR_VAL(lx->whitespace_trim), ZSTR_LEN(lx->whitespace_trim), ZSTR_VAL(open[alt]) + ZSTR_LEN(open[alt])) != NULL;
+				break;
+			}
+		}
+	}
+	zend_string_release(open[0]);
+
+	if (!match_end) {
+		spprintf(&message, 0, "Unexpected end of file: Unclosed \"%.*s\" block", (int) tag_len, tag);
+		TWIG_LEX_ERROR(lx, lx->lineno, message, strlen(message));
+		efree(message);
+		return FAILURE;
+	}
+
+	pos = lx->cursor;
+	text_len = match_start - pos;
+	TWIG_LEX_MOVE_CURSOR(lx, match_end);
+
+	if (trim) {
+		while (text_len && TWIG_LEX_IS_TRIM(lx->code[pos + text_len - 1])) {
+			text_len--;
+		}
+	}
+	TWIG_LEX_PUSH_STRING_TOKEN(lx, TWIG_TOKEN_TEXT, pos, text_len);
+	return SUCCESS;
+}
+
+/* lexComment() */
+static int TWIG_LEX_COMMENT(twig_lexer *lx)
+{
+	zend_string *trim = lx->whitespace_trim, *end = lx->tag_comment[1];
+	size_t       at;
+
+	for (at = lx->cursor; at < lx->end; at++) {
+		if (lx->code[at] == (unsigned char) ZSTR_VAL(trim)[0] && TWIG_LEX_MATCH2(lx, at, trim, end)) {
+			TWIG_LEX_MOVE_CURSOR(lx, TWIG_LEX_SKIP_SPACE(lx, at + ZSTR_LEN(trim) + ZSTR_LEN(end)));
+			return SUCCESS;
+		}
+		if (lx->code[at] == (unsigned char) ZSTR_VAL(end)[0] && TWIG_LEX_MATCH(lx, at, end)) {
+			at += ZSTR_LEN(end);
+			if (at < lx->end && lx->code[at] == '\n') {
+				at++;
+			}
+			TWIG_LEX_MOVE_CURSOR(lx, at);
+			return SUCCESS;
+		}
+	}
+
+	TWIG_LEX_ERROR(lx, lx->lineno, "Unclosed comment", sizeof("Unclosed comment") - 1);
+	return FAILURE;
+}
+
+/* lexData() */
+static int TWIG_LEX_DATA(twig_lexer *lx)
+{
+	twig_lex_position *position;
+	size_t             text_len, pos, digits;
+	const char        *tag;
+	size_t             tag_len = 0;
+
+	/* if no matches are left we return the rest of the template as simple text token */
+	if (lx->position == (zend_long) lx->positions_count - 1) {
+		TWIG_LEX_PUSH_STRING_TOKEN(lx, TWIG_TOKEN_TEXT, lx->cursor, lx->end - lx->cursor);
+		lx->cursor = lx->end;
+		return SUCCESS;
+	}
+
+	/* Find the first token after the current cursor */
+	position = &lx->positions[++lx->position];
+	while (position->offset < lx->cursor) {
+		if (lx->position == (zend_long) lx->positions_count - 1) {
+			return SUCCESS;
+		}
+		position = &lx->positions[++lx->position];
+	}
+
+	/* push the template text first */
+	text_len = position->offset - lx->cursor;
+	if (position->trim) {
+		while (text_len && TWIG_LEX_IS_TRIM(lx->code[lx->cursor + text_len - 1])) {
+			text_len--;
+		}
+	}
+	TWIG_LEX_PUSH_STRING_TOKEN(lx, TWIG_TOKEN_TEXT, lx->cursor, text_len);
+	TWIG_LEX_MOVE_CURSOR(lx, position->offset + position->len);
+
+	switch (position->kind) {
+		case TWIG_LEX_TAG_COMMENT:
+			return TWIG_LEX_COMMENT(lx);
+
+		case TWIG_LEX_TAG_BLOCK:
+			/* raw data? */
+			pos = TWIG_LEX_SKIP_SPACE(lx, lx->cursor);
+			tag = NULL;
+			if (lx->end - pos >= 3 && !memcmp(lx->code + pos, "raw", 3)) {
+				tag = "raw";
+				tag_len = 3;
+			} else if (lx->end - pos >= 8 && !memcmp(lx->code + pos, "verbatim", 8)) {
+				tag = "verbatim";
+				tag_len = 8;
+			}
+			if (tag && (pos = TWIG_LEX_MATCH_BLOCK_END(lx, pos + tag_len))) {
+				TWIG_LEX_MOVE_CURSOR(lx, pos);
+				return TWIG_LEX_RAW_DATA(lx, tag, tag_len);
+			}
+
+			/* {% line \d+ %} */
+			pos = TWIG_LEX_SKIP_SPACE(lx, lx->cursor);
+			if (lx->end - pos > 4 && !memcmp(lx->code + pos, "line", 4) && TWIG_LEX_IS_SPACE(lx->code[pos + 4])) {
+				pos = TWIG_LEX_SKIP_SPACE(lx, pos + 4);
+				for (digits = pos; digits < lx->end && TWIG_LEX_IS_DIGIT(lx->code[digits]); digits++);
+				if (digits > pos) {
+					size_t lineno_start = pos;
+
+					pos = TWIG_LEX_SKIP_SPACE(lx, digits);
+					if (TWIG_LEX_MATCH(lx, pos, lx->tag_block[1])) {
+						TWIG_LEX_MOVE_CURSOR(lx, pos + ZSTR_LEN(lx->tag_block[1]));
+						lx->lineno = ZEND_STRTOL((const char *) lx->code + lineno_start, NULL, 10);
+						return SUCCESS;
+					}
+				}
+			}
+
+			TWIG_LEX_PUSH_EMPTY_TOKEN(lx, TWIG_TOKEN_BLOCK_START);
+			TWIG_LEX_PUSH_STATE(lx, TWIG_LEX_STATE_BLOCK);
+			lx->current_var_block_line = lx->lineno;
+			break;
+
+		case TWIG_LEX_TAG_VARIABLE:
+			TWIG_LEX_PUSH_EMPTY_TOKEN(lx, TWIG_TOKEN_VAR_START);
+			TWIG_LEX_PUSH_STATE(lx, TWIG_LEX_STATE_VAR);
+			lx->current_var_block_line = lx->lineno;
+			break;
+	}
+	return SUCCESS;
+}
+
+/* One of the operators of the environment at the cursor, with whitespace
+ * in it matching any amount of whitespace and a trailing letter having to
+ * be followed by whitespace or a parenthesis. Returns where it ends, or 0. */
+static size_t TWIG_LEX_MATCH_OPERATOR(twig_lexer *lx, zend_string *op)
+{
+	const unsigned char *o = (const unsigned char *) ZSTR_VAL(op), *e = o + ZSTR_LEN(op);
+	size_t               pos = lx->cursor;
+
+	while (o < e) {
+		if (TWIG_LEX_IS_SPACE(*o)) {
+			if (pos >= lx->end || !TWIG_LEX_IS_SPACE(lx->code[pos])) {
+				return 0;
+			}
+			pos = TWIG_LEX_SKIP_SPACE(lx, pos);
+			while (o < e && TWIG_LEX_IS_SPACE(*o)) {
+				o++;
+			}
+			continue;
+		}
+		if (pos >= lx->end || lx->code[pos] != *o) {
+			return 0;
+		}
+		pos++;
+		o++;
+	}
+
+	if (TWIG_LEX_IS_ALPHA(e[-1])) {
+		if (pos >= lx->end || !(TWIG_LEX_IS_SPACE(lx->code[pos]) || lx->code[pos] == '(' || lx->code[pos] == ')')) {
+			return 0;
+		}
+	}
+	return pos;
+}
+
+/* REGEX_STRING at the cursor. Returns where it ends, or 0. */
+static size_t TWIG_LEX_MATCH_STRING(twig_lexer *lx)
+{
+	unsigned char quote = lx->code[lx->cursor], c;
+	size_t        pos = lx->cursor + 1;
+
+	if (quote != '"' && quote != '\'') {
+		return 0;
+	}
+	while (pos < lx->end) {
+		c = lx->code[pos];
+		if (c == quote) {
+			return pos + 1;
+		}
+		if (c == '\\') {
+			if (pos + 1 >= lx->end) {
+				return 0;
+			}
+			pos += 2;
+			continue;
+		}
+		if (c == '#' && quote == '"') {
+			return 0;
+		}
+		pos++;
+	}
+	return 0;
+}
+
+/* lexExpression() */
+static int TWIG_LEX_EXPRESSION(twig_lexer *lx)
+{
+	size_t        pos, i, k, len;
+	unsigned char c;
+	zend_string  *str;
+	zval          value;
+	int           is_float;
+	char         *message;
+
+	/* whitespace */
+	if (TWIG_LEX_IS_SPACE(lx->code[lx->cursor])) {
+		TWIG_LEX_MOVE_CURSOR(lx, TWIG_LEX_SKIP_SPACE(lx, lx->cursor));
+
+		if (lx->cursor >= lx->end) {
+			spprintf(&message, 0, "Unclosed \"%s\"", lx->state == TWIG_LEX_STATE_BLOCK ? "block" : "variable");
+			TWIG_LEX_ERROR(lx, lx->current_var_block_line, message, strlen(message));
+			efree(message);
+			return FAILURE;
+		}
+	}
+
+	c = lx->code[lx->cursor];
+
+	/* operators */
+	for (i = 0; i < lx->operators_count; i++) {
+		if ((unsigned char) ZSTR_VAL(lx->operators[i])[0] != c || !(pos = TWIG_LEX_MATCH_OPERATOR(lx, lx->operators[i]))) {
+			continue;
+		}
+
+		/* preg_replace('/\s+/', ' ', $match[0]) */
+		str = zend_string_alloc(pos - lx->cursor, 0);
+		for (k = lx->cursor, len = 0; k < pos; ) {
+			if (TWIG_LEX_IS_SPACE(lx->code[k])) {
+				ZSTR_VAL(str)[len++] = ' ';
+				while (k < pos && TWIG_LEX_IS_SPACE(lx->code[k])) {
+					k++;
+				}
+			} else {
+				ZSTR_VAL(str)[len++] = lx->code[k++];
+			}
+		}
+		ZSTR_VAL(str)[len] = '\0';
+		ZSTR_LEN(str) = len;
+
+		ZVAL_STR(&value, str);
+		TWIG_LEX_PUSH_TOKEN(lx, TWIG_TOKEN_OPERATOR, &value);
+		TWIG_LEX_MOVE_CURSOR(lx, pos);
+		return SUCCESS;
+	}
+
+	/* names */
+	if (TWIG_LEX_IS_NAME_START(c)) {
+		for (pos = lx->cursor + 1; pos < lx->end && TWIG_LEX_IS_NAME_CHAR(lx->code[pos]); pos++);
+		TWIG_LEX_PUSH_STRING_TOKEN(lx, TWIG_TOKEN_NAME, lx->cursor, pos - lx->cursor);
+		TWIG_LEX_MOVE_CURSOR(lx, pos);
+		return SUCCESS;
+	}
+
+	/* numbers */
+	if (TWIG_LEX_IS_DIGIT(c)) {
+		for (pos = lx->cursor + 1; pos < lx->end && TWIG_LEX_IS_DIGIT(lx->code[pos]); pos++);
+		is_float = 0;
+		if (pos + 1 < lx->end && lx->code[pos] == '.' && TWIG_LEX_IS_DIGIT(lx->code[pos + 1])) {
+			for (pos += 2; pos < lx->end && TWIG_LEX_IS_DIGIT(lx->code[pos]); pos++);
+			is_float = 1;
+		}
+
+		/* floats, and integers lower than the maximum */
+		str = zend_string_init((const char *) lx->code + lx->cursor, pos - lx->cursor, 0);
+		ZVAL_DOUBLE(&value, zend_strtod(ZSTR_VAL(str), NULL));
+		if (!is_float && Z_DVAL(value) <= (double) ZEND_LONG_MAX) {
+			ZVAL_LONG(&value, ZEND_STRTOL(ZSTR_VAL(str), NULL, 10));
+		}
+		zend_string_release(str);
+
+		TWIG_LEX_PUSH_TOKEN(lx, TWIG_TOKEN_NUMBER, &value);
+		TWIG_LEX_MOVE_CURSOR(lx, pos);
+		return SUCCESS;
+	}
+
+	/* punctuation */
+	if (c && strchr("()[]{}?:.,|", c)) {
+		if (strchr("([{", c)) {
+			/* opening bracket */
+			TWIG_LEX_PUSH_BRACKET(lx, (const char *) lx->code + lx->cursor, 1);
+		} else if (strchr(")]}", c)) {
+			/* closing bracket */
+			twig_lex_bracket *bracket;
+
+			if (!lx->brackets_count) {
+				TWIG_LEX_UNEXPECTED(lx, "Unexpected \"", sizeof("Unexpected \"") - 1, c);
+				return FAILURE;
+			}
+
+			bracket = &lx->brackets[--lx->brackets_count];
+			if (bracket->open_len != 1 || c != (bracket->open[0] == '(' ? ')' : bracket->open[0] == '[' ? ']' : bracket->open[0] == '{' ? '}' : bracket->open[0])) {
+				TWIG_LEX_UNCLOSED(lx, bracket);
+				return FAILURE;
+			}
+		}
+
+		TWIG_LEX_PUSH_STRING_TOKEN(lx, TWIG_TOKEN_PUNCTUATION, lx->cursor, 1);
+		lx->cursor++;
+		return SUCCESS;
+	}
+
+	/* strings */
+	if ((pos = TWIG_LEX_MATCH_STRING(lx))) {
+		TWIG_LEX_PUSH_UNESCAPED_TOKEN(lx, lx->cursor + 1, pos - lx->cursor - 2);
+		TWIG_LEX_MOVE_CURSOR(lx, pos);
+		return SUCCESS;
+	}
+
+	/* opening double quoted string */
+	if (c == '"') {
+		TWIG_LEX_PUSH_BRACKET(lx, "\"", 1);
+		TWIG_LEX_PUSH_STATE(lx, TWIG_LEX_STATE_STRING);
+		lx->cursor++;
+		return SUCCESS;
+	}
+
+	/* unlexable */
+	TWIG_LEX_UNEXPECTED(lx, "Unexpected character \"", sizeof("Unexpected character \"") - 1, c);
+	return FAILURE;
+}
+
+/* lexBlock() and lexVar() */
+static int TWIG_LEX_TAG(twig_lexer *lx)
+{
+	size_t pos = 0, end_pos;
+
+	if (!lx->brackets_count) {
+		if (lx->state == TWIG_LEX_STATE_BLOCK) {
+			if ((pos = TWIG_LEX_MATCH_BLOCK_END(lx, lx->cursor)) && pos < lx->end && lx->code[pos] == '\n') {
+				pos++;
+			}
+		} else {
+			end_pos = TWIG_LEX_SKIP_SPACE(lx, lx->cursor);
+			if (TWIG_LEX_MATCH2(lx, end_pos, lx->whitespace_trim, lx->tag_variable[1])) {
+				pos = TWIG_LEX_SKIP_SPACE(lx, end_pos + ZSTR_LEN(lx->whitespace_trim) + ZSTR_LEN(lx->tag_variable[1]));
+			} else if (TWIG_LEX_MATCH(lx, end_pos, lx->tag_variable[1])) {
+				pos = end_pos + ZSTR_LEN(lx->tag_variable[1]);
+			}
+		}
+	}
+
+	if (!pos) {
+		return TWIG_LEX_EXPRESSION(lx);
+	}
+
+	TWIG_LEX_PUSH_EMPTY_TOKEN(lx, lx->state == TWIG_LEX_STATE_BLOCK ? TWIG_TOKEN_BLOCK_END : TWIG_TOKEN_VAR_END);
+	TWIG_LEX_MOVE_CURSOR(lx, pos);
+	TWIG_LEX_POP_STATE(lx);
+	return SUCCESS;
+}
+
+/* lexString() */
+static int TWIG_LEX_STRING(twig_lexer *lx)
+{
+	size_t        pos;
+	unsigned char c;
+
+	if (TWIG_LEX_MATCH(lx, lx->cursor, lx->interpolation[0])) {
+		TWIG_LEX_PUSH_BRACKET(lx, ZSTR_VAL(lx->interpolation[0]), ZSTR_LEN(lx->interpolation[0]));
+		TWIG_LEX_PUSH_EMPTY_TOKEN(lx, TWIG_TOKEN_INTERPOLATION_START);
+		TWIG_LEX_MOVE_CURSOR(lx, TWIG_LEX_SKIP_SPACE(lx, lx->cursor + ZSTR_LEN(lx->interpolation[0])));
+		TWIG_LEX_PUSH_STATE(lx, TWIG_LEX_STATE_INTERPOLATION);
+		return SUCCESS;
+	}
+
+	/* REGEX_DQ_STRING_PART: up to a quote or an interpolation */
+	for (pos = lx->cursor; pos < lx->end; ) {
+		c = lx->code[pos];
+		if (c == '\\' && pos + 1 < lx->end) {
+			pos += 2;
+		} else if (c == '#' && (pos + 1 >= lx->end || lx->code[pos + 1] != '{')) {
+			pos++;
+		} else if (c != '#' && c != '"' && c != '\\') {
+			pos++;
+		} else {
+			break;
+		}
+	}
+	if (pos > lx->cursor) {
+		TWIG_LEX_PUSH_UNESCAPED_TOKEN(lx, lx->cursor, pos - lx->cursor);
+		TWIG_LEX_MOVE_CURSOR(lx, pos);
+		return SUCCESS;
+	}
+
+	if (lx->code[lx->cursor] == '"') {
+		lx->brackets_count--;
+		TWIG_LEX_POP_STATE(lx);
+		lx->cursor++;
+		return SUCCESS;
+	}
+
+	/* A trailing backslash, or a "#{" that isn't the interpolation, which
+	 * Twig_Lexer would keep looking at forever */
+	TWIG_LEX_UNCLOSED(lx, &lx->brackets[lx->brackets_count - 1]);
+	return FAILURE;
+}
+
+/* lexInterpolation() */
+static int TWIG_LEX_INTERPOLATION(twig_lexer *lx)
+{
+	twig_lex_bracket *bracket = lx->brackets_count ? &lx->brackets[lx->brackets_count - 1] : NULL;
+	size_t            pos;
+
+	if (bracket && bracket->open_len == ZSTR_LEN(lx->interpolation[0]) && !memcmp(bracket->open, ZSTR_VAL(lx->interpolation[0]), bracket->open_len)) {
+		pos = TWIG_LEX_SKIP_SPACE(lx, lx->cursor);
+		if (TWIG_LEX_MATCH(lx, pos, lx->interpolation[1])) {
+			lx->brackets_count--;
+			TWIG_LEX_PUSH_EMPTY_TOKEN(lx, TWIG_TOKEN_INTERPOLATION_END);
+			TWIG_LEX_MOVE_CURSOR(lx, pos + ZSTR_LEN(lx->interpolation[1]));
+			TWIG_LEX_POP_STATE(lx);
+			return SUCCESS;
+		}
+	}
+	return TWIG_LEX_EXPRESSION(lx);
+}
+
+static zend_property_info *TWIG_LEX_TOKEN_PROPERTY(zend_class_entry *ce, const char *name, size_t name_len)
+{
+	zend_property_info *info = zend_hash_str_find_ptr(&ce->properties_info, name, name_len);
+
+	return info && !(info->flags & ZEND_ACC_STATIC) ? info : NULL;
+}
+
+/* Reads $options['name'][index], which has to be a non-empty string */
+static zend_string *TWIG_LEX_OPTION(HashTable *options, const char *name, size_t name_len, zend_long index)
+{
+	zval *option = zend_hash_str_find(options, name, name_len);
+
+	if (option && index >= 0) {
+		ZVAL_DEREF(option);
+		option = Z_TYPE_P(option) == IS_ARRAY ? zend_hash_index_find(Z_ARRVAL_P(option), index) : NULL;
+	}
+	if (!option) {
+		return NULL;
+	}
+	ZVAL_DEREF(option);
+
+	return Z_TYPE_P(option) == IS_STRING && Z_STRLEN_P(option) ? Z_STR_P(option) : NULL;
+}
+
+/* {{{ proto array|false twig_lexer_tokenize(string code, string filename, array options, array operators)
+   Tokenizes a template like Twig_Lexer::tokenize(), and returns the tokens.
+   The operators have to be sorted the way Twig_Lexer::getOperatorRegex()
+   sorts them. Returns false for options it can't handle. */
+PHP_FUNCTION(twig_lexer_tokenize)
+{
+	zend_string *code;
+	zval        *filename;
+	HashTable   *options, *operators;
+	twig_lexer   lx;
+	zval        *op;
+	int          result = SUCCESS;
+	size_t       i;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "Szhh", &code, &filename, &options, &operators) == FAILURE) {
+		return;
+	}
+
+	memset(&lx, 0, sizeof(lx));
+	lx.position = -1;
+	lx.lineno = 1;
+	lx.filename = filename;
+	lx.tokens = return_value;
+
+	lx.tag_comment[0] = TWIG_LEX_OPTION(options, "tag_comment", sizeof("tag_comment") - 1, 0);
+	lx.tag_comment[1] = TWIG_LEX_OPTION(options, "tag_comment", sizeof("tag_comment") - 1, 1);
+	lx.tag_block[0] = TWIG_LEX_OPTION(options, "tag_block", sizeof("tag_block") - 1, 0);
+	lx.tag_block[1] = TWIG_LEX_OPTION(options, "tag_block", sizeof("tag_block") - 1, 1);
+	lx.tag_variable[0] = TWIG_LEX_OPTION(options, "tag_variable", sizeof("tag_variable") - 1, 0);
+	lx.tag_variable[1] = TWIG_LEX_OPTION(options, "tag_variable", sizeof("tag_variable") - 1, 1);
+	lx.whitespace_trim = TWIG_LEX_OPTION(options, "whitespace_trim", sizeof("whitespace_trim") - 1, -1);
+	lx.interpolation[0] = TWIG_LEX_OPTION(options, "interpolation", sizeof("interpolation") - 1, 0);
+	lx.interpolation[1] = TWIG_LEX_OPTION(options, "interpolation", sizeof("interpolation") - 1, 1);
+
+	if (!lx.tag_comment[0] || !lx.tag_comment[1] || !lx.tag_block[0] || !lx.tag_block[1] ||
+		!lx.tag_variable[0] || !lx.tag_variable[1] || !lx.whitespace_trim ||
+		!lx.interpolation[0] || !lx.interpolation[1]
+	) {
+		RETURN_FALSE;
+	}
+
+	lx.token_ce = TWIG_LOOKUP_CLASS("Twig_Token", sizeof("Twig_Token") - 1);
+	if (!lx.token_ce) {
+		RETURN_FALSE;
+	}
+	lx.token_value = TWIG_LEX_TOKEN_PROPERTY(lx.token_ce, "value", sizeof("value") - 1);
+	lx.token_type = TWIG_LEX_TOKEN_PROPERTY(lx.token_ce, "type", sizeof("type") - 1);
+	lx.token_lineno = TWIG_LEX_TOKEN_PROPERTY(lx.token_ce, "lineno", sizeof("lineno") - 1);
+
+	lx.operators = safe_emalloc(zend_hash_num_elements(operators), sizeof(zend_string *), 0);
+	ZEND_HASH_FOREACH_VAL(operators, op) {
+		ZVAL_DEREF(op);
+		if (Z_TYPE_P(op) == IS_STRING && Z_STRLEN_P(op)) {
+			lx.operators[lx.operators_count++] = Z_STR_P(op);
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	/* str_replace(array("\r\n", "\r"), "\n", $code) */
+	if (memchr(ZSTR_VAL(code), '\r', ZSTR_LEN(code))) {
+		zend_string *normalized = zend_string_alloc(ZSTR_LEN(code), 0);
+		size_t       len = 0;
+
+		for (i = 0; i < ZSTR_LEN(code); i++) {
+			if (ZSTR_VAL(code)[i] == '\r') {
+				ZSTR_VAL(normalized)[len++] = '\n';
+				if (i + 1 < ZSTR_LEN(code) && ZSTR_VAL(code)[i + 1] == '\n') {
+					i++;
+				}
+			} else {
+				ZSTR_VAL(normalized)[len++] = ZSTR_VAL(code)[i];
+			}
+		}
+		ZSTR_VAL(normalized)[len] = '\0';
+		ZSTR_LEN(normalized) = len;
+		code = normalized;
+	} else {
+		zend_string_addref(code);
+	}
+	lx.code = (const unsigned char *) ZSTR_VAL(code);
+	lx.end = ZSTR_LEN(code);
+
+	array_init(return_value);
+
+	/* find all token starts in one go */
+	TWIG_LEX_FIND_POSITIONS(&lx);
+
+	while (result == SUCCESS && lx.cursor < lx.end) {
+		/* dispatch to the lexing functions depending on the current state */
+		switch (lx.state) {
+			case TWIG_LEX_STATE_DATA:
+				result = TWIG_LEX_DATA(&lx);
+				break;
+
+			case TWIG_LEX_STATE_BLOCK:
+			case TWIG_LEX_STATE_VAR:
+				result = TWIG_LEX_TAG(&lx);
+				break;
+
+			case TWIG_LEX_STATE_STRING:
+				result = TWIG_LEX_STRING(&lx);
+				break;
+
+			case TWIG_LEX_STATE_INTERPOLATION:
+				result = TWIG_LEX_INTERPOLATION(&lx);
+				break;
+		}
+		if (EG(exception)) {
+			result = FAILURE;
+		}
+	}
+
+	if (result == SUCCESS) {
+		TWIG_LEX_PUSH_EMPTY_TOKEN(&lx, TWIG_TOKEN_EOF);
+
+		if (lx.brackets_count) {
+			TWIG_LEX_UNCLOSED(&lx, &lx.brackets[lx.brackets_count - 1]);
+		}
+	}
+
+	if (lx.positions) {
+		efree(lx.positions);
+	}
+	if (lx.brackets) {
+		efree(lx.brackets);
+	}
+	if (lx.states) {
+		efree(lx.states);
+	}
+	efree(lx.operators);
+	zend_string_release(code);
+}
+/* }}} */
+
+/* Loops and filters
+ *
+ * twig_ensure_traversable(), which every {% for %} calls, and the filters
+ * that templates call most in loops. Arrays, UTF-8 strings and Countable
+ * objects are handled here; other values go to the PHP functions that the
+ * userland versions call, so that they behave the same. */
+
+/* The number of bytes mbstring takes a UTF-8 character starting with a
+ * byte to be, which is also what it goes by for broken ones */
+static const unsigned char twig_utf8_mblen[256] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 1, 1
+};
+
+/* Moves 'pos' forward by 'chars' UTF-8 characters, or to the end */
+static size_t TWIG_UTF8_SKIP(const unsigned char *s, size_t len, size_t pos, zend_long chars)
+{
+	while (chars-- > 0 && pos < len) {
+		pos += twig_utf8_mblen[s[pos]];
+	}
+	return pos > len ? len : pos;
+}
+
+/* mb_strlen($str, 'UTF-8') */
+static zend_long TWIG_UTF8_STRLEN(zend_string *str)
+{
+	const unsigned char *s = (const unsigned char *) ZSTR_VAL(str);
+	size_t               pos = 0;
+	zend_long            chars = 0;
+
+	while (pos < ZSTR_LEN(str)) {
+		pos += twig_utf8_mblen[s[pos]];
+		chars++;
+	}
+	return chars;
+}
+
+static int TWIG_IS_UTF8(zend_string *charset)
+{
+	return zend_string_equals_literal_ci(charset, "UTF-8");
+}
+
+/* What function_exists('mb_get_info') says, which Core.php goes by */
+static int TWIG_HAS_MBSTRING(void)
+{
+	return zend_hash_str_exists(EG(function_table), "mb_get_info", sizeof("mb_get_info") - 1);
+}
+
+/* Calls the PHP function 'name'. Returns FAILURE, with 'retval' undefined,
+ * if it threw. */
+static int TWIG_CALL_FUNCTION(const char *name, size_t name_len, zval *retval, uint32_t argc, zval *argv)
+{
+	zval function;
+	int  result;
+
+	ZVAL_STRINGL(&function, name, name_len);
+	ZVAL_UNDEF(retval);
+	result = call_user_function(EG(function_table), NULL, &function, retval, argc, argv);
+	zval_ptr_dtor(&function);
+
+	if (result != SUCCESS || EG(exception) || Z_ISUNDEF_P(retval)) {
+		zval_ptr_dtor(retval);
+		ZVAL_UNDEF(retval);
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+/* iterator_to_array($traversable, $preserveKeys) */
+static int TWIG_ITERATOR_TO_ARRAY(zval *traversable, zend_bool preserve_keys, zval *retval)
+{
+	zval args[2];
+
+	ZVAL_COPY_VALUE(&args[0], traversable);
+	ZVAL_BOOL(&args[1], preserve_keys);
+	return TWIG_CALL_FUNCTION("iterator_to_array", sizeof("iterator_to_array") - 1, retval, 2, args);
+}
+
+/* The first or last element of an array as current() gives it, or false */
+static void TWIG_ARRAY_END(HashTable *ht, int last, zval *return_value)
+{
+	HashPosition pos;
+	zval        *entry;
+
+	if (last) {
+		zend_hash_internal_pointer_end_ex(ht, &pos);
+	} else {
+		zend_hash_internal_pointer_reset_ex(ht, &pos);
+	}
+	entry = zend_hash_get_current_data_ex(ht, &pos);
+	if (!entry) {
+		RETURN_FALSE;
+	}
+	if (Z_TYPE_P(entry) == IS_INDIRECT) {
+		entry = Z_INDIRECT_P(entry);
+	}
+	ZVAL_DEREF(entry);
+	ZVAL_COPY(return_value, entry);
+}
+
+/* array_slice() for an integer offset and length, the latter being
+ * negative for none */
+static void TWIG_ARRAY_SLICE(HashTable *ht, zend_long offset, zend_long length, int has_length, zend_bool preserve_keys, zval *return_value)
+{
+	zend_long    num_in = zend_hash_num_elements(ht), pos = 0;
+	zend_string *string_key;
+	zend_ulong   num_key;
+	zval        *entry;
+
+	if (offset > num_in) {
+		array_init(return_value);
+		return;
+	} else if (offset < 0 && (offset = num_in + offset) < 0) {
+		offset = 0;
+	}
+
+	if (!has_length) {
+		length = num_in;
+	}
+	if (length < 0) {
+		length = num_in - offset + length;
+	} else if ((zend_ulong) offset + (zend_ulong) length > (zend_ulong) num_in) {
+		length = num_in - offset;
+	}
+
+	if (length <= 0) {
+		array_init(return_value);
+		return;
+	}
+
+	array_init_size(return_value, (uint32_t) length);
+	ZEND_HASH_FOREACH_KEY_VAL(ht, num_key, string_key, entry) {
+		if (pos++ < offset) {
+			continue;
+		}
+		if (pos > offset + length) {
+			break;
+		}
+
+		if (Z_ISREF_P(entry) && Z_REFCOUNT_P(entry) == 1) {
+			entry = Z_REFVAL_P(entry);
+		}
+		Z_TRY_ADDREF_P(entry);
+
+		if (string_key) {
+			zend_hash_add_new(Z_ARRVAL_P(return_value), string_key, entry);
+		} else if (preserve_keys) {
+			zend_hash_index_add_new(Z_ARRVAL_P(return_value), num_key, entry);
+		} else {
+			zend_hash_next_index_insert_new(Z_ARRVAL_P(return_value), entry);
+		}
+	} ZEND_HASH_FOREACH_END();
+}
+
+/* $value >= 0 */
+static int TWIG_IS_NOT_NEGATIVE(zval *value)
+{
+	zval zero, result;
+
+	ZVAL_LONG(&zero, 0);
+	is_smaller_or_equal_function(&result, &zero, value);
+	return Z_TYPE(result) == IS_TRUE;
+}
+
+/* twig_slice() of a Traversable, which is left with the sliced array or an
+ * array to slice in 'array'. Returns FAILURE if something threw, 1 if
+ * 'array' is the result and 0 if it still has to be sliced. */
+static int TWIG_SLICE_TRAVERSABLE(zval *item, zval *start, zval *length, zend_bool preserve_keys, zval *array)
+{
+	zval iterator, limit, constructor, args[3], retval;
+	int  result;
+
+	ZVAL_COPY(&iterator, item);
+	if (instanceof_function(Z_OBJCE(iterator), zend_ce_aggregate)) {
+		ZVAL_UNDEF(&retval);
+		zend_call_method_with_0_params(&iterator, Z_OBJCE(iterator), NULL, "getiterator", &retval);
+		zval_ptr_dtor(&iterator);
+		if (EG(exception) || Z_ISUNDEF(retval)) {
+			zval_ptr_dtor(&retval);
+			return FAILURE;
+		}
+		ZVAL_COPY_VALUE(&iterator, &retval);
+	}
+
+	if (TWIG_IS_NOT_NEGATIVE(start) && TWIG_IS_NOT_NEGATIVE(length) && TWIG_INSTANCE_OF(&iterator, zend_ce_iterator)) {
+		/* iterator_to_array(new LimitIterator($item, $start, $length === null ? -1 : $length), $preserveKeys) */
+		object_init_ex(&limit, spl_ce_LimitIterator);
+		ZVAL_COPY_VALUE(&args[0], &iterator);
+		ZVAL_COPY_VALUE(&args[1], start);
+		if (Z_TYPE_P(length) == IS_NULL) {
+			ZVAL_LONG(&args[2], -1);
+		} else {
+			ZVAL_COPY_VALUE(&args[2], length);
+		}
+		ZVAL_STRINGL(&constructor, "__construct", sizeof("__construct") - 1);
+		ZVAL_UNDEF(&retval);
+		call_user_function(EG(function_table), &limit, &constructor, &retval, 3, args);
+		zval_ptr_dtor(&retval);
+		zval_ptr_dtor(&constructor);
+
+		result = EG(exception) ? FAILURE : TWIG_ITERATOR_TO_ARRAY(&limit, preserve_keys, array);
+		zval_ptr_dtor(&limit);
+		zval_ptr_dtor(&iterator);
+
+		if (result == FAILURE && EG(exception) && instanceof_function(EG(exception)->ce, spl_ce_OutOfBoundsException)) {
+			zend_clear_exception();
+			array_init(array);
+			return 1;
+		}
+		return result == SUCCESS ? 1 : FAILURE;
+	}
+
+	result = TWIG_ITERATOR_TO_ARRAY(&iterator, preserve_keys, array);
+	zval_ptr_dtor(&iterator);
+	return result == SUCCESS ? 0 : FAILURE;
+}
+
+/* twig_slice() of a string */
+static void TWIG_SLICE_STRING(zval *env, zend_string *str, zval *start, zval *length, zval *return_value)
+{
+	zend_string *charset;
+	zend_long    from, chars;
+	size_t       begin, end;
+	zval         args[4], strlen_args[2], retval, mblen;
+
+	if (!TWIG_HAS_MBSTRING() || !(charset = TWIG_GET_CHARSET(env))) {
 		if (EG(exception)) {
-			efree(tmp_method_name_get);
-			efree(tmp_method_name_is);
-			efree(lcItem);efree(item);
 			return;
 		}
-/*
-	// Some objects throw exceptions when they have __call, and the method we try
-	// to call is not supported. If ignoreStrictCheck is true, we should return null.
-	try {
-	    $ret = call_user_func_array(array($object, $method), $arguments);
-	} catch (BadMethodCallException $e) {
-	    if ($call && ($ignoreStrictCheck || !$this->env->isStrictVariables())) {
-	        return null;
-	    }
-	    throw $e;
+		/* (string) (null === $length ? substr($item, $start) : substr($item, $start, $length)) */
+		ZVAL_STR(&args[0], str);
+		ZVAL_COPY_VALUE(&args[1], start);
+		ZVAL_COPY_VALUE(&args[2], length);
+		if (TWIG_CALL_FUNCTION("substr", sizeof("substr") - 1, &retval, Z_TYPE_P(length) == IS_NULL ? 2 : 3, args) == SUCCESS) {
+			RETVAL_STR(zval_get_string(&retval));
+			zval_ptr_dtor(&retval);
+		}
+		return;
 	}
-*/
-		ret = TWIG_CALL_USER_FUNC_ARRAY(object, method, arguments TSRMLS_CC);
-		if (EG(exception) && TWIG_INSTANCE_OF(EG(exception), spl_ce_BadMethodCallException TSRMLS_CC)) {
-			if (ignoreStrictCheck || !TWIG_CALL_BOOLEAN(TWIG_PROPERTY_CHAR(template, "env" TSRMLS_CC), "isStrictVariables" TSRMLS_CC)) {
-				efree(tmp_method_name_get);
-				efree(tmp_method_name_is);
-				efree(lcItem);efree(item);
-				zend_clear_exception(TSRMLS_C);
-				return;
-			}
+
+	if (TWIG_IS_UTF8(charset) && Z_TYPE_P(start) == IS_LONG && Z_LVAL_P(start) >= 0 &&
+		(Z_TYPE_P(length) == IS_NULL || (Z_TYPE_P(length) == IS_LONG && Z_LVAL_P(length) >= 0))
+	) {
+		/* With no length, mb_substr() is given what is left after the start,
+		 * or a negative length that gives nothing if there is nothing left */
+		from = Z_LVAL_P(start);
+		begin = TWIG_UTF8_SKIP((const unsigned char *) ZSTR_VAL(str), ZSTR_LEN(str), 0, from);
+		if (Z_TYPE_P(length) == IS_NULL) {
+			end = ZSTR_LEN(str);
+		} else {
+			chars = Z_LVAL_P(length);
+			end = TWIG_UTF8_SKIP((const unsigned char *) ZSTR_VAL(str), ZSTR_LEN(str), begin, chars);
 		}
-		free_ret = 1;
-		efree(tmp_method_name_get);
-		efree(tmp_method_name_is);
-		efree(lcItem);
+		zend_string_release(charset);
+		if (begin == 0 && end == ZSTR_LEN(str)) {
+			RETURN_STR_COPY(str);
+		}
+		RETURN_STRINGL(ZSTR_VAL(str) + begin, end - begin);
 	}
-/*
-	// useful when calling a template method from a template
-	// this is not supported but unfortunately heavily used in the Symfony profiler
-	if ($object instanceof Twig_TemplateInterface) {
-		return $ret === '' ? '' : new Twig_Markup($ret, $this->env->getCharset());
+
+	/* (string) mb_substr($item, $start, null === $length ? mb_strlen($item, $charset) - $start : $length, $charset) */
+	ZVAL_STR(&args[0], str);
+	ZVAL_COPY_VALUE(&args[1], start);
+	ZVAL_STR(&args[3], charset);
+	if (Z_TYPE_P(length) == IS_NULL) {
+		ZVAL_STR(&strlen_args[0], str);
+		ZVAL_STR(&strlen_args[1], charset);
+		if (TWIG_CALL_FUNCTION("mb_strlen", sizeof("mb_strlen") - 1, &mblen, 2, strlen_args) == FAILURE) {
+			zend_string_release(charset);
+			return;
+		}
+		sub_function(&args[2], &mblen, start);
+		zval_ptr_dtor(&mblen);
+		if (EG(exception)) {
+			zval_ptr_dtor(&args[2]);
+			zend_string_release(charset);
+			return;
+		}
+	} else {
+		ZVAL_COPY(&args[2], length);
+	}
+	if (TWIG_CALL_FUNCTION("mb_substr", sizeof("mb_substr") - 1, &retval, 4, args) == SUCCESS) {
+		RETVAL_STR(zval_get_string(&retval));
+		zval_ptr_dtor(&retval);
 	}
+	zval_ptr_dtor(&args[2]);
+	zend_string_release(charset);
+}
 
-	return $ret;
-*/
-	efree(item);
-	// ret can be null, if e.g. the called method throws an exception
-	if (ret) {
-		if (TWIG_INSTANCE_OF_USERLAND(object, "Twig_TemplateInterface" TSRMLS_CC)) {
-			if (Z_STRLEN_P(ret) != 0) {
-				zval *charset = TWIG_CALL_USER_FUNC_ARRAY(TWIG_PROPERTY_CHAR(template, "env" TSRMLS_CC), "getCharset", NULL TSRMLS_CC);
-				TWIG_NEW(return_value, "Twig_Markup", ret, charset TSRMLS_CC);
-				zval_ptr_dtor(&charset);
-				if (ret) {
-					zval_ptr_dtor(&ret);
+/* twig_slice() */
+static void TWIG_SLICE(zval *env, zval *item, zval *start, zval *length, zend_bool preserve_keys, zval *return_value)
+{
+	zval         array, args[4];
+	zend_string *str;
+	int          result;
+
+	ZVAL_UNDEF(&array);
+	if (TWIG_INSTANCE_OF(item, zend_ce_traversable)) {
+		result = TWIG_SLICE_TRAVERSABLE(item, start, length, preserve_keys, &array);
+		if (result == FAILURE) {
+			return;
+		}
+		if (result == 1) {
+			ZVAL_COPY_VALUE(return_value, &array);
+			return;
+		}
+		item = &array;
+	}
+
+	if (Z_TYPE_P(item) == IS_ARRAY) {
+		if (Z_TYPE_P(start) == IS_LONG && (Z_TYPE_P(length) == IS_NULL || Z_TYPE_P(length) == IS_LONG)) {
+			TWIG_ARRAY_SLICE(Z_ARRVAL_P(item), Z_LVAL_P(start), Z_TYPE_P(length) == IS_LONG ? Z_LVAL_P(length) : 0, Z_TYPE_P(length) == IS_LONG, preserve_keys, return_value);
+		} else {
+			ZVAL_COPY_VALUE(&args[0], item);
+			ZVAL_COPY_VALUE(&args[1], start);
+			ZVAL_COPY_VALUE(&args[2], length);
+			ZVAL_BOOL(&args[3], preserve_keys);
+			TWIG_CALL_FUNCTION("array_slice", sizeof("array_slice") - 1, return_value, 4, args);
+		}
+		zval_ptr_dtor(&array);
+		return;
+	}
+
+	str = zval_get_string(item);
+	if (!EG(exception)) {
+		TWIG_SLICE_STRING(env, str, start, length, return_value);
+	}
+	zend_string_release(str);
+}
+
+/* twig_first() and twig_last(): an element of twig_slice() */
+static void TWIG_FIRST_OR_LAST(INTERNAL_FUNCTION_PARAMETERS, int last)
+{
+	zval *env, *item, start, length, elements;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "oz", &env, &item) == FAILURE) {
+		return;
+	}
+
+	if (Z_TYPE_P(item) == IS_ARRAY) {
+		TWIG_ARRAY_END(Z_ARRVAL_P(item), last, return_value);
+		return;
+	}
+
+	ZVAL_LONG(&start, last ? -1 : 0);
+	ZVAL_LONG(&length, 1);
+	ZVAL_UNDEF(&elements);
+	TWIG_SLICE(env, item, &start, &length, 0, &elements);
+
+	if (Z_TYPE(elements) == IS_ARRAY) {
+		TWIG_ARRAY_END(Z_ARRVAL(elements), 0, return_value);
+		zval_ptr_dtor(&elements);
+	} else if (Z_TYPE(elements) == IS_STRING) {
+		RETVAL_ZVAL(&elements, 0, 0);
+	} else {
+		zval_ptr_dtor(&elements);
+		if (!EG(exception)) {
+			RETVAL_FALSE;
+		}
+	}
+}
+
+/* {{{ proto mixed twig_ensure_traversable(mixed seq)
+   A C implementation of twig_ensure_traversable() */
+PHP_FUNCTION(twig_ensure_traversable)
+{
+	zval *seq;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "z", &seq) == FAILURE) {
+		return;
+	}
+
+	if (Z_TYPE_P(seq) == IS_ARRAY || TWIG_INSTANCE_OF(seq, zend_ce_traversable)) {
+		RETURN_ZVAL(seq, 1, 0);
+	}
+	array_init(return_value);
+}
+/* }}} */
+
+/* {{{ proto int twig_length_filter(Twig_Environment env, mixed thing)
+   A C implementation of twig_length_filter() */
+PHP_FUNCTION(twig_length_filter)
+{
+	zval        *env, *thing, args[2], retval;
+	zend_string *str, *charset;
+	zend_long    count;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "oz", &env, &thing) == FAILURE) {
+		return;
+	}
+
+	switch (Z_TYPE_P(thing)) {
+		case IS_ARRAY:
+			RETURN_LONG(zend_array_count(Z_ARRVAL_P(thing)));
+
+		case IS_OBJECT:
+			/* count(), as far as it doesn't warn */
+			if (Z_OBJ_HT_P(thing)->count_elements && Z_OBJ_HT_P(thing)->count_elements(thing, &count) == SUCCESS) {
+				RETURN_LONG(count);
+			}
+			if (instanceof_function(Z_OBJCE_P(thing), spl_ce_Countable)) {
+				ZVAL_UNDEF(&retval);
+				zend_call_method_with_0_params(thing, Z_OBJCE_P(thing), NULL, "count", &retval);
+				if (!Z_ISUNDEF(retval)) {
+					RETVAL_LONG(zval_get_long(&retval));
+					zval_ptr_dtor(&retval);
 				}
 				return;
 			}
+			break;
+
+		case IS_LONG:
+		case IS_DOUBLE:
+		case IS_STRING:
+		case IS_FALSE:
+		case IS_TRUE:
+			str = zval_get_string(thing);
+			if (!TWIG_HAS_MBSTRING()) {
+				RETVAL_LONG(ZSTR_LEN(str));
+				zend_string_release(str);
+				return;
+			}
+
+			charset = TWIG_GET_CHARSET(env);
+			if (!charset) {
+				zend_string_release(str);
+				return;
+			}
+			if (TWIG_IS_UTF8(charset)) {
+				RETVAL_LONG(TWIG_UTF8_STRLEN(str));
+			} else {
+				/* mb_strlen($thing, $env->getCharset()) */
+				ZVAL_STR(&args[0], str);
+				ZVAL_STR(&args[1], charset);
+				if (TWIG_CALL_FUNCTION("mb_strlen", sizeof("mb_strlen") - 1, &retval, 2, args) == SUCCESS) {
+					ZVAL_COPY_VALUE(return_value, &retval);
+				}
+			}
+			zend_string_release(charset);
+			zend_string_release(str);
+			return;
+	}
+
+	/* count() of anything else, with its warning */
+	ZVAL_COPY_VALUE(&args[0], thing);
+	TWIG_CALL_FUNCTION("count", sizeof("count") - 1, return_value, 1, args);
+}
+/* }}} */
+
+/* in_array($value, $array, $strict) */
+static int TWIG_IN_ARRAY(zval *value, HashTable *ht, int strict)
+{
+	zval *entry;
+
+	ZEND_HASH_FOREACH_VAL_IND(ht, entry) {
+		ZVAL_DEREF(entry);
+		if (strict ? fast_is_identical_function(value, entry) : fast_equal_check_function(value, entry)) {
+			return 1;
 		}
+	} ZEND_HASH_FOREACH_END();
+	return 0;
+}
 
-		RETVAL_ZVAL(ret, 1, 0);
-		if (free_ret) {
-			zval_ptr_dtor(&ret);
+/* {{{ proto bool twig_in_filter(mixed value, mixed compare)
+   A C implementation of twig_in_filter() */
+PHP_FUNCTION(twig_in_filter)
+{
+	zval        *value, *compare, array;
+	zend_string *needle;
+	int          strict;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "zz", &value, &compare) == FAILURE) {
+		return;
+	}
+
+	strict = Z_TYPE_P(value) == IS_OBJECT || Z_TYPE_P(value) == IS_RESOURCE;
+
+	if (Z_TYPE_P(compare) == IS_ARRAY) {
+		RETURN_BOOL(TWIG_IN_ARRAY(value, Z_ARRVAL_P(compare), strict));
+	}
+
+	if (Z_TYPE_P(compare) == IS_STRING && (Z_TYPE_P(value) == IS_STRING || Z_TYPE_P(value) == IS_LONG || Z_TYPE_P(value) == IS_DOUBLE)) {
+		if (Z_TYPE_P(value) == IS_STRING && Z_STRLEN_P(value) == 0) {
+			RETURN_TRUE;
+		}
+		needle = zval_get_string(value);
+		RETVAL_BOOL(php_memnstr(Z_STRVAL_P(compare), ZSTR_VAL(needle), ZSTR_LEN(needle), Z_STRVAL_P(compare) + Z_STRLEN_P(compare)) != NULL);
+		zend_string_release(needle);
+		return;
+	}
+
+	if (TWIG_INSTANCE_OF(compare, zend_ce_traversable)) {
+		if (TWIG_ITERATOR_TO_ARRAY(compare, 0, &array) == FAILURE) {
+			return;
+		}
+		RETVAL_BOOL(TWIG_IN_ARRAY(value, Z_ARRVAL(array), strict));
+		zval_ptr_dtor(&array);
+		return;
+	}
+
+	RETURN_FALSE;
+}
+/* }}} */
+
+/* {{{ proto mixed twig_slice(Twig_Environment env, mixed item, int start [, int length [, bool preserveKeys]])
+   A C implementation of twig_slice() */
+PHP_FUNCTION(twig_slice)
+{
+	zval     *env, *item, *start, *length = NULL, null_length;
+	zend_bool preserve_keys = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "ozz|zb", &env, &item, &start, &length, &preserve_keys) == FAILURE) {
+		return;
+	}
+
+	if (!length) {
+		ZVAL_NULL(&null_length);
+		length = &null_length;
+	}
+	TWIG_SLICE(env, item, start, length, preserve_keys, return_value);
+}
+/* }}} */
+
+/* {{{ proto mixed twig_first(Twig_Environment env, mixed item)
+   A C implementation of twig_first() */
+PHP_FUNCTION(twig_first)
+{
+	TWIG_FIRST_OR_LAST(INTERNAL_FUNCTION_PARAM_PASSTHRU, 0);
+}
+/* }}} */
+
+/* {{{ proto mixed twig_last(Twig_Environment env, mixed item)
+   A C implementation of twig_last() */
+PHP_FUNCTION(twig_last)
+{
+	TWIG_FIRST_OR_LAST(INTERNAL_FUNCTION_PARAM_PASSTHRU, 1);
+}
+/* }}} */
+
+/* {{{ proto string twig_join_filter(mixed value [, string glue])
+   A C implementation of twig_join_filter() */
+PHP_FUNCTION(twig_join_filter)
+{
+	zval        *value, *glue = NULL, array;
+	zend_string *delim;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "z|z", &value, &glue) == FAILURE) {
+		return;
+	}
+
+	if (TWIG_INSTANCE_OF(value, zend_ce_traversable)) {
+		if (TWIG_ITERATOR_TO_ARRAY(value, 0, &array) == FAILURE) {
+			return;
+		}
+	} else {
+		/* (array) $value */
+		ZVAL_COPY(&array, value);
+		convert_to_array(&array);
+	}
+
+	delim = glue ? zval_get_string(glue) : ZSTR_EMPTY_ALLOC();
+#if PHP_VERSION_ID >= 70400
+	php_implode(delim, Z_ARRVAL(array), return_value);
+#else
+	php_implode(delim, &array, return_value);
+#endif
+	zend_string_release(delim);
+	zval_ptr_dtor(&array);
+}
+/* }}} */
+
+/* Profiles are recorded as a flat list of enter and leave events, kept in
+ * C until something reads the Twig_Profiler_Profile they belong to. Leave
+ * events have no template. */
+typedef struct _twig_profiler_event {
+	zend_string *template;
+	zend_string *type;
+	zend_string *name;
+	uint64_t     time;        /* nanoseconds on the monotonic clock */
+	size_t       memory;
+	size_t       peak_memory;
+} twig_profiler_event;
+
+/* The events of one Twig_Extension_Profiler, and the monotonic and wall
+ * clocks at the same instant, to report times like microtime(true) does */
+typedef struct _twig_profiler_buffer {
+	twig_profiler_event *events;
+	uint32_t             count;
+	uint32_t             size;
+	uint64_t             origin;
+	double               wall_origin;
+} twig_profiler_buffer;
+
+#define TWIG_PROFILER_BUFFER_SIZE 256
+
+static uint64_t TWIG_PROFILER_CLOCK(void)
+{
+#ifdef PHP_WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER        counter;
+
+	if (!frequency.QuadPart) {
+		QueryPerformanceFrequency(&frequency);
+	}
+	QueryPerformanceCounter(&counter);
+	return (uint64_t) ((double) counter.QuadPart * 1000000000.0 / (double) frequency.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000000000 + (uint64_t) tv.tv_usec * 1000;
+#endif
+}
+
+static double TWIG_PROFILER_WALL_CLOCK(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
+
+static void TWIG_PROFILER_RELEASE_EVENTS(twig_profiler_buffer *buffer)
+{
+	uint32_t i;
+
+	for (i = 0; i < buffer->count; i++) {
+		if (buffer->events[i].template) {
+			zend_string_release(buffer->events[i].template);
+			zend_string_release(buffer->events[i].type);
+			zend_string_release(buffer->events[i].name);
+		}
+	}
+	buffer->count = 0;
+}
+
+static void twig_profiler_buffer_dtor(zval *zv)
+{
+	twig_profiler_buffer *buffer = Z_PTR_P(zv);
+
+	TWIG_PROFILER_RELEASE_EVENTS(buffer);
+	efree(buffer->events);
+	efree(buffer);
+}
+
+/* Buffers are keyed by the handle of the extension object, which
+ * Twig_Extension_Profiler::__destruct() gives back */
+static twig_profiler_buffer *TWIG_PROFILER_BUFFER(zval *extension, int create)
+{
+	twig_profiler_buffer *buffer;
+
+	if (!TWIG_G(profiler_buffers)) {
+		if (!create) {
+			return NULL;
+		}
+		ALLOC_HASHTABLE(TWIG_G(profiler_buffers));
+		zend_hash_init(TWIG_G(profiler_buffers), 8, NULL, twig_profiler_buffer_dtor, 0);
+	}
+
+	buffer = zend_hash_index_find_ptr(TWIG_G(profiler_buffers), Z_OBJ_HANDLE_P(extension));
+	if (buffer || !create) {
+		return buffer;
+	}
+
+	buffer = emalloc(sizeof(twig_profiler_buffer));
+	buffer->events = safe_emalloc(TWIG_PROFILER_BUFFER_SIZE, sizeof(twig_profiler_event), 0);
+	buffer->count = 0;
+	buffer->size = TWIG_PROFILER_BUFFER_SIZE;
+	buffer->origin = TWIG_PROFILER_CLOCK();
+	buffer->wall_origin = TWIG_PROFILER_WALL_CLOCK();
+
+	return zend_hash_index_add_new_ptr(TWIG_G(profiler_buffers), Z_OBJ_HANDLE_P(extension), buffer);
+}
+
+static twig_profiler_event *TWIG_PROFILER_RECORD(zval *extension)
+{
+	twig_profiler_buffer *buffer = TWIG_PROFILER_BUFFER(extension, 1);
+
+	if (buffer->count == buffer->size) {
+		buffer->size *= 2;
+		buffer->events = safe_erealloc(buffer->events, buffer->size, sizeof(twig_profiler_event), 0);
+	}
+
+	return &buffer->events[buffer->count++];
+}
+
+/* {{{ proto void twig_profiler_enter(Twig_Extension_Profiler extension, string template, string type, string name)
+   Starts profiling a template, block or macro */
+PHP_FUNCTION(twig_profiler_enter)
+{
+	zval                *extension;
+	zend_string         *template, *type, *name;
+	twig_profiler_event *event;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "oSSS", &extension, &template, &type, &name) == FAILURE) {
+		return;
+	}
+
+	event = TWIG_PROFILER_RECORD(extension);
+	event->template = zend_string_copy(template);
+	event->type = zend_string_copy(type);
+	event->name = zend_string_copy(name);
+	event->memory = zend_memory_usage(0);
+	event->peak_memory = zend_memory_peak_usage(0);
+	/* last, so that recording is not part of the profile */
+	event->time = TWIG_PROFILER_CLOCK();
+}
+/* }}} */
+
+/* {{{ proto void twig_profiler_leave(Twig_Extension_Profiler extension)
+   Stops profiling the template, block or macro entered last */
+PHP_FUNCTION(twig_profiler_leave)
+{
+	zval                *extension;
+	uint64_t             time = TWIG_PROFILER_CLOCK();
+	twig_profiler_event *event;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "o", &extension) == FAILURE) {
+		return;
+	}
+
+	event = TWIG_PROFILER_RECORD(extension);
+	event->template = NULL;
+	event->type = NULL;
+	event->name = NULL;
+	event->time = time;
+	event->memory = zend_memory_usage(0);
+	event->peak_memory = zend_memory_peak_usage(0);
+}
+/* }}} */
+
+/* {{{ proto array twig_profiler_flush(Twig_Extension_Profiler extension)
+   Returns and forgets the events recorded so far */
+PHP_FUNCTION(twig_profiler_flush)
+{
+	zval                 *extension, entry;
+	twig_profiler_buffer *buffer;
+	twig_profiler_event  *event;
+	uint32_t              i;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "o", &extension) == FAILURE) {
+		return;
+	}
+
+	buffer = TWIG_PROFILER_BUFFER(extension, 0);
+	array_init_size(return_value, buffer ? buffer->count : 0);
+	if (!buffer) {
+		return;
+	}
+
+	for (i = 0; i < buffer->count; i++) {
+		event = &buffer->events[i];
+
+		array_init_size(&entry, 6);
+		if (event->template) {
+			add_assoc_str(&entry, "template", zend_string_copy(event->template));
+			add_assoc_str(&entry, "type", zend_string_copy(event->type));
+			add_assoc_str(&entry, "name", zend_string_copy(event->name));
 		}
+		add_assoc_double(&entry, "wt", buffer->wall_origin + (double) (int64_t) (event->time - buffer->origin) / 1000000000.0);
+		add_assoc_long(&entry, "mu", (zend_long) event->memory);
+		add_assoc_long(&entry, "pmu", (zend_long) event->peak_memory);
+		add_next_index_zval(return_value, &entry);
+	}
+
+	TWIG_PROFILER_RELEASE_EVENTS(buffer);
+}
+/* }}} */
+
+/* {{{ proto void twig_profiler_close(Twig_Extension_Profiler extension)
+   Frees the events recorded for a profiler extension */
+PHP_FUNCTION(twig_profiler_close)
+{
+	zval *extension;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "o", &extension) == FAILURE) {
+		return;
+	}
+
+	if (TWIG_G(profiler_buffers)) {
+		zend_hash_index_del(TWIG_G(profiler_buffers), Z_OBJ_HANDLE_P(extension));
 	}
 }
+/* }}} */
@@ -0,0 +1,237 @@
+<?php
+
+/*
+ * This file is part of Twig.
+ *
+ * (c) 2015 Fabien Potencier
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/**
+ * Compiles templates into the cache of an environment ahead of time.
+ *
+ * Templates can be compiled by several processes at once when the pcntl
+ * extension is available. The warmer can also write the manifest that
+ * Twig_Loader_Compiled reads and a script for opcache.preload.
+ *
+ * @author Fabien Potencier <fabien@symfony.com>
+ */
+class Twig_CacheWarmer
+{
+    protected $env;
+
+    public function __construct(Twig_Environment $env)
+    {
+        $this->env = $env;
+    }
+
+    /**
+     * Returns the names of all templates of the filesystem loader of the environment.
+     *
+     * @param string $extension Only returns the templates with this file extension
+     *
+     * @return array The template names, sorted
+     *
+     * @throws LogicException When the environment does not use a filesystem loader
+     */
+    public function findTemplates($extension = null)
+    {
+        $loader = $this->env->getLoader();
+        if ($loader instanceof Twig_Loader_Compiled) {
+            $loader = $loader->getLoader();
+        }
+
+        if (!$loader instanceof Twig_Loader_Filesystem) {
+            throw new LogicException('Templates can only be found for a Twig_Loader_Filesystem loader.');
+        }
+
+        $names = array();
+        foreach ($loader->getNamespaces() as $namespace) {
+            $prefix = Twig_Loader_Filesystem::MAIN_NAMESPACE === $namespace ? '' : '@'.$namespace.'/';
+
+            foreach ($loader->getPaths($namespace) as $path) {
+                $path = rtrim(str_replace('\\', '/', $path), '/');
+                $files = new RecursiveIteratorIterator(new RecursiveDirectoryIterator($path), RecursiveIteratorIterator::LEAVES_ONLY);
+
+                foreach ($files as $file) {
+                    if (!$file->isFile()) {
+                        continue;
+                    }
+
+                    $name = substr(str_replace('\\', '/', $file->getPathname()), strlen($path) + 1);
+                    if (null !== $extension && $extension !== pathinfo($name, PATHINFO_EXTENSION)) {
+                        continue;
+                    }
+
+                    $names[$prefix.$name] = true;
+                }
+            }
+        }
+
+        $names = array_keys($names);
+        sort($names);
+
+        return $names;
+    }
+
+    /**
+     * Compiles templates into the cache.
+     *
+     * @param array $names   The template names
+     * @param int   $workers The number of processes to compile them with
+     *
+     * @return array The error messages of the templates that could not be compiled, by template name
+     *
+     * @throws LogicException When the environment has no cache
+     */
+    public function warmUp(array $names, $workers = 1)
+    {
+        if (false === $this->env->getCache()) {
+            throw new LogicException('Templates can only be warmed up for an environment with a cache.');
+        }
+
+        $workers = max(1, min((int) $workers, count($names)));
+        if (1 === $workers || !function_exists('pcntl_fork')) {
+            return $this->compile($names);
+        }
+
+        $errors = array();
+        $children = array();
+        $chunks = array_chunk($names, (int) ceil(count($names) / $workers));
+        while ($chunk = array_shift($chunks)) {
+            $errorFile = tempnam(sys_get_temp_dir(), 'twig');
+            $pid = pcntl_fork();
+
+            // compile what is left in this process when no more workers can be started
+            if (-1 === $pid) {
+                unlink($errorFile);
+                foreach (array_merge(array($chunk), $chunks) as $chunk) {
+                    $errors = array_merge($errors, $this->compile($chunk));
+                }
+
+                break;
+            }
+
+            if (0 === $pid) {
+                file_put_contents($errorFile, serialize($this->compile($chunk)));
+                exit(0);
+            }
+
+            $children[] = array($pid, $errorFile, $chunk);
+        }
+
+        foreach ($children as $child) {
+            $errors = array_merge($errors, $this->wait($child));
+        }
+        ksort($errors);
+
+        return $errors;
+    }
+
+    /**
+     * Writes the manifest that Twig_Loader_Compiled reads.
+     *
+     * @param string $file  The manifest file
+     * @param array  $names The template names, which must have been compiled
+     */
+    public function writeManifest($file, array $names)
+    {
+        $loader = $this->env->getLoader();
+
+        $cacheKeys = array();
+        foreach ($names as $name) {
+            $cacheKeys[$name] = $loader->getCacheKey($name);
+        }
+
+        $this->write($file, '<?php return '.var_export($cacheKeys, true).";\n");
+    }
+
+    /**
+     * Writes a script that compiles the cache files of templates into opcache,
+     * to be used as opcache.preload (PHP 7.4 and later).
+     *
+     * The script loads Twig_Template first, so that the template classes can
+     * be linked and stay preloaded.
+     *
+     * @param string $file  The script
+     * @param array  $names The template names, which must have been compiled
+     */
+    public function writePreloadScript($file, array $names)
+    {
+        $script = "<?php\n\nif (PHP_VERSION_ID < 70400 || !function_exists('opcache_compile_file')) {\n    return;\n}\n\n";
+        $script .= sprintf("require_once %s;\nTwig_Autoloader::register();\nclass_exists('Twig_Template');\n\n", var_export(dirname(__FILE__).'/Autoloader.php', true));
+        foreach ($names as $name) {
+            $script .= sprintf("opcache_compile_file(%s);\n", var_export($this->env->getCacheFilename($name), true));
+        }
+
+        $this->write($file, $script);
+    }
+
+    /**
+     * Compiles templates in this process.
+     *
+     * Templates are always compiled again, as their cache file names do not
+     * change with their content and Twig_Loader_Compiled does not check them.
+     *
+     * @param array $names The template names
+     *
+     * @return array The error messages, by template name
+     */
+    protected function compile(array $names)
+    {
+        $loader = $this->env->getLoader();
+        if ($loader instanceof Twig_Loader_Compiled) {
+            $loader = $loader->getLoader();
+        }
+
+        $errors = array();
+        foreach ($names as $name) {
+            try {
+                $this->write($this->env->getCacheFilename($name), $this->env->compileSource($loader->getSource($name), $name));
+            } catch (Twig_Error $e) {
+                $errors[$name] = $e->getMessage();
+            }
+        }
+
+        return $errors;
+    }
+
+    private function wait(array $child)
+    {
+        list($pid, $errorFile, $names) = $child;
+
+        pcntl_waitpid($pid, $status);
+        $errors = @unserialize(file_get_contents($errorFile));
+        unlink($errorFile);
+
+        if (!pcntl_wifexited($status) || 0 !== pcntl_wexitstatus($status) || !is_array($errors)) {
+            $errors = array();
+            foreach ($names as $name) {
+                $errors[$name] = 'The worker compiling this template did not finish.';
+            }
+        }
+
+        return $errors;
+    }
+
+    private function write($file, $content)
+    {
+        $dir = dirname($file);
+        if (!is_dir($dir) && false === @mkdir($dir, 0777, true) && !is_dir($dir)) {
+            throw new RuntimeException(sprintf('Unable to create the directory "%s".', $dir));
+        }
+
+        $tmpFile = tempnam($dir, basename($file));
+        if (false !== @file_put_contents($tmpFile, $content) && @rename($tmpFile, $file)) {
+            @chmod($file, 0666 & ~umask());
+
+            return;
+        }
+
+        @unlink($tmpFile);
+
+        throw new RuntimeException(sprintf('Failed to write "%s".', $file));
+    }
+}
@@ -0,0 +1,68 @@
+<?php
+
+/*
+ * This file is part of Twig.
+ *
+ * (c) Fabien Potencier
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+require_once dirname(__FILE__).'/../LexerTest.php';
+
+class Twig_Tests_Lexer_NativeTest extends Twig_Tests_LexerTest
+{
+    protected function setUp()
+    {
+        if (!function_exists('twig_lexer_tokenize')) {
+            $this->markTestSkipped('The C extension is not loaded.');
+        }
+    }
+
+    /**
+     * @dataProvider getTemplates
+     */
+    public function testSameTokensAsTwigLexer($template)
+    {
+        $env = new Twig_Environment();
+        $lexer = new Twig_Lexer($env);
+        $native = new Twig_Lexer_Native($env);
+
+        $this->assertEquals($this->dumpTokens($lexer->tokenize($template)), $this->dumpTokens($native->tokenize($template)));
+    }
+
+    public function getTemplates()
+    {
+        return array(
+            array("foo\r\nbar\rbaz"),
+            array("{{ foo }}\n{{- bar -}}\n  {%- if baz -%}\n{% endif %}\nqux"),
+            array('{# a comment #}{#- trimmed -#}  {# with a newline #}'."\n".'x'),
+            array("{% raw %}{{ foo }}{% endraw %}{% verbatim %}  {% foo %}  {%- endverbatim %}"),
+            array("{% line 10 %}{{ foo }}\n{{ bar }}"),
+            array('{{ 1 + 2.5 - 9223372036854775808 * 12345678901234567890 // 3 ** 2 }}'),
+            array('{{ a not in b and c is not d or e starts with f ends with g matches h }}'),
+            array('{{ a not   in b }}{{ notin }}{{ not(a) }}{{ a..b }}{{ a ~ b ?: c ?? d }}'),
+            array('{{ "foo #{ bar ~ "baz #{ qux }" } \\"quux\\"" }}{{ \'single \\\' quote\' }}'),
+            array('{{ {"a": [1, (2)], b: c|d(e)} }}{{ a ? b : c }}{{ a.b[c] }}'),
+            array('{{ "#foo" }}{{ "\\n\\t\\x41" }}{{ "a#b#" }}'),
+            array('{{ é.ü }}'),
+        );
+    }
+
+    protected function createLexer()
+    {
+        return new Twig_Lexer_Native(new Twig_Environment());
+    }
+
+    protected function dumpTokens(Twig_TokenStream $stream)
+    {
+        $tokens = array();
+        while (!$stream->isEOF()) {
+            $token = $stream->next();
+            $tokens[] = array($token->getType(), $token->getValue(), $token->getLine());
+        }
+
+        return $tokens;
+    }
+}
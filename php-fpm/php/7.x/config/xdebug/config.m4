@@ -6,6 +6,12 @@ PHP_ARG_ENABLE(xdebug, whether to enable Xdebug support,
 PHP_ARG_ENABLE(xdebug-dev, whether to enable Xdebug developer build flags,
 [  --enable-xdebug-dev       Xdebug: Enable developer flags],, no)
 
+PHP_ARG_WITH(xdebug-zlib, whether to support gzip compressed output files,
+[  --with-xdebug-zlib[=DIR]  Xdebug: Support gzip compressed trace, profile and GC stats files], no, no)
+
+PHP_ARG_WITH(xdebug-zstd, whether to support zstd compressed output files,
+[  --with-xdebug-zstd[=DIR]  Xdebug: Support zstd compressed trace, profile and GC stats files], no, no)
+
 
 if test "$PHP_XDEBUG" != "no"; then
   AC_MSG_CHECKING([Check for supported PHP versions])
@@ -26,13 +32,47 @@ if test "$PHP_XDEBUG" != "no"; then
   old_CPPFLAGS=$CPPFLAGS
   CPPFLAGS="$INCLUDES $CPPFLAGS"
 
-  AC_CHECK_FUNCS(gettimeofday)
+  AC_CHECK_FUNCS(gettimeofday fopencookie funopen)
   AC_CHECK_HEADERS([netinet/in.h poll.h sys/poll.h])
 
   PHP_CHECK_LIBRARY(m, cos, [ PHP_ADD_LIBRARY(m,, XDEBUG_SHARED_LIBADD) ])
 
   CPPFLAGS=$old_CPPFLAGS
 
+  if test "$PHP_XDEBUG_ZLIB" != "no"; then
+    if test "$PHP_XDEBUG_ZLIB" != "yes"; then
+      PHP_ADD_INCLUDE($PHP_XDEBUG_ZLIB/include)
+      XDEBUG_ZLIB_LIBDIR="-L$PHP_XDEBUG_ZLIB/$PHP_LIBDIR"
+    fi
+    PHP_CHECK_LIBRARY(z, deflateInit2_, [
+      if test "$PHP_XDEBUG_ZLIB" != "yes"; then
+        PHP_ADD_LIBRARY_WITH_PATH(z, $PHP_XDEBUG_ZLIB/$PHP_LIBDIR, XDEBUG_SHARED_LIBADD)
+      else
+        PHP_ADD_LIBRARY(z,, XDEBUG_SHARED_LIBADD)
+      fi
+      AC_DEFINE(HAVE_XDEBUG_ZLIB, 1, [ ])
+    ], [
+      AC_MSG_ERROR([zlib not found, which is needed for --with-xdebug-zlib])
+    ], [$XDEBUG_ZLIB_LIBDIR])
+  fi
+
+  if test "$PHP_XDEBUG_ZSTD" != "no"; then
+    if test "$PHP_XDEBUG_ZSTD" != "yes"; then
+      PHP_ADD_INCLUDE($PHP_XDEBUG_ZSTD/include)
+      XDEBUG_ZSTD_LIBDIR="-L$PHP_XDEBUG_ZSTD/$PHP_LIBDIR"
+    fi
+    PHP_CHECK_LIBRARY(zstd, ZSTD_compressStream, [
+      if test "$PHP_XDEBUG_ZSTD" != "yes"; then
+        PHP_ADD_LIBRARY_WITH_PATH(zstd, $PHP_XDEBUG_ZSTD/$PHP_LIBDIR, XDEBUG_SHARED_LIBADD)
+      else
+        PHP_ADD_LIBRARY(zstd,, XDEBUG_SHARED_LIBADD)
+      fi
+      AC_DEFINE(HAVE_XDEBUG_ZSTD, 1, [ ])
+    ], [
+      AC_MSG_ERROR([libzstd not found, which is needed for --with-xdebug-zstd])
+    ], [$XDEBUG_ZSTD_LIBDIR])
+  fi
+
   if test "$PHP_XDEBUG_DEV" = "yes"; then
     PHP_CHECK_GCC_ARG(-Wbool-conversion,                _MAINTAINER_CFLAGS="$_MAINTAINER_CFLAGS -Wbool-conversion")
     PHP_CHECK_GCC_ARG(-Wdeclaration-after-statement,    _MAINTAINER_CFLAGS="$_MAINTAINER_CFLAGS -Wdeclaration-after-statement")
@@ -77,7 +117,7 @@ if test "$PHP_XDEBUG" != "no"; then
 
   PHP_XDEBUG_CFLAGS="$STD_CFLAGS $MAINTAINER_CFLAGS"
 
-  PHP_NEW_EXTENSION(xdebug, xdebug.c xdebug_branch_info.c xdebug_code_coverage.c xdebug_com.c xdebug_compat.c xdebug_gc_stats.c xdebug_filter.c xdebug_handler_dbgp.c xdebug_handlers.c xdebug_llist.c xdebug_monitor.c xdebug_hash.c xdebug_private.c xdebug_profiler.c xdebug_set.c xdebug_stack.c xdebug_str.c xdebug_superglobals.c xdebug_tracing.c xdebug_trace_textual.c xdebug_trace_computerized.c xdebug_trace_html.c xdebug_var.c xdebug_xml.c usefulstuff.c, $ext_shared,,$PHP_XDEBUG_CFLAGS,,yes)
+  PHP_NEW_EXTENSION(xdebug, xdebug.c xdebug_branch_info.c xdebug_brk_index.c xdebug_code_coverage.c xdebug_com.c xdebug_compat.c xdebug_compress.c xdebug_gc_stats.c xdebug_filter.c xdebug_handler_dbgp.c xdebug_handlers.c xdebug_llist.c xdebug_monitor.c xdebug_hash.c xdebug_private.c xdebug_profiler.c xdebug_set.c xdebug_stack.c xdebug_str.c xdebug_superglobals.c xdebug_tracing.c xdebug_trie.c xdebug_trace_textual.c xdebug_trace_computerized.c xdebug_trace_html.c xdebug_var.c xdebug_xml.c usefulstuff.c, $ext_shared,,$PHP_XDEBUG_CFLAGS,,yes)
   PHP_SUBST(XDEBUG_SHARED_LIBADD)
   PHP_ADD_MAKEFILE_FRAGMENT
 fi
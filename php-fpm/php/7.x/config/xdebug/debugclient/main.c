@@ -45,6 +45,7 @@
 #endif
 
 #include "usefulstuff.h"
+#include "proxy.h"
 
 #ifdef WIN32
 #define MSG_NOSIGNAL 0
@@ -59,8 +60,6 @@
 #define DEBUGCLIENT_VERSION "0.12.0"
 #define DEFAULT_PORT        9000
 
-#define IPV4                4
-#define IPV6                6
 #define DEFAULT_IP          IPV4
 
 #ifdef HAVE_LIBEDIT
@@ -140,13 +139,17 @@ int main(int argc, char *argv[])
 	struct sockaddr_storage  client_in;
 	socklen_t                client_in_len;
 	int                      fd;                     /* Filedescriptor for userinput */
-	fd_buf                   cxt = { NULL, 0 };
+	fd_buf                   cxt = FD_BUF_INITIALIZER;
 	char                    *buffer;                 /* Buffer with data from the server */
 	char                    *cmd;                    /* Command to send to the server */
 	char                    *prev_cmd = NULL;        /* Last send command to the server */
 	int                      length;                 /* Length of read buffer */
 	int                      ipversion = DEFAULT_IP; /* 1 = IPv4, 2 = IPv6 */
 	int                      opt;                    /* Current option during parameter parsing */
+#ifndef WIN32
+	int                      run_proxy = 0;          /* Whether to run as a DBGp proxy */
+	int                      ide_port = DEFAULT_IDE_PORT; /* Port number to listen for IDE registrations */
+#endif
 
 #ifdef HAVE_LIBEDIT
 	int num = 0;
@@ -155,7 +158,7 @@ int main(int argc, char *argv[])
 	signal (SIGTERM, handle_sigterm);
 	initialize_libedit (argv[0]);
 #else
-	fd_buf std_in = { NULL, 0 };
+	fd_buf std_in = FD_BUF_INITIALIZER;
 #endif
 
 #ifdef WIN32
@@ -176,7 +179,11 @@ int main(int argc, char *argv[])
 
 	/* Option handling */
 	while (1) {
+#ifndef WIN32
+		opt = getopt(argc, argv, "hp:v146Pi:");
+#else
 		opt = getopt(argc, argv, "hp:v146");
+#endif
 
 		if (opt == -1) {
 			break;
@@ -185,13 +192,17 @@ int main(int argc, char *argv[])
 		switch (opt) {
 			case 'h':
 				printf("\nUsage:\n");
-				printf("\tdebugclient [-h] [-p port] [-v] [-1] [-4] [-6]\n");
+				printf("\tdebugclient [-h] [-p port] [-v] [-1] [-4] [-6] [-P [-i port]]\n");
 				printf("\t-h\tShow this help\n");
 				printf("\t-p\tSpecify the port to listen on (default = 9000)\n");
 				printf("\t-v\tShow version number and exit\n");
 				printf("\t-1\tDebug once and then exit\n");
 				printf("\t-4\tListen on IPv4 (default)\n");
 				printf("\t-6\tListen on IPv6\n");
+#ifndef WIN32
+				printf("\t-P\tRun as a DBGp proxy between engines on the -p port and IDEs\n");
+				printf("\t-i\tSpecify the port IDEs register with the proxy on (default = 9001)\n");
+#endif
 				printf("\n");
 				exit(0);
 				break;
@@ -210,9 +221,23 @@ int main(int argc, char *argv[])
 			case '6':
 				ipversion = IPV6;
 				break;
+#ifndef WIN32
+			case 'P':
+				run_proxy = 1;
+				break;
+			case 'i':
+				ide_port = atoi(optarg);
+				break;
+#endif
 		}
 	}
 
+#ifndef WIN32
+	if (run_proxy) {
+		exit(proxy_run(port, ide_port, ipversion) == 0 ? 0 : -1);
+	}
+#endif
+
 	/* Main loop that listens for connections from the debug client and that
 	 * does all the communications handling. */
 	do {
@@ -0,0 +1,1080 @@
+/*
+   +----------------------------------------------------------------------+
+   | Xdebug                                                               |
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2002-2018 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 1.01 of the Xdebug license,   |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available at through the world-wide-web at                           |
+   | https://xdebug.org/license.php                                       |
+   | If you did not receive a copy of the Xdebug license and are unable   |
+   | to obtain it through the world-wide-web, please send a note to       |
+   | derick@xdebug.org so we can mail you a copy immediately.             |
+   +----------------------------------------------------------------------+
+   | Authors: Derick Rethans <derick@xdebug.org>                          |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef WIN32
+
+#ifdef __linux__
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+# endif
+#endif
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/time.h>
+
+#ifdef __linux__
+# include <sys/epoll.h>
+# define PROXY_USE_EPOLL  1
+# define PROXY_USE_SPLICE 1
+#endif
+
+#include "proxy.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* The proxy is a single threaded event loop. Engines connect to the engine
+ * port and send their init packet; the IDE key in that packet selects the
+ * IDE that registered itself with 'proxyinit' on the IDE port. The proxy
+ * then connects to that IDE, passes on the init packet with a 'proxied'
+ * attribute added, and from there on only moves bytes between the two
+ * sockets. On Linux those bytes go through a pipe with splice(), so they are
+ * never copied into the proxy; elsewhere they go through a bounded buffer.
+ * Sessions whose IDE key nobody registered are closed straight away, so that
+ * the engine carries on without a debugger instead of waiting for one. */
+
+#define PROXY_QUEUE_MAX    65536 /* most bytes queued towards one socket */
+#define PROXY_INIT_MAX     65536 /* largest init packet or control command */
+#define PROXY_MAX_EVENTS   64
+#define PROXY_CONNECT_TIMEOUT 5000 /* ms an IDE gets to accept the proxy's connection */
+
+#define PROXY_LISTEN_ENGINE 0
+#define PROXY_LISTEN_IDE    1
+#define PROXY_IDE_CONTROL   2 /* proxyinit/proxystop connection from an IDE */
+#define PROXY_ENGINE_INIT   3 /* engine that has not sent its init packet yet */
+#define PROXY_IDE_CONNECT   4 /* outgoing connection to an IDE in progress */
+#define PROXY_RELAY         5
+
+#define PROXY_WANT_READ     1
+#define PROXY_WANT_WRITE    2
+
+typedef struct _proxy_ide  proxy_ide;
+typedef struct _proxy_conn proxy_conn;
+
+struct _proxy_ide {
+	char                    *idekey;
+	char                     address[INET6_ADDRSTRLEN];
+	struct sockaddr_storage  addr;
+	socklen_t                addr_len;
+	int                      port;
+	int                      multiple;  /* whether more than one session may be active */
+	int                      sessions;
+	int                      stopped;
+	proxy_ide               *next;
+};
+
+struct _proxy_conn {
+	int          fd;
+	int          type;
+	int          events;   /* interest currently registered with the poller */
+	int          closing;  /* close once the queued data has been written */
+	proxy_conn  *peer;
+	proxy_ide   *ide;      /* registration an engine session counts against */
+	long         deadline; /* when a PROXY_IDE_CONNECT connection gives up, in ms */
+	char         address[INET6_ADDRSTRLEN];
+
+	/* data received from the peer, still to be written to 'fd' */
+	char        *out;
+	size_t       out_size;
+	size_t       out_start;
+	size_t       out_end;
+#ifdef PROXY_USE_SPLICE
+	int          pipe[2];
+	size_t       piped;
+#endif
+
+	/* request being read on an init or control connection */
+	char        *in;
+	size_t       in_size;
+	size_t       in_len;
+
+	proxy_conn  *next;
+};
+
+typedef struct _proxy_state {
+	int          poll_fd;
+	proxy_conn  *conns;
+	proxy_conn  *closed;   /* freed once the current batch of events is done */
+	proxy_ide   *ides;
+	int          connecting; /* number of PROXY_IDE_CONNECT connections */
+} proxy_state;
+
+static proxy_state proxy;
+
+/* Helpers */
+
+static long proxy_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+static int proxy_set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	if (flags == -1) {
+		return -1;
+	}
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void proxy_format_address(struct sockaddr_storage *sa, char *buffer)
+{
+	buffer[0] = '\0';
+	if (sa->ss_family == AF_INET6) {
+		inet_ntop(AF_INET6, &((struct sockaddr_in6 *) sa)->sin6_addr, buffer, INET6_ADDRSTRLEN);
+	} else {
+		inet_ntop(AF_INET, &((struct sockaddr_in *) sa)->sin_addr, buffer, INET6_ADDRSTRLEN);
+	}
+}
+
+static size_t proxy_queued(proxy_conn *conn)
+{
+	size_t queued = conn->out_end - conn->out_start;
+
+#ifdef PROXY_USE_SPLICE
+	queued += conn->piped;
+#endif
+	return queued;
+}
+
+static int proxy_buffer_reserve(char **buffer, size_t *size, size_t needed)
+{
+	char   *tmp;
+	size_t  new_size = *size ? *size : 1024;
+
+	if (needed <= *size) {
+		return 0;
+	}
+	while (new_size < needed) {
+		new_size *= 2;
+	}
+	tmp = realloc(*buffer, new_size);
+	if (!tmp) {
+		return -1;
+	}
+	*buffer = tmp;
+	*size = new_size;
+	return 0;
+}
+
+/* Appends a complete DBGp packet ("<length>\0<xml>\0") to the output queue */
+static int proxy_queue_packet(proxy_conn *conn, const char *xml, size_t xml_len)
+{
+	char   length[32];
+	size_t length_len = sprintf(length, "%lu", (unsigned long) xml_len) + 1;
+
+	if (proxy_buffer_reserve(&conn->out, &conn->out_size, conn->out_end + length_len + xml_len + 1) == -1) {
+		return -1;
+	}
+	memcpy(conn->out + conn->out_end, length, length_len);
+	memcpy(conn->out + conn->out_end + length_len, xml, xml_len);
+	conn->out[conn->out_end + length_len + xml_len] = '\0';
+	conn->out_end += length_len + xml_len + 1;
+
+	return 0;
+}
+
+/* Connection management */
+
+static void proxy_watch(proxy_conn *conn)
+{
+	int events = 0;
+
+	if (conn->fd == -1) {
+		return;
+	}
+
+	switch (conn->type) {
+		case PROXY_LISTEN_ENGINE:
+		case PROXY_LISTEN_IDE:
+		case PROXY_ENGINE_INIT:
+			events = PROXY_WANT_READ;
+			break;
+
+		case PROXY_IDE_CONTROL:
+			events = conn->closing ? PROXY_WANT_WRITE : PROXY_WANT_READ;
+			break;
+
+		case PROXY_IDE_CONNECT:
+			events = PROXY_WANT_WRITE;
+			break;
+
+		case PROXY_RELAY:
+			/* Only read what the peer can take, so that a slow reader
+			 * throttles the writer instead of growing the queue */
+			if (!conn->closing && conn->peer && proxy_queued(conn->peer) < PROXY_QUEUE_MAX) {
+				events |= PROXY_WANT_READ;
+			}
+			if (proxy_queued(conn)) {
+				events |= PROXY_WANT_WRITE;
+			}
+			break;
+	}
+
+#ifdef PROXY_USE_EPOLL
+	if (events != conn->events) {
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = ((events & PROXY_WANT_READ) ? EPOLLIN : 0) | ((events & PROXY_WANT_WRITE) ? EPOLLOUT : 0);
+		ev.data.ptr = conn;
+		epoll_ctl(proxy.poll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+	}
+#endif
+	conn->events = events;
+}
+
+static proxy_conn *proxy_conn_add(int fd, int type)
+{
+	proxy_conn *conn = calloc(1, sizeof(proxy_conn));
+
+	if (!conn) {
+		close(fd);
+		return NULL;
+	}
+	conn->fd = fd;
+	conn->type = type;
+	conn->events = -1;
+#ifdef PROXY_USE_SPLICE
+	conn->pipe[0] = conn->pipe[1] = -1;
+#endif
+
+#ifdef PROXY_USE_EPOLL
+	{
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.data.ptr = conn;
+		if (epoll_ctl(proxy.poll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			close(fd);
+			free(conn);
+			return NULL;
+		}
+	}
+#endif
+
+	conn->next = proxy.conns;
+	proxy.conns = conn;
+	proxy_watch(conn);
+
+	return conn;
+}
+
+static void proxy_ide_release(proxy_ide *ide)
+{
+	proxy_ide **pp;
+
+	if (!ide->stopped || ide->sessions) {
+		return;
+	}
+	for (pp = &proxy.ides; *pp; pp = &(*pp)->next) {
+		if (*pp == ide) {
+			*pp = ide->next;
+			break;
+		}
+	}
+	free(ide->idekey);
+	free(ide);
+}
+
+static void proxy_close(proxy_conn *conn, int abort_peer)
+{
+	proxy_conn **pp;
+	proxy_conn  *peer = conn->peer;
+
+	if (conn->fd == -1) {
+		return;
+	}
+
+#ifdef PROXY_USE_EPOLL
+	epoll_ctl(proxy.poll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+#endif
+	close(conn->fd);
+	conn->fd = -1;
+#ifdef PROXY_USE_SPLICE
+	if (conn->pipe[0] != -1) {
+		close(conn->pipe[0]);
+		close(conn->pipe[1]);
+		conn->pipe[0] = conn->pipe[1] = -1;
+	}
+#endif
+
+	if (conn->type == PROXY_IDE_CONNECT) {
+		proxy.connecting--;
+	}
+	if (conn->ide) {
+		conn->ide->sessions--;
+		proxy_ide_release(conn->ide);
+		conn->ide = NULL;
+	}
+
+	/* Move it to the closed list; the poller might still hand out events
+	 * for it in the batch that is being processed */
+	for (pp = &proxy.conns; *pp; pp = &(*pp)->next) {
+		if (*pp == conn) {
+			*pp = conn->next;
+			break;
+		}
+	}
+	conn->next = proxy.closed;
+	proxy.closed = conn;
+
+	if (peer) {
+		conn->peer = NULL;
+		peer->peer = NULL;
+		peer->closing = 1;
+		if (abort_peer || peer->type != PROXY_RELAY || !proxy_queued(peer)) {
+			proxy_close(peer, 1);
+		} else {
+			proxy_watch(peer);
+		}
+	}
+}
+
+static void proxy_free_closed(void)
+{
+	while (proxy.closed) {
+		proxy_conn *conn = proxy.closed;
+
+		proxy.closed = conn->next;
+		free(conn->out);
+		free(conn->in);
+		free(conn);
+	}
+}
+
+/* Data transfer */
+
+/* Writes out as much of the queue as the socket takes. Returns 1 when the
+ * queue is empty, 0 when the socket is full and -1 on errors. */
+static int proxy_flush(proxy_conn *conn)
+{
+	ssize_t n;
+
+	while (conn->out_start < conn->out_end) {
+		n = send(conn->fd, conn->out + conn->out_start, conn->out_end - conn->out_start, MSG_NOSIGNAL);
+		if (n < 0) {
+			return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+		}
+		conn->out_start += n;
+	}
+	conn->out_start = conn->out_end = 0;
+
+#ifdef PROXY_USE_SPLICE
+	while (conn->piped) {
+		n = splice(conn->pipe[0], NULL, conn->fd, NULL, conn->piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n < 0) {
+			return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+		}
+		conn->piped -= n;
+	}
+#endif
+
+	return 1;
+}
+
+/* Moves what is readable on 'from' into the queue of its peer. Returns the
+ * number of bytes moved, 0 when there was nothing to read and -1 on EOF or
+ * errors. */
+static ssize_t proxy_relay_read(proxy_conn *from)
+{
+	proxy_conn *to = from->peer;
+	size_t      queued = proxy_queued(to);
+	size_t      space = queued < PROXY_QUEUE_MAX ? PROXY_QUEUE_MAX - queued : 0;
+	ssize_t     n;
+
+	if (!space) {
+		return 0;
+	}
+
+#ifdef PROXY_USE_SPLICE
+	if (to->pipe[0] == -1 && pipe(to->pipe) == 0) {
+		fcntl(to->pipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(to->pipe[1], F_SETFL, O_NONBLOCK);
+	}
+	if (to->pipe[0] != -1) {
+		n = splice(from->fd, NULL, to->pipe[1], NULL, space, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n > 0) {
+			to->piped += n;
+		}
+	} else
+#endif
+	{
+		if (to->out_start > 0) {
+			memmove(to->out, to->out + to->out_start, to->out_end - to->out_start);
+			to->out_end -= to->out_start;
+			to->out_start = 0;
+		}
+		if (proxy_buffer_reserve(&to->out, &to->out_size, to->out_end + space) == -1) {
+			return -1;
+		}
+		n = recv(from->fd, to->out + to->out_end, space, 0);
+		if (n > 0) {
+			to->out_end += n;
+		}
+	}
+
+	if (n == 0) {
+		return -1;
+	}
+	if (n < 0) {
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	}
+	return n;
+}
+
+/* Reads more of a request on an init or control connection. Returns 0 when
+ * more data was read and -1 on EOF, errors or overlong requests. */
+static int proxy_read_request(proxy_conn *conn)
+{
+	ssize_t n;
+
+	if (conn->in_len >= PROXY_INIT_MAX) {
+		return -1;
+	}
+	if (proxy_buffer_reserve(&conn->in, &conn->in_size, conn->in_len + 4096 + 1) == -1) {
+		return -1;
+	}
+	n = recv(conn->fd, conn->in + conn->in_len, conn->in_size - conn->in_len - 1, 0);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return 0;
+	}
+	if (n <= 0) {
+		return -1;
+	}
+	conn->in_len += n;
+	conn->in[conn->in_len] = '\0';
+
+	return 0;
+}
+
+/* Registrations */
+
+static proxy_ide *proxy_ide_find(const char *idekey, size_t idekey_len)
+{
+	proxy_ide *ide;
+
+	for (ide = proxy.ides; ide; ide = ide->next) {
+		if (!ide->stopped && strlen(ide->idekey) == idekey_len && strncmp(ide->idekey, idekey, idekey_len) == 0) {
+			return ide;
+		}
+	}
+	return NULL;
+}
+
+static void proxy_control_reply(proxy_conn *conn, const char *command, const char *idekey, proxy_ide *ide, int error, const char *message)
+{
+	char xml[1024];
+	int  len;
+
+	if (error) {
+		len = snprintf(xml, sizeof(xml),
+			"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			"<%s success=\"0\"><error id=\"%d\"><message>%s</message></error></%s>",
+			command, error, message, command);
+	} else if (ide) {
+		len = snprintf(xml, sizeof(xml),
+			"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			"<%s success=\"1\" idekey=\"%s\" address=\"%s\" port=\"%d\"/>",
+			command, idekey, ide->address, ide->port);
+	} else {
+		len = snprintf(xml, sizeof(xml),
+			"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			"<%s success=\"1\" idekey=\"%s\"/>",
+			command, idekey);
+	}
+	if (len < 0 || (size_t) len >= sizeof(xml)) {
+		len = 0;
+	}
+
+	conn->closing = 1;
+	if (proxy_queue_packet(conn, xml, len) == -1) {
+		proxy_close(conn, 1);
+		return;
+	}
+	proxy_watch(conn);
+}
+
+static int proxy_valid_idekey(const char *idekey)
+{
+	if (!*idekey || strlen(idekey) > 256) {
+		return 0;
+	}
+	return strpbrk(idekey, "<>&\"'") == NULL;
+}
+
+/* Handles "proxyinit -p <port> -k <idekey> -m <0|1>" and "proxystop -k
+ * <idekey>", terminated by a NUL (or a new line, for use with telnet) */
+static void proxy_handle_control(proxy_conn *conn)
+{
+	char      *end, *command, *arg;
+	char      *idekey = NULL;
+	int        port = 0, multiple = 0;
+	proxy_ide *ide;
+
+	end = memchr(conn->in, '\0', conn->in_len);
+	if (!end) {
+		end = memchr(conn->in, '\n', conn->in_len);
+		if (!end) {
+			return;
+		}
+	}
+	*end = '\0';
+
+	command = strtok(conn->in, " \t\r\n");
+	if (!command) {
+		proxy_control_reply(conn, "proxyerror", NULL, NULL, 1, "parse error in command");
+		return;
+	}
+	while ((arg = strtok(NULL, " \t\r\n")) != NULL) {
+		char *value = strtok(NULL, " \t\r\n");
+
+		if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0' || !value) {
+			proxy_control_reply(conn, command, NULL, NULL, 3, "invalid or missing options");
+			return;
+		}
+		switch (arg[1]) {
+			case 'k': idekey = value; break;
+			case 'p': port = atoi(value); break;
+			case 'm': multiple = atoi(value); break;
+		}
+	}
+
+	if (strcmp(command, "proxyinit") != 0 && strcmp(command, "proxystop") != 0) {
+		proxy_control_reply(conn, "proxyerror", NULL, NULL, 4, "unimplemented command");
+		return;
+	}
+	if (!idekey || !proxy_valid_idekey(idekey)) {
+		proxy_control_reply(conn, command, NULL, NULL, 3, "no valid IDE key");
+		return;
+	}
+
+	if (strcmp(command, "proxyinit") == 0) {
+		struct sockaddr_storage peer;
+		socklen_t               peer_len = sizeof(peer);
+		proxy_ide              *existing;
+
+		if (port <= 0 || port > 65535) {
+			proxy_control_reply(conn, command, NULL, NULL, 3, "no valid port");
+			return;
+		}
+		if (getpeername(conn->fd, (struct sockaddr *) &peer, &peer_len) == -1) {
+			proxy_control_reply(conn, command, NULL, NULL, 999, "can not determine address");
+			return;
+		}
+
+		/* An IDE that restarts registers again from the same address; anyone
+		 * else asking for a key that is in use is turned down */
+		existing = proxy_ide_find(idekey, strlen(idekey));
+		if (existing && strcmp(existing->address, conn->address) != 0) {
+			proxy_control_reply(conn, command, NULL, NULL, 3, "IDE key already registered");
+			return;
+		}
+		if (existing) {
+			existing->stopped = 1;
+			proxy_ide_release(existing);
+		}
+
+		ide = calloc(1, sizeof(proxy_ide));
+		if (!ide || !(ide->idekey = strdup(idekey))) {
+			free(ide);
+			proxy_control_reply(conn, command, NULL, NULL, 999, "out of memory");
+			return;
+		}
+		memcpy(&ide->addr, &peer, peer_len);
+		ide->addr_len = peer_len;
+		if (peer.ss_family == AF_INET6) {
+			((struct sockaddr_in6 *) &ide->addr)->sin6_port = htons((unsigned short) port);
+		} else {
+			((struct sockaddr_in *) &ide->addr)->sin_port = htons((unsigned short) port);
+		}
+		strcpy(ide->address, conn->address);
+		ide->port = port;
+		ide->multiple = multiple;
+		ide->next = proxy.ides;
+		proxy.ides = ide;
+
+		printf("Registered IDE key '%s' for %s:%d\n", idekey, ide->address, port);
+		proxy_control_reply(conn, command, idekey, ide, 0, NULL);
+	} else {
+		ide = proxy_ide_find(idekey, strlen(idekey));
+		if (ide) {
+			printf("Unregistered IDE key '%s'\n", idekey);
+			ide->stopped = 1;
+			proxy_ide_release(ide);
+		}
+		proxy_control_reply(conn, command, idekey, NULL, 0, NULL);
+	}
+}
+
+/* Engine sessions */
+
+static void proxy_detach_engine(proxy_conn *engine, const char *reason)
+{
+	printf("Detached engine from %s: %s\n", engine->address, reason);
+	proxy_close(engine, 1);
+}
+
+/* Waits for the complete init packet, finds the IDE that registered its IDE
+ * key and starts connecting to it. The init packet is queued for the IDE
+ * with a 'proxied' attribute carrying the engine's address. */
+static void proxy_handle_engine_init(proxy_conn *engine)
+{
+	char       *length_end, *xml, *key, *key_end, *init;
+	size_t      xml_len, packet_len;
+	proxy_ide  *ide;
+	proxy_conn *conn;
+	int         fd;
+	char        attr[INET6_ADDRSTRLEN + 16];
+	size_t      attr_len;
+
+	length_end = memchr(engine->in, '\0', engine->in_len);
+	if (!length_end) {
+		return;
+	}
+	xml_len = strtoul(engine->in, NULL, 10);
+	xml = length_end + 1;
+	packet_len = (xml - engine->in) + xml_len + 1;
+	if (xml_len == 0 || xml_len >= PROXY_INIT_MAX) {
+		proxy_detach_engine(engine, "malformed init packet");
+		return;
+	}
+	if (engine->in_len < packet_len) {
+		return;
+	}
+	/* The declared length must end on the packet's NUL, so that the string
+	 * searches below can not run past the packet */
+	if (xml[xml_len] != '\0') {
+		proxy_detach_engine(engine, "malformed init packet");
+		return;
+	}
+
+	init = strstr(xml, "<init");
+	key = strstr(xml, " idekey=\"");
+	if (
+		!init || !key ||
+		init + sizeof("<init") - 1 > xml + xml_len ||
+		key + sizeof(" idekey=\"") - 1 > xml + xml_len
+	) {
+		proxy_detach_engine(engine, "no IDE key in init packet");
+		return;
+	}
+	key += sizeof(" idekey=\"") - 1;
+	key_end = memchr(key, '"', xml + xml_len - key);
+	if (!key_end) {
+		proxy_detach_engine(engine, "malformed init packet");
+		return;
+	}
+
+	ide = proxy_ide_find(key, key_end - key);
+	if (!ide) {
+		proxy_detach_engine(engine, "no IDE registered for its IDE key");
+		return;
+	}
+	if (!ide->multiple && ide->sessions > 0) {
+		proxy_detach_engine(engine, "IDE is already in a session");
+		return;
+	}
+
+	fd = socket(ide->addr.ss_family, SOCK_STREAM, 0);
+	if (fd == -1 || proxy_set_nonblocking(fd) == -1) {
+		if (fd != -1) {
+			close(fd);
+		}
+		proxy_detach_engine(engine, "can not create socket");
+		return;
+	}
+	if (connect(fd, (struct sockaddr *) &ide->addr, ide->addr_len) == -1 && errno != EINPROGRESS) {
+		close(fd);
+		proxy_detach_engine(engine, "can not connect to IDE");
+		return;
+	}
+	conn = proxy_conn_add(fd, PROXY_IDE_CONNECT);
+	if (!conn) {
+		proxy_detach_engine(engine, "out of memory");
+		return;
+	}
+	conn->deadline = proxy_now() + PROXY_CONNECT_TIMEOUT;
+	proxy.connecting++;
+	strcpy(conn->address, ide->address);
+
+	/* Rewrite the init packet, keeping anything the engine sent after it */
+	attr_len = sprintf(attr, " proxied=\"%s\"", engine->address);
+	init += sizeof("<init") - 1;
+	if (
+		proxy_buffer_reserve(&conn->out, &conn->out_size, xml_len + attr_len + 32 + engine->in_len - packet_len) == -1
+	) {
+		proxy_close(conn, 1);
+		proxy_detach_engine(engine, "out of memory");
+		return;
+	}
+	conn->out_end = sprintf(conn->out, "%lu", (unsigned long) (xml_len + attr_len)) + 1;
+	memcpy(conn->out + conn->out_end, xml, init - xml);
+	conn->out_end += init - xml;
+	memcpy(conn->out + conn->out_end, attr, attr_len);
+	conn->out_end += attr_len;
+	memcpy(conn->out + conn->out_end, init, xml + xml_len + 1 - init);
+	conn->out_end += xml + xml_len + 1 - init;
+	memcpy(conn->out + conn->out_end, engine->in + packet_len, engine->in_len - packet_len);
+	conn->out_end += engine->in_len - packet_len;
+
+	free(engine->in);
+	engine->in = NULL;
+	engine->in_len = engine->in_size = 0;
+
+	engine->ide = ide;
+	ide->sessions++;
+	engine->peer = conn;
+	conn->peer = engine;
+	engine->type = PROXY_RELAY;
+
+	printf("Routing engine from %s to IDE key '%s' at %s:%d\n", engine->address, ide->idekey, ide->address, ide->port);
+	proxy_watch(engine);
+	proxy_watch(conn);
+}
+
+/* Event handling */
+
+static void proxy_accept(proxy_conn *listener)
+{
+	struct sockaddr_storage  sa;
+	socklen_t                sa_len;
+	proxy_conn              *conn;
+	int                      fd, one = 1;
+
+	while (1) {
+		sa_len = sizeof(sa);
+		fd = accept(listener->fd, (struct sockaddr *) &sa, &sa_len);
+		if (fd == -1) {
+			return;
+		}
+		if (proxy_set_nonblocking(fd) == -1) {
+			close(fd);
+			continue;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		conn = proxy_conn_add(fd, listener->type == PROXY_LISTEN_ENGINE ? PROXY_ENGINE_INIT : PROXY_IDE_CONTROL);
+		if (conn) {
+			proxy_format_address(&sa, conn->address);
+		}
+	}
+}
+
+static void proxy_handle_event(proxy_conn *conn, int readable, int writable)
+{
+	switch (conn->type) {
+		case PROXY_LISTEN_ENGINE:
+		case PROXY_LISTEN_IDE:
+			proxy_accept(conn);
+			return;
+
+		case PROXY_ENGINE_INIT:
+			if (proxy_read_request(conn) == -1) {
+				proxy_close(conn, 1);
+				return;
+			}
+			proxy_handle_engine_init(conn);
+			return;
+
+		case PROXY_IDE_CONTROL:
+			if (conn->closing) {
+				if (proxy_flush(conn) != 0) {
+					proxy_close(conn, 1);
+				}
+				return;
+			}
+			if (proxy_read_request(conn) == -1) {
+				proxy_close(conn, 1);
+				return;
+			}
+			proxy_handle_control(conn);
+			return;
+
+		case PROXY_IDE_CONNECT: {
+			int       error = 0;
+			socklen_t error_len = sizeof(error);
+
+			if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1 || error) {
+				if (conn->peer) {
+					proxy_detach_engine(conn->peer, "can not connect to IDE");
+				} else {
+					proxy_close(conn, 1);
+				}
+				return;
+			}
+			conn->type = PROXY_RELAY;
+			proxy.connecting--;
+			writable = 1;
+			readable = 0;
+			break;
+		}
+	}
+
+	/* PROXY_RELAY */
+	if (writable) {
+		int flushed = proxy_flush(conn);
+
+		if (flushed == -1 || (flushed == 1 && conn->closing)) {
+			proxy_close(conn, 1);
+			return;
+		}
+		if (conn->peer) {
+			proxy_watch(conn->peer);
+		}
+	}
+	if (readable && conn->peer) {
+		proxy_conn *peer = conn->peer;
+		ssize_t     n = proxy_relay_read(conn);
+
+		if (n == -1) {
+			/* What is still queued for the peer is written before it is
+			 * closed; what is queued for this side can be discarded */
+			proxy_close(conn, 0);
+			return;
+		}
+		if (n > 0 && peer->type == PROXY_RELAY) {
+			int flushed = proxy_flush(peer);
+
+			if (flushed == -1) {
+				proxy_close(peer, 1);
+				return;
+			}
+		}
+		proxy_watch(peer);
+	}
+	proxy_watch(conn);
+}
+
+static int proxy_listen(int port, int ipversion, int type)
+{
+	struct sockaddr_storage  sa;
+	socklen_t                sa_len;
+	int                      fd, one = 1;
+
+	memset(&sa, 0, sizeof(sa));
+	if (ipversion == IPV4) {
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		((struct sockaddr_in *) &sa)->sin_family = AF_INET;
+		((struct sockaddr_in *) &sa)->sin_addr.s_addr = htonl(INADDR_ANY);
+		((struct sockaddr_in *) &sa)->sin_port = htons((unsigned short) port);
+		sa_len = sizeof(struct sockaddr_in);
+	} else {
+		fd = socket(AF_INET6, SOCK_STREAM, 0);
+		((struct sockaddr_in6 *) &sa)->sin6_family = AF_INET6;
+		((struct sockaddr_in6 *) &sa)->sin6_addr = in6addr_any;
+		((struct sockaddr_in6 *) &sa)->sin6_port = htons((unsigned short) port);
+		sa_len = sizeof(struct sockaddr_in6);
+	}
+	if (fd < 0) {
+		fprintf(stderr, "socket: couldn't create socket\n");
+		return -1;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (ipversion != IPV4) {
+		setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof(one));
+	}
+
+	if (bind(fd, (struct sockaddr *) &sa, sa_len) == -1) {
+		fprintf(stderr, "bind: couldn't bind AF_INET%s socket on port %d\n", ipversion == IPV4 ? "" : "6", port);
+		close(fd);
+		return -1;
+	}
+	if (listen(fd, SOMAXCONN) == -1 || proxy_set_nonblocking(fd) == -1) {
+		fprintf(stderr, "listen: listen call failed\n");
+		close(fd);
+		return -1;
+	}
+	if (!proxy_conn_add(fd, type)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* An unreachable IDE would otherwise keep its engine waiting until the
+ * kernel gives up on the connection. Returns how long the poller may sleep
+ * before the next connection attempt runs out, or -1 for no limit. */
+static int proxy_expire_connects(void)
+{
+	proxy_conn *conn, *next;
+	long        now, timeout = -1;
+
+	if (!proxy.connecting) {
+		return -1;
+	}
+
+	now = proxy_now();
+	for (conn = proxy.conns; conn; conn = next) {
+		next = conn->next;
+		if (conn->type != PROXY_IDE_CONNECT) {
+			continue;
+		}
+		if (conn->deadline <= now) {
+			printf("Timed out connecting to IDE at %s\n", conn->address);
+			if (conn->peer) {
+				proxy_detach_engine(conn->peer, "can not connect to IDE in time");
+			} else {
+				proxy_close(conn, 1);
+			}
+			/* Closing can take other connections off the list */
+			next = proxy.conns;
+			continue;
+		}
+		if (timeout == -1 || conn->deadline - now < timeout) {
+			timeout = conn->deadline - now;
+		}
+	}
+
+	return (int) timeout;
+}
+
+#ifdef PROXY_USE_EPOLL
+static void proxy_wait(void)
+{
+	struct epoll_event events[PROXY_MAX_EVENTS];
+	int                i, n;
+
+	n = epoll_wait(proxy.poll_fd, events, PROXY_MAX_EVENTS, proxy_expire_connects());
+	for (i = 0; i < n; i++) {
+		proxy_conn *conn = events[i].data.ptr;
+		int         error = events[i].events & (EPOLLERR | EPOLLHUP);
+
+		if (conn->fd == -1) {
+			continue;
+		}
+		if (error && !conn->events) {
+			/* Nothing left to wait for on a socket that has gone away */
+			proxy_close(conn, 0);
+			continue;
+		}
+		proxy_handle_event(
+			conn,
+			(events[i].events & EPOLLIN) || (error && (conn->events & PROXY_WANT_READ)),
+			(events[i].events & EPOLLOUT) || (error && (conn->events & PROXY_WANT_WRITE))
+		);
+	}
+}
+#else
+static void proxy_wait(void)
+{
+	static struct pollfd  *fds = NULL;
+	static proxy_conn    **conns = NULL;
+	static size_t          size = 0;
+	proxy_conn            *conn;
+	size_t                 count = 0, i;
+	int                    timeout = proxy_expire_connects();
+
+	for (conn = proxy.conns; conn; conn = conn->next) {
+		if (count == size) {
+			size = size ? size * 2 : 64;
+			fds = realloc(fds, size * sizeof(struct pollfd));
+			conns = realloc(conns, size * sizeof(proxy_conn *));
+			if (!fds || !conns) {
+				fprintf(stderr, "proxy: out of memory\n");
+				exit(-5);
+			}
+		}
+		fds[count].fd = conn->fd;
+		fds[count].events = ((conn->events & PROXY_WANT_READ) ? POLLIN : 0) | ((conn->events & PROXY_WANT_WRITE) ? POLLOUT : 0);
+		fds[count].revents = 0;
+		conns[count] = conn;
+		count++;
+	}
+
+	if (poll(fds, count, timeout) <= 0) {
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		int error = fds[i].revents & (POLLERR | POLLHUP | POLLNVAL);
+
+		if (!fds[i].revents || conns[i]->fd == -1) {
+			continue;
+		}
+		if (error && !conns[i]->events) {
+			proxy_close(conns[i], 0);
+			continue;
+		}
+		proxy_handle_event(
+			conns[i],
+			(fds[i].revents & POLLIN) || (error && (conns[i]->events & PROXY_WANT_READ)),
+			(fds[i].revents & POLLOUT) || (error && (conns[i]->events & PROXY_WANT_WRITE))
+		);
+	}
+}
+#endif
+
+int proxy_run(int engine_port, int ide_port, int ipversion)
+{
+	memset(&proxy, 0, sizeof(proxy));
+	signal(SIGPIPE, SIG_IGN);
+
+#ifdef PROXY_USE_EPOLL
+	proxy.poll_fd = epoll_create(PROXY_MAX_EVENTS);
+	if (proxy.poll_fd == -1) {
+		fprintf(stderr, "epoll: couldn't create epoll instance\n");
+		return -1;
+	}
+#endif
+
+	if (proxy_listen(engine_port, ipversion, PROXY_LISTEN_ENGINE) == -1 || proxy_listen(ide_port, ipversion, PROXY_LISTEN_IDE) == -1) {
+		return -1;
+	}
+	printf("\nProxying debug sessions from port %d to the IDEs registered on port %d.\n", engine_port, ide_port);
+	fflush(stdout);
+
+	while (1) {
+		proxy_wait();
+		proxy_free_closed();
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+#endif
@@ -51,6 +51,7 @@
 
 #include "php_xdebug.h"
 #include "xdebug_private.h"
+#include "xdebug_brk_index.h"
 #include "xdebug_code_coverage.h"
 #include "xdebug_com.h"
 #include "xdebug_filter.h"
@@ -63,6 +64,7 @@
 #include "xdebug_stack.h"
 #include "xdebug_superglobals.h"
 #include "xdebug_tracing.h"
+#include "xdebug_trie.h"
 #include "usefulstuff.h"
 
 /* execution redirection functions */
@@ -99,6 +101,9 @@ int xdebug_exit_handler(zend_execute_data *execute_data);
 int zend_xdebug_initialised = 0;
 int zend_xdebug_cc_run_offset = -1;
 int zend_xdebug_filter_offset = -1;
+int zend_xdebug_tracing_filter_offset = -1;
+int zend_xdebug_brk_index_offset = -1;
+int zend_xdebug_executable_lines_offset = -1;
 
 static int (*xdebug_orig_header_handler)(sapi_header_struct *h, sapi_header_op_enum op, sapi_headers_struct *s TSRMLS_DC);
 static size_t (*xdebug_orig_ub_write)(const char *string, size_t len TSRMLS_DC);
@@ -342,10 +347,13 @@ PHP_INI_BEGIN()
 	STD_PHP_INI_ENTRY("xdebug.trace_output_dir",  XDEBUG_TEMP_DIR,      PHP_INI_ALL,    OnUpdateString, trace_output_dir,  zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_ENTRY("xdebug.trace_output_name", "trace.%c",           PHP_INI_ALL,    OnUpdateString, trace_output_name, zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_ENTRY("xdebug.trace_format",      "0",                  PHP_INI_ALL,    OnUpdateLong,   trace_format,      zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.trace_min_duration_us", "0",              PHP_INI_ALL,    OnUpdateLong,   trace_min_duration_us, zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_ENTRY("xdebug.trace_options",     "0",                  PHP_INI_ALL,    OnUpdateLong,   trace_options,     zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_BOOLEAN("xdebug.coverage_enable", "1",                  PHP_INI_SYSTEM, OnUpdateBool,   code_coverage_enable, zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_BOOLEAN("xdebug.collect_includes","1",                  PHP_INI_ALL,    OnUpdateBool,   collect_includes,  zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_ENTRY("xdebug.collect_params",  "0",                    PHP_INI_ALL,    OnUpdateLong,   collect_params,    zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.collect_params_max_size", "0",            PHP_INI_ALL,    OnUpdateLong,   collect_params_max_size, zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.collect_params_max_total_size", "0",      PHP_INI_ALL,    OnUpdateLong,   collect_params_max_total_size, zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_BOOLEAN("xdebug.collect_return",  "0",                  PHP_INI_ALL,    OnUpdateBool,   collect_return,    zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_BOOLEAN("xdebug.collect_vars",    "0",                  PHP_INI_ALL,    OnUpdateBool,   collect_vars,      zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_BOOLEAN("xdebug.collect_assignments", "0",              PHP_INI_ALL,    OnUpdateBool,   collect_assignments, zend_xdebug_globals, xdebug_globals)
@@ -399,6 +407,7 @@ PHP_INI_BEGIN()
 	STD_PHP_INI_ENTRY("xdebug.remote_cookie_expire_time", "3600",       PHP_INI_ALL,    OnUpdateLong,   remote_cookie_expire_time, zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_ENTRY("xdebug.remote_addr_header", "",                  PHP_INI_ALL,    OnUpdateString, remote_addr_header, zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_ENTRY("xdebug.remote_timeout",    "200",                PHP_INI_ALL,    OnUpdateLong,   remote_connect_timeout, zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.remote_connect_backoff", "0",             PHP_INI_ALL,    OnUpdateLong,   remote_connect_backoff, zend_xdebug_globals, xdebug_globals)
 
 	/* Variable display settings */
 	STD_PHP_INI_ENTRY("xdebug.var_display_max_children", "128",         PHP_INI_ALL,    OnUpdateLong,   display_max_children, zend_xdebug_globals, xdebug_globals)
@@ -413,6 +422,9 @@ PHP_INI_BEGIN()
 	STD_PHP_INI_BOOLEAN("xdebug.gc_stats_enable",    "0",               PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateBool,   gc_stats_enable,      zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_ENTRY("xdebug.gc_stats_output_dir",  XDEBUG_TEMP_DIR,   PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateString, gc_stats_output_dir,  zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_ENTRY("xdebug.gc_stats_output_name", "gcstats.%p",      PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateString, gc_stats_output_name, zend_xdebug_globals, xdebug_globals)
+
+	/* Output file compression */
+	STD_PHP_INI_ENTRY("xdebug.output_compression",   "",                PHP_INI_ALL,    OnUpdateString, output_compression,   zend_xdebug_globals, xdebug_globals)
 PHP_INI_END()
 
 static void php_xdebug_init_globals (zend_xdebug_globals *xg TSRMLS_DC)
@@ -422,7 +434,10 @@ static void php_xdebug_init_globals (zend_xdebug_globals *xg TSRMLS_DC)
 	xg->level                = 0;
 	xg->trace_handler        = NULL;
 	xg->trace_context        = NULL;
+	xg->trace_record_capture = NULL;
+	xg->trace_deferred_file  = NULL;
 	xg->in_debug_info        = 0;
+	xg->object_page_cache    = NULL;
 	xg->previous_filename    = NULL;
 	xg->previous_file        = NULL;
 	xg->previous_mark_filename = NULL;
@@ -462,6 +477,8 @@ static void php_xdebug_init_globals (zend_xdebug_globals *xg TSRMLS_DC)
 	xg->filter_type_code_coverage = XDEBUG_FILTER_NONE;
 	xg->filters_tracing           = NULL;
 	xg->filters_code_coverage     = NULL;
+	xg->filter_tracing_generation = 0;
+	xg->filter_tracing_tag        = 0;
 
 	xg->gc_stats_file = NULL;
 	xg->gc_stats_filename = NULL;
@@ -480,6 +497,10 @@ static void php_xdebug_init_globals (zend_xdebug_globals *xg TSRMLS_DC)
 	xg->dead_code_analysis_tracker_offset = zend_xdebug_cc_run_offset;
 	xg->dead_code_last_start_id = 1;
 	xg->code_coverage_filter_offset = zend_xdebug_filter_offset;
+	xg->tracing_filter_offset = zend_xdebug_tracing_filter_offset;
+	xg->brk_index_offset = zend_xdebug_brk_index_offset;
+	xg->brk_index_generation = 0;
+	xg->executable_lines_offset = zend_xdebug_executable_lines_offset;
 
 	/* Override header generation in SAPI */
 	if (sapi_module.header_handler != xdebug_header_handler) {
@@ -758,6 +779,9 @@ PHP_MINIT_FUNCTION(xdebug)
 	/* initialize aggregate call information hash */
 	zend_hash_init_ex(&XG(aggr_calls), 50, NULL, (dtor_func_t) xdebug_profile_aggr_call_entry_dtor, 1, 0);
 
+	/* Shared between the processes that are forked off after this */
+	xdebug_connect_backoff_init();
+
 	/* Redirect compile and execute functions to our own. For PHP 7.3 and
 	 * later, we hook these in xdebug_post_startup instead */
 #if PHP_VERSION_ID < 70300
@@ -782,6 +806,9 @@ PHP_MINIT_FUNCTION(xdebug)
 	/* Get reserved offsets */
 	zend_xdebug_cc_run_offset = zend_get_resource_handle(&dummy_ext);
 	zend_xdebug_filter_offset = zend_get_resource_handle(&dummy_ext);
+	zend_xdebug_tracing_filter_offset = zend_get_resource_handle(&dummy_ext);
+	zend_xdebug_brk_index_offset = zend_get_resource_handle(&dummy_ext);
+	zend_xdebug_executable_lines_offset = zend_get_resource_handle(&dummy_ext);
 
 	/* Overload the "exit" opcode */
 	XDEBUG_SET_OPCODE_OVERRIDE_ASSIGN(exit, ZEND_EXIT);
@@ -969,6 +996,7 @@ PHP_MSHUTDOWN_FUNCTION(xdebug)
 	gc_collect_cycles = xdebug_old_gc_collect_cycles;
 
 	zend_hash_destroy(&XG(aggr_calls));
+	xdebug_connect_backoff_shutdown();
 
 #ifdef ZTS
 	ts_free_id(xdebug_globals_id);
@@ -1169,6 +1197,11 @@ static void function_stack_entry_dtor(void *dummy, void *elem)
 			e->executable_lines_cache = NULL;
 		}
 
+		if (e->trace_pending_records) {
+			xdebug_str_free(e->trace_pending_records);
+			e->trace_pending_records = NULL;
+		}
+
 		xdfree(e);
 	}
 }
@@ -1292,11 +1325,15 @@ PHP_RINIT_FUNCTION(xdebug)
 	XG(no_exec)       = 0;
 	XG(level)         = 0;
 	XG(in_debug_info) = 0;
+	xdebug_var_object_page_cache_clear(TSRMLS_C);
 	XG(code_coverage_active) = 0;
 	XG(code_coverage_info) = xdebug_hash_alloc(32, xdebug_coverage_file_dtor);
 	XG(stack)         = xdebug_llist_alloc(function_stack_entry_dtor);
 	XG(trace_handler) = NULL;
 	XG(trace_context) = NULL;
+	XG(trace_record_capture) = NULL;
+	XG(trace_deferred_file)  = NULL;
+	XG(collect_params_total_size) = 0;
 	XG(profile_file)  = NULL;
 	XG(profile_filename) = NULL;
 	XG(profile_filename_refs) = NULL;
@@ -1317,6 +1354,9 @@ PHP_RINIT_FUNCTION(xdebug)
 	XG(dead_code_analysis_tracker_offset) = zend_xdebug_cc_run_offset;
 	XG(dead_code_last_start_id) = 1;
 	XG(code_coverage_filter_offset) = zend_xdebug_filter_offset;
+	XG(tracing_filter_offset) = zend_xdebug_tracing_filter_offset;
+	XG(brk_index_offset) = zend_xdebug_brk_index_offset;
+	XG(executable_lines_offset) = zend_xdebug_executable_lines_offset;
 	XG(previous_filename) = NULL;
 	XG(previous_file) = NULL;
 	XG(gc_stats_file) = NULL;
@@ -1362,6 +1402,8 @@ PHP_RINIT_FUNCTION(xdebug)
 
 	/* Initialize some debugger context properties */
 	XG(context).program_name   = NULL;
+	XG(context).line_breakpoint_index = NULL;
+	XG(context).output         = NULL;
 	XG(context).list.last_file = NULL;
 	XG(context).list.last_line = 0;
 	XG(context).do_break       = 0;
@@ -1398,8 +1440,11 @@ PHP_RINIT_FUNCTION(xdebug)
 	XG(filter_type_tracing)       = XDEBUG_FILTER_NONE;
 	XG(filter_type_profiler)      = XDEBUG_FILTER_NONE;
 	XG(filter_type_code_coverage) = XDEBUG_FILTER_NONE;
-	XG(filters_tracing)           = xdebug_llist_alloc(xdebug_llist_string_dtor);
-	XG(filters_code_coverage)     = xdebug_llist_alloc(xdebug_llist_string_dtor);
+	XG(filters_tracing)           = xdebug_trie_alloc();
+	XG(filters_code_coverage)     = xdebug_trie_alloc();
+	xdebug_filter_tracing_invalidate_cache();
+
+	xdebug_executable_lines_cache_init();
 
 	return SUCCESS;
 }
@@ -1424,9 +1469,11 @@ ZEND_MODULE_POST_ZEND_DEACTIVATE_D(xdebug)
 	xdebug_llist_destroy(XG(stack), NULL);
 	XG(stack) = NULL;
 
+	xdebug_executable_lines_cache_destroy();
+
 	/* filters */
-	xdebug_llist_destroy(XG(filters_tracing), NULL);
-	xdebug_llist_destroy(XG(filters_code_coverage), NULL);
+	xdebug_trie_destroy(XG(filters_tracing));
+	xdebug_trie_destroy(XG(filters_code_coverage));
 	XG(filters_tracing) = NULL;
 	XG(filters_code_coverage) = NULL;
 
@@ -1513,6 +1560,20 @@ PHP_RSHUTDOWN_FUNCTION(xdebug)
 	/* Signal that we're no longer in a request */
 	XG(in_execution) = 0;
 
+	/* The paging cache is request memory */
+	xdebug_var_object_page_cache_clear(TSRMLS_C);
+
+	/* Compiled breakpoint conditions are op_arrays in request memory, so
+	 * they have to go while the executor is still around; the breakpoints
+	 * themselves are only freed when the remote context is torn down */
+	if (XG(remote_connection_enabled) && XG(context).line_breakpoints) {
+		xdebug_llist_element *le;
+
+		for (le = XDEBUG_LLIST_HEAD(XG(context).line_breakpoints); le != NULL; le = XDEBUG_LLIST_NEXT(le)) {
+			xdebug_brk_info_condition_dtor(XDEBUG_LLIST_VALP(le));
+		}
+	}
+
 	return SUCCESS;
 }
 
@@ -1634,6 +1695,56 @@ static void add_used_variables(function_stack_entry *fse, zend_op_array *op_arra
 	}
 }
 
+/* Returns the exception breakpoint that matches the class, or one of its
+ * parents, or NULL if there is none. The outcome is remembered per class
+ * entry until exception breakpoints are added or removed, so that code that
+ * throws a lot only looks up the class hierarchy once per class. */
+static xdebug_brk_info *xdebug_find_exception_breakpoint(zend_class_entry *exception_ce TSRMLS_DC)
+{
+	xdebug_con       *context = &XG(context);
+	xdebug_brk_info  *extra_brk_info = NULL;
+	zend_class_entry *ce_ptr = exception_ce;
+	zval             *cached;
+	zval              verdict;
+
+	if (context->exception_breakpoint_cache && context->exception_breakpoint_cache_generation != context->exception_breakpoints_generation) {
+		zend_hash_clean(context->exception_breakpoint_cache);
+		context->exception_breakpoint_cache_generation = context->exception_breakpoints_generation;
+	}
+	if (!context->exception_breakpoint_cache) {
+		context->exception_breakpoint_cache = pemalloc(sizeof(HashTable), 1);
+		zend_hash_init(context->exception_breakpoint_cache, 8, NULL, NULL, 1);
+		context->exception_breakpoint_cache_generation = context->exception_breakpoints_generation;
+	}
+
+	cached = zend_hash_index_find(context->exception_breakpoint_cache, (zend_ulong) (zend_uintptr_t) exception_ce);
+	if (cached) {
+		return Z_TYPE_P(cached) == IS_PTR ? (xdebug_brk_info *) Z_PTR_P(cached) : NULL;
+	}
+
+	/* Check if we have a wild card exception breakpoint */
+	if (!xdebug_hash_find(context->exception_breakpoints, "*", 1, (void *) &extra_brk_info)) {
+		/* Check if we have a breakpoint on this exception or its parent classes */
+		extra_brk_info = NULL;
+		do {
+			if (xdebug_hash_find(context->exception_breakpoints, (char *) STR_NAME_VAL(ce_ptr->name), STR_NAME_LEN(ce_ptr->name), (void *) &extra_brk_info)) {
+				break;
+			}
+			extra_brk_info = NULL;
+			ce_ptr = ce_ptr->parent;
+		} while (ce_ptr);
+	}
+
+	if (extra_brk_info) {
+		ZVAL_PTR(&verdict, extra_brk_info);
+	} else {
+		ZVAL_NULL(&verdict);
+	}
+	zend_hash_index_update(context->exception_breakpoint_cache, (zend_ulong) (zend_uintptr_t) exception_ce, &verdict);
+
+	return extra_brk_info;
+}
+
 static void xdebug_throw_exception_hook(zval *exception TSRMLS_DC)
 {
 	zval *code, *message, *file, *line;
@@ -1710,20 +1821,9 @@ static void xdebug_throw_exception_hook(zval *exception TSRMLS_DC)
 	if (xdebug_is_debug_connection_active_for_current_pid()) {
 		int exception_breakpoint_found = 0;
 
-		/* Check if we have a wild card exception breakpoint */
-		if (xdebug_hash_find(XG(context).exception_breakpoints, "*", 1, (void *) &extra_brk_info)) {
-			exception_breakpoint_found = 1;
-		} else {
-			/* Check if we have a breakpoint on this exception or its parent classes */
-			zend_class_entry *ce_ptr = exception_ce;
-
-			/* Check if we have a breakpoint on this exception or its parent classes */
-			do {
-				if (xdebug_hash_find(XG(context).exception_breakpoints, (char *) STR_NAME_VAL(ce_ptr->name), STR_NAME_LEN(ce_ptr->name), (void *) &extra_brk_info)) {
-					exception_breakpoint_found = 1;
-				}
-				ce_ptr = ce_ptr->parent;
-			} while (!exception_breakpoint_found && ce_ptr);
+		if (XG(context).exception_breakpoints->size) {
+			extra_brk_info = xdebug_find_exception_breakpoint(exception_ce TSRMLS_CC);
+			exception_breakpoint_found = extra_brk_info != NULL;
 		}
 
 		if (XG(context).resolved_breakpoints && exception_breakpoint_found) {
@@ -1813,6 +1913,7 @@ void xdebug_execute_ex(zend_execute_data *execute_data TSRMLS_DC)
 	zend_execute_data    *edata = execute_data->prev_execute_data;
 	function_stack_entry *fse, *xfse;
 	int                   function_nr = 0;
+	int                   function_call_traced = 0;
 	xdebug_llist_element *le;
 	xdebug_func           code_coverage_func_info;
 	char                 *code_coverage_function_name = NULL;
@@ -1904,8 +2005,8 @@ void xdebug_execute_ex(zend_execute_data *execute_data TSRMLS_DC)
 	}
 
 	function_nr = XG(function_count);
-	if (!fse->filtered_tracing && XG(trace_context) && (XG(trace_handler)->function_entry)) {
-		XG(trace_handler)->function_entry(XG(trace_context), fse, function_nr TSRMLS_CC);
+	if (!fse->filtered_tracing && XG(trace_context)) {
+		xdebug_trace_function_begin(fse, function_nr TSRMLS_CC);
 	}
 
 	fse->execute_data = EG(current_execute_data)->prev_execute_data;
@@ -1988,12 +2089,12 @@ void xdebug_execute_ex(zend_execute_data *execute_data TSRMLS_DC)
 	}
 
 
-	if (!fse->filtered_tracing && XG(trace_context) && (XG(trace_handler)->function_exit)) {
-		XG(trace_handler)->function_exit(XG(trace_context), fse, function_nr TSRMLS_CC);
+	if (!fse->filtered_tracing && XG(trace_context)) {
+		function_call_traced = xdebug_trace_function_end(fse, function_nr TSRMLS_CC);
 	}
 
 	/* Store return value in the trace file */
-	if (!fse->filtered_tracing && XG(collect_return) && XG(trace_context)) {
+	if (function_call_traced && XG(collect_return) && XG(trace_context)) {
 		if (execute_data && execute_data->return_value) {
 			if (op_array->fn_flags & ZEND_ACC_GENERATOR) {
 				if (XG(trace_handler)->generator_return_value) {
@@ -2014,6 +2115,8 @@ void xdebug_execute_ex(zend_execute_data *execute_data TSRMLS_DC)
 		}
 	}
 
+	xdebug_trace_release_arguments(fse TSRMLS_CC);
+
 	fse->symbol_table = NULL;
 	fse->execute_data = NULL;
 	if (XG(stack)) {
@@ -2068,9 +2171,9 @@ void xdebug_execute_internal(zend_execute_data *current_execute_data, zval *retu
 
 	function_nr = XG(function_count);
 
-	if (!fse->filtered_tracing && fse->function.type != XFUNC_ZEND_PASS && XG(trace_context) && (XG(trace_handler)->function_entry)) {
+	if (!fse->filtered_tracing && fse->function.type != XFUNC_ZEND_PASS && XG(trace_context)) {
 		function_call_traced = 1;
-		XG(trace_handler)->function_entry(XG(trace_context), fse, function_nr TSRMLS_CC);
+		xdebug_trace_function_begin(fse, function_nr TSRMLS_CC);
 	}
 
 	/* Check for entry breakpoints */
@@ -2112,12 +2215,14 @@ void xdebug_execute_internal(zend_execute_data *current_execute_data, zval *retu
 	 * function call was also traced. Otherwise we end up with return trace
 	 * lines without a corresponding function call line. */
 	if (function_call_traced && !fse->filtered_tracing && XG(trace_context)) {
-		if (fse->function.type != XFUNC_ZEND_PASS && (XG(trace_handler)->function_exit)) {
-			XG(trace_handler)->function_exit(XG(trace_context), fse, function_nr TSRMLS_CC);
+		/* Calls that finished below xdebug.trace_min_duration_us are dropped
+		 * together with their return value */
+		if (!xdebug_trace_function_end(fse, function_nr TSRMLS_CC)) {
+			function_call_traced = 0;
 		}
 
 		/* Store return value in the trace file */
-		if (XG(collect_return) && fse->function.type != XFUNC_ZEND_PASS && return_value && XG(trace_handler)->return_value) {
+		if (function_call_traced && XG(collect_return) && return_value && XG(trace_handler)->return_value) {
 			XG(trace_handler)->return_value(XG(trace_context), fse, function_nr, return_value TSRMLS_CC);
 		}
 	}
@@ -2129,6 +2234,8 @@ void xdebug_execute_internal(zend_execute_data *current_execute_data, zval *retu
 		}
 	}
 
+	xdebug_trace_release_arguments(fse TSRMLS_CC);
+
 	if (XG(stack)) {
 		xdebug_llist_remove(XG(stack), XDEBUG_LLIST_TAIL(XG(stack)), function_stack_entry_dtor);
 	}
@@ -2570,6 +2677,96 @@ PHP_FUNCTION(xdebug_time_index)
 	RETURN_DOUBLE(xdebug_get_utime() - XG(start_time));
 }
 
+/* A breakpoint's condition is compiled the first time it is checked, and
+ * the resulting op_array is executed in the current frame's scope for every
+ * hit after that, just like zend_eval_string() would do. It is recompiled
+ * when the scope changes, as the op_array's run-time cache depends on it. */
+static int xdebug_eval_breakpoint_condition(xdebug_brk_info *brk_info, zval *retval TSRMLS_DC)
+{
+	zend_class_entry        *scope;
+	zend_op_array           *op_array;
+	zval                     local_retval;
+	int                      original_no_extensions = EG(no_extensions);
+	struct _xdebug_brk_index *brk_index;
+	zend_ulong               brk_index_generation;
+
+#if PHP_VERSION_ID >= 70100
+	scope = zend_get_executed_scope();
+#else
+	scope = EG(scope);
+#endif
+
+	if (brk_info->condition_compiled && brk_info->condition_op_array && brk_info->condition_scope != scope) {
+		xdebug_brk_info_condition_dtor(brk_info);
+	}
+
+	if (!brk_info->condition_compiled) {
+		zval     source;
+		uint32_t original_compiler_options = CG(compiler_options);
+
+		ZVAL_STR(&source, zend_strpprintf(0, "return %s;", brk_info->condition));
+
+		CG(compiler_options) = ZEND_COMPILE_DEFAULT_FOR_EVAL;
+		brk_info->condition_op_array = zend_compile_string(&source, (char*) "xdebug conditional breakpoint" TSRMLS_CC);
+		CG(compiler_options) = original_compiler_options;
+
+		zval_dtor(&source);
+
+		brk_info->condition_compiled = 1;
+		brk_info->condition_scope = scope;
+		if (brk_info->condition_op_array) {
+			brk_info->condition_op_array->scope = scope;
+		}
+	}
+
+	/* A condition that doesn't compile will never be true */
+	if (!brk_info->condition_op_array) {
+		return FAILURE;
+	}
+
+	/* The condition's code could hit another breakpoint, during which the
+	 * IDE can remove this one. The op_array is therefore taken away from
+	 * the breakpoint while it runs, and only handed back if the breakpoints
+	 * are still the same ones afterwards. */
+	op_array = brk_info->condition_op_array;
+	brk_info->condition_op_array = NULL;
+	brk_info->condition_compiled = 0;
+	brk_index = XG(context).line_breakpoint_index;
+	brk_index_generation = XG(brk_index_generation);
+
+	ZVAL_UNDEF(&local_retval);
+	EG(no_extensions) = 1;
+
+	zend_try {
+		zend_execute(op_array, &local_retval TSRMLS_CC);
+	} zend_catch {
+		EG(no_extensions) = original_no_extensions;
+		zend_bailout();
+	} zend_end_try();
+
+	EG(no_extensions) = original_no_extensions;
+
+	if (
+		brk_index && XG(context).line_breakpoint_index == brk_index &&
+		XG(brk_index_generation) == brk_index_generation &&
+		!brk_info->condition_compiled
+	) {
+		brk_info->condition_op_array = op_array;
+		brk_info->condition_compiled = 1;
+	} else {
+		destroy_op_array(op_array);
+		efree(op_array);
+	}
+
+	if (Z_TYPE(local_retval) != IS_UNDEF) {
+		ZVAL_COPY_VALUE(retval, &local_retval);
+	} else {
+		ZVAL_NULL(retval);
+	}
+
+	return SUCCESS;
+}
+
 #if PHP_VERSION_ID >= 70100
 ZEND_DLEXPORT void xdebug_statement_call(zend_execute_data *frame)
 {
@@ -2663,10 +2860,16 @@ ZEND_DLEXPORT void xdebug_statement_call(zend_op_array *op_array)
 		}
 
 		if (XG(context).line_breakpoints) {
-			int   break_ok;
-			zval  retval;
+			int           break_ok;
+			zval          retval;
+			xdebug_llist *line_breakpoints;
+			zend_ulong    brk_index_generation;
+
+			/* Only the breakpoints on this very line need checking */
+			line_breakpoints = xdebug_brk_index_find(&(XG(context)), op_array, lineno);
+			brk_index_generation = XG(brk_index_generation);
 
-			for (le = XDEBUG_LLIST_HEAD(XG(context).line_breakpoints); le != NULL; le = XDEBUG_LLIST_NEXT(le)) {
+			for (le = line_breakpoints ? XDEBUG_LLIST_HEAD(line_breakpoints) : NULL; le != NULL; le = XDEBUG_LLIST_NEXT(le)) {
 				extra_brk_info = XDEBUG_LLIST_VALP(le);
 
 				if (XG(context).handler->break_on_line(&(XG(context)), extra_brk_info, file, file_len, lineno)) {
@@ -2686,7 +2889,7 @@ ZEND_DLEXPORT void xdebug_statement_call(zend_op_array *op_array)
 						XG(context).inhibit_notifications = 1;
 
 						/* Check the condition */
-						if (zend_eval_string(extra_brk_info->condition, &retval, (char*) "xdebug conditional breakpoint" TSRMLS_CC) == SUCCESS) {
+						if (xdebug_eval_breakpoint_condition(extra_brk_info, &retval TSRMLS_CC) == SUCCESS) {
 							break_ok = Z_TYPE(retval) == IS_TRUE;
 							zval_dtor(&retval);
 						}
@@ -2695,6 +2898,13 @@ ZEND_DLEXPORT void xdebug_statement_call(zend_op_array *op_array)
 						EG(error_reporting) = XG(error_reporting_override);
 						XG(error_reporting_overridden) = 0;
 						XG(context).inhibit_notifications = 0;
+
+						/* The condition's code could have hit another
+						 * breakpoint, during which the IDE could have changed
+						 * the breakpoints that we are walking over */
+						if (!XG(context).line_breakpoint_index || XG(brk_index_generation) != brk_index_generation) {
+							return;
+						}
 					}
 					if (break_ok && xdebug_handle_hit_value(extra_brk_info)) {
 						if (!XG(context).handler->remote_breakpoint(&(XG(context)), XG(stack), file, lineno, XDEBUG_BREAK, NULL, 0, NULL)) {
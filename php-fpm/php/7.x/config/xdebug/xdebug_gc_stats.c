@@ -17,6 +17,7 @@
  */
 
 #include "php_xdebug.h"
+#include "xdebug_compress.h"
 #include "xdebug_gc_stats.h"
 #include "xdebug_stack.h"
 #include "zend_builtin_functions.h"
@@ -127,7 +128,7 @@ int xdebug_gc_stats_init(char *fname, char *script_name)
 		xdfree(fname);
 	}
 
-	XG(gc_stats_file) = xdebug_fopen(filename, "w", NULL, &XG(gc_stats_filename));
+	XG(gc_stats_file) = xdebug_fopen_output(filename, "w", NULL, &XG(gc_stats_filename));
 	xdfree(filename);
 
 	if (!XG(gc_stats_file)) {
@@ -35,6 +35,7 @@
 #include "php_globals.h"
 #include "php_xdebug.h"
 #include "xdebug_private.h"
+#include "xdebug_brk_index.h"
 #include "xdebug_code_coverage.h"
 #include "xdebug_com.h"
 #include "xdebug_compat.h"
@@ -273,45 +274,126 @@ void XDEBUG_ATTRIBUTE_FORMAT(printf, 2, 3) xdebug_dbgp_log(int log_level, const
 	}
 }
 
-static xdebug_str *make_message(xdebug_con *context, xdebug_xml_node *message TSRMLS_DC)
+#define XDEBUG_DBGP_XML_DECLARATION "<?xml version=\"1.0\" encoding=\"iso-8859-1\"?>\n"
+
+/* Responses are streamed to the socket through the XML writer's buffer,
+ * instead of being rendered into one string first. The writer lives as long
+ * as the connection, so that responses to commands that the IDE sent in one
+ * go can be held back and written out together. The bytes in between
+ * log_start and log_end are the XML body, which goes to the remote log. */
+typedef struct _xdebug_dbgp_output {
+	xdebug_con        *context;
+	size_t             offset;
+	size_t             log_start;
+	size_t             log_end;
+	size_t             queued;
+	int                hold;
+	xdebug_xml_writer  writer;
+} xdebug_dbgp_output;
+
+static int send_message_chunk(void *ctxt, const char *data, size_t len)
 {
-	xdebug_str  xml_message = XDEBUG_STR_INITIALIZER;
-	xdebug_str *ret = xdebug_str_new();
+	xdebug_dbgp_output *output = (xdebug_dbgp_output*) ctxt;
+	size_t              log_from, log_to;
+	long                sent;
 
-	xdebug_xml_return_node(message, &xml_message);
-	context->handler->log(XDEBUG_LOG_COM, "-> %s\n\n", xml_message.d);
+	if (XG(remote_log_file) && XG(remote_log_level) >= XDEBUG_LOG_COM) {
+		log_from = output->offset > output->log_start ? output->offset : output->log_start;
+		log_to = output->offset + len < output->log_end ? output->offset + len : output->log_end;
 
-	xdebug_str_add(ret, xdebug_sprintf("%d", xml_message.l + sizeof("<?xml version=\"1.0\" encoding=\"iso-8859-1\"?>\n") - 1), 1);
-	xdebug_str_addl(ret, "\0", 1, 0);
-	xdebug_str_add(ret, "<?xml version=\"1.0\" encoding=\"iso-8859-1\"?>\n", 0);
-	xdebug_str_add(ret, xml_message.d, 0);
-	xdebug_str_addl(ret, "\0", 1, 0);
-	xdebug_str_destroy(&xml_message);
+		if (log_from < log_to) {
+			fwrite(data + (log_from - output->offset), 1, log_to - log_from, XG(remote_log_file));
+		}
+	}
+	output->offset += len;
 
-	return ret;
+	while (len > 0) {
+		sent = SSENDL(output->context->socket, data, len);
+		if (sent <= 0) {
+			return 0;
+		}
+		data += sent;
+		len -= sent;
+	}
+
+	return 1;
 }
 
-static void send_message_ex(xdebug_con *context, xdebug_xml_node *message, int stage TSRMLS_DC)
+static xdebug_dbgp_output *output_alloc(xdebug_con *context)
 {
-	xdebug_str *tmp;
+	xdebug_dbgp_output *output = xdmalloc(sizeof(xdebug_dbgp_output));
 
-	/* Sometimes we end up in 'send_message' although the debugging connection
-	 * is already closed. In that case, we early return. */
-	if (XG(status) != DBGP_STATUS_STARTING && !xdebug_is_debug_connection_active()) {
+	output->context = context;
+	output->offset = 0;
+	output->log_start = 0;
+	output->log_end = 0;
+	output->queued = 0;
+	output->hold = 0;
+	xdebug_xml_writer_init(&output->writer, send_message_chunk, output);
+
+	return output;
+}
+
+static void send_pending_messages(xdebug_con *context)
+{
+	xdebug_dbgp_output *output = context->output;
+
+	if (!output || !output->queued) {
 		return;
 	}
 
-	tmp = make_message(context, message TSRMLS_CC);
-	if ((size_t) SSENDL(context->socket, tmp->d, tmp->l) != tmp->l) {
+	if (!xdebug_xml_writer_flush(&output->writer)) {
 		char *sock_error = php_socket_strerror(php_socket_errno(), NULL, 0);
 		char *utime_str = xdebug_sprintf("%F", xdebug_get_utime());
 
-		fprintf(stderr, "%s: There was a problem sending %zd bytes on socket %d: %s\n", utime_str, tmp->l, context->socket, sock_error);
+		fprintf(stderr, "%s: There was a problem sending %zd bytes on socket %d: %s\n", utime_str, output->queued, context->socket, sock_error);
 
 		efree(sock_error);
 		xdfree(utime_str);
 	}
-	xdebug_str_free(tmp);
+	output->queued = 0;
+
+	if (XG(remote_log_file) && XG(remote_log_level) >= XDEBUG_LOG_COM) {
+		fprintf(XG(remote_log_file), "\n\n");
+		fflush(XG(remote_log_file));
+	}
+}
+
+static void send_message_ex(xdebug_con *context, xdebug_xml_node *message, int stage TSRMLS_DC)
+{
+	xdebug_dbgp_output *output = context->output;
+	size_t              body_len, length, header_len;
+	char               *header;
+
+	/* Sometimes we end up in 'send_message' although the debugging connection
+	 * is already closed. In that case, we early return. */
+	if (XG(status) != DBGP_STATUS_STARTING && !xdebug_is_debug_connection_active()) {
+		return;
+	}
+
+	/* The length prefix comes from a sizing pass over the tree, so that the
+	 * XML itself never has to exist as a whole in memory */
+	body_len = xdebug_xml_node_length(message);
+	length = body_len + sizeof(XDEBUG_DBGP_XML_DECLARATION) - 1;
+	header = xdebug_sprintf("%lu", (unsigned long) length);
+	header_len = strlen(header) + 1;
+
+	output->log_start = output->offset + output->writer.used + header_len + sizeof(XDEBUG_DBGP_XML_DECLARATION) - 1;
+	output->log_end = output->log_start + body_len;
+	output->queued += header_len + length + 1;
+
+	context->handler->log(XDEBUG_LOG_COM, "-> ");
+
+	xdebug_xml_writer_addl(&output->writer, header, header_len);
+	xdebug_xml_writer_addl(&output->writer, XDEBUG_DBGP_XML_DECLARATION, sizeof(XDEBUG_DBGP_XML_DECLARATION) - 1);
+	xdebug_xml_write_node(message, &output->writer);
+	xdebug_xml_writer_addl(&output->writer, "\0", 1);
+
+	if (!output->hold) {
+		send_pending_messages(context);
+	}
+
+	xdfree(header);
 }
 
 static void send_message(xdebug_con *context, xdebug_xml_node *message TSRMLS_DC)
@@ -688,7 +770,9 @@ static int breakpoint_remove(int type, char *hkey)
 				brk_info = XDEBUG_LLIST_VALP(le);
 
 				if (atoi(parts->args[1]) == brk_info->original_lineno && memcmp(brk_info->file, parts->args[0], brk_info->file_len) == 0) {
+					xdebug_brk_info_condition_dtor(brk_info);
 					xdebug_llist_remove(XG(context).line_breakpoints, le, NULL);
+					xdebug_brk_index_invalidate(&XG(context));
 					retval = SUCCESS;
 					break;
 				}
@@ -707,6 +791,7 @@ static int breakpoint_remove(int type, char *hkey)
 
 		case XDEBUG_BREAKPOINT_TYPE_EXCEPTION:
 			if (xdebug_hash_delete(XG(context).exception_breakpoints, hkey, strlen(hkey))) {
+				XG(context).exception_breakpoints_generation++;
 				retval = SUCCESS;
 			}
 			break;
@@ -780,6 +865,7 @@ static void breakpoint_do_action(DBGP_FUNC_PARAMETERS, int action)
 				brk_info->resolved_lineno = brk_info->original_lineno;
 				brk_info->resolved_span.start = XDEBUG_RESOLVED_SPAN_MIN;
 				brk_info->resolved_span.end   = XDEBUG_RESOLVED_SPAN_MAX;
+				xdebug_brk_index_invalidate(context);
 			}
 			if (CMD_OPTION_SET('h')) {
 				brk_info->hit_value = strtol(CMD_OPTION_CHAR('h'), NULL, 10);
@@ -859,6 +945,9 @@ DBGP_FUNC(breakpoint_set)
 	brk_info->function_break_type = 0;
 	brk_info->exceptionname = NULL;
 	brk_info->condition = NULL;
+	brk_info->condition_compiled = 0;
+	brk_info->condition_op_array = NULL;
+	brk_info->condition_scope = NULL;
 	brk_info->disabled = 0;
 	brk_info->temporary = 0;
 	brk_info->hit_count = 0;
@@ -942,6 +1031,7 @@ DBGP_FUNC(breakpoint_set)
 		}
 		xdfree(tmp_name);
 		xdebug_llist_insert_next(context->line_breakpoints, XDEBUG_LLIST_TAIL(context->line_breakpoints), (void*) brk_info);
+		xdebug_brk_index_invalidate(context);
 
 		if (XG(context).resolved_breakpoints) {
 			function_stack_entry *fse = xdebug_get_stack_tail(TSRMLS_C);
@@ -1000,6 +1090,7 @@ DBGP_FUNC(breakpoint_set)
 		if (!xdebug_hash_add(context->exception_breakpoints, CMD_OPTION_CHAR('x'), CMD_OPTION_LEN('x'), (void*) brk_info)) {
 			RETURN_RESULT(XG(status), XG(reason), XDEBUG_ERROR_BREAKPOINT_NOT_SET);
 		} else {
+			context->exception_breakpoints_generation++;
 			brk_info->id = breakpoint_admin_add(context, XDEBUG_BREAKPOINT_TYPE_EXCEPTION, CMD_OPTION_CHAR('x'));
 		}
 	} else
@@ -1091,6 +1182,9 @@ DBGP_FUNC(eval)
 	} else {
 		ret_xml = xdebug_get_zval_value_xml_node(NULL, &ret_zval, options TSRMLS_CC);
 		xdebug_xml_add_child(*retval, ret_xml);
+		/* The result is freed right away, so the paging cache must not
+		 * keep pointing at it */
+		xdebug_var_object_page_cache_clear(TSRMLS_C);
 		zval_ptr_dtor(&ret_zval);
 	}
 }
@@ -2226,6 +2320,12 @@ static int xdebug_dbgp_parse_option(xdebug_con *context, char* line, int flags,
 		command = lookup_cmd(cmd);
 
 		if (command) {
+			/* Any other command can run PHP code, which could change the
+			 * properties that the paging cache points to */
+			if (strcmp(command->name, "property_get") != 0 && strcmp(command->name, "property_value") != 0) {
+				xdebug_var_object_page_cache_clear(TSRMLS_C);
+			}
+
 			if (command->cont) {
 				XG(status) = DBGP_STATUS_RUNNING;
 				XG(reason) = DBGP_REASON_OK;
@@ -2272,11 +2372,24 @@ static int xdebug_dbgp_cmdloop(xdebug_con *context, int bail TSRMLS_DC)
 	xdebug_xml_node *response;
 
 	do {
+		/* Held back responses have to go out before we block waiting for
+		 * the IDE's next command */
+		if (!xdebug_fd_line_pending(context->socket, context->buffer, FD_RL_SOCKET, '\0')) {
+			send_pending_messages(context);
+		}
+
 		option = xdebug_fd_read_line_delim(context->socket, context->buffer, FD_RL_SOCKET, '\0', NULL);
 		if (!option) {
 			return 0;
 		}
 
+		/* When the IDE has already sent its next command, the response to
+		 * this one is held back, so that all of them are written together.
+		 * The remote log shows each response on its own instead. */
+		context->output->hold =
+			!(XG(remote_log_file) && XG(remote_log_level) >= XDEBUG_LOG_COM) &&
+			xdebug_fd_line_pending(context->socket, context->buffer, FD_RL_SOCKET, '\0');
+
 		response = xdebug_xml_node_init("response");
 		xdebug_xml_add_attribute(response, "xmlns", "urn:debugger_protocol_v1");
 		xdebug_xml_add_attribute(response, "xmlns:xdebug", "https://xdebug.org/dbgp/xdebug");
@@ -2285,10 +2398,11 @@ static int xdebug_dbgp_cmdloop(xdebug_con *context, int bail TSRMLS_DC)
 			send_message(context, response TSRMLS_CC);
 		}
 		xdebug_xml_node_dtor(response);
-
-		free(option);
 	} while (0 == ret);
 
+	context->output->hold = 0;
+	send_pending_messages(context);
+
 	if (bail && XG(status) == DBGP_STATUS_STOPPED) {
 		_zend_bailout((char*)__FILE__, __LINE__);
 	}
@@ -2356,7 +2470,11 @@ int xdebug_dbgp_init(xdebug_con *context, int mode)
 
 	context->buffer = xdmalloc(sizeof(fd_buf));
 	context->buffer->buffer = NULL;
-	context->buffer->buffer_size = 0;
+	context->buffer->size = 0;
+	context->buffer->start = 0;
+	context->buffer->end = 0;
+	context->buffer->scanned = 0;
+	context->output = output_alloc(context);
 
 	send_message_ex(context, response, DBGP_STATUS_STARTING TSRMLS_CC);
 	xdebug_xml_node_dtor(response);
@@ -2379,7 +2497,10 @@ int xdebug_dbgp_init(xdebug_con *context, int mode)
 	context->breakpoint_list = xdebug_hash_alloc(64, (xdebug_hash_dtor_t) xdebug_hash_admin_dtor);
 	context->function_breakpoints = xdebug_hash_alloc(64, (xdebug_hash_dtor_t) xdebug_hash_brk_dtor);
 	context->exception_breakpoints = xdebug_hash_alloc(64, (xdebug_hash_dtor_t) xdebug_hash_brk_dtor);
+	context->exception_breakpoints_generation = 0;
+	context->exception_breakpoint_cache = NULL;
 	context->line_breakpoints = xdebug_llist_alloc((xdebug_llist_dtor) xdebug_llist_brk_dtor);
+	context->line_breakpoint_index = NULL;
 	context->eval_id_lookup = xdebug_hash_alloc(64, (xdebug_hash_dtor_t) xdebug_hash_eval_info_dtor);
 	context->eval_id_sequence = 0;
 	context->send_notifications = 0;
@@ -2425,11 +2546,21 @@ int xdebug_dbgp_deinit(xdebug_con *context)
 		xdfree(context->options);
 		xdebug_hash_destroy(context->function_breakpoints);
 		xdebug_hash_destroy(context->exception_breakpoints);
+		if (context->exception_breakpoint_cache) {
+			zend_hash_destroy(context->exception_breakpoint_cache);
+			pefree(context->exception_breakpoint_cache, 1);
+			context->exception_breakpoint_cache = NULL;
+		}
 		xdebug_hash_destroy(context->eval_id_lookup);
+		xdebug_brk_index_invalidate(context);
 		xdebug_llist_destroy(context->line_breakpoints, NULL);
 		xdebug_hash_destroy(context->breakpoint_list);
+		xdebug_var_object_page_cache_clear(TSRMLS_C);
+		xdebug_fd_buf_dtor(context->buffer);
 		xdfree(context->buffer);
 		context->buffer = NULL;
+		xdfree(context->output);
+		context->output = NULL;
 	}
 
 	if (XG(lasttransid)) {
@@ -2608,23 +2739,18 @@ int xdebug_dbgp_breakpoint(xdebug_con *context, xdebug_llist *stack, char *file,
 
 xdebug_set *get_executable_lines_from_oparray(function_stack_entry *fse)
 {
-	int         i;
-	zend_op_array *opa = fse->op_array;
 	xdebug_set *tmp;
 
-	if (fse->executable_lines_cache) {
-		return fse->executable_lines_cache;
+	if ((tmp = xdebug_executable_lines_cache_find(fse->op_array)) != NULL) {
+		return tmp;
 	}
 
-	tmp = xdebug_set_create(opa->line_end);
-
-	for (i = 0; i < opa->last; i++ ) {
-		if (opa->opcodes[i].opcode == ZEND_EXT_STMT ) {
-			xdebug_set_add(tmp, opa->opcodes[i].lineno);
-		}
+	/* Without a slot to cache it in, the set lives as long as the frame */
+	if (!fse->executable_lines_cache) {
+		fse->executable_lines_cache = xdebug_executable_lines_build(fse->op_array);
 	}
 
-	return tmp;
+	return fse->executable_lines_cache;
 }
 
 static int xdebug_dbgp_resolved_breakpoint_notification(xdebug_con *context, xdebug_brk_info *brk_info)
@@ -2778,6 +2904,7 @@ static void line_breakpoint_resolve_helper(xdebug_con *context, function_stack_e
 		brk_info->resolved_span.start = fse->op_array->line_start;
 		brk_info->resolved_span.end   = fse->op_array->line_end;
 		brk_info->resolved = XDEBUG_BRK_RESOLVED;
+		xdebug_brk_index_invalidate(context);
 		xdebug_dbgp_resolved_breakpoint_notification(context, brk_info);
 		return;
 	} else {
@@ -2797,6 +2924,7 @@ static void line_breakpoint_resolve_helper(xdebug_con *context, function_stack_e
 				brk_info->resolved_span.start = fse->op_array->line_start;
 				brk_info->resolved_span.end   = fse->op_array->line_end;
 				brk_info->resolved = XDEBUG_BRK_RESOLVED;
+				xdebug_brk_index_invalidate(context);
 				xdebug_dbgp_resolved_breakpoint_notification(context, brk_info);
 				return;
 			} else {
@@ -2816,6 +2944,7 @@ static void line_breakpoint_resolve_helper(xdebug_con *context, function_stack_e
 				brk_info->resolved_span.start = fse->op_array->line_start;
 				brk_info->resolved_span.end   = fse->op_array->line_end;
 				brk_info->resolved = XDEBUG_BRK_RESOLVED;
+				xdebug_brk_index_invalidate(context);
 				xdebug_dbgp_resolved_breakpoint_notification(context, brk_info);
 				return;
 			} else {
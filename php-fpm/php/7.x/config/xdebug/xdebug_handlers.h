@@ -60,13 +60,18 @@ struct _xdebug_con {
 	void                  *options;
 	xdebug_remote_handler *handler;
 	fd_buf                *buffer;
+	struct _xdebug_dbgp_output *output;
 	char                  *program_name;
 	xdebug_hash           *breakpoint_list;
 	xdebug_hash           *function_breakpoints;
 	xdebug_hash           *eval_id_lookup;
 	int                    eval_id_sequence;
 	xdebug_llist          *line_breakpoints;
+	struct _xdebug_brk_index *line_breakpoint_index;
 	xdebug_hash           *exception_breakpoints;
+	int                    exception_breakpoints_generation; /* bumped whenever exception breakpoints are added or removed */
+	HashTable             *exception_breakpoint_cache;       /* zend_class_entry* -> matching xdebug_brk_info*, or NULL */
+	int                    exception_breakpoint_cache_generation;
 	xdebug_debug_list      list;
 	int                    do_break;
 
@@ -113,6 +118,9 @@ struct _xdebug_brk_info {
 	int                   resolved_lineno; /* line number after resolving, initialised with 'original_lineno' */
 	xdebug_brk_span       resolved_span;
 	char                 *condition;
+	int                   condition_compiled;
+	zend_op_array        *condition_op_array; /* NULL if the condition didn't compile */
+	zend_class_entry     *condition_scope;
 	int                   disabled;
 	int                   temporary;
 	int                   hit_count;
@@ -160,6 +168,7 @@ xdebug_remote_handler* xdebug_handler_get(char* mode);
 xdebug_remote_handler_info* xdebug_handlers_get(void);
 
 void xdebug_brk_info_dtor(xdebug_brk_info *brk);
+void xdebug_brk_info_condition_dtor(xdebug_brk_info *brk);
 void xdebug_llist_brk_dtor(void *dummy, xdebug_brk_info *brk);
 void xdebug_hash_brk_dtor(xdebug_brk_info *brk);
 void xdebug_hash_eval_info_dtor(xdebug_eval_info *ei);
@@ -34,6 +34,7 @@
 #include "xdebug_hash.h"
 #include "xdebug_llist.h"
 #include "xdebug_set.h"
+#include "xdebug_str.h"
 
 #define MICRO_IN_SEC 1000000.00
 
@@ -208,6 +209,9 @@ typedef struct _function_stack_entry {
 	signed long  memory;
 	signed long  prev_memory;
 	double       time;
+	int          trace_entry_pending;   /* entry record held back while xdebug.trace_min_duration_us is in effect */
+	int          trace_arguments_held;
+	xdebug_str  *trace_pending_records; /* records of the frame written while its entry is held back */
 
 	/* profiling properties */
 	xdebug_profile profile;
@@ -1140,6 +1140,7 @@ function_stack_entry *xdebug_add_stack_frame(zend_execute_data *zdata, zend_op_a
 	int                   aggr_key_len = 0;
 	int                   hit_variadic = 0;
 	zend_string          *aggr_key_str = NULL;
+	zend_op_array        *location_op_array = NULL;
 
 	if (type == XDEBUG_USER_DEFINED) {
 		edata = EG(current_execute_data)->prev_execute_data;
@@ -1170,6 +1171,9 @@ function_stack_entry *xdebug_add_stack_frame(zend_execute_data *zdata, zend_op_a
 	tmp->filtered_tracing       = 0;
 	tmp->filtered_code_coverage = 0;
 	tmp->executable_lines_cache = NULL;
+	tmp->trace_entry_pending    = 0;
+	tmp->trace_arguments_held   = 0;
+	tmp->trace_pending_records  = NULL;
 
 	XG(function_count)++;
 	tmp->function_nr = XG(function_count);
@@ -1180,12 +1184,16 @@ function_stack_entry *xdebug_add_stack_frame(zend_execute_data *zdata, zend_op_a
 		}
 		if (ptr) {
 			tmp->filename = xdstrdup(ptr->func->op_array.filename->val);
+			location_op_array = &ptr->func->op_array;
 		}
 	}
 
 	if (!tmp->filename) {
 		/* Includes/main script etc */
 		tmp->filename  = (type == XDEBUG_USER_DEFINED && op_array && op_array->filename) ? xdstrdup(op_array->filename->val): NULL;
+		if (tmp->filename) {
+			location_op_array = op_array;
+		}
 	}
 	/* Call user function locations */
 	if (
@@ -1310,7 +1318,7 @@ function_stack_entry *xdebug_add_stack_frame(zend_execute_data *zdata, zend_op_a
 	}
 
 	/* Now we have location and name, we can run the filter */
-	xdebug_filter_run_tracing(tmp);
+	xdebug_filter_run_tracing(tmp, location_op_array, zdata->func);
 
 	/* Count code coverage line for call */
 	if (XG(code_coverage_active)) {
@@ -116,8 +116,7 @@ void xdebug_trace_html_function_entry(void *ctxt, function_stack_entry *fse, int
 	xdebug_str_add(&str, xdebug_sprintf(")</td><td>%s:%d</td>", fse->filename, fse->lineno), 1);
 	xdebug_str_add(&str, "</tr>\n", 0);
 
-	fprintf(context->trace_file, "%s", str.d);
-	fflush(context->trace_file);
+	xdebug_trace_write_record(context->trace_file, &str TSRMLS_CC);
 	xdfree(str.d);
 }
 
@@ -23,6 +23,7 @@
 #include "ext/standard/php_string.h"
 
 #include "xdebug_compat.h"
+#include "xdebug_compress.h"
 #include "xdebug_tracing.h"
 #include "xdebug_trace_textual.h"
 #include "xdebug_trace_computerized.h"
@@ -75,9 +76,9 @@ FILE *xdebug_trace_open_file(char *fname, char *script_filename, long options, c
 		xdfree(fname);
 	}
 	if (options & XDEBUG_TRACE_OPTION_APPEND) {
-		file = xdebug_fopen(filename, "a", (options & XDEBUG_TRACE_OPTION_NAKED_FILENAME) ? NULL : "xt", used_fname);
+		file = xdebug_fopen_output(filename, "a", (options & XDEBUG_TRACE_OPTION_NAKED_FILENAME) ? NULL : "xt", used_fname);
 	} else {
-		file = xdebug_fopen(filename, "w", (options & XDEBUG_TRACE_OPTION_NAKED_FILENAME) ? NULL : "xt", used_fname);
+		file = xdebug_fopen_output(filename, "w", (options & XDEBUG_TRACE_OPTION_NAKED_FILENAME) ? NULL : "xt", used_fname);
 	}
 	xdfree(filename);
 
@@ -104,12 +105,252 @@ char* xdebug_start_trace(char* fname, char *script_filename, long options TSRMLS
 void xdebug_stop_trace(TSRMLS_D)
 {
 	if (XG(trace_context)) {
+		xdebug_trace_discard_pending_records(TSRMLS_C);
+
 		XG(trace_handler)->write_footer(XG(trace_context) TSRMLS_CC);
 		XG(trace_handler)->deinit(XG(trace_context) TSRMLS_CC);
 		XG(trace_context) = NULL;
 	}
 }
 
+/* Writes out a fully rendered trace record. While a record is being captured
+ * for a frame whose entry line is still held back (see
+ * xdebug.trace_min_duration_us), it is appended to that frame's buffer
+ * instead. */
+void xdebug_trace_write_record(FILE *file, xdebug_str *record TSRMLS_DC)
+{
+	if (XG(trace_record_capture)) {
+		xdebug_str_add(XG(trace_record_capture), record->d, 0);
+		XG(trace_deferred_file) = file;
+		return;
+	}
+
+	fprintf(file, "%s", record->d);
+	fflush(file);
+}
+
+/* Returns how many bytes the export of a value takes at least, so that values
+ * that are over budget anyway do not have to be exported first */
+static size_t xdebug_trace_value_min_size(zval *zv, int collection_level)
+{
+	size_t elements;
+
+	ZVAL_DEREF(zv);
+	switch (Z_TYPE_P(zv)) {
+		case IS_STRING:
+			return Z_STRLEN_P(zv);
+
+		case IS_ARRAY:
+			/* Every element takes at least four bytes, such as "0 => 1" or "i:0;i:1;" */
+			elements = zend_hash_num_elements(Z_ARRVAL_P(zv));
+			if (collection_level != 5 && XG(display_max_children) >= 0 && elements > (size_t) XG(display_max_children)) {
+				elements = XG(display_max_children);
+			}
+			return elements * 4;
+	}
+
+	return 0;
+}
+
+/* Adds a parameter or return value to a trace record. Full values are
+ * replaced by their synopsis when they are larger than
+ * xdebug.collect_params_max_size, or than what is left of
+ * xdebug.collect_params_max_total_size for the request. */
+void xdebug_trace_add_value(xdebug_str *str, zval *zv, int collection_level TSRMLS_DC)
+{
+	xdebug_str *tmp_value = NULL;
+	size_t      max_size = 0;
+
+	if (XG(collect_params_max_size) > 0) {
+		max_size = XG(collect_params_max_size);
+	}
+	if (XG(collect_params_max_total_size) > 0) {
+		if (XG(collect_params_total_size) >= (size_t) XG(collect_params_max_total_size)) {
+			collection_level = 1;
+		} else if (max_size == 0 || (size_t) XG(collect_params_max_total_size) - XG(collect_params_total_size) < max_size) {
+			max_size = XG(collect_params_max_total_size) - XG(collect_params_total_size);
+		}
+	}
+
+	/* No need to export a value first to find out that it's too large */
+	if (collection_level >= 3 && max_size > 0 && xdebug_trace_value_min_size(zv, collection_level) > max_size) {
+		collection_level = 1;
+	}
+
+	switch (collection_level) {
+		case 1: /* synopsis */
+		case 2:
+			tmp_value = xdebug_get_zval_synopsis(zv, 0, NULL);
+			break;
+		case 3: /* full */
+		case 4: /* full (with var) */
+		default:
+			tmp_value = xdebug_get_zval_value(zv, 0, NULL);
+			break;
+		case 5: /* serialized */
+			tmp_value = xdebug_get_zval_value_serialized(zv, 0, NULL);
+			break;
+	}
+
+	if (tmp_value && collection_level >= 3 && max_size > 0 && tmp_value->l > max_size) {
+		xdebug_str_free(tmp_value);
+		tmp_value = xdebug_get_zval_synopsis(zv, 0, NULL);
+	}
+
+	if (tmp_value) {
+		XG(collect_params_total_size) += tmp_value->l;
+		xdebug_str_add_str(str, tmp_value);
+		xdebug_str_free(tmp_value);
+	} else {
+		xdebug_str_add(str, "???", 0);
+	}
+}
+
+/* Takes a reference on the collected arguments of a frame whose entry record
+ * is deferred, so that they can still be exported when the call returns */
+static void xdebug_trace_hold_arguments(function_stack_entry *fse)
+{
+	unsigned int i;
+
+	for (i = 0; i < fse->varc; i++) {
+		if (!Z_ISUNDEF(fse->var[i].data)) {
+			Z_TRY_ADDREF(fse->var[i].data);
+		}
+	}
+	fse->trace_arguments_held = 1;
+}
+
+void xdebug_trace_release_arguments(function_stack_entry *fse TSRMLS_DC)
+{
+	unsigned int i;
+
+	if (!fse->trace_arguments_held) {
+		return;
+	}
+
+	for (i = 0; i < fse->varc; i++) {
+		if (!Z_ISUNDEF(fse->var[i].data)) {
+			zval_ptr_dtor(&fse->var[i].data);
+			ZVAL_UNDEF(&fse->var[i].data);
+		}
+	}
+	fse->trace_arguments_held = 0;
+}
+
+/* Drops all records that are still held back on the stack, for example
+ * because the trace file is about to be closed */
+void xdebug_trace_discard_pending_records(TSRMLS_D)
+{
+	xdebug_llist_element *le;
+
+	if (!XG(stack)) {
+		return;
+	}
+
+	for (le = XDEBUG_LLIST_HEAD(XG(stack)); le != NULL; le = XDEBUG_LLIST_NEXT(le)) {
+		function_stack_entry *fse = XDEBUG_LLIST_VALP(le);
+
+		fse->trace_entry_pending = 0;
+		if (fse->trace_pending_records) {
+			xdebug_str_free(fse->trace_pending_records);
+			fse->trace_pending_records = NULL;
+		}
+	}
+	XG(trace_deferred_file) = NULL;
+}
+
+/* Writes out the held back records of all frames on the stack, outermost
+ * first, so that a slow call shows up with its full ancestor chain */
+static void xdebug_trace_flush_pending_records(TSRMLS_D)
+{
+	xdebug_llist_element *le;
+
+	for (le = XDEBUG_LLIST_HEAD(XG(stack)); le != NULL; le = XDEBUG_LLIST_NEXT(le)) {
+		function_stack_entry *fse = XDEBUG_LLIST_VALP(le);
+
+		if (fse->trace_entry_pending) {
+			fse->trace_entry_pending = 0;
+			XG(trace_handler)->function_entry(XG(trace_context), fse, fse->function_nr TSRMLS_CC);
+		}
+
+		if (fse->trace_pending_records) {
+			if (XG(trace_deferred_file)) {
+				fprintf(XG(trace_deferred_file), "%s", fse->trace_pending_records->d);
+				fflush(XG(trace_deferred_file));
+			}
+			xdebug_str_free(fse->trace_pending_records);
+			fse->trace_pending_records = NULL;
+		}
+	}
+}
+
+void xdebug_trace_function_begin(function_stack_entry *fse, int function_nr TSRMLS_DC)
+{
+	if (!XG(trace_handler)->function_entry) {
+		return;
+	}
+
+	if (XG(trace_min_duration_us) <= 0) {
+		XG(trace_handler)->function_entry(XG(trace_context), fse, function_nr TSRMLS_CC);
+		return;
+	}
+
+	/* Hold the entry record back until we know how long the call took. It
+	 * is only rendered then, so that the arguments of the many calls that
+	 * end up being dropped are never exported. Arrays and strings are
+	 * exported as they were passed in, objects as they are on return. */
+	fse->trace_entry_pending = 1;
+	if (XG(collect_params)) {
+		xdebug_trace_hold_arguments(fse);
+	}
+}
+
+/* Returns 0 if the call was dropped because it was faster than
+ * xdebug.trace_min_duration_us, and 1 if it made it into the trace file */
+int xdebug_trace_function_end(function_stack_entry *fse, int function_nr TSRMLS_DC)
+{
+	/* A frame without a held back entry was either traced in full, or had
+	 * its entry written out already because one of its callees was slow */
+	if (fse->trace_entry_pending) {
+		double elapsed_us = (xdebug_get_utime() - fse->time) * MICRO_IN_SEC;
+
+		if (elapsed_us < (double) XG(trace_min_duration_us)) {
+			fse->trace_entry_pending = 0;
+			if (fse->trace_pending_records) {
+				xdebug_str_free(fse->trace_pending_records);
+				fse->trace_pending_records = NULL;
+			}
+			return 0;
+		}
+
+		xdebug_trace_flush_pending_records(TSRMLS_C);
+	}
+
+	if (XG(trace_handler)->function_exit) {
+		XG(trace_handler)->function_exit(XG(trace_context), fse, function_nr TSRMLS_CC);
+	}
+
+	return 1;
+}
+
+void xdebug_trace_assignment(function_stack_entry *fse, char *full_varname, zval *value, char *right_full_varname, const char *op, char *file, int lineno TSRMLS_DC)
+{
+	if (!XG(trace_handler)->assignment) {
+		return;
+	}
+
+	/* Assignments in a frame that is still held back belong with its entry
+	 * record, so that they are kept or dropped together */
+	if (fse->trace_entry_pending) {
+		if (!fse->trace_pending_records) {
+			fse->trace_pending_records = xdebug_str_new();
+		}
+		XG(trace_record_capture) = fse->trace_pending_records;
+	}
+	XG(trace_handler)->assignment(XG(trace_context), fse, full_varname, value, right_full_varname, op, file, lineno TSRMLS_CC);
+	XG(trace_record_capture) = NULL;
+}
+
 PHP_FUNCTION(xdebug_start_trace)
 {
 	char *fname = NULL;
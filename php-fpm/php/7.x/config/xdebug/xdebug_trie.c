@@ -0,0 +1,149 @@
+/*
+   +----------------------------------------------------------------------+
+   | Xdebug                                                               |
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2002-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 1.01 of the Xdebug license,   |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available at through the world-wide-web at                           |
+   | https://xdebug.org/license.php                                       |
+   | If you did not receive a copy of the Xdebug license and are unable   |
+   | to obtain it through the world-wide-web, please send a note to       |
+   | derick@xdebug.org so we can mail you a copy immediately.             |
+   +----------------------------------------------------------------------+
+   | Authors: Derick Rethans <derick@xdebug.org>                          |
+   +----------------------------------------------------------------------+
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "xdebug_mm.h"
+#include "xdebug_trie.h"
+
+#define XDEBUG_TRIE_FOLD(c) ((unsigned char) tolower((unsigned char) (c)))
+
+static xdebug_trie_node *xdebug_trie_node_alloc(void)
+{
+	return xdcalloc(1, sizeof(xdebug_trie_node));
+}
+
+static void xdebug_trie_node_free(xdebug_trie_node *node)
+{
+	unsigned int i;
+
+	for (i = 0; i < node->child_count; i++) {
+		xdebug_trie_node_free(node->children[i]);
+	}
+	if (node->child_count) {
+		xdfree(node->child_chars);
+		xdfree(node->children);
+	}
+	xdfree(node);
+}
+
+/* Returns the position of 'c' in the node's sorted child list, or the
+ * position it would have to be inserted at (with *found set to 0) */
+static unsigned int xdebug_trie_node_find_child(xdebug_trie_node *node, unsigned char c, int *found)
+{
+	unsigned int low = 0, high = node->child_count;
+
+	while (low < high) {
+		unsigned int middle = low + ((high - low) / 2);
+
+		if (node->child_chars[middle] == c) {
+			*found = 1;
+			return middle;
+		}
+		if (node->child_chars[middle] < c) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	*found = 0;
+	return low;
+}
+
+static xdebug_trie_node *xdebug_trie_node_add_child(xdebug_trie_node *node, unsigned int position, unsigned char c)
+{
+	xdebug_trie_node *child = xdebug_trie_node_alloc();
+
+	node->child_chars = xdrealloc(node->child_chars, (node->child_count + 1) * sizeof(unsigned char));
+	node->children = xdrealloc(node->children, (node->child_count + 1) * sizeof(xdebug_trie_node*));
+
+	memmove(&node->child_chars[position + 1], &node->child_chars[position], (node->child_count - position) * sizeof(unsigned char));
+	memmove(&node->children[position + 1], &node->children[position], (node->child_count - position) * sizeof(xdebug_trie_node*));
+
+	node->child_chars[position] = c;
+	node->children[position] = child;
+	node->child_count++;
+
+	return child;
+}
+
+xdebug_trie *xdebug_trie_alloc(void)
+{
+	xdebug_trie *trie = xdmalloc(sizeof(xdebug_trie));
+
+	trie->root = xdebug_trie_node_alloc();
+	trie->size = 0;
+
+	return trie;
+}
+
+void xdebug_trie_add(xdebug_trie *trie, const char *key)
+{
+	xdebug_trie_node *node = trie->root;
+
+	for (; *key; key++) {
+		unsigned char c = XDEBUG_TRIE_FOLD(*key);
+		unsigned int  position;
+		int           found;
+
+		position = xdebug_trie_node_find_child(node, c, &found);
+		node = found ? node->children[position] : xdebug_trie_node_add_child(node, position, c);
+	}
+
+	if (!node->terminal) {
+		node->terminal = 1;
+		trie->size++;
+	}
+}
+
+/* Returns the length of the longest key that is a (case-insensitive) prefix
+ * of 'subject', or XDEBUG_TRIE_NO_MATCH if there is no such key */
+long xdebug_trie_longest_prefix(xdebug_trie *trie, const char *subject)
+{
+	xdebug_trie_node *node = trie->root;
+	long              depth = 0;
+	long              longest = node->terminal ? 0 : XDEBUG_TRIE_NO_MATCH;
+
+	for (; *subject && node->child_count; subject++) {
+		unsigned int position;
+		int          found;
+
+		position = xdebug_trie_node_find_child(node, XDEBUG_TRIE_FOLD(*subject), &found);
+		if (!found) {
+			break;
+		}
+
+		node = node->children[position];
+		depth++;
+
+		if (node->terminal) {
+			longest = depth;
+		}
+	}
+
+	return longest;
+}
+
+void xdebug_trie_destroy(xdebug_trie *trie)
+{
+	xdebug_trie_node_free(trie->root);
+	xdfree(trie);
+}
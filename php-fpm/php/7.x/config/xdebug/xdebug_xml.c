@@ -18,85 +18,229 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "xdebug_mm.h"
 #include "xdebug_str.h"
 #include "xdebug_var.h"
 #include "xdebug_xml.h"
 #include "xdebug_compat.h"
 
-static void xdebug_xml_return_attribute(xdebug_xml_attribute* attr, xdebug_str* output)
+/* Input is base64 encoded in pieces of this many bytes; a multiple of three
+ * so that the pieces concatenate to the encoding of the whole text */
+#define XDEBUG_XML_BASE64_CHUNK 3072
+
+void xdebug_xml_writer_init(xdebug_xml_writer *writer, xdebug_xml_writer_flush_t flush, void *ctxt)
 {
-	char *tmp;
-	size_t newlen;
+	writer->flush = flush;
+	writer->ctxt = ctxt;
+	writer->used = 0;
+	writer->failed = 0;
+}
 
-	xdebug_str_addl(output, " ", 1, 0);
+int xdebug_xml_writer_flush(xdebug_xml_writer *writer)
+{
+	if (writer->used && !writer->failed) {
+		if (!writer->flush(writer->ctxt, writer->buffer, writer->used)) {
+			writer->failed = 1;
+		}
+	}
+	writer->used = 0;
 
-	/* attribute name */
-	tmp = xdebug_xmlize(attr->name, attr->name_len, &newlen);
-	xdebug_str_addl(output, tmp, newlen, 0);
-	efree(tmp);
+	return !writer->failed;
+}
 
-	/* attribute value */
-	xdebug_str_addl(output, "=\"", 2, 0);
-	if (attr->value) {
-		tmp = xdebug_xmlize(attr->value, attr->value_len, &newlen);
-		xdebug_str_add(output, tmp, 0);
-		efree(tmp);
+void xdebug_xml_writer_addl(xdebug_xml_writer *writer, const char *data, size_t len)
+{
+	size_t room;
+
+	while (len > 0) {
+		if (writer->used == sizeof(writer->buffer)) {
+			xdebug_xml_writer_flush(writer);
+		}
+
+		room = sizeof(writer->buffer) - writer->used;
+		if (room > len) {
+			room = len;
+		}
+		memcpy(writer->buffer + writer->used, data, room);
+		writer->used += room;
+		data += room;
+		len -= room;
 	}
-	xdebug_str_addl(output, "\"", 1, 0);
+}
 
-	if (attr->next) {
-		xdebug_xml_return_attribute(attr->next, output);
+#define xdebug_xml_writer_add_literal(w,s) xdebug_xml_writer_addl((w), (s), sizeof(s) - 1)
+
+/* Returns the replacement for characters that xdebug_xmlize() escapes */
+static const char *xdebug_xml_entity(char c, size_t *entity_len)
+{
+	switch (c) {
+		case '&':  *entity_len = 5; return "&amp;";
+		case '>':  *entity_len = 4; return "&gt;";
+		case '<':  *entity_len = 4; return "&lt;";
+		case '"':  *entity_len = 6; return "&quot;";
+		case '\'': *entity_len = 5; return "&#39;";
+		case '\n': *entity_len = 5; return "&#10;";
+		case '\r': *entity_len = 5; return "&#13;";
+		case '\0': *entity_len = 4; return "&#0;";
 	}
+	return NULL;
 }
 
-static void xdebug_xml_return_text_node(xdebug_xml_text_node* node, xdebug_str* output)
+static size_t xdebug_xml_escaped_length(const char *string, size_t len)
 {
-	xdebug_str_addl(output, "<![CDATA[", 9, 0);
-	if (node->encode) {
-		/* if cdata tags are in the text, then we must base64 encode */
-		size_t         new_len = 0;
-		unsigned char *encoded_text;
+	size_t i, entity_len, newlen = len;
 
-		encoded_text = xdebug_base64_encode((unsigned char*) node->text, node->text_len, &new_len);
-		xdebug_str_add(output, (char*) encoded_text, 0);
-		xdfree(encoded_text);
-	} else {
-		xdebug_str_add(output, node->text, 0);
+	for (i = 0; i < len; i++) {
+		if (xdebug_xml_entity(string[i], &entity_len)) {
+			newlen += entity_len - 1;
+		}
 	}
-	xdebug_str_addl(output, "]]>", 3, 0);
+
+	return newlen;
 }
 
-void xdebug_xml_return_node(xdebug_xml_node* node, struct xdebug_str *output)
+static void xdebug_xml_write_escaped(xdebug_xml_writer *writer, const char *string, size_t len)
 {
-	xdebug_str_addl(output, "<", 1, 0);
-	xdebug_str_add(output, node->tag, 0);
+	const char *start = string, *end = string + len, *p, *entity;
+	size_t      entity_len;
 
-	if (node->text && node->text->encode) {
-		xdebug_xml_add_attribute_ex(node, "encoding", "base64", 0, 0);
+	for (p = string; p < end; p++) {
+		entity = xdebug_xml_entity(*p, &entity_len);
+		if (!entity) {
+			continue;
+		}
+		xdebug_xml_writer_addl(writer, start, p - start);
+		xdebug_xml_writer_addl(writer, entity, entity_len);
+		start = p + 1;
 	}
-	if (node->attribute) {
-		xdebug_xml_return_attribute(node->attribute, output);
-	}
-	xdebug_str_addl(output, ">", 1, 0);
+	xdebug_xml_writer_addl(writer, start, end - start);
+}
 
-	if (node->child) {
-		xdebug_xml_return_node(node->child, output);
+static void xdebug_xml_write_base64(xdebug_xml_writer *writer, const char *data, size_t len)
+{
+	size_t         chunk, new_len;
+	unsigned char *encoded;
+
+	while (len > 0) {
+		chunk = len > XDEBUG_XML_BASE64_CHUNK ? XDEBUG_XML_BASE64_CHUNK : len;
+
+		encoded = xdebug_base64_encode((unsigned char*) data, chunk, &new_len);
+		xdebug_xml_writer_addl(writer, (char*) encoded, new_len);
+		xdfree(encoded);
+
+		data += chunk;
+		len -= chunk;
 	}
+}
+
+/* Text nodes that need encoding get an extra 'encoding' attribute when they
+ * are written out, without it being added to the node itself */
+#define XDEBUG_XML_ENCODING_ATTRIBUTE " encoding=\"base64\""
 
-	if (node->text) {
-		xdebug_xml_return_text_node(node->text, output);
+size_t xdebug_xml_node_length(xdebug_xml_node *node)
+{
+	size_t                length = 0, tag_len;
+	xdebug_xml_attribute *attr;
+
+	for (; node; node = node->next) {
+		tag_len = strlen(node->tag);
+
+		/* <tag attributes> */
+		length += 1 + tag_len;
+		for (attr = node->attribute; attr; attr = attr->next) {
+			length += 1 + xdebug_xml_escaped_length(attr->name, attr->name_len) + 2 + 1;
+			if (attr->value) {
+				length += xdebug_xml_escaped_length(attr->value, attr->value_len);
+			}
+		}
+		if (node->text && node->text->encode) {
+			length += sizeof(XDEBUG_XML_ENCODING_ATTRIBUTE) - 1;
+		}
+		length += 1;
+
+		if (node->child) {
+			length += xdebug_xml_node_length(node->child);
+		}
+
+		/* <![CDATA[text]]> */
+		if (node->text) {
+			length += 9 + 3;
+			if (node->text->encode) {
+				length += ((node->text->text_len + 2) / 3) * 4;
+			} else {
+				length += strlen(node->text->text);
+			}
+		}
+
+		/* </tag> */
+		length += 2 + tag_len + 1;
 	}
 
-	xdebug_str_addl(output, "</", 2, 0);
-	xdebug_str_add(output, node->tag, 0);
-	xdebug_str_addl(output, ">", 1, 0);
+	return length;
+}
+
+void xdebug_xml_write_node(xdebug_xml_node *node, xdebug_xml_writer *writer)
+{
+	size_t                tag_len;
+	xdebug_xml_attribute *attr;
+
+	for (; node; node = node->next) {
+		tag_len = strlen(node->tag);
+
+		xdebug_xml_writer_add_literal(writer, "<");
+		xdebug_xml_writer_addl(writer, node->tag, tag_len);
 
-	if (node->next) {
-		xdebug_xml_return_node(node->next, output);
+		for (attr = node->attribute; attr; attr = attr->next) {
+			xdebug_xml_writer_add_literal(writer, " ");
+			xdebug_xml_write_escaped(writer, attr->name, attr->name_len);
+			xdebug_xml_writer_add_literal(writer, "=\"");
+			if (attr->value) {
+				xdebug_xml_write_escaped(writer, attr->value, attr->value_len);
+			}
+			xdebug_xml_writer_add_literal(writer, "\"");
+		}
+		if (node->text && node->text->encode) {
+			xdebug_xml_writer_add_literal(writer, XDEBUG_XML_ENCODING_ATTRIBUTE);
+		}
+		xdebug_xml_writer_add_literal(writer, ">");
+
+		if (node->child) {
+			xdebug_xml_write_node(node->child, writer);
+		}
+
+		if (node->text) {
+			xdebug_xml_writer_add_literal(writer, "<![CDATA[");
+			if (node->text->encode) {
+				/* if cdata tags are in the text, then we must base64 encode */
+				xdebug_xml_write_base64(writer, node->text->text, node->text->text_len);
+			} else {
+				xdebug_xml_writer_addl(writer, node->text->text, strlen(node->text->text));
+			}
+			xdebug_xml_writer_add_literal(writer, "]]>");
+		}
+
+		xdebug_xml_writer_add_literal(writer, "</");
+		xdebug_xml_writer_addl(writer, node->tag, tag_len);
+		xdebug_xml_writer_add_literal(writer, ">");
 	}
 }
 
+static int xdebug_xml_str_flush(void *ctxt, const char *data, size_t len)
+{
+	xdebug_str_addl((xdebug_str*) ctxt, data, len, 0);
+	return 1;
+}
+
+void xdebug_xml_return_node(xdebug_xml_node* node, struct xdebug_str *output)
+{
+	xdebug_xml_writer writer;
+
+	xdebug_xml_writer_init(&writer, xdebug_xml_str_flush, output);
+	xdebug_xml_write_node(node, &writer);
+	xdebug_xml_writer_flush(&writer);
+}
+
 xdebug_xml_node *xdebug_xml_node_init_ex(const char *tag, int free_tag)
 {
 	xdebug_xml_node *xml = xdmalloc(sizeof (xdebug_xml_node));
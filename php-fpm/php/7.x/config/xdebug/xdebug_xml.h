@@ -70,6 +70,28 @@ void xdebug_xml_add_text_encode(xdebug_xml_node *xml, char *text);
 #define xdebug_xml_add_textl(x,t,l) 	 xdebug_xml_add_text_ex((x), (t), (l), 1, 0)
 #define xdebug_xml_add_text_encodel(x,t,l)  xdebug_xml_add_text_ex((x), (t), (l), 1, 1)
 
+/* Serializes a node tree in pieces through a fixed size buffer, handing every
+ * full buffer to the flush callback. The callback returns 0 on failure, after
+ * which the remaining output is discarded. */
+#define XDEBUG_XML_WRITER_BUFFER_SIZE 16384
+
+typedef int (*xdebug_xml_writer_flush_t)(void *ctxt, const char *data, size_t len);
+
+typedef struct _xdebug_xml_writer
+{
+	xdebug_xml_writer_flush_t  flush;
+	void                      *ctxt;
+	char                       buffer[XDEBUG_XML_WRITER_BUFFER_SIZE];
+	size_t                     used;
+	int                        failed;
+} xdebug_xml_writer;
+
+void xdebug_xml_writer_init(xdebug_xml_writer *writer, xdebug_xml_writer_flush_t flush, void *ctxt);
+void xdebug_xml_writer_addl(xdebug_xml_writer *writer, const char *data, size_t len);
+int xdebug_xml_writer_flush(xdebug_xml_writer *writer);
+
+size_t xdebug_xml_node_length(xdebug_xml_node* node);
+void xdebug_xml_write_node(xdebug_xml_node* node, xdebug_xml_writer *writer);
 void xdebug_xml_return_node(xdebug_xml_node* node, struct xdebug_str *output);
 void xdebug_xml_node_dtor(xdebug_xml_node* xml);
 